@@ -0,0 +1,317 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "BatchCompiler.h"
+#include "Disassembler.h"
+#include "Reader.h"
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+// Constructor (threads count defaults to number of hardware threads)
+BatchCompiler::BatchCompiler(const CompileOptions& options, size_t threads)
+{
+	mOptions = options;
+	mOptions.assemble = true;
+	if (mOptions.includes == nullptr)
+	{
+		mOptions.includes = &mIncludes;
+	}
+
+	mThreadsCount = threads;
+	if (mThreadsCount == 0)
+	{
+		mThreadsCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	mCache = nullptr;
+	mMilliseconds = 0.0;
+}
+
+// Set cache of binaries, unchanged scripts are loaded from it instead of being compiled
+void BatchCompiler::SetCache(BuildCache* cache)
+{
+	mCache = cache;
+}
+
+// Add script, output is path of binary (defaults to script path with .scbin extension, .sco for objects)
+void BatchCompiler::Add(const std::string& source, const std::string& output)
+{
+	Entry e;
+	e.source = source;
+	e.output = output;
+	e.written = false;
+	e.cached = false;
+	e.milliseconds = 0.0;
+
+	if (e.output.empty())
+	{
+		size_t dot = source.find_last_of('.');
+		size_t slash = source.find_last_of("/\\");
+		if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+		{
+			e.output = source.substr(0, dot);
+		}
+		else
+		{
+			e.output = source;
+		}
+		e.output += GetExtension();
+	}
+
+	mEntries.push_back(e);
+}
+
+// Add scripts listed in manifest file - each line contains script path optionally followed by output
+// path, empty lines and lines starting with '#' are skipped. Returns false when manifest can't be read
+bool BatchCompiler::AddManifest(const std::string& filename)
+{
+	std::ifstream f(filename);
+	if (!f.good())
+	{
+		return false;
+	}
+	f.close();
+
+	for (std::string line : Reader::ReadFile(filename))
+	{
+		StringUtil::trim(line);
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+
+		std::string source;
+		std::string output;
+		std::istringstream ss(line);
+		ss >> source >> output;
+		Add(source, output);
+	}
+
+	return true;
+}
+
+// Add all .scs scripts in directory, binaries are written into output directory (defaults to the same
+// directory). Returns false when directory can't be read
+bool BatchCompiler::AddDirectory(const std::string& directory, const std::string& outputDirectory)
+{
+	std::vector<std::string> names;
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((directory + "/*.scs").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		return IsDirectory(directory);
+	}
+	do
+	{
+		if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+		{
+			names.push_back(data.cFileName);
+		}
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (dir == nullptr)
+	{
+		return false;
+	}
+	while (dirent* d = readdir(dir))
+	{
+		std::string name = d->d_name;
+		if (name.length() > 4 && name.compare(name.length() - 4, 4, ".scs") == 0 && !IsDirectory(directory + "/" + name))
+		{
+			names.push_back(name);
+		}
+	}
+	closedir(dir);
+#endif
+
+	// Order of scripts (and so report) doesn't depend on file system
+	std::sort(names.begin(), names.end());
+
+	const std::string& outDir = outputDirectory.empty() ? directory : outputDirectory;
+	for (const std::string& name : names)
+	{
+		Add(directory + "/" + name, outDir + "/" + name.substr(0, name.length() - 4) + GetExtension());
+	}
+
+	return true;
+}
+
+// Compile all added scripts, returns true when all of them were compiled and written
+bool BatchCompiler::Run()
+{
+	std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
+
+	// Entries are dealt round-robin, so each thread starts with a mix of them
+	size_t threads = std::min(mThreadsCount, std::max((size_t)1, mEntries.size()));
+	mQueues.clear();
+	for (size_t i = 0; i < threads; i++)
+	{
+		mQueues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+	}
+	for (size_t i = 0; i < mEntries.size(); i++)
+	{
+		mQueues[i % threads]->entries.push_back(i);
+	}
+
+	// Calling thread works too
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < threads; i++)
+	{
+		workers.push_back(std::thread(&BatchCompiler::Worker, this, i));
+	}
+	Worker(0);
+	for (std::thread& t : workers)
+	{
+		t.join();
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+	mMilliseconds = elapsed.count() * 1000.0;
+
+	for (const Entry& e : mEntries)
+	{
+		if (!e.result.success || !e.written)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Thread compiling entries of its queue, then stealing from others
+void BatchCompiler::Worker(size_t id)
+{
+	size_t entry;
+	while (Take(id, entry))
+	{
+		Process(mEntries[entry]);
+	}
+}
+
+// Take next entry for thread, returns false when there is no work left
+bool BatchCompiler::Take(size_t id, size_t& entry)
+{
+	{
+		WorkQueue& own = *mQueues[id];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.entries.empty())
+		{
+			entry = own.entries.back();
+			own.entries.pop_back();
+			return true;
+		}
+	}
+
+	// No entries are added while running, so once all queues are empty the work is done
+	for (size_t i = 1; i < mQueues.size(); i++)
+	{
+		WorkQueue& victim = *mQueues[(id + i) % mQueues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.entries.empty())
+		{
+			entry = victim.entries.front();
+			victim.entries.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Compile single entry and write its binary (or object)
+void BatchCompiler::Process(Entry& entry)
+{
+	std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
+
+	if (mCache != nullptr)
+	{
+		entry.result = mCache->CompileFile(entry.source, mOptions, &entry.cached);
+	}
+	else
+	{
+		entry.result = ScriptCompiler::CompileFile(entry.source, mOptions);
+	}
+	if (entry.result.success)
+	{
+		entry.written = mOptions.relocatable ? entry.result.object.Save(entry.output) : Disassembler::Save(entry.result.binary, entry.output);
+		if (!entry.written)
+		{
+			entry.result.diagnostics.push_back(Diagnostic(Diagnostic::SEVERITY_ERROR, "Can't write file " + entry.output, "", 0));
+		}
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+	entry.milliseconds = elapsed.count() * 1000.0;
+}
+
+// Print summary and messages of all scripts
+void BatchCompiler::Report(std::ostream& os) const
+{
+	size_t succeeded = 0;
+	size_t cached = 0;
+	size_t warnings = 0;
+	for (const Entry& e : mEntries)
+	{
+		if (e.result.success && e.written)
+		{
+			succeeded++;
+		}
+		if (e.cached)
+		{
+			cached++;
+		}
+		for (const Diagnostic& d : e.result.diagnostics)
+		{
+			if (d.GetSeverity() == Diagnostic::SEVERITY_WARNING)
+			{
+				warnings++;
+			}
+		}
+	}
+
+	for (const Entry& e : mEntries)
+	{
+		os << e.source << " -> " << e.output << ": " << (e.result.success && e.written ? "ok" : "failed") << (e.cached ? " cached" : "") << " (" << e.milliseconds << "ms)" << std::endl;
+		for (const Diagnostic& d : e.result.diagnostics)
+		{
+			d.Print(os);
+		}
+	}
+
+	os << "Batch: " << mEntries.size() << " scripts, " << succeeded << " succeeded (" << cached << " cached), " << (mEntries.size() - succeeded) << " failed, " <<
+		warnings << " warnings, took " << mMilliseconds << "ms on " << mQueues.size() << " threads" << std::endl;
+}
+
+// Check whether path is a directory
+bool BatchCompiler::IsDirectory(const std::string& path)
+{
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+	{
+		return false;
+	}
+	return (info.st_mode & S_IFMT) == S_IFDIR;
+}
\ No newline at end of file
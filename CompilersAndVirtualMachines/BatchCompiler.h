@@ -0,0 +1,104 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __BATCH_COMPILER_H__
+#define __BATCH_COMPILER_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include "IncludeCache.h"
+#include "ScriptCompiler.h"
+#include "BuildCache.h"
+
+// Compilation of many scripts at once. Each script is compiled into its own binary, scripts are
+// distributed between threads which steal work from each other once their own queue is empty
+class BatchCompiler
+{
+public:
+	// Single script of batch
+	struct Entry
+	{
+		std::string source;				// Script file
+		std::string output;				// Binary (or object) file
+		CompileResult result;			// Result of compilation
+		bool written;					// Binary was written into output file
+		bool cached;					// Binary was loaded from build cache
+		double milliseconds;			// Time spent on script
+	};
+
+private:
+	// Queue of entries owned by single thread (owner takes from back, others steal from front)
+	struct WorkQueue
+	{
+		std::deque<size_t> entries;
+		std::mutex mutex;
+	};
+
+	CompileOptions mOptions;			// Options used for all scripts
+	size_t mThreadsCount;				// Number of threads
+	IncludeCache mIncludes;				// Included files shared by all scripts (unless options specify own cache)
+	BuildCache* mCache;					// Cache of binaries (nullptr when all scripts are compiled)
+	std::vector<Entry> mEntries;		// Scripts of batch
+	std::vector<std::unique_ptr<WorkQueue> > mQueues;	// Queue of each thread
+	double mMilliseconds;				// Time spent on whole batch
+
+	// Thread compiling entries of its queue, then stealing from others
+	void Worker(size_t id);
+
+	// Take next entry for thread, returns false when there is no work left
+	bool Take(size_t id, size_t& entry);
+
+	// Compile single entry and write its binary (or object)
+	void Process(Entry& entry);
+
+	// Extension of output files (objects when options are relocatable)
+	const char* GetExtension() const
+	{
+		return mOptions.relocatable ? ".sco" : ".scbin";
+	}
+
+public:
+	// Constructor (threads count defaults to number of hardware threads)
+	BatchCompiler(const CompileOptions& options, size_t threads = 0);
+
+	// Set cache of binaries, unchanged scripts are loaded from it instead of being compiled
+	void SetCache(BuildCache* cache);
+
+	// Add script, output is path of binary (defaults to script path with .scbin extension, .sco for objects)
+	void Add(const std::string& source, const std::string& output = "");
+
+	// Add scripts listed in manifest file - each line contains script path optionally followed by output
+	// path, empty lines and lines starting with '#' are skipped. Returns false when manifest can't be read
+	bool AddManifest(const std::string& filename);
+
+	// Add all .scs scripts in directory, binaries are written into output directory (defaults to the same
+	// directory). Returns false when directory can't be read
+	bool AddDirectory(const std::string& directory, const std::string& outputDirectory = "");
+
+	// Compile all added scripts, returns true when all of them were compiled and written
+	bool Run();
+
+	// Print summary and messages of all scripts
+	void Report(std::ostream& os) const;
+
+	// Get scripts of batch (with results after Run)
+	const std::vector<Entry>& GetEntries() const
+	{
+		return mEntries;
+	}
+
+	// Check whether path is a directory
+	static bool IsDirectory(const std::string& path);
+};
+
+#endif
\ No newline at end of file
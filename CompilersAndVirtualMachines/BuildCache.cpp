@@ -0,0 +1,232 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "BuildCache.h"
+#include "Reader.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <process.h>
+#define GET_PROCESS_ID _getpid
+#else
+#include <unistd.h>
+#define GET_PROCESS_ID getpid
+#endif
+
+// Constructor, cache entries are stored in given (existing) directory
+BuildCache::BuildCache(const std::string& directory)
+{
+	mDirectory = directory;
+	mHits = 0;
+	mMisses = 0;
+}
+
+// Compile script file, binary is loaded from cache when neither script nor its dependencies changed (in
+// that case result contains only binary). Options always assemble result
+CompileResult BuildCache::CompileFile(const std::string& filename, const CompileOptions& options, bool* cached)
+{
+	if (cached != nullptr)
+	{
+		*cached = false;
+	}
+
+	// Entries hold binaries only, objects are always compiled
+	std::string content;
+	if (options.relocatable || !ReadContent(filename, content))
+	{
+		return ScriptCompiler::CompileFile(filename, options);
+	}
+
+	// Everything which affects generated code, except dependencies (which are known only after preprocessing)
+	unsigned long long key = Hash(ScriptCompiler::GetVersion());
+	key = Hash(options.optimize ? "optimize" : "", key);
+	key = Hash("inline " + std::to_string(options.inlineBudget) + '\n', key);
+	key = Hash(options.evaluateLoops ? "evaluate loops\n" : "", key);
+	for (const std::string& d : options.defines)
+	{
+		key = Hash(std::string("define ") + d + '\n', key);
+	}
+	for (const std::string& d : options.directories)
+	{
+		key = Hash(std::string("directory ") + d + '\n', key);
+	}
+	key = Hash(filename + '\n', key);
+	key = Hash(content, key);
+
+	CompileResult result;
+	if (Load(key, result.binary))
+	{
+		mHits++;
+		result.success = true;
+		if (cached != nullptr)
+		{
+			*cached = true;
+		}
+		return result;
+	}
+	mMisses++;
+
+	CompileOptions assemble = options;
+	assemble.assemble = true;
+
+	std::vector<std::string> dependencies;
+	std::vector<std::string> preprocessed = ScriptCompiler::Preprocess(Reader::ReadFile(filename), filename, assemble, &dependencies);
+	result = ScriptCompiler::CompilePreprocessed(preprocessed, filename, assemble);
+	if (result.success)
+	{
+		Store(key, dependencies, result.binary);
+	}
+
+	return result;
+}
+
+// Get path of entry file for key
+std::string BuildCache::GetPath(unsigned long long key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.sccache", key);
+	return mDirectory + "/" + name;
+}
+
+// Load binary of entry, returns false when there is no entry or any of its dependencies changed
+bool BuildCache::Load(unsigned long long key, std::vector<int>& binary) const
+{
+	std::ifstream f(GetPath(key), std::ios::binary | std::ios::in);
+	if (!f.good())
+	{
+		return false;
+	}
+
+	// Entry written by different compiler version is never used (though it can't have the same key)
+	std::string line;
+	std::getline(f, line);
+	if (line != std::string("sccache ") + ScriptCompiler::GetVersion())
+	{
+		return false;
+	}
+
+	// Each dependency is "dep <hash> <path>", followed by "code <count>" and binary itself
+	while (std::getline(f, line))
+	{
+		std::istringstream ss(line);
+		std::string type;
+		ss >> type;
+
+		if (type == "dep")
+		{
+			unsigned long long hash = 0;
+			std::string path;
+			ss >> std::hex >> hash;
+			std::getline(ss >> std::ws, path);
+
+			std::string content;
+			if (!ReadContent(path, content) || Hash(content) != hash)
+			{
+				return false;
+			}
+		}
+		else if (type == "code")
+		{
+			// Count has to match rest of file exactly (truncated or corrupted entry is a miss, and nothing
+			// is allocated for it)
+			size_t count = 0;
+			std::streamoff start = f.tellg();
+			f.seekg(0, std::ios::end);
+			std::streamoff end = f.tellg();
+			if (!(ss >> count) || start < 0 || end < start || (unsigned long long)(end - start) / sizeof(int) != count ||
+				(unsigned long long)(end - start) % sizeof(int) != 0)
+			{
+				return false;
+			}
+
+			f.seekg(start);
+			binary.resize(count);
+			f.read((char*)binary.data(), count * sizeof(int));
+			return (size_t)f.gcount() == count * sizeof(int);
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return false;
+}
+
+// Store binary of entry along with hashes of its dependencies
+void BuildCache::Store(unsigned long long key, const std::vector<std::string>& dependencies, const std::vector<int>& binary) const
+{
+	std::ostringstream header;
+	header << "sccache " << ScriptCompiler::GetVersion() << "\n";
+	for (const std::string& d : dependencies)
+	{
+		std::string content;
+		if (!ReadContent(d, content))
+		{
+			return;
+		}
+		header << "dep " << std::hex << Hash(content) << std::dec << " " << d << "\n";
+	}
+	header << "code " << binary.size() << "\n";
+
+	// Entry is written under temporary name first (unique for process and thread), so other threads or
+	// processes never read partial entry
+	std::string path = GetPath(key);
+	std::string temporary = path + "." + std::to_string(GET_PROCESS_ID()) + "." +
+		std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	{
+		std::ofstream f(temporary, std::ios::binary | std::ios::out);
+		if (!f.good())
+		{
+			return;
+		}
+		std::string h = header.str();
+		f.write(h.c_str(), h.length());
+		f.write((const char*)binary.data(), binary.size() * sizeof(int));
+	}
+
+	if (rename(temporary.c_str(), path.c_str()) != 0)
+	{
+		// Rename doesn't replace existing file on Windows
+		remove(path.c_str());
+		if (rename(temporary.c_str(), path.c_str()) != 0)
+		{
+			remove(temporary.c_str());
+		}
+	}
+}
+
+// Read whole file, returns false when file can't be read
+bool BuildCache::ReadContent(const std::string& filename, std::string& content)
+{
+	std::ifstream f(filename, std::ios::binary | std::ios::in);
+	if (!f.good())
+	{
+		return false;
+	}
+
+	std::ostringstream ss;
+	ss << f.rdbuf();
+	content = ss.str();
+	return true;
+}
+
+// FNV-1a hash of data, continuing from given hash
+unsigned long long BuildCache::Hash(const std::string& data, unsigned long long hash)
+{
+	for (unsigned char c : data)
+	{
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
\ No newline at end of file
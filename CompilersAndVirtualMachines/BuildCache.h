@@ -0,0 +1,65 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __BUILD_CACHE_H__
+#define __BUILD_CACHE_H__
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include "ScriptCompiler.h"
+
+// On-disk cache of compiled binaries (thread-safe). Entry is keyed by hash of script content, defines,
+// include directories, options and compiler version, and it stores content hash of every file script
+// included - entry is used only when none of them changed, so changed header invalidates exactly the
+// scripts which include it
+class BuildCache
+{
+private:
+	std::string mDirectory;					// Directory with cache entries
+	std::atomic<size_t> mHits;				// Number of scripts loaded from cache
+	std::atomic<size_t> mMisses;			// Number of scripts which had to be compiled
+
+	// Get path of entry file for key
+	std::string GetPath(unsigned long long key) const;
+
+	// Load binary of entry, returns false when there is no entry or any of its dependencies changed
+	bool Load(unsigned long long key, std::vector<int>& binary) const;
+
+	// Store binary of entry along with hashes of its dependencies
+	void Store(unsigned long long key, const std::vector<std::string>& dependencies, const std::vector<int>& binary) const;
+
+	// Read whole file, returns false when file can't be read
+	static bool ReadContent(const std::string& filename, std::string& content);
+
+public:
+	// Constructor, cache entries are stored in given (existing) directory
+	BuildCache(const std::string& directory);
+
+	// Compile script file, binary is loaded from cache when neither script nor its dependencies changed (in
+	// that case result contains only binary). Options always assemble result
+	CompileResult CompileFile(const std::string& filename, const CompileOptions& options, bool* cached = nullptr);
+
+	// Get number of scripts loaded from cache
+	size_t GetHits() const
+	{
+		return mHits;
+	}
+
+	// Get number of scripts which had to be compiled
+	size_t GetMisses() const
+	{
+		return mMisses;
+	}
+
+	// FNV-1a hash of data, continuing from given hash
+	static unsigned long long Hash(const std::string& data, unsigned long long hash = 14695981039346656037ULL);
+};
+
+#endif
\ No newline at end of file
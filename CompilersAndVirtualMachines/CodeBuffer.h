@@ -0,0 +1,89 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __CODE_BUFFER_H__
+#define __CODE_BUFFER_H__
+
+#include <string>
+#include <list>
+#include <vector>
+#include <ostream>
+
+// Buffer holding generated assembly as a list of segments (one instruction
+// or label per segment). Whole buffers can be moved into another buffer in
+// constant time, no generated code is ever copied while reordering it
+class CodeBuffer
+{
+private:
+	std::list<std::string> mSegments;		// Instruction segments
+
+public:
+	// Append single line of assembly
+	void Emit(const std::string& line)
+	{
+		mSegments.push_back(line);
+	}
+
+	// Move all segments of other buffer to the end of this one (other buffer is left empty)
+	void Append(CodeBuffer& other)
+	{
+		mSegments.splice(mSegments.end(), other.mSegments);
+	}
+
+	// Move all segments of other buffer to the beginning of this one (other buffer is left empty)
+	void Prepend(CodeBuffer& other)
+	{
+		mSegments.splice(mSegments.begin(), other.mSegments);
+	}
+
+	// Is there any code in buffer
+	bool Empty() const
+	{
+		return mSegments.empty();
+	}
+
+	// Get last count segments (all of them when there is less segments)
+	std::vector<std::string> Tail(size_t count) const
+	{
+		auto it = mSegments.end();
+		while (count > 0 && it != mSegments.begin())
+		{
+			it--;
+			count--;
+		}
+		return std::vector<std::string>(it, mSegments.end());
+	}
+
+	// Remove last count segments
+	void RemoveTail(size_t count)
+	{
+		while (count > 0 && !mSegments.empty())
+		{
+			mSegments.pop_back();
+			count--;
+		}
+	}
+
+	// Get segments
+	const std::list<std::string>& GetSegments() const
+	{
+		return mSegments;
+	}
+
+	// Write whole buffer into stream, line by line
+	void Write(std::ostream& os) const
+	{
+		for (const std::string& s : mSegments)
+		{
+			os << s << std::endl;
+		}
+	}
+};
+
+#endif
\ No newline at end of file
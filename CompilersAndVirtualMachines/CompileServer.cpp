@@ -0,0 +1,431 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "CompileServer.h"
+#include "VirtualMachine.h"
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#define INVALID_SOCKET_HANDLE INVALID_SOCKET
+#define SHUTDOWN_BOTH SD_BOTH
+#define SHUTDOWN_RECEIVE SD_RECEIVE
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+#define INVALID_SOCKET_HANDLE (-1)
+#define SHUTDOWN_BOTH SHUT_RDWR
+#define SHUTDOWN_RECEIVE SHUT_RD
+#endif
+
+// Writing into connection closed by client must not terminate the server
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+// Constructor, socket at given path is created once server runs
+CompileServer::CompileServer(const std::string& path, size_t workers)
+{
+	mPath = path;
+	mWorkersCount = workers > 0 ? workers : 1;
+	mProgramLimit = 256;
+	mInstructionLimit = 100000000;
+	mIdleTimeout = 30;
+	mListen = INVALID_SOCKET_HANDLE;
+	mStopping = false;
+	mProgramHits = 0;
+}
+
+// D-tor
+CompileServer::~CompileServer()
+{
+	Stop();
+}
+
+// Set maximum number of cached programs
+void CompileServer::SetProgramLimit(size_t limit)
+{
+	mProgramLimit = limit;
+}
+
+// Set maximum number of instructions executed per run request (0 for no limit)
+void CompileServer::SetInstructionLimit(size_t limit)
+{
+	mInstructionLimit = limit;
+}
+
+// Set number of seconds connection may wait for data before it's closed (0 for no limit), applies
+// to connections accepted afterwards
+void CompileServer::SetIdleTimeout(size_t seconds)
+{
+	mIdleTimeout = seconds;
+}
+
+// Listen and serve clients until server is stopped, returns false when socket can't be created
+bool CompileServer::Run()
+{
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	{
+		return false;
+	}
+#endif
+
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (mPath.length() >= sizeof(address.sun_path))
+	{
+		return false;
+	}
+	strncpy(address.sun_path, mPath.c_str(), sizeof(address.sun_path) - 1);
+
+	// Socket file left behind by previous run would make bind fail
+	remove(mPath.c_str());
+
+	mListen = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (mListen == INVALID_SOCKET_HANDLE)
+	{
+		return false;
+	}
+
+	if (bind(mListen, (sockaddr*)&address, sizeof(address)) != 0 || listen(mListen, 16) != 0)
+	{
+		CloseSocket(mListen);
+		mListen = INVALID_SOCKET_HANDLE;
+		return false;
+	}
+
+	mStopping = false;
+	for (size_t i = 0; i < mWorkersCount; i++)
+	{
+		mWorkers.push_back(std::thread(&CompileServer::Worker, this));
+	}
+
+	// Accept connections and pass them to workers, accept fails once listening socket is shut down
+	while (!mStopping)
+	{
+		Socket client = accept(mListen, nullptr, nullptr);
+		if (client == INVALID_SOCKET_HANDLE)
+		{
+			if (mStopping)
+			{
+				break;
+			}
+			continue;
+		}
+
+		// Receiving fails once connection waits for data too long, which closes it
+		if (mIdleTimeout > 0)
+		{
+#ifdef _WIN32
+			DWORD timeout = (DWORD)(mIdleTimeout * 1000);
+#else
+			timeval timeout;
+			timeout.tv_sec = (time_t)mIdleTimeout;
+			timeout.tv_usec = 0;
+#endif
+			setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+		}
+
+		std::lock_guard<std::mutex> lock(mPendingMutex);
+		mPending.push_back(client);
+		mPendingReady.notify_one();
+	}
+
+	// Wait for workers to finish requests they're serving
+	mPendingReady.notify_all();
+	for (std::thread& t : mWorkers)
+	{
+		t.join();
+	}
+	mWorkers.clear();
+
+	for (Socket s : mPending)
+	{
+		CloseSocket(s);
+	}
+	mPending.clear();
+
+	CloseSocket(mListen);
+	mListen = INVALID_SOCKET_HANDLE;
+	remove(mPath.c_str());
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+
+	return true;
+}
+
+// Stop the server (can be called from any thread)
+void CompileServer::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mPendingMutex);
+		mStopping = true;
+		mPendingReady.notify_all();
+
+		// Wake up workers waiting for requests, requests being served can still send their responses
+		for (Socket s : mServed)
+		{
+			shutdown(s, SHUTDOWN_RECEIVE);
+		}
+	}
+
+	// Wake up accept in Run
+	if (mListen != INVALID_SOCKET_HANDLE)
+	{
+		shutdown(mListen, SHUTDOWN_BOTH);
+	}
+}
+
+// Worker thread, serves pending connections until server stops
+void CompileServer::Worker()
+{
+	while (true)
+	{
+		Socket client;
+		{
+			std::unique_lock<std::mutex> lock(mPendingMutex);
+			mPendingReady.wait(lock, [this]() { return mStopping || !mPending.empty(); });
+			if (mStopping)
+			{
+				return;
+			}
+			client = mPending.front();
+			mPending.pop_front();
+			mServed.insert(client);
+		}
+
+		Serve(client);
+	}
+}
+
+// Serve all requests of single connection
+void CompileServer::Serve(Socket socket)
+{
+	Connection connection;
+	connection.socket = socket;
+
+	while (!mStopping && Request(connection))
+	{
+	}
+
+	// Socket is closed only once Stop can't shut it down (its handle may be reused afterwards)
+	{
+		std::lock_guard<std::mutex> lock(mPendingMutex);
+		mServed.erase(socket);
+	}
+	CloseSocket(socket);
+}
+
+// Handle single request, returns false when connection should be closed
+bool CompileServer::Request(Connection& connection)
+{
+	std::string header;
+	if (!ReadLine(connection, header))
+	{
+		return false;
+	}
+
+	// Header is "<command> <filename> <line count>"
+	std::string command;
+	std::string filename;
+	long long count = -1;
+	std::istringstream ss(header);
+	ss >> command >> filename >> count;
+
+	if (command == "shutdown")
+	{
+		Respond(connection.socket, true, std::vector<std::string>());
+		Stop();
+		return false;
+	}
+
+	if ((command != "compile" && command != "run") || filename.empty() || count < 0)
+	{
+		Respond(connection.socket, false, std::vector<std::string>(1, "Error: Invalid request '" + header + "'"));
+		return false;
+	}
+
+	std::vector<std::string> source;
+	for (long long i = 0; i < count; i++)
+	{
+		std::string line;
+		if (!ReadLine(connection, line))
+		{
+			return false;
+		}
+		source.push_back(line);
+	}
+
+	std::shared_ptr<const CompileResult> program = GetProgram(source, filename);
+
+	// Messages are printed in the same format as by command line compiler
+	std::ostringstream messages;
+	for (const Diagnostic& d : program->diagnostics)
+	{
+		d.Print(messages);
+	}
+
+	std::vector<std::string> lines;
+	std::string line;
+	std::istringstream messagesLines(messages.str());
+	while (std::getline(messagesLines, line))
+	{
+		lines.push_back(line);
+	}
+
+	if (!program->success)
+	{
+		return Respond(connection.socket, false, lines);
+	}
+
+	if (command == "compile")
+	{
+		lines.insert(lines.end(), program->assembly.begin(), program->assembly.end());
+		return Respond(connection.socket, true, lines);
+	}
+
+	// Each run gets its own VM, only its output (without trace) is sent back
+	std::ostringstream output;
+	VirtualMachine vm;
+	vm.SetTrace(nullptr);
+	vm.SetOutput(output);
+	vm.SetInstructionLimit(mInstructionLimit);
+	bool success = vm.Execute(program->binary);
+
+	std::istringstream outputLines(output.str());
+	while (std::getline(outputLines, line))
+	{
+		lines.push_back(line);
+	}
+
+	return Respond(connection.socket, success, lines);
+}
+
+// Get compiled program for source, it's compiled only when it isn't cached yet
+std::shared_ptr<const CompileResult> CompileServer::GetProgram(const std::vector<std::string>& source, const std::string& filename)
+{
+	CompileOptions options;
+	options.assemble = true;
+	options.includes = &mIncludes;
+
+	// Preprocessing is cheap with cached includes, its output (which carries line info of all included
+	// files) identifies the program along with filename (diagnostics refer to it), so changed header
+	// results in new compilation. Filename of request never contains whitespace
+	std::vector<std::string> preprocessed = ScriptCompiler::Preprocess(source, filename, options);
+	std::string key = filename + '\n';
+	for (const std::string& s : preprocessed)
+	{
+		key += s;
+		key += '\n';
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mProgramsMutex);
+		auto it = mPrograms.find(key);
+		if (it != mPrograms.end())
+		{
+			mProgramHits++;
+			return it->second;
+		}
+	}
+
+	// Compilation runs outside of lock, so workers compile different programs at once
+	std::shared_ptr<const CompileResult> program = std::make_shared<CompileResult>(ScriptCompiler::CompilePreprocessed(preprocessed, filename, options));
+
+	std::lock_guard<std::mutex> lock(mProgramsMutex);
+	if (mPrograms.find(key) == mPrograms.end())
+	{
+		mPrograms[key] = program;
+		mProgramsOrder.push_back(key);
+
+		// Oldest programs are dropped once there is too many of them
+		while (mProgramsOrder.size() > mProgramLimit)
+		{
+			mPrograms.erase(mProgramsOrder.front());
+			mProgramsOrder.pop_front();
+		}
+	}
+
+	return program;
+}
+
+// Read single line from connection, returns false when connection was closed
+bool CompileServer::ReadLine(Connection& connection, std::string& line)
+{
+	while (true)
+	{
+		size_t pos = connection.buffer.find('\n');
+		if (pos != std::string::npos)
+		{
+			line = connection.buffer.substr(0, pos);
+			connection.buffer.erase(0, pos + 1);
+
+			// Clients on Windows send CRLF
+			if (!line.empty() && line[line.length() - 1] == '\r')
+			{
+				line.erase(line.length() - 1);
+			}
+			return true;
+		}
+
+		char data[4096];
+		int received = (int)recv(connection.socket, data, sizeof(data), 0);
+		if (received <= 0)
+		{
+			return false;
+		}
+		connection.buffer.append(data, received);
+	}
+}
+
+// Send response header followed by lines
+bool CompileServer::Respond(Socket socket, bool success, const std::vector<std::string>& lines)
+{
+	std::string response = (success ? "ok " : "error ") + std::to_string(lines.size()) + "\n";
+	for (const std::string& s : lines)
+	{
+		response += s;
+		response += '\n';
+	}
+
+	size_t sent = 0;
+	while (sent < response.length())
+	{
+		int count = (int)send(socket, response.c_str() + sent, (int)(response.length() - sent), SEND_FLAGS);
+		if (count <= 0)
+		{
+			return false;
+		}
+		sent += count;
+	}
+
+	return true;
+}
+
+// Close socket
+void CompileServer::CloseSocket(Socket socket)
+{
+#ifdef _WIN32
+	closesocket(socket);
+#else
+	close(socket);
+#endif
+}
\ No newline at end of file
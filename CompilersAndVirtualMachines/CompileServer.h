@@ -0,0 +1,138 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __COMPILE_SERVER_H__
+#define __COMPILE_SERVER_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <set>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include "IncludeCache.h"
+#include "ScriptCompiler.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#endif
+
+// Persistent compilation server listening on local (Unix domain) socket. Included files and compiled
+// programs stay cached between requests, clients are served concurrently by pool of worker threads.
+//
+// Protocol is line based, client sends request header followed by source lines:
+//   compile <filename> <line count>	- compile source, response contains assembly
+//   run <filename> <line count>		- compile source and execute it, response contains VM output
+//   shutdown 0 0						- stop the server
+// Server responds with "ok <line count>" or "error <line count>" followed by that many lines. Multiple
+// requests may be sent over single connection, connection idle for too long is closed (so idle clients
+// don't keep workers from serving others).
+class CompileServer
+{
+public:
+#ifdef _WIN32
+	typedef SOCKET Socket;
+#else
+	typedef int Socket;
+#endif
+
+private:
+	// Connection with buffered reading of lines
+	struct Connection
+	{
+		Socket socket;
+		std::string buffer;
+	};
+
+	std::string mPath;										// Path of socket
+	size_t mWorkersCount;									// Number of worker threads
+	size_t mProgramLimit;									// Maximum number of cached programs
+	size_t mInstructionLimit;								// Maximum number of instructions executed per run request
+	size_t mIdleTimeout;									// Seconds connection may wait for data before it's closed
+	Socket mListen;											// Listening socket
+	std::atomic<bool> mStopping;							// Server is being stopped
+
+	std::vector<std::thread> mWorkers;						// Worker threads
+	std::deque<Socket> mPending;							// Accepted connections waiting for worker
+	std::set<Socket> mServed;								// Connections served by workers
+	std::mutex mPendingMutex;								// Guards pending and served connections
+	std::condition_variable mPendingReady;					// Signalled when connection is pending or server stops
+
+	IncludeCache mIncludes;									// Included files (shared by all workers)
+	std::map<std::string, std::shared_ptr<const CompileResult> > mPrograms;	// Compiled programs by filename and preprocessed source
+	std::list<std::string> mProgramsOrder;					// Order in which programs were cached (oldest first)
+	std::mutex mProgramsMutex;								// Guards programs
+	std::atomic<size_t> mProgramHits;						// Number of compilations served from cache
+
+	// Worker thread, serves pending connections until server stops
+	void Worker();
+
+	// Serve all requests of single connection
+	void Serve(Socket socket);
+
+	// Handle single request, returns false when connection should be closed
+	bool Request(Connection& connection);
+
+	// Get compiled program for source, it's compiled only when it isn't cached yet
+	std::shared_ptr<const CompileResult> GetProgram(const std::vector<std::string>& source, const std::string& filename);
+
+	// Read single line from connection, returns false when connection was closed
+	static bool ReadLine(Connection& connection, std::string& line);
+
+	// Send response header followed by lines
+	static bool Respond(Socket socket, bool success, const std::vector<std::string>& lines);
+
+	// Close socket
+	static void CloseSocket(Socket socket);
+
+public:
+	// Constructor, socket at given path is created once server runs
+	CompileServer(const std::string& path, size_t workers = 4);
+
+	// D-tor
+	~CompileServer();
+
+	// Set maximum number of cached programs
+	void SetProgramLimit(size_t limit);
+
+	// Set maximum number of instructions executed per run request (0 for no limit)
+	void SetInstructionLimit(size_t limit);
+
+	// Set number of seconds connection may wait for data before it's closed (0 for no limit), applies
+	// to connections accepted afterwards
+	void SetIdleTimeout(size_t seconds);
+
+	// Listen and serve clients until server is stopped, returns false when socket can't be created
+	bool Run();
+
+	// Stop the server (can be called from any thread)
+	void Stop();
+
+	// Get included files cache
+	const IncludeCache& GetIncludes() const
+	{
+		return mIncludes;
+	}
+
+	// Get number of compilations served from program cache
+	size_t GetProgramHits() const
+	{
+		return mProgramHits;
+	}
+};
+
+#endif
\ No newline at end of file
@@ -7,58 +7,114 @@
 // (C) Vilem Otte <vilem.otte@post.cz>
 ///////////////////////////////////////////////////////////////////////////////
 #include "Compiler.h"
+#include <climits>
 
-// Error function
+// Report error at given token and continue
+void Compiler::Error(const std::string& error, size_t token)
+{
+	auto it = mDebugInfo.find(token);
+	if (it != mDebugInfo.end())
+	{
+		mDiagnostics.push_back(Diagnostic(Diagnostic::SEVERITY_ERROR, error, it->second.GetFilename(), it->second.GetLine()));
+	}
+	else
+	{
+		mDiagnostics.push_back(Diagnostic(Diagnostic::SEVERITY_ERROR, error, "", 0));
+	}
+
+	if (mDiagnostics.size() >= MAX_ERRORS)
+	{
+		mDiagnostics.push_back(Diagnostic(Diagnostic::SEVERITY_ERROR, "Too many errors, compilation stopped", "", 0));
+		throw TooManyErrors();
+	}
+}
+
+// Report syntax error, parsing continues with next statement
 void Compiler::Expected(const std::string& error)
 {
-	auto it = mDebugInfo.find(mNextToken - 1);
+	// Error is at current token (or at the last one when we're at the end of input)
+	Error(error, (mTokens[mNextToken] != Lexer::END || mNextToken == 0) ? mNextToken : mNextToken - 1);
+	throw SyntaxError();
+}
 
-	std::cout << "Error: " << error << std::endl;
-	if (it != mDebugInfo.end())
+// Skip tokens up to end of statement (';' which is consumed, or '}' or keyword beginning next statement
+// which aren't), nested blocks are skipped whole
+void Compiler::Synchronize()
+{
+	size_t depth = 0;
+	while (Look())
 	{
-		std::cout << "At line " << it->second.GetLine() << " in file " << it->second.GetFilename() << std::endl;
+		// Statement missing its ';' doesn't take the following one with it
+		Lexer::Token t = mTokens[mNextToken];
+		if (depth == 0 && (t == Lexer::RBRACE || t == Lexer::TYPE || t == Lexer::RETURN || t == Lexer::BREAK ||
+			t == Lexer::IF || t == Lexer::DO || t == Lexer::WHILE || t == Lexer::FOR || t == Lexer::SWITCH ||
+			t == Lexer::PARALLEL || t == Lexer::CASE || t == Lexer::DEFAULT))
+		{
+			return;
+		}
+
+		mNextToken++;
+		if (t == Lexer::LBRACE)
+		{
+			depth++;
+		}
+		else if (t == Lexer::RBRACE)
+		{
+			depth--;
+		}
+		else if (t == Lexer::PUNCT && depth == 0)
+		{
+			return;
+		}
 	}
-	std::cin.get();
-	std::exit(-1);
 }
 
-// Returns false in case we read whole input, otherwise true
-bool Compiler::Look()
+// Enter nested construct (block or expression), reports syntax error when it's nested too deep
+void Compiler::Enter()
 {
-	if (mNextToken >= mTokens.size())
+	if (mNesting >= MAX_NESTING)
 	{
-		return false;
+		Expected("Nested too deep");
 	}
-	return true;
+	mNesting++;
+}
+
+// Leave nested construct
+void Compiler::Leave()
+{
+	mNesting--;
+}
+
+// Returns false in case we read whole input, otherwise true
+bool Compiler::Look()
+{
+	// Tokens are followed by end sentinel, which is never consumed
+	return mTokens[mNextToken] != Lexer::END;
 }
 
 // Look whether next token is the token we want
 bool Compiler::Look(Lexer::Token t)
 {
-	if (mNextToken >= mTokens.size())
-	{
-		return false;
-	}
+	return mTokens[mNextToken] == t;
+}
 
-	if (mTokens[mNextToken] == t)
+// Look whether token at given distance after the next one is the token we want
+bool Compiler::Look(Lexer::Token t, size_t ahead)
+{
+	if (mNextToken + ahead >= mTokens.size())
 	{
-		return true;
+		return false;
 	}
 
-	return false;
+	return mTokens[mNextToken + ahead] == t;
 }
 
 // Match current token
 void Compiler::Match(Lexer::Token t)
 {
-	if (mNextToken >= mTokens.size())
-	{
-		Expected("Unexpected end of file");
-	}
-
 	if (mTokens[mNextToken] != t)
 	{
-		Expected("Unexpected token");
+		Expected((mTokens[mNextToken] == Lexer::END) ? "Unexpected end of file" : "Unexpected token");
 	}
 
 	mNextToken++;
@@ -67,271 +123,787 @@ void Compiler::Match(Lexer::Token t)
 // Get value
 std::string Compiler::GetValue()
 {
-	if (mNextToken >= mTokens.size())
+	if (mTokens[mNextToken] != Lexer::VALUE)
 	{
-		Expected("Unexpected end of file");
+		Expected((mTokens[mNextToken] == Lexer::END) ? "Unexpected end of file" : "Expected integer value");
 	}
 
-	if (mTokens[mNextToken] != Lexer::VALUE)
+	return mData[mNextToken++];
+}
+
+// Match type, returns it
+Compiler::Type Compiler::GetType()
+{
+	Type type = (Look(Lexer::TYPE) && mData[mNextToken] == "string") ? TYPE_STRING : TYPE_INT;
+	Match(Lexer::TYPE);
+	return type;
+}
+
+// Report error at given token when value of the last compiled expression isn't integer
+void Compiler::RequireInteger(size_t token)
+{
+	if (mType != TYPE_INT)
 	{
-		Expected("Expected integer value");
+		Error("Integer value expected", token);
 	}
+}
 
-	return mData[mNextToken++];
+// Handle of interned string (equal strings always get the same handle)
+int Compiler::Intern(const std::string& text)
+{
+	auto it = mStrings.find(text);
+	if (it != mStrings.end())
+	{
+		return it->second;
+	}
+
+	int handle = (int)mStringPool.size();
+	mStrings[text] = handle;
+	mStringPool[handle] = text;
+	return handle;
 }
 
-// Get value
-std::string Compiler::GetIdent()
+// Load handle of interned string into register, handles of relocatable unit are rewritten by linker
+// (so they're loaded by instruction linker knows about and never used as constants)
+void Compiler::LoadString(int handle, const std::string& reg)
+{
+	// Empty string is 0 in all units
+	if (mExternals && handle != 0)
+	{
+		Emit("mov.reg.str " + reg + " " + std::to_string(handle));
+	}
+	else
+	{
+		Emit("mov.reg.i32 " + reg + " " + std::to_string(handle));
+	}
+}
+
+// Integer value of literal - string literal is interned (its handle is the value), character literal
+// is its code. Returns false when value isn't integer, character or string literal
+bool Compiler::Literal(const std::string& value, int& result, Type& type)
 {
-	if (mNextToken >= mTokens.size())
+	if (value.length() >= 2 && value[0] == '"')
+	{
+		result = Intern(value.substr(1, value.length() - 2));
+		type = TYPE_STRING;
+		return true;
+	}
+
+	type = TYPE_INT;
+	if (value.length() == 3 && value[0] == '\'')
+	{
+		result = (unsigned char)value[1];
+		return true;
+	}
+
+	if (value.empty() || value.length() > 10 || !std::all_of(value.begin(), value.end(), [](char c) { return isdigit((unsigned char)c) != 0; }) ||
+		std::stoll(value) > INT_MAX)
 	{
-		Expected("Unexpected end of file");
+		return false;
 	}
+	result = std::stoi(value);
+	return true;
+}
 
+// Get value
+std::string Compiler::GetIdent()
+{
 	if (mTokens[mNextToken] != Lexer::IDENT)
 	{
-		Expected("Expected integer value");
+		Expected((mTokens[mNextToken] == Lexer::END) ? "Unexpected end of file" : "Expected identifier");
 	}
 
 	return mData[mNextToken++];
 }
 
-//////////////////////////////////////////////////////////////////////////////
-// Integer
-// Rule '<integer> ::= [0..9]+'
-void Compiler::Integer()
+// Open new scope
+void Compiler::OpenScope()
 {
-	mCodeStack[mCodeStack.size() - 1] << "mov.reg.i32 r0 " << GetValue() << std::endl;
+	Scope scope;
+	scope.base = mStackOffset;
+	mScopes.push_back(scope);
 }
 
-//////////////////////////////////////////////////////////////////////////////
-// Identifier
-// Rule '<ident> ::= [A..z _][A..z 0..1 _]*'
-// Param 'declare' specifies whether we declare the identifier or not
-void Compiler::Ident(bool declare, bool lvalue)
+// Close innermost scope, its stack slots can be used by following variables
+void Compiler::CloseScope()
 {
-	if (declare)
+	mStackOffset = mScopes.back().base;
+	mScopes.pop_back();
+}
+
+// Declare variable (array when count isn't 0) in innermost scope (token is used for error reporting),
+// returns its stack offset
+size_t Compiler::DeclareVariable(const std::string& name, Type type, size_t token, size_t count)
+{
+	// Variable may hide one of outer scope, but not one declared in the same scope
+	std::map<std::string, Variable>& variables = mScopes.back().variables;
+	auto it = variables.find(name);
+	if (it != variables.end())
 	{
-		// Declared identifier is just pushed on stack
-		mVariables.insert(std::pair<std::string, size_t>(GetIdent(), mStackOffset));
-		mCodeStack[mCodeStack.size() - 1] << "push.i32 r0 " << std::endl;
-		mStackOffset += 4;
+		Error("Identifier already declared", token);
+		return it->second.offset;
 	}
-	else
+
+	// Array never shares slots with other variables (which would become array elements for optimizer), so
+	// it's placed above everything used so far and following variables are placed above it
+	Variable variable;
+	variable.offset = std::max(mStackOffset, (count > 0) ? mFrameSize : mArraysEnd);
+	variable.count = count;
+	variable.global = false;
+	variable.type = type;
+	variables[name] = variable;
+	mStackOffset = variable.offset + 4 * std::max(count, (size_t)1);
+	mFrameSize = std::max(mFrameSize, mStackOffset);
+	mArraysEnd = (count > 0) ? mStackOffset : mArraysEnd;
+	return variable.offset;
+}
+
+// Find variable in open scopes (innermost first), procedure finds arrays of program too. Returns false
+// when it isn't declared
+bool Compiler::FindVariable(const std::string& name, Variable& variable) const
+{
+	for (auto scope = mScopes.rbegin(); scope != mScopes.rend(); scope++)
 	{
-		// Either undeclared ident (error) or assignment/read
-		if (lvalue)
-		{
-			// Assignment (e.g. l-value), writing into memory
-			std::string ident = GetIdent();
-			if (mVariables.find(ident) == mVariables.end())
-			{
-				Expected("Undeclared Identiefier");
-			}
-			mCodeStack[mCodeStack.size() - 1] << "mov.mem.reg.i32 [sp+" << mVariables[ident] << "] r0 " << std::endl;
-		}
-		else
+		auto it = scope->variables.find(name);
+		if (it != scope->variables.end())
 		{
-			// Reading from memory
-			std::string ident = GetIdent();
-			if (mVariables.find(ident) == mVariables.end())
-			{
-				Expected("Undeclared Identiefier");
-			}
-			mCodeStack[mCodeStack.size() - 1] << "mov.reg.mem.i32 r0 [sp+" << mVariables[ident] << "]" << std::endl;
+			variable = it->second;
+			return true;
 		}
 	}
+
+	// Frame of program begins where gp points to
+	auto it = mGlobals.find(name);
+	if (mInProcedure && it != mGlobals.end())
+	{
+		variable = it->second;
+		variable.global = true;
+		return true;
+	}
+	return false;
 }
 
-//////////////////////////////////////////////////////////////////////////////
-// Factor
-// Rule '<factor> ::= (<expr>) | <ident> | <integer>'
-void Compiler::Factor()
+// Address of element of variable
+std::string Compiler::Address(const Variable& variable, size_t element) const
 {
-	if (Look(Lexer::LPAREN))
+	return std::string(variable.global ? "[gp+" : "[sp+") + std::to_string(variable.offset + 4 * element) + "]";
+}
+
+// Check whether statement starting at token at given distance after the current one assigns into
+// variable or array element
+bool Compiler::IsAssignment(size_t ahead)
+{
+	if (!Look(Lexer::IDENT, ahead))
 	{
-		Match(Lexer::LPAREN);
-		Assign();
-		Match(Lexer::RPAREN);
+		return false;
 	}
-	else if (Look(Lexer::IDENT))
+
+	// Index of element is skipped (it may contain nested brackets)
+	ahead++;
+	if (Look(Lexer::LBRACKET, ahead))
 	{
-		Ident(false, false);
+		size_t depth = 0;
+		do
+		{
+			if (Look(Lexer::LBRACKET, ahead))
+			{
+				depth++;
+			}
+			else if (Look(Lexer::RBRACKET, ahead))
+			{
+				depth--;
+			}
+			else if (Look(Lexer::END, ahead) || Look(Lexer::PUNCT, ahead))
+			{
+				return false;
+			}
+			ahead++;
+		} while (depth > 0);
 	}
-	else
+
+	return Look(Lexer::ASSIGN, ahead);
+}
+
+// Check whether variable is declared in body of parallel loop being compiled (innermost declaration)
+bool Compiler::IsPrivate(const std::string& name) const
+{
+	for (size_t i = mScopes.size(); i > 0; i--)
 	{
-		Integer();
+		if (mScopes[i - 1].variables.find(name) != mScopes[i - 1].variables.end())
+		{
+			return i - 1 >= mParallel.scopes;
+		}
 	}
+	return false;
 }
 
-void Compiler::MulOp()
+// Check whether assignment starting at current token adds to sum of parallel loop 's = s + <add>',
+// added expression doesn't use the sum and has no comparison at its top level
+bool Compiler::IsSum()
 {
-	Factor();
+	if (!mInParallel || !Look(Lexer::IDENT) || !Look(Lexer::ASSIGN, 1) || !Look(Lexer::IDENT, 2) || !Look(Lexer::ADDITION, 3))
+	{
+		return false;
+	}
+
+	std::string name = mData[mNextToken];
+	Variable variable;
+	if (mData[mNextToken + 2] != name || !FindVariable(name, variable) || variable.count > 0 || IsPrivate(name) ||
+		std::find(mParallel.sums.begin(), mParallel.sums.end(), Address(variable, 0)) == mParallel.sums.end())
+	{
+		return false;
+	}
 
-	while (Look(Lexer::MULTIPLICATION) || Look(Lexer::DIVISION))
+	// Added expression ends with statement, or with parenthesis or bracket enclosing the assignment
+	size_t depth = 0;
+	for (size_t ahead = 4; mTokens[mNextToken + ahead] != Lexer::END; ahead++)
 	{
-		mCodeStack[mCodeStack.size() - 1] << "push.i32 r0" << std::endl;
-		if (Look(Lexer::MULTIPLICATION))
+		Lexer::Token t = mTokens[mNextToken + ahead];
+		if (t == Lexer::LPAREN || t == Lexer::LBRACKET)
+		{
+			depth++;
+		}
+		else if (t == Lexer::RPAREN || t == Lexer::RBRACKET)
 		{
-			Match(Lexer::MULTIPLICATION);
-			Factor();
-			mCodeStack[mCodeStack.size() - 1] << "pop.i32 r1" << std::endl;
-			mCodeStack[mCodeStack.size() - 1] << "mul.i32 r0 r1" << std::endl;
+			if (depth == 0)
+			{
+				return true;
+			}
+			depth--;
+		}
+		else if (depth == 0 && (t == Lexer::PUNCT || t == Lexer::COMMA))
+		{
+			return true;
 		}
-		else if (Look(Lexer::DIVISION))
+		else if (t == Lexer::ASSIGN || (t == Lexer::IDENT && mData[mNextToken + ahead] == name))
 		{
-			Match(Lexer::DIVISION);
-			Factor();
-			mCodeStack[mCodeStack.size() - 1] << "pop.i32 r1" << std::endl;
-			mCodeStack[mCodeStack.size() - 1] << "div.i32 r1 r0" << std::endl;
-			mCodeStack[mCodeStack.size() - 1] << "mov.reg.reg r0 r1" << std::endl;
+			return false;
 		}
-		else if (Look())
+		else if (depth == 0 && (t == Lexer::LEQUAL || t == Lexer::GEQUAL || t == Lexer::LESS || t == Lexer::GREATER || t == Lexer::EQUAL || t == Lexer::NOTEQUAL))
 		{
-			Expected("Expected addition or subtraction operation");
+			return false;
 		}
 	}
+	return false;
 }
 
-void Compiler::AddOp()
+//////////////////////////////////////////////////////////////////////////////
+// Integer
+// Rule '<integer> ::= [0..9]+ | '<char>' | "<string>"'
+// String literal is loaded as handle of interned string, character literal as its code
+void Compiler::Integer()
 {
-	MulOp();
-
-	while (Look(Lexer::ADDITION) || Look(Lexer::SUBTRACTION))
+	std::string value = GetValue();
+	int result = 0;
+	if (Literal(value, result, mType))
 	{
-		mCodeStack[mCodeStack.size() - 1] << "push.i32 r0" << std::endl;
-		if (Look(Lexer::ADDITION))
-		{
-			Match(Lexer::ADDITION);
-			MulOp();
-			mCodeStack[mCodeStack.size() - 1] << "pop.i32 r1" << std::endl;
-			mCodeStack[mCodeStack.size() - 1] << "add.i32 r0 r1" << std::endl;
-		}
-		else if (Look(Lexer::SUBTRACTION))
-		{
-			Match(Lexer::SUBTRACTION);
-			MulOp();
-			mCodeStack[mCodeStack.size() - 1] << "pop.i32 r1" << std::endl;
-			mCodeStack[mCodeStack.size() - 1] << "sub.i32 r0 r1" << std::endl;
-			mCodeStack[mCodeStack.size() - 1] << "neg.i32 r0" << std::endl;
-		}
-		else if (Look())
+		if (mType == TYPE_STRING)
 		{
-			Expected("Expected addition or subtraction operation");
+			LoadString(result, "r0");
+			return;
 		}
+		value = std::to_string(result);
 	}
+	Emit("mov.reg.i32 r0 " + value);
 }
 
-void Compiler::CompareOp()
+//////////////////////////////////////////////////////////////////////////////
+// Identifier
+// Rule '<ident> ::= [A..z _][A..z 0..1 _]*'
+// Param 'declare' specifies whether we declare the identifier (of given type) or not
+void Compiler::Ident(bool declare, bool lvalue, Type type)
 {
-	AddOp();
-
-	while (Look(Lexer::LEQUAL) || Look(Lexer::GEQUAL) || Look(Lexer::LESS) || Look(Lexer::GREATER))
+	if (declare)
+	{
+		// Declared identifier gets slot in frame (reserved at the beginning of program or procedure),
+		// initial value is written into it
+		std::string ident = GetIdent();
+		size_t offset = DeclareVariable(ident, type, mNextToken - 1);
+		Emit("mov.mem.reg.i32 [sp+" + std::to_string(offset) + "] r0 ");
+		mType = type;
+	}
+	else
 	{
-		mCodeStack[mCodeStack.size() - 1] << "push.i32 r0" << std::endl;
-		if (Look(Lexer::LEQUAL))
+		// Either undeclared ident (error) or assignment/read
+		Variable variable;
+		std::string ident = GetIdent();
+		size_t token = mNextToken - 1;
+		if (!FindVariable(ident, variable))
 		{
-			Match(Lexer::LEQUAL);
-			AddOp();
-			mCodeStack[mCodeStack.size() - 1] << "pop.i32 r1" << std::endl;
-			mCodeStack[mCodeStack.size() - 1] << "cmpleq.i32 r1 r0" << std::endl;
+			Error("Undeclared Identiefier", token);
+			return;
 		}
-		else if (Look(Lexer::GEQUAL))
+
+		// Type of read value or of value written into variable
+		mType = variable.type;
+
+		if (variable.count > 0)
 		{
-			Match(Lexer::GEQUAL);
-			AddOp();
-			mCodeStack[mCodeStack.size() - 1] << "pop.i32 r1" << std::endl;
-			mCodeStack[mCodeStack.size() - 1] << "cmpgeq.i32 r1 r0" << std::endl;
+			if (!Look(Lexer::LBRACKET))
+			{
+				Error("Array used without index", token);
+				return;
+			}
+			Element(variable, lvalue);
 		}
-		else if (Look(Lexer::LESS))
+		else if (Look(Lexer::LBRACKET))
 		{
-			Match(Lexer::LESS);
-			AddOp();
-			mCodeStack[mCodeStack.size() - 1] << "pop.i32 r1" << std::endl;
-			mCodeStack[mCodeStack.size() - 1] << "cmpless.i32 r1 r0" << std::endl;
+			// Index is parsed (so parsing continues after it), no code is generated
+			Error("Identifier isn't an array", token);
+			mCodeStack.push_back(CodeBuffer());
+			Match(Lexer::LBRACKET);
+			EqOp();
+			Match(Lexer::RBRACKET);
+			mCodeStack.pop_back();
+			mType = variable.type;
 		}
-		else if (Look(Lexer::GREATER))
+		else if (lvalue)
 		{
-			Match(Lexer::GREATER);
-			AddOp();
-			mCodeStack[mCodeStack.size() - 1] << "pop.i32 r1" << std::endl;
-			mCodeStack[mCodeStack.size() - 1] << "cmpgreater.i32 r1 r0" << std::endl;
+			// Parallel loop assigns only its own variables and sums
+			if (mInParallel && !IsPrivate(ident))
+			{
+				if (Address(variable, 0) == mParallel.counter)
+				{
+					Error("Counter of parallel loop can't be assigned", token);
+				}
+				else if (mSum == 0 || token != mSum)
+				{
+					Error("Parallel loop can't assign variable declared outside of it", token);
+				}
+			}
+
+			// Assignment (e.g. l-value), writing into memory
+			Emit("mov.mem.reg.i32 " + Address(variable, 0) + " r0 ");
 		}
-		else if (Look())
+		else
 		{
-			Expected("Expected comparison operation");
+			// Sum of parallel loop is read only by assignment adding to it
+			if (mInParallel && !IsPrivate(ident) && (mSum == 0 || token != mSum + 2) &&
+				std::find(mParallel.sums.begin(), mParallel.sums.end(), Address(variable, 0)) != mParallel.sums.end())
+			{
+				Error("Sum of parallel loop can be used only as 's = s + <expression>'", token);
+			}
+
+			// Reading from memory
+			Emit("mov.reg.mem.i32 r0 " + Address(variable, 0));
 		}
 	}
 }
 
-void Compiler::EqOp()
+//////////////////////////////////////////////////////////////////////////////
+// Array element
+// Rule '<element> ::= <ident>[<eq>]' (identifier is already matched)
+// Element is read into r0, or value in r0 is written into it. Index is checked against array
+// bounds - constant one at compile time, others at runtime
+void Compiler::Element(const Variable& variable, bool lvalue)
 {
-	CompareOp();
+	const std::string constant = "mov.reg.i32 r0 ";
+
+	// Procedure accessing arrays of program can't be called from parallel loop
+	if (variable.global && mInProcedure)
+	{
+		mProcedures[mProcedure].globals = true;
+	}
+
+	std::string name = mData[mNextToken - 1];
+	Match(Lexer::LBRACKET);
+	size_t token = mNextToken;
+	mCodeStack.push_back(CodeBuffer());
+	EqOp();
+	RequireInteger(token);
+	mType = variable.type;
+	CodeBuffer index = std::move(mCodeStack.back());
+	mCodeStack.pop_back();
+	Match(Lexer::RBRACKET);
+
+	// Array shared by iterations of parallel loop is either only read, or accessed only by counter
+	std::vector<std::string> tail = index.Tail(2);
+	if (mInParallel && !IsPrivate(name))
+	{
+		SharedArray& shared = mParallel.arrays[Address(variable, 0)];
+		bool conflict = shared.written && shared.other != 0;
+		shared.count = variable.count;
+		shared.written = shared.written || lvalue;
+		if (shared.other == 0 && (tail.size() != 1 || tail[0] != "mov.reg.mem.i32 r0 " + mParallel.counter))
+		{
+			shared.other = token;
+		}
+		if (!conflict && shared.written && shared.other != 0)
+		{
+			Error("Array written in parallel loop has to be accessed only by its counter", shared.other);
+		}
+	}
 
-	while (Look(Lexer::EQUAL) || Look(Lexer::NOTEQUAL))
+	// Constant index addresses element directly
+	if (tail.size() == 1 && StringUtil::starts_with(tail[0], constant) && tail[0].length() - constant.length() <= 9)
 	{
-		mCodeStack[mCodeStack.size() - 1] << "push.i32 r0" << std::endl;
-		if (Look(Lexer::EQUAL))
+		size_t element = (size_t)std::stoi(tail[0].substr(constant.length()));
+		if (element >= variable.count)
 		{
-			Match(Lexer::EQUAL);
-			CompareOp();
-			mCodeStack[mCodeStack.size() - 1] << "pop.i32 r1" << std::endl;
-			mCodeStack[mCodeStack.size() - 1] << "cmpeq.i32 r0 r1" << std::endl;
+			Error("Array index out of bounds", token);
+			return;
 		}
-		else if (Look(Lexer::NOTEQUAL))
+
+		if (lvalue)
 		{
-			Match(Lexer::NOTEQUAL);
-			CompareOp();
-			mCodeStack[mCodeStack.size() - 1] << "pop.i32 r1" << std::endl;
-			mCodeStack[mCodeStack.size() - 1] << "cmpneq.i32 r0 r1" << std::endl;
+			Emit("mov.mem.reg.i32 " + Address(variable, element) + " r0 ");
 		}
-		else if (Look())
+		else
 		{
-			Expected("Expected equal or not-equal operation");
+			Emit("mov.reg.mem.i32 r0 " + Address(variable, element));
 		}
+		return;
 	}
-}
 
-// Generate new unique label
-std::string Compiler::NewLabel()
-{
-	std::string label = "L" + std::to_string(mLabelCount);
-	mLabelCount++;
-	return label;
+	// Index goes into r0 (value written into element is kept in r1)
+	std::string count = std::to_string(variable.count);
+	if (lvalue)
+	{
+		Emit("push.i32 r0");
+		mCodeStack.back().Append(index);
+		Emit("pop.i32 r1");
+		Emit("mov.idx.reg.i32 " + Address(variable, 0) + " r0 " + count + " r1");
+	}
+	else
+	{
+		mCodeStack.back().Append(index);
+		Emit("mov.reg.idx.i32 r0 " + Address(variable, 0) + " r0 " + count);
+	}
 }
 
-// Post label into code
-void Compiler::PostLabel(const std::string& label)
+//////////////////////////////////////////////////////////////////////////////
+// Procedure call
+// Rule '<call> ::= <ident>(<eq> [, <eq>]*)'
+// Arguments are pushed on stack in order, result is in r0
+void Compiler::Call()
 {
-	mCodeStack[mCodeStack.size() - 1] << label << ":" << std::endl;
-}
+	std::string name = GetIdent();
+	size_t token = mNextToken - 1;
+	Match(Lexer::LPAREN);
 
-void Compiler::ControlIf()
-{
-	std::string labelElse = NewLabel();
-	std::string labelEndIf = NewLabel();	
+	// Arguments are plain expressions (identifier in them is never assigned)
+	std::vector<Type> types;
+	if (!Look(Lexer::RPAREN))
+	{
+		EqOp();
+		Emit("push.i32 r0");
+		types.push_back(mType);
 
-	Match(Lexer::IF);
-	Match(Lexer::LPAREN);
-	EqOp();
+		while (Look(Lexer::COMMA))
+		{
+			Match(Lexer::COMMA);
+			EqOp();
+			Emit("push.i32 r0");
+			types.push_back(mType);
+		}
+	}
 	Match(Lexer::RPAREN);
-	mCodeStack[mCodeStack.size() - 1] << "jz " << labelElse << std::endl;
-	
-	if (Look(Lexer::LBRACE))
+	size_t count = types.size();
+
+	mType = TYPE_INT;
+	auto it = mProcedures.find(name);
+	if (it == mProcedures.end())
 	{
-		Block();
+		Error("Undeclared procedure", token);
 	}
-	else
+	else if (it->second.arguments.size() != count)
 	{
-		Expression();
+		Error("Wrong number of arguments", token);
+	}
+	else if (it->second.arguments != types)
+	{
+		Error("Wrong type of argument", token);
 	}
 
-	if (Look(Lexer::ELSE))
+	if (it != mProcedures.end())
 	{
-		Match(Lexer::ELSE);
-		labelEndIf = NewLabel();
-		mCodeStack[mCodeStack.size() - 1] << "jmp " << labelEndIf << std::endl;
-		PostLabel(labelElse);
+		mType = it->second.result;
+		it->second.called = true;
+
+		// Iterations of parallel loop have their own copies of arrays of program, so procedures called
+		// in it can't access them (caller inherits properties of callee)
+		if (mInParallel && it->second.globals)
+		{
+			Error("Procedure called in parallel loop can't access arrays of program", token);
+		}
+		if (mInParallel && it->second.parallel)
+		{
+			Error("Parallel loops can't be nested", token);
+		}
+
+		// Properties of procedure which isn't defined yet (or which calls such one) are checked once
+		// whole unit is compiled
+		if (mInParallel && (!it->second.defined || !it->second.pending.empty()))
+		{
+			mParallelCalls.push_back(std::make_pair(name, token));
+		}
+		if (mInProcedure)
+		{
+			Signature& caller = mProcedures[mProcedure];
+			caller.globals = caller.globals || it->second.globals;
+			caller.parallel = caller.parallel || it->second.parallel;
+			caller.pending.insert(it->second.pending.begin(), it->second.pending.end());
+			if (!it->second.defined)
+			{
+				caller.pending.insert(name);
+			}
+		}
+	}
+
+	// Callee removes arguments from stack
+	Emit("call P" + name + " " + std::to_string(count));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Factor
+// Rule '<factor> ::= (<assign>) | (<eq>) | <call> | <element> | <ident> | <integer>'
+// Parentheses which don't enclose assignment are handled by expression itself
+void Compiler::Factor()
+{
+	if (Look(Lexer::LPAREN))
+	{
+		Match(Lexer::LPAREN);
+		Assign();
+		Match(Lexer::RPAREN);
+	}
+	else if (Look(Lexer::IDENT) && Look(Lexer::LPAREN, 1))
+	{
+		Call();
+	}
+	else if (Look(Lexer::IDENT))
+	{
+		Ident(false, false);
+	}
+	else
+	{
+		Integer();
+	}
+}
+
+// Operator of token
+const Compiler::Operator& Compiler::GetOperator(Lexer::Token t)
+{
+	static const Operator none = { 0, false, { nullptr, nullptr } };
+	static const std::vector<Operator> operators = []()
+	{
+		std::vector<Operator> table(Lexer::END + 1, none);
+		table[Lexer::MULTIPLICATION] = { 4, true, { "mul.i32 r0 r1", nullptr } };
+		table[Lexer::DIVISION] = { 4, true, { "div.i32 r1 r0", "mov.reg.reg r0 r1" } };
+		table[Lexer::ADDITION] = { 3, true, { "add.i32 r0 r1", nullptr } };
+		table[Lexer::SUBTRACTION] = { 3, true, { "sub.i32 r0 r1", "neg.i32 r0" } };
+		table[Lexer::LEQUAL] = { 2, true, { "cmpleq.i32 r1 r0", nullptr } };
+		table[Lexer::GEQUAL] = { 2, true, { "cmpgeq.i32 r1 r0", nullptr } };
+		table[Lexer::LESS] = { 2, true, { "cmpless.i32 r1 r0", nullptr } };
+		table[Lexer::GREATER] = { 2, true, { "cmpgreater.i32 r1 r0", nullptr } };
+		table[Lexer::EQUAL] = { 1, false, { "cmpeq.i32 r0 r1", nullptr } };
+		table[Lexer::NOTEQUAL] = { 1, false, { "cmpneq.i32 r0 r1", nullptr } };
+		return table;
+	}();
+
+	return operators[t];
+}
+
+// Combine left operand (on stack) of pending operator with right one (in r0)
+void Compiler::Reduce(const PendingOperator& pending)
+{
+	// Interned strings are equal when their handles are
+	if (pending.op->integer)
+	{
+		RequireInteger(pending.token);
+	}
+	else if (pending.type != mType)
+	{
+		Error("Compared values have different types", pending.token);
+	}
+
+	Emit("pop.i32 r1");
+	for (const char* line : pending.op->code)
+	{
+		if (line != nullptr)
+		{
+			Emit(line);
+		}
+	}
+	mType = TYPE_INT;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Expression (precedence climbing driven by table of operators)
+// Rule '<eq> ::= <cmp> [<eq_op> <cmp>]*'
+// Rule '<cmp> ::= <add> [<cmp_op> <add>]*'
+// Rule '<add> ::= <mul> [<add_op> <mul>]*'
+// Rule '<mul> ::= <factor> [<mul_op> <factor>]*'
+// Left operand is pushed on stack while right one is computed. Operators waiting for right operand
+// and open parentheses are kept on explicit stack, so nesting of parentheses isn't limited
+void Compiler::EqOp()
+{
+	Enter();
+
+	std::vector<PendingOperator> pending;
+	while (true)
+	{
+		// Operand, parentheses enclosing assignment are part of it
+		while (Look(Lexer::LPAREN) && !IsAssignment(1))
+		{
+			PendingOperator parenthesis = { nullptr, mNextToken, mType };
+			pending.push_back(parenthesis);
+			mNextToken++;
+		}
+		Factor();
+
+		// Once next operator is known, pending operators which bind at least as tight have both operands,
+		// closing parenthesis completes everything since the opening one
+		const Operator* op = nullptr;
+		while (op == nullptr)
+		{
+			const Operator& next = GetOperator(mTokens[mNextToken]);
+			while (!pending.empty() && pending.back().op != nullptr && pending.back().op->precedence >= next.precedence)
+			{
+				Reduce(pending.back());
+				pending.pop_back();
+			}
+
+			if (next.precedence > 0)
+			{
+				op = &next;
+			}
+			else if (pending.empty())
+			{
+				Leave();
+				return;
+			}
+			else
+			{
+				Match(Lexer::RPAREN);
+				pending.pop_back();
+			}
+		}
+
+		PendingOperator left = { op, mNextToken, mType };
+		if (op->integer)
+		{
+			RequireInteger(left.token);
+		}
+		Emit("push.i32 r0");
+		mNextToken++;
+		pending.push_back(left);
+	}
+}
+
+// Generate new unique label
+std::string Compiler::NewLabel()
+{
+	std::string label = "L" + std::to_string(mLabelCount);
+	mLabelCount++;
+	return label;
+}
+
+// Emit single line of assembly into current code buffer
+void Compiler::Emit(const std::string& line)
+{
+	mCodeStack.back().Emit(line);
+}
+
+// Post label into code
+void Compiler::PostLabel(const std::string& label)
+{
+	Emit(label + ":");
+}
+
+// Condition of control statement, jumps to label when condition result is equal to jumpIf
+// (comparison at the root of condition is fused with the jump)
+void Compiler::Condition(const std::string& label, bool jumpIf)
+{
+	// Comparison instruction -> fused jumps taken when comparison holds and when it doesn't
+	static const std::map<std::string, std::pair<std::string, std::string> > fused =
+	{
+		{ "cmpleq.i32", { "jle", "jgt" } },
+		{ "cmpgeq.i32", { "jge", "jlt" } },
+		{ "cmpless.i32", { "jlt", "jge" } },
+		{ "cmpgreater.i32", { "jgt", "jle" } },
+		{ "cmpeq.i32", { "jeq", "jne" } },
+		{ "cmpneq.i32", { "jne", "jeq" } }
+	};
+
+	// Fused jump -> fused jump with swapped operands
+	static const std::map<std::string, std::string> swapped =
+	{
+		{ "jle", "jge" }, { "jge", "jle" }, { "jlt", "jgt" }, { "jgt", "jlt" }, { "jeq", "jeq" }, { "jne", "jne" }
+	};
+	const std::string constant = "mov.reg.i32 r0 ";
+
+	mCodeStack.push_back(CodeBuffer());
+	size_t token = mNextToken;
+	EqOp();
+	RequireInteger(token);
+	CodeBuffer& code = mCodeStack.back();
+
+	std::vector<std::string> tail = code.Tail(5);
+	std::vector<std::string> compare = tail.empty() ? std::vector<std::string>() : StringUtil::split(tail.back(), ' ');
+	auto it = compare.empty() ? fused.end() : fused.find(compare[0]);
+	if (it == fused.end() || compare.size() != 3)
+	{
+		Emit((jumpIf ? "jnz " : "jz ") + label);
+	}
+	else
+	{
+		std::string jump = jumpIf ? it->second.first : it->second.second;
+
+		// Comparison with constant (left operand is pushed, constant is loaded and left operand popped
+		// back) uses constant directly
+		size_t n = tail.size();
+		if (n >= 4 && tail[n - 4] == "push.i32 r0" && StringUtil::starts_with(tail[n - 3], constant) && tail[n - 2] == "pop.i32 r1")
+		{
+			std::string value = tail[n - 3].substr(constant.length());
+			code.RemoveTail(4);
+			Emit(jump + ".reg.i32 r0 " + value + " " + label);
+		}
+		else if (n == 5 && StringUtil::starts_with(tail[0], constant) && tail[1] == "push.i32 r0" && tail[3] == "pop.i32 r1" &&
+			(StringUtil::starts_with(tail[2], "mov.reg.mem.i32 r0 ") || StringUtil::starts_with(tail[2], constant)))
+		{
+			// Constant compared with single variable, operands are swapped
+			std::string value = tail[0].substr(constant.length());
+			std::string load = tail[2];
+			code.RemoveTail(5);
+			Emit(load);
+			Emit(swapped.at(jump) + ".reg.i32 r0 " + value + " " + label);
+		}
+		else
+		{
+			code.RemoveTail(1);
+			Emit(jump + ".reg.reg " + compare[1] + " " + compare[2] + " " + label);
+		}
+	}
+
+	CodeBuffer condition = std::move(mCodeStack.back());
+	mCodeStack.pop_back();
+	mCodeStack.back().Append(condition);
+}
+
+void Compiler::ControlIf()
+{
+	std::string labelElse = NewLabel();
+	std::string labelEndIf = NewLabel();	
+
+	Match(Lexer::IF);
+	Match(Lexer::LPAREN);
+	Condition(labelElse, false);
+	Match(Lexer::RPAREN);
+	
+	if (Look(Lexer::LBRACE))
+	{
+		Block();
+	}
+	else
+	{
+		Expression();
+	}
+
+	if (Look(Lexer::ELSE))
+	{
+		Match(Lexer::ELSE);
+		Emit("jmp " + labelEndIf);
+		PostLabel(labelElse);
 
 		if (Look(Lexer::LBRACE))
 		{
@@ -341,65 +913,612 @@ void Compiler::ControlIf()
 		{
 			Expression();
 		}
+
+		PostLabel(labelEndIf);
+	}
+	else
+	{
+		PostLabel(labelElse);
+	}
+}
+
+void Compiler::ControlDo()
+{
+	std::string labelRepeat = NewLabel();
+	PostLabel(labelRepeat);
+
+	Match(Lexer::DO);
+
+	// Break is allowed only in switch (loops don't have it)
+	mBreakLabels.push_back("");
+	if (Look(Lexer::LBRACE))
+	{
+		Block();
+	}
+	else
+	{
+		Expression();
+	}
+	mBreakLabels.pop_back();
+
+	Match(Lexer::WHILE);
+	Match(Lexer::LPAREN);
+	Condition(labelRepeat, true);
+	Match(Lexer::RPAREN);
+}
+
+void Compiler::ControlWhile()
+{
+	std::string labelRepeat = NewLabel();
+	std::string labelCondition = NewLabel();
+
+	// Condition is buffered and placed after the body, so each iteration ends with single jump
+	Match(Lexer::WHILE);
+	Match(Lexer::LPAREN);
+	mCodeStack.push_back(CodeBuffer());
+	Condition(labelRepeat, true);
+	CodeBuffer condition = std::move(mCodeStack.back());
+	mCodeStack.pop_back();
+	Match(Lexer::RPAREN);
+
+	Emit("jmp " + labelCondition);
+	PostLabel(labelRepeat);
+
+	mBreakLabels.push_back("");
+	if (Look(Lexer::LBRACE))
+	{
+		Block();
+	}
+	else
+	{
+		Expression();
+	}
+	mBreakLabels.pop_back();
+
+	PostLabel(labelCondition);
+	mCodeStack.back().Append(condition);
+}
+
+// Check whether for loop condition and step (starting at current token) describe counted loop -
+// variable compared with constant or variable and stepped by constant. Returns loop instruction
+// stepping the variable and jumping to label while condition holds
+bool Compiler::CountedLoop(const std::string& label, std::string& instruction)
+{
+	// Comparison token -> condition of loop instruction with counter on the left and on the right side
+	static const std::map<Lexer::Token, std::pair<std::string, std::string> > conditions =
+	{
+		{ Lexer::LESS, { "lt", "gt" } },
+		{ Lexer::LEQUAL, { "le", "ge" } },
+		{ Lexer::GREATER, { "gt", "lt" } },
+		{ Lexer::GEQUAL, { "ge", "le" } },
+		{ Lexer::EQUAL, { "eq", "eq" } },
+		{ Lexer::NOTEQUAL, { "ne", "ne" } }
+	};
+
+	// Pattern is '<ident> <cmp_op> <bound>; <ident> = <ident> <add_op> <integer>)' (or with operands
+	// swapped), where bound is either integer or identifier
+	size_t i = mNextToken;
+	if (i + 10 > mTokens.size() || mTokens[i + 3] != Lexer::PUNCT || mTokens[i + 9] != Lexer::RPAREN)
+	{
+		return false;
+	}
+
+	auto IsInteger = [this](size_t token)
+	{
+		const std::string& value = mData[token];
+		if (mTokens[token] != Lexer::VALUE || value.empty() || value.length() > 9)
+		{
+			return false;
+		}
+
+		for (char c : value)
+		{
+			if (!isdigit(c))
+			{
+				return false;
+			}
+		}
+		return true;
+	};
+
+	// Step
+	const std::string& counter = mData[i + 4];
+	Variable variable;
+	if (mTokens[i + 4] != Lexer::IDENT || mTokens[i + 5] != Lexer::ASSIGN || !FindVariable(counter, variable) || variable.count > 0 ||
+		variable.type != TYPE_INT)
+	{
+		return false;
+	}
+
+	std::string step;
+	if (mTokens[i + 6] == Lexer::IDENT && mData[i + 6] == counter && IsInteger(i + 8) &&
+		(mTokens[i + 7] == Lexer::ADDITION || mTokens[i + 7] == Lexer::SUBTRACTION))
+	{
+		step = ((mTokens[i + 7] == Lexer::SUBTRACTION) ? "-" : "") + mData[i + 8];
+	}
+	else if (IsInteger(i + 6) && mTokens[i + 7] == Lexer::ADDITION && mTokens[i + 8] == Lexer::IDENT && mData[i + 8] == counter)
+	{
+		step = mData[i + 6];
+	}
+	else
+	{
+		return false;
+	}
+
+	// Condition
+	auto it = conditions.find(mTokens[i + 1]);
+	if (it == conditions.end())
+	{
+		return false;
+	}
+
+	size_t bound = 0;
+	std::string condition;
+	if (mTokens[i] == Lexer::IDENT && mData[i] == counter)
+	{
+		bound = i + 2;
+		condition = it->second.first;
+	}
+	else if (mTokens[i + 2] == Lexer::IDENT && mData[i + 2] == counter)
+	{
+		bound = i;
+		condition = it->second.second;
+	}
+	else
+	{
+		return false;
+	}
+
+	std::string address = Address(variable, 0);
+	Variable boundVariable;
+	if (IsInteger(bound))
+	{
+		instruction = "loop." + condition + ".i32 " + address + " " + step + " " + mData[bound] + " " + label;
+		return true;
+	}
+	else if (mTokens[bound] == Lexer::IDENT && mData[bound] != counter && FindVariable(mData[bound], boundVariable) && boundVariable.count == 0 &&
+		boundVariable.type == TYPE_INT)
+	{
+		instruction = "loop." + condition + ".mem " + address + " " + step + " " + Address(boundVariable, 0) + " " + label;
+		return true;
+	}
+
+	return false;
+}
+
+void Compiler::ControlFor()
+{
+	std::string labelRepeat = NewLabel();
+	std::string labelCondition = NewLabel();
+	std::string labelEnd = NewLabel();
+
+	Match(Lexer::FOR);
+	Match(Lexer::LPAREN);
+
+	// Variable declared in initialization is visible only in loop
+	OpenScope();
+
+	// Initialization
+	if (Look(Lexer::TYPE))
+	{
+		Declaration();
+	}
+	else if (!Look(Lexer::PUNCT))
+	{
+		Assign();
+	}
+	Match(Lexer::PUNCT);
+
+	// Counted loop tests condition once before entering the loop, then stepping, test and jump are
+	// single instruction at the end of each iteration
+	std::string loop;
+	bool counted = CountedLoop(labelRepeat, loop);
+
+	// Condition and step are buffered and placed after the body (missing condition is always true)
+	mCodeStack.push_back(CodeBuffer());
+	if (counted)
+	{
+		Condition(labelEnd, false);
+	}
+	else if (!Look(Lexer::PUNCT))
+	{
+		Condition(labelRepeat, true);
+	}
+	else
+	{
+		Emit("jmp " + labelRepeat);
+	}
+	CodeBuffer condition = std::move(mCodeStack.back());
+	mCodeStack.pop_back();
+	Match(Lexer::PUNCT);
+
+	mCodeStack.push_back(CodeBuffer());
+	if (!Look(Lexer::RPAREN))
+	{
+		Assign();
+	}
+	CodeBuffer step = std::move(mCodeStack.back());
+	mCodeStack.pop_back();
+	Match(Lexer::RPAREN);
+
+	if (counted)
+	{
+		mCodeStack.back().Append(condition);
+	}
+	else
+	{
+		Emit("jmp " + labelCondition);
+	}
+	PostLabel(labelRepeat);
+
+	mBreakLabels.push_back("");
+	if (Look(Lexer::LBRACE))
+	{
+		Block();
+	}
+	else
+	{
+		Expression();
+	}
+	mBreakLabels.pop_back();
+
+	if (counted)
+	{
+		Emit(loop);
+		PostLabel(labelEnd);
+	}
+	else
+	{
+		mCodeStack.back().Append(step);
+		PostLabel(labelCondition);
+		mCodeStack.back().Append(condition);
+	}
+
+	CloseScope();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Parallel loop
+// Rule '<parallel> ::= parallel [(<ident> [, <ident>]*)]^ for(<type><ident> = <eq>; <ident> < <eq>; <ident> = <ident> + 1) <block>'
+// Iterations run on worker threads, so they have to be independent - body assigns only its own
+// variables, elements of arrays indexed by counter (which aren't accessed by other index) and sums
+// listed after parallel. Procedures called in body can't access arrays of program
+void Compiler::ControlParallel()
+{
+	std::string labelEnd = NewLabel();
+
+	// Nested loop is reported, its body is still checked on its own
+	size_t token = mNextToken;
+	Match(Lexer::PARALLEL);
+	bool inParallel = mInParallel;
+	Parallel outer = mParallel;
+	if (mInParallel)
+	{
+		Error("Parallel loops can't be nested", token);
+	}
+
+	// Sums are int variables of outer scopes, each worker adds to its own copy starting at 0
+	std::vector<std::string> sums;
+	if (Look(Lexer::LPAREN))
+	{
+		Match(Lexer::LPAREN);
+		while (true)
+		{
+			std::string name = GetIdent();
+			Variable variable;
+			if (!FindVariable(name, variable))
+			{
+				Error("Undeclared Identiefier", mNextToken - 1);
+			}
+			else if (variable.count > 0 || variable.type != TYPE_INT)
+			{
+				Error("Sum of parallel loop has to be int variable", mNextToken - 1);
+			}
+			else
+			{
+				sums.push_back(Address(variable, 0));
+			}
+
+			if (!Look(Lexer::COMMA))
+			{
+				break;
+			}
+			Match(Lexer::COMMA);
+		}
+		Match(Lexer::RPAREN);
+	}
+
+	Match(Lexer::FOR);
+	Match(Lexer::LPAREN);
+
+	// Counter declared in initialization is visible only in loop
+	OpenScope();
+	size_t counterToken = mNextToken;
+	if (GetType() != TYPE_INT)
+	{
+		Error("Counter of parallel loop has to be int", counterToken);
+	}
+	std::string counter = GetIdent();
+	Match(Lexer::ASSIGN);
+	size_t valueToken = mNextToken;
+	EqOp();
+	RequireInteger(valueToken);
+	Variable variable;
+	DeclareVariable(counter, TYPE_INT, counterToken + 1);
+	FindVariable(counter, variable);
+	Emit("mov.mem.reg.i32 " + Address(variable, 0) + " r0 ");
+	Match(Lexer::PUNCT);
+
+	// End is evaluated once (into r0), counter is stepped by one
+	if (GetIdent() != counter)
+	{
+		Error("Condition of parallel loop has to compare its counter", mNextToken - 1);
+	}
+	Match(Lexer::LESS);
+	valueToken = mNextToken;
+	EqOp();
+	RequireInteger(valueToken);
+	Match(Lexer::PUNCT);
+
+	size_t stepToken = mNextToken;
+	bool step = (GetIdent() == counter);
+	Match(Lexer::ASSIGN);
+	step = (GetIdent() == counter) && step;
+	Match(Lexer::ADDITION);
+	step = (GetValue() == "1") && step;
+	if (!step)
+	{
+		Error("Parallel loop has to step its counter by 1", stepToken);
+	}
+	Match(Lexer::RPAREN);
+
+	// Body is compiled first, so arrays written by it are known
+	mParallel = Parallel();
+	mParallel.scopes = mScopes.size();
+	mParallel.counter = Address(variable, 0);
+	mParallel.sums = sums;
+	mInParallel = true;
+	mCodeStack.push_back(CodeBuffer());
+	mBreakLabels.push_back("");
+	Block();
+	mBreakLabels.pop_back();
+	CodeBuffer body = std::move(mCodeStack.back());
+	mCodeStack.pop_back();
+
+	// 'pfor <counter> <writes> (<array> <count>)* <sums> <address>* <label>'
+	size_t writes = 0;
+	std::string arrays;
+	for (const std::pair<const std::string, SharedArray>& a : mParallel.arrays)
+	{
+		if (a.second.written)
+		{
+			arrays += " " + a.first + " " + std::to_string(a.second.count);
+			writes++;
+		}
+	}
+	std::string line = "pfor " + mParallel.counter + " " + std::to_string(writes) + arrays + " " + std::to_string(sums.size());
+	for (const std::string& sum : sums)
+	{
+		line += " " + sum;
+	}
+	Emit(line + " " + labelEnd);
+	mCodeStack.back().Append(body);
+	Emit("pend");
+	PostLabel(labelEnd);
+
+	CloseScope();
+	mInParallel = inParallel;
+	mParallel = outer;
+
+	// Procedure with parallel loop can't be called from another one
+	if (mInProcedure)
+	{
+		mProcedures[mProcedure].parallel = true;
+	}
+}
+
+// Case value (integer, optionally negative, or literal of switch type)
+int Compiler::CaseValue(Type type)
+{
+	bool negative = false;
+	if (Look(Lexer::SUBTRACTION))
+	{
+		Match(Lexer::SUBTRACTION);
+		negative = true;
+	}
+
+	size_t token = mNextToken;
+	std::string value = GetValue();
+	if (value[0] == '"' || value[0] == '\'')
+	{
+		int result = 0;
+		Type literal = TYPE_INT;
+		if (!Literal(value, result, literal) || literal != type || negative)
+		{
+			Error("Case value has different type than switch", token);
+			return 0;
+		}
+		return result;
+	}
+
+	if (value.empty() || value.length() > 10 || !std::all_of(value.begin(), value.end(), [](char c) { return isdigit((unsigned char)c) != 0; }))
+	{
+		mNextToken = token;
+		Expected("Expected integer value");
+	}
+
+	if (type != TYPE_INT)
+	{
+		Error("Case value has different type than switch", token);
+		return 0;
+	}
+
+	long long v = std::stoll(value);
+	if (negative)
+	{
+		v = -v;
+	}
+
+	if (v < INT_MIN || v > INT_MAX)
+	{
+		Error("Case value out of range", token);
+		return 0;
+	}
+	return (int)v;
+}
+
+// Jump to label of case with value in r0 (cases are sorted by value), otherwise to given label. Dense
+// cases use jump table, sparse ones binary decision tree (which uses tables for its dense parts)
+void Compiler::Dispatch(const std::vector<std::pair<int, std::string> >& cases, size_t first, size_t last, const std::string& otherwise)
+{
+	size_t count = last - first;
+	if (count >= MIN_TABLE_CASES && (long long)cases[last - 1].first - cases[first].first < (long long)(count * TABLE_DENSITY))
+	{
+		// Table has entry for each value in range, values out of range jump to default
+		std::string table = "jmp.table r0 " + std::to_string(cases[first].first) + " " + otherwise;
+		size_t c = first;
+		for (long long v = cases[first].first; v <= cases[last - 1].first; v++)
+		{
+			if (cases[c].first == v)
+			{
+				table += " " + cases[c].second;
+				c++;
+			}
+			else
+			{
+				table += " " + otherwise;
+			}
+		}
+		Emit(table);
+		return;
+	}
+
+	if (count <= MAX_LINEAR_CASES)
+	{
+		for (size_t c = first; c < last; c++)
+		{
+			Emit("jeq.reg.i32 r0 " + std::to_string(cases[c].first) + " " + cases[c].second);
+		}
+		Emit("jmp " + otherwise);
+		return;
+	}
+
+	// Largest dense cluster is split off to get its own table, otherwise cases are split in halves
+	size_t middle = first + count / 2;
+	size_t clusterFirst = first;
+	size_t clusterLast = first;
+	for (size_t i = first; i < last; i++)
+	{
+		for (size_t j = i + MIN_TABLE_CASES; j <= last; j++)
+		{
+			if ((long long)cases[j - 1].first - cases[i].first < (long long)((j - i) * TABLE_DENSITY) && j - i > clusterLast - clusterFirst)
+			{
+				clusterFirst = i;
+				clusterLast = j;
+			}
+		}
+	}
+	if (clusterLast > clusterFirst)
+	{
+		middle = (clusterFirst > first) ? clusterFirst : clusterLast;
 	}
 
-	PostLabel(labelEndIf);
+	// Lower part of cases is decided first, upper part after jump
+	std::string labelUpper = NewLabel();
+	Emit("jge.reg.i32 r0 " + std::to_string(cases[middle].first) + " " + labelUpper);
+	Dispatch(cases, first, middle, otherwise);
+	PostLabel(labelUpper);
+	Dispatch(cases, middle, last, otherwise);
 }
 
-void Compiler::ControlDo()
+// Jump to label of case with handle of string in r0, otherwise to given label. Linker changes handles
+// of relocatable unit (their order isn't known), so they're compared one by one
+void Compiler::DispatchStrings(const std::vector<std::pair<int, std::string> >& cases, const std::string& otherwise)
 {
-	std::string labelRepeat = NewLabel();
-	std::string labelBreak = NewLabel();
-	PostLabel(labelRepeat);
-
-	Match(Lexer::DO);
-
-	if (Look(Lexer::LBRACE))
+	for (const std::pair<int, std::string>& c : cases)
 	{
-		Block();
-	}
-	else
-	{
-		Expression();
+		LoadString(c.first, "r1");
+		Emit("jeq.reg.reg r0 r1 " + c.second);
 	}
-
-	Match(Lexer::WHILE);
-	Match(Lexer::LPAREN);
-	Assign();
-	Match(Lexer::RPAREN);
-	mCodeStack[mCodeStack.size() - 1] << "jz " << labelBreak << std::endl;
-	mCodeStack[mCodeStack.size() - 1] << "jnz " << labelRepeat << std::endl;
-	PostLabel(labelBreak);
+	Emit("jmp " + otherwise);
 }
 
-void Compiler::ControlWhile()
+//////////////////////////////////////////////////////////////////////////////
+// Switch
+// Rule '<switch> ::= switch(<eq>) { [case <integer>: | default: | <command>]* }'
+// Cases fall through into following ones, break jumps past the end of switch. Switch on string has
+// string literals as cases (handles of interned strings are dense, so they usually get jump table,
+// except in relocatable unit where linker changes them)
+void Compiler::ControlSwitch()
 {
-	std::string labelRepeat = NewLabel();
-	std::string labelBreak = NewLabel();
-	PostLabel(labelRepeat);
+	std::string labelEnd = NewLabel();
 
-	Match(Lexer::WHILE);
+	Match(Lexer::SWITCH);
 	Match(Lexer::LPAREN);
-	Assign();
+	EqOp();
+	Type type = mType;
 	Match(Lexer::RPAREN);
-	mCodeStack[mCodeStack.size() - 1] << "jz " << labelBreak << std::endl;
+	Match(Lexer::LBRACE);
 
-	if (Look(Lexer::LBRACE))
+	// Body is buffered, dispatch (with value in r0) is placed before it once all cases are known
+	OpenScope();
+	mBreakLabels.push_back(labelEnd);
+	mCodeStack.push_back(CodeBuffer());
+
+	std::map<int, std::string> cases;
+	std::string labelDefault;
+	while (Look() && !Look(Lexer::RBRACE))
 	{
-		Block();
+		if (Look(Lexer::CASE))
+		{
+			size_t token = mNextToken;
+			Match(Lexer::CASE);
+			int value = CaseValue(type);
+			Match(Lexer::COLON);
+
+			std::string label = NewLabel();
+			if (!cases.insert(std::pair<int, std::string>(value, label)).second)
+			{
+				Error("Duplicate case value", token);
+			}
+			PostLabel(label);
+		}
+		else if (Look(Lexer::DEFAULT))
+		{
+			size_t token = mNextToken;
+			Match(Lexer::DEFAULT);
+			Match(Lexer::COLON);
+
+			if (!labelDefault.empty())
+			{
+				Error("Duplicate default label", token);
+				continue;
+			}
+			labelDefault = NewLabel();
+			PostLabel(labelDefault);
+		}
+		else
+		{
+			Command();
+		}
+	}
+
+	CodeBuffer body = std::move(mCodeStack.back());
+	mCodeStack.pop_back();
+	mBreakLabels.pop_back();
+	CloseScope();
+	Match(Lexer::RBRACE);
+
+	if (type == TYPE_STRING && mExternals)
+	{
+		DispatchStrings(std::vector<std::pair<int, std::string> >(cases.begin(), cases.end()), labelDefault.empty() ? labelEnd : labelDefault);
 	}
 	else
 	{
-		Expression();
+		Dispatch(std::vector<std::pair<int, std::string> >(cases.begin(), cases.end()), 0, cases.size(), labelDefault.empty() ? labelEnd : labelDefault);
 	}
-
-	mCodeStack[mCodeStack.size() - 1] << "jmp " << labelRepeat << std::endl;
-	PostLabel(labelBreak);
-}
-
-void Compiler::ControlFor()
-{
-	std::string labelCondition;
+	mCodeStack.back().Append(body);
+	PostLabel(labelEnd);
 }
 
 void Compiler::Control()
@@ -420,6 +1539,14 @@ void Compiler::Control()
 	{
 		ControlFor();
 	}
+	else if (Look(Lexer::SWITCH))
+	{
+		ControlSwitch();
+	}
+	else if (Look(Lexer::PARALLEL))
+	{
+		ControlParallel();
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -427,49 +1554,53 @@ void Compiler::Control()
 // Rule '<assign> ::= <ident> [<assign_op> <ident>]* [<assign_op> <sub>]^ | <sub>'
 void Compiler::Assign()
 {
-	if (!Look(Lexer::IDENT))
+	if (!IsAssignment())
 	{
-		// If we don't begin with <ident>, 2nd rule takes place
+		// If we don't begin with assigned <ident> (expression or procedure call isn't an l-value), 2nd rule takes place
 		EqOp();
 	}
 	else
 	{
-		// Buffer the assembly output
-		mCodeStack.push_back(std::stringstream());
+		// Buffer the assembly output (sum of parallel loop is assigned only by adding to it)
+		mSum = IsSum() ? mNextToken : 0;
+		mCodeStack.push_back(CodeBuffer());
+		size_t token = mNextToken;
 		Ident(false, true);
-		std::string top = mCodeStack[mCodeStack.size() - 1].str();
+		Type type = mType;
+		CodeBuffer top = std::move(mCodeStack.back());
 		mCodeStack.pop_back();
 
 		size_t deep = 0;
-		bool variable = true;
 
 		// Buffer all the assignments into separate buffer
 		while (Look(Lexer::ASSIGN))
 		{
 			deep++;
-			mCodeStack.push_back(std::stringstream());
+			mCodeStack.push_back(CodeBuffer());
 
 			Match(Lexer::ASSIGN);
 
 			EqOp();
 		}
 
-		// Print out in last in first out way (LIFO)
-		std::vector<std::string> temp;
-		while (deep > 0)
+		// The last value is the one written
+		if (mType != type)
 		{
-			std::string tmp = mCodeStack[mCodeStack.size() - 1].str();
-			temp.insert(temp.begin(), tmp);
-			mCodeStack.pop_back();
-			deep--;
+			Error("Assigned value has different type", token);
 		}
+		mType = type;
 
-		for (const std::string& s : temp)
+		// Print out in last in first out way (LIFO), segments are just moved
+		CodeBuffer temp;
+		while (deep > 0)
 		{
-			mCodeStack[mCodeStack.size() - 1] << s;
+			temp.Prepend(mCodeStack.back());
+			mCodeStack.pop_back();
+			deep--;
 		}
 
-		mCodeStack[mCodeStack.size() - 1] << top;
+		mCodeStack.back().Append(temp);
+		mCodeStack.back().Append(top);
 	}
 }
 
@@ -479,44 +1610,183 @@ void Compiler::Assign()
 void Compiler::Declaration()
 {
 	// Buffer assignments
-	Match(Lexer::TYPE);
-	mCodeStack.push_back(std::stringstream());
-	Ident(true, true);
-	std::string top = mCodeStack[mCodeStack.size() - 1].str();
+	Type type = GetType();
+	if (Look(Lexer::IDENT) && Look(Lexer::LBRACKET, 1))
+	{
+		ArrayDeclaration(type);
+		return;
+	}
+
+	size_t token = mNextToken;
+	mCodeStack.push_back(CodeBuffer());
+	Ident(true, true, type);
+	CodeBuffer top = std::move(mCodeStack.back());
 	mCodeStack.pop_back();
 
+	// Variable without initializer isn't written at all (its value is undefined)
+	if (!Look(Lexer::ASSIGN))
+	{
+		return;
+	}
+
 	// Assignment on the right side is buffered
 	size_t deep = 0;
 	if (Look(Lexer::ASSIGN))
 	{
 		deep++;
-		mCodeStack.push_back(std::stringstream());
+		mCodeStack.push_back(CodeBuffer());
 
 		Match(Lexer::ASSIGN);
 		Assign();
+		if (mType != type)
+		{
+			Error("Initializer has different type", token);
+		}
+		mType = type;
 	}
 
-	std::vector<std::string> temp;
+	CodeBuffer temp;
 	while (deep > 0)
 	{
-		std::string tmp = mCodeStack[mCodeStack.size() - 1].str();
-		temp.insert(temp.begin(), tmp);
+		temp.Prepend(mCodeStack.back());
 		mCodeStack.pop_back();
 		deep--;
 	}
 
-	// Print out in last in first out way (LIFO)
-	for (const std::string& s : temp)
+	// Print out in last in first out way (LIFO), segments are just moved
+	mCodeStack.back().Append(temp);
+	mCodeStack.back().Append(top);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Array declaration
+// Rule '<array> ::= <type><ident>[<integer>] [<assign_op> {[<eq> [, <eq>]*]^}]^' (type is already matched)
+// Elements without initializer are set to 0 (all of them are undefined without initializer list)
+void Compiler::ArrayDeclaration(Type type)
+{
+	std::string name = GetIdent();
+	size_t token = mNextToken - 1;
+	Match(Lexer::LBRACKET);
+	std::string size = GetValue();
+	Match(Lexer::RBRACKET);
+
+	size_t count = 0;
+	if (size.empty() || size.length() > 6 || !std::all_of(size.begin(), size.end(), ::isdigit) || (count = (size_t)std::stoi(size)) == 0)
+	{
+		Error("Invalid array size", token + 2);
+		count = 1;
+	}
+
+	Variable variable;
+	variable.offset = DeclareVariable(name, type, token, count);
+	variable.count = count;
+	variable.global = false;
+	variable.type = type;
+
+	// Arrays of program outside of blocks live as long as program, so procedures can use them
+	if (!mInProcedure && mScopes.size() == 1)
+	{
+		mGlobals[name] = variable;
+	}
+
+	// Optimizer has to know which slots are elements (they're never held in registers)
+	Emit("array " + Address(variable, 0) + " " + std::to_string(count));
+
+	if (!Look(Lexer::ASSIGN))
+	{
+		return;
+	}
+
+	Match(Lexer::ASSIGN);
+	Match(Lexer::LBRACE);
+	size_t element = 0;
+	while (!Look(Lexer::RBRACE))
+	{
+		if (element > 0)
+		{
+			Match(Lexer::COMMA);
+		}
+
+		size_t initializer = mNextToken;
+		EqOp();
+		if (element == count)
+		{
+			Error("Too many initializers", initializer);
+		}
+		else if (mType != type)
+		{
+			Error("Initializer has different type", initializer);
+		}
+		else if (element < count)
+		{
+			Emit("mov.mem.reg.i32 " + Address(variable, element) + " r0 ");
+		}
+		element++;
+	}
+	Match(Lexer::RBRACE);
+
+	if (element < count)
+	{
+		Emit("mov.reg.i32 r0 0");
+		for (; element < count; element++)
+		{
+			Emit("mov.mem.reg.i32 " + Address(variable, element) + " r0 ");
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Return from procedure
+// Rule '<return> ::= return [<eq>]^'
+void Compiler::Return()
+{
+	Match(Lexer::RETURN);
+	if (!mInProcedure)
+	{
+		Error("Return outside of procedure", mNextToken - 1);
+	}
+	if (mInParallel)
+	{
+		Error("Return inside parallel loop", mNextToken - 1);
+	}
+
+	// Empty string has handle 0 too
+	if (Look(Lexer::PUNCT))
+	{
+		Emit("mov.reg.i32 r0 0");
+	}
+	else
+	{
+		size_t token = mNextToken;
+		EqOp();
+		if (mInProcedure && mType != mReturnType)
+		{
+			Error("Returned value has different type", token);
+		}
+	}
+
+	// Return removes whole frame (arguments and variables) from stack
+	Emit("ret");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Break out of switch
+// Rule '<break> ::= break'
+void Compiler::Break()
+{
+	Match(Lexer::BREAK);
+	if (mBreakLabels.empty() || mBreakLabels.back().empty())
 	{
-		mCodeStack[mCodeStack.size() - 1] << s;
+		Error("Break outside of switch", mNextToken - 1);
+		return;
 	}
 
-	mCodeStack[mCodeStack.size() - 1] << top;
+	Emit("jmp " + mBreakLabels.back());
 }
 
 //////////////////////////////////////////////////////////////////////////////
 // Expression
-// Rule '<expr> ::= <decl> | <assign>'
+// Rule '<expr> ::= <decl> | <return> | <break> | <assign>'
 void Compiler::Expression()
 {
 	// <decl> must begin with <type>
@@ -525,10 +1795,24 @@ void Compiler::Expression()
 		Declaration();
 		Match(Lexer::PUNCT);
 	}
-	else if (Look(Lexer::IF) || Look(Lexer::DO) || Look(Lexer::WHILE) || Look(Lexer::FOR))
+	else if (Look(Lexer::RETURN))
+	{
+		Return();
+		Match(Lexer::PUNCT);
+	}
+	else if (Look(Lexer::BREAK))
+	{
+		Break();
+		Match(Lexer::PUNCT);
+	}
+	else if (Look(Lexer::IF) || Look(Lexer::DO) || Look(Lexer::WHILE) || Look(Lexer::FOR) || Look(Lexer::SWITCH) || Look(Lexer::PARALLEL))
 	{
 		Control();
 	}
+	else if (Look(Lexer::CASE) || Look(Lexer::DEFAULT))
+	{
+		Expected("Case label outside of switch");
+	}
 	else
 	{
 		Assign();
@@ -542,51 +1826,378 @@ void Compiler::Expression()
 // Processes single command of the program
 void Compiler::Command()
 {
-	Expression();
+	// On syntax error, buffers of unfinished constructs are dropped and parsing continues after the statement
+	size_t start = mNextToken;
+	size_t buffers = mCodeStack.size();
+	size_t scopes = mScopes.size();
+	size_t breaks = mBreakLabels.size();
+	bool parallel = mInParallel;
+	size_t nesting = mNesting;
+	try
+	{
+		Expression();
+	}
+	catch (const SyntaxError&)
+	{
+		mCodeStack.resize(buffers);
+		mBreakLabels.resize(breaks);
+		mInParallel = parallel;
+		mNesting = nesting;
+		while (mScopes.size() > scopes)
+		{
+			CloseScope();
+		}
+		Synchronize();
+
+		// Error at the first token of statement (e.g. '}' or misplaced keyword) has to be skipped, so we
+		// don't get stuck on it
+		if (mNextToken == start)
+		{
+			mNextToken++;
+		}
+	}
 }
 
-// Build block
+// Build block (has its own scope)
 void Compiler::Block()
 {
+	// Block nested too deep is skipped whole by statement containing it
+	Enter();
 	Match(Lexer::LBRACE);
+	OpenScope();
 
-	while (!Look(Lexer::RBRACE))
+	while (Look() && !Look(Lexer::RBRACE))
 	{
 		Command();
 	}
 
+	CloseScope();
 	Match(Lexer::RBRACE);
+	Leave();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Procedure definition
+// Rule '<proc> ::= <type><ident>([<type><ident> [, <type><ident>]*]^) <block>'
+// Arguments are the first variables of procedure frame, procedure returns 0 unless it returns value
+void Compiler::Procedure()
+{
+	// Procedure has its own frame, variables of program aren't visible in it
+	std::vector<Scope> scopes = std::move(mScopes);
+	size_t stackOffset = mStackOffset;
+	size_t frameSize = mFrameSize;
+	size_t arraysEnd = mArraysEnd;
+	size_t buffers = mCodeStack.size();
+	size_t nesting = mNesting;
+	mScopes.clear();
+	mStackOffset = 0;
+	mFrameSize = 0;
+	mArraysEnd = 0;
+	mInProcedure = true;
+	mCodeStack.push_back(CodeBuffer());
+	OpenScope();
+
+	try
+	{
+		Signature signature;
+		signature.result = GetType();
+		std::string name = GetIdent();
+		size_t token = mNextToken - 1;
+		Match(Lexer::LPAREN);
+
+		while (!Look(Lexer::RPAREN))
+		{
+			if (mStackOffset > 0)
+			{
+				Match(Lexer::COMMA);
+			}
+			Type type = GetType();
+			std::string argument = GetIdent();
+			DeclareVariable(argument, type, mNextToken - 1);
+			signature.arguments.push_back(type);
+		}
+		Match(Lexer::RPAREN);
+		size_t arguments = mStackOffset / 4;
+
+		signature.globals = false;
+		signature.parallel = false;
+		signature.defined = !Look(Lexer::PUNCT);
+		signature.called = false;
+		signature.token = token;
+
+		auto it = mProcedures.find(name);
+		if (it != mProcedures.end())
+		{
+			if (it->second.arguments != signature.arguments || it->second.result != signature.result)
+			{
+				Error("Procedure doesn't match its declaration", token);
+			}
+			else if (it->second.defined && signature.defined)
+			{
+				Error("Procedure already defined", token);
+			}
+			signature.called = it->second.called;
+			signature.token = it->second.token;
+		}
+
+		// Declaration only makes procedure known
+		if (!signature.defined)
+		{
+			Match(Lexer::PUNCT);
+			if (it == mProcedures.end())
+			{
+				mProcedures[name] = signature;
+			}
+		}
+		else
+		{
+			// Procedure is known before its body, so it can call itself
+			mProcedures[name] = signature;
+			mProcedure = name;
+			mReturnType = signature.result;
+
+			Block();
+			Emit("mov.reg.i32 r0 0");
+			Emit("ret");
+
+			// Variables (everything above arguments) are reserved at once when procedure begins
+			CodeBuffer header;
+			header.Emit("proc P" + name + " " + std::to_string(arguments));
+			if (mFrameSize / 4 > arguments)
+			{
+				header.Emit("reserve " + std::to_string(mFrameSize / 4 - arguments));
+			}
+			mCodeStack.back().Prepend(header);
+
+			mProceduresCode.Append(mCodeStack.back());
+		}
+	}
+	catch (const SyntaxError&)
+	{
+		Synchronize();
+	}
+
+	mCodeStack.resize(buffers);
+	mNesting = nesting;
+	mScopes = std::move(scopes);
+	mStackOffset = stackOffset;
+	mFrameSize = frameSize;
+	mArraysEnd = arraysEnd;
+	mInProcedure = false;
 }
 
 // Build program
 void Compiler::Program()
 {
-	// Just loop through commands until end of token stream
+	// Just loop through procedures and commands until end of token stream
 	while (Look())
 	{
-		Command();
+		if (Look(Lexer::TYPE) && Look(Lexer::IDENT, 1) && Look(Lexer::LPAREN, 2))
+		{
+			Procedure();
+		}
+		else
+		{
+			mHasProgram = true;
+			Command();
+		}
+	}
+}
+
+// Properties of procedure including procedures it calls which are defined in unit, procedures which
+// aren't defined are added to external ones
+void Compiler::Summarize(const std::string& name, bool& globals, bool& parallel, std::set<std::string>& external,
+	std::set<std::string>& visited) const
+{
+	if (!visited.insert(name).second)
+	{
+		return;
+	}
+
+	auto it = mProcedures.find(name);
+	if (it == mProcedures.end() || !it->second.defined)
+	{
+		external.insert(name);
+		return;
+	}
+
+	globals = globals || it->second.globals;
+	parallel = parallel || it->second.parallel;
+	for (const std::string& p : it->second.pending)
+	{
+		Summarize(p, globals, parallel, external, visited);
+	}
+}
+
+// Check calls whose properties weren't known when they were compiled, report procedures which are
+// called but never defined (unless other units may define them)
+void Compiler::ResolveCalls()
+{
+	mExternalParallel.clear();
+	for (const auto& c : mParallelCalls)
+	{
+		bool globals = false;
+		bool parallel = false;
+		std::set<std::string> visited;
+		Summarize(c.first, globals, parallel, mExternalParallel, visited);
+
+		if (globals)
+		{
+			Error("Procedure called in parallel loop can't access arrays of program", c.second);
+		}
+		if (parallel)
+		{
+			Error("Parallel loops can't be nested", c.second);
+		}
+	}
+
+	for (const auto& p : mProcedures)
+	{
+		if (!mExternals && p.second.called && !p.second.defined)
+		{
+			Error("Procedure is declared but never defined", p.second.token);
+		}
 	}
 }
 
 // Construct from lexer, specify output file
-Compiler::Compiler(const Lexer& l, const std::string& output)
+Compiler::Compiler(const Lexer& l, const std::string& output) : Compiler(l)
+{
+	mAssembly.open(output, std::ios::out);
+}
+
+// Construct from lexer, assembly is kept in memory only
+Compiler::Compiler(const Lexer& l)
 {
 	mTokens = l.GetTokens();
 	mData = l.GetData();
 	mDebugInfo = l.GetDebugInfo();
-	mAssembly.open(output, std::ios::out);
+	mTokens.push_back(Lexer::END);
+	mData.push_back("");
+	mNextToken = 0;
+	mNesting = 0;
+	mStackOffset = 0;
+	mFrameSize = 0;
+	mArraysEnd = 0;
+	mLabelCount = 0;
+	mInProcedure = false;
+	mReturnType = TYPE_INT;
+	mExternals = false;
+	mHasProgram = false;
+	mInParallel = false;
+	mSum = 0;
+	mType = TYPE_INT;
+}
+
+// Allow procedures which are only declared to be defined by other units (unit is linked with them)
+void Compiler::AllowExternals(bool allow)
+{
+	mExternals = allow;
 }
 
-// Build
-void Compiler::Compile()
+// Build, returns false when any error was reported
+bool Compiler::Compile()
 {
 	mNextToken = 0;
-	mCodeStack.push_back(std::stringstream());
-	
-	Program();
+	mNesting = 0;
+	mStackOffset = 0;
+	mFrameSize = 0;
+	mArraysEnd = 0;
+	mLabelCount = 0;
+	mBreakLabels.clear();
+	mScopes.clear();
+	mGlobals.clear();
+	OpenScope();
+	mOutput.clear();
+	mDiagnostics.clear();
+	mCodeStack.clear();
+	mCodeStack.push_back(CodeBuffer());
+	mProcedures.clear();
+	mProceduresCode = CodeBuffer();
+	mInProcedure = false;
+	mProcedure.clear();
+	mReturnType = TYPE_INT;
+	mHasProgram = false;
+	mInParallel = false;
+	mParallelCalls.clear();
+	mExternalParallel.clear();
+	mSum = 0;
+	mType = TYPE_INT;
+	mStrings.clear();
+	mStringPool.clear();
+	Intern("");
+
+	try
+	{
+		Program();
+		ResolveCalls();
+	}
+	catch (const TooManyErrors&)
+	{
+		mCodeStack.resize(1);
+	}
+
+	// Variables of program are reserved at once when it begins, interned strings (except empty one,
+	// which is always there) precede it
+	CodeBuffer header;
+	for (const auto& s : mStringPool)
+	{
+		if (s.first != 0)
+		{
+			header.Emit("string " + std::to_string(s.first) + " \"" + s.second + "\"");
+		}
+	}
+	if (mFrameSize > 0)
+	{
+		header.Emit("reserve " + std::to_string(mFrameSize / 4));
+	}
+	mCodeStack.back().Prepend(header);
+
+	// Program ends before the first procedure
+	if (!mProceduresCode.Empty())
+	{
+		mCodeStack.back().Emit("halt");
+		mCodeStack.back().Append(mProceduresCode);
+	}
 
-	mAssembly << mCodeStack[mCodeStack.size() - 1].rdbuf();
+	const std::list<std::string>& code = mCodeStack.back().GetSegments();
+	mOutput.assign(code.begin(), code.end());
+	if (mAssembly.is_open())
+	{
+		mCodeStack.back().Write(mAssembly);
+		mAssembly.close();
+	}
 	mCodeStack.pop_back();
-	
-	mAssembly.close();
+
+	return mDiagnostics.empty();
+}
+
+// Store properties of unit and of its procedures into object (code and tables come from disassembler)
+void Compiler::Export(ObjectFile& object) const
+{
+	object.program = mHasProgram;
+
+	// Procedures of other units are resolved by linker, which knows their properties (labels are 'P<name>')
+	for (ObjectFile::Symbol& symbol : object.symbols)
+	{
+		bool globals = false;
+		bool parallel = false;
+		std::set<std::string> external;
+		std::set<std::string> visited;
+		Summarize(symbol.label.substr(1), globals, parallel, external, visited);
+
+		symbol.globals = globals;
+		symbol.parallel = parallel;
+		symbol.calls.clear();
+		for (const std::string& e : external)
+		{
+			symbol.calls.push_back("P" + e);
+		}
+	}
+
+	object.parallelCalls.clear();
+	for (const std::string& e : mExternalParallel)
+	{
+		object.parallelCalls.push_back("P" + e);
+	}
 }
\ No newline at end of file
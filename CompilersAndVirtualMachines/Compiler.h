@@ -13,6 +13,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <algorithm>
 #include <sstream>
 #include <fstream>
 #include <iostream>
@@ -21,38 +23,220 @@
 //#include <boost/tokenizer.hpp>
 #include <iostream>
 #include "Lexer.h"
+#include "CodeBuffer.h"
+#include "Diagnostic.h"
+#include "ObjectFile.h"
 
 class Compiler
 {
 private:
 	std::string mDebug;						// Debug info
-	std::vector<Lexer::Token> mTokens;		// Tokens from Lexer
+	std::vector<Lexer::Token> mTokens;		// Tokens from Lexer (followed by end sentinel)
 	std::vector<std::string> mData;			// Data from Lexer (string behind tokens)
 	std::map<size_t, LineInfo> mDebugInfo;	// Debuginfo map (for each line)
 	std::ofstream mAssembly;				// Assembly output stream
 	size_t mNextToken;						// Token counter (where we are)
+	size_t mNesting;						// Nesting of blocks and recursively parsed expressions
 
-	size_t mStackOffset;						// Stack offset due to variables
-	std::map<std::string, size_t> mVariables;	// Maps string names to stack pointer offset
-	std::vector<std::stringstream> mCodeStack;	// Allows us to for right-to-left (buffers for generated assembly)
+	// Types of values (string value is handle of interned string, so it fits into register too)
+	enum Type
+	{
+		TYPE_INT,
+		TYPE_STRING
+	};
+
+	// Variable (or array) in stack frame
+	struct Variable
+	{
+		size_t offset;								// Stack pointer offset (of the first element)
+		size_t count;								// Number of elements (0 for scalar variable)
+		bool global;								// Array of program addressed from procedure (relative to gp)
+		Type type;									// Type of variable (of its elements for array)
+	};
+
+	// Procedure signature
+	struct Signature
+	{
+		std::vector<Type> arguments;				// Types of arguments
+		Type result;								// Type of returned value
+		bool globals;								// Accesses arrays of program (directly or through calls)
+		bool parallel;								// Contains parallel loop (directly or through calls)
+		bool defined;								// Body was compiled (otherwise procedure is only declared)
+		bool called;								// Procedure is called
+		size_t token;								// Token of name in the first declaration
+		std::set<std::string> pending;				// Procedures called (directly or through calls) which weren't defined
+													// at that point, their properties aren't included yet
+	};
+
+	// Array of outer scope accessed in body of parallel loop
+	struct SharedArray
+	{
+		size_t count;								// Number of elements
+		bool written;								// Element of array is assigned
+		size_t other;								// The first access by index other than counter (0 if there is none)
+	};
+
+	// Binary operator of expression (all of them are left associative)
+	struct Operator
+	{
+		int precedence;								// Higher binds tighter (0 for tokens which aren't operators)
+		bool integer;								// Operands have to be integers (otherwise of the same type)
+		const char* code[2];						// Instructions combining left operand (r1) with right one (r0)
+	};
+
+	// Operator waiting for its right operand, or open parenthesis (explicit stack of expression parser)
+	struct PendingOperator
+	{
+		const Operator* op;							// Operator (nullptr for parenthesis)
+		size_t token;								// Token of operator
+		Type type;									// Type of left operand
+	};
+
+	// Parallel loop being compiled, its iterations have to be independent
+	struct Parallel
+	{
+		size_t scopes;								// Number of scopes outside of body (variables of deeper ones are private)
+		std::string counter;						// Address of counter
+		std::vector<std::string> sums;				// Addresses of sums computed by loop
+		std::map<std::string, SharedArray> arrays;	// Arrays of outer scopes accessed in body (by address)
+	};
+
+	// Lexical scope, its variables are released when it ends (so sibling scopes share stack slots)
+	struct Scope
+	{
+		std::map<std::string, Variable> variables;	// Maps string names to variables
+		size_t base;								// Stack offset at the beginning of scope
+	};
+
+	size_t mStackOffset;						// Stack offset of next variable
+	size_t mFrameSize;							// Size of frame (most variables alive at once), reserved at once
+	size_t mArraysEnd;							// End of the last array in frame (slots of arrays aren't shared)
+	std::vector<Scope> mScopes;					// Open scopes (innermost is the last one)
+	std::map<std::string, Variable> mGlobals;	// Arrays declared by program outside of blocks (visible in procedures)
+	std::vector<CodeBuffer> mCodeStack;		// Allows us to for right-to-left (buffers for generated assembly)
+
+	std::map<std::string, Signature> mProcedures;	// Maps procedure names to their signatures
+	CodeBuffer mProceduresCode;				// Code of all procedures (placed after the program)
+	bool mInProcedure;						// Are we compiling body of procedure
+	std::string mProcedure;					// Name of procedure being compiled
+	Type mReturnType;						// Type returned by procedure being compiled
+	bool mExternals;						// Procedures may be defined by other units (linked later)
+	bool mHasProgram;						// Program has any command (unit isn't just procedures)
+
+	bool mInParallel;						// Are we compiling body of parallel loop
+	Parallel mParallel;						// Parallel loop being compiled
+	size_t mSum;							// Token of sum assigned by current statement of parallel loop
+	std::vector<std::pair<std::string, size_t> > mParallelCalls;	// Calls in parallel loops whose properties weren't
+																	// known yet (procedure and token of call)
+	std::set<std::string> mExternalParallel;	// Procedures of other units called in parallel loops
+
+	Type mType;								// Type of value of the last compiled expression (in r0)
+	std::map<std::string, int> mStrings;	// Handles of interned string literals (empty string is always 0)
+	std::map<int, std::string> mStringPool;	// Interned strings (by handle)
 
 	unsigned int mLabelCount;				// Label Counter (to allow for unique labels)
+	std::vector<std::string> mBreakLabels;	// Targets of break statement (innermost last, empty where break isn't allowed)
+
+	std::vector<std::string> mOutput;		// Generated assembly
+	std::vector<Diagnostic> mDiagnostics;	// Reported errors
+
+	enum
+	{
+		MAX_ERRORS = 32,					// Compilation stops after this many errors
+		MIN_TABLE_CASES = 4,				// Minimum number of cases dispatched through jump table
+		TABLE_DENSITY = 2,					// Maximum number of jump table entries per case (rest jumps to default)
+		MAX_LINEAR_CASES = 3,				// Cases tested one by one at leaves of decision tree
+		MAX_NESTING = 4096					// Maximum nesting of blocks and of expressions in calls, indexes and
+											// parenthesized assignments (they're parsed recursively, the deepest
+											// nesting needs a few MB of stack, project reserves 16 MB)
+	};
+
+	// Thrown by syntax error, caught by command which resynchronizes at the end of statement
+	struct SyntaxError
+	{
+	};
 
-	// Error function
+	// Thrown when too many errors were reported, stops compilation
+	struct TooManyErrors
+	{
+	};
+
+	// Report error at given token and continue
+	void Error(const std::string& error, size_t token);
+
+	// Report syntax error, parsing continues with next statement
 	void Expected(const std::string& error);
 
+	// Skip tokens up to end of statement (';' which is consumed, or '}' or keyword beginning next statement
+	// which aren't), nested blocks are skipped whole
+	void Synchronize();
+
+	// Enter nested construct (block or expression), reports syntax error when it's nested too deep
+	void Enter();
+
+	// Leave nested construct
+	void Leave();
+
 	// Returns false in case we read whole input, otherwise true
 	bool Look();
 
 	// Look whether next token is the token we want
 	bool Look(Lexer::Token t);
 
+	// Look whether token at given distance after the next one is the token we want
+	bool Look(Lexer::Token t, size_t ahead);
+
 	// Match current token
 	void Match(Lexer::Token t);
 
 	// Get value
 	std::string GetValue();
 
+	// Match type, returns it
+	Type GetType();
+
+	// Report error at given token when value of the last compiled expression isn't integer
+	void RequireInteger(size_t token);
+
+	// Handle of interned string (equal strings always get the same handle)
+	int Intern(const std::string& text);
+
+	// Load handle of interned string into register, handles of relocatable unit are rewritten by linker
+	// (so they're loaded by instruction linker knows about and never used as constants)
+	void LoadString(int handle, const std::string& reg);
+
+	// Integer value of literal - string literal is interned (its handle is the value), character literal
+	// is its code. Returns false when value isn't integer, character or string literal
+	bool Literal(const std::string& value, int& result, Type& type);
+
+	// Open new scope
+	void OpenScope();
+
+	// Close innermost scope, its stack slots can be used by following variables
+	void CloseScope();
+
+	// Declare variable (array when count isn't 0) in innermost scope (token is used for error reporting),
+	// returns its stack offset
+	size_t DeclareVariable(const std::string& name, Type type, size_t token, size_t count = 0);
+
+	// Find variable in open scopes (innermost first), procedure finds arrays of program too. Returns false
+	// when it isn't declared
+	bool FindVariable(const std::string& name, Variable& variable) const;
+
+	// Address of element of variable
+	std::string Address(const Variable& variable, size_t element) const;
+
+	// Check whether statement starting at token at given distance after the current one assigns into
+	// variable or array element
+	bool IsAssignment(size_t ahead = 0);
+
+	// Check whether variable is declared in body of parallel loop being compiled (innermost declaration)
+	bool IsPrivate(const std::string& name) const;
+
+	// Check whether assignment starting at current token adds to sum of parallel loop 's = s + <add>',
+	// added expression doesn't use the sum and has no comparison at its top level
+	bool IsSum();
+
 	//////////////////////////////////////////////////////////////////////////////
 	// Identifier
 	// Rule '<ident> ::= [A..z _][A..z 0..1 _]*'
@@ -60,65 +244,131 @@ private:
 
 	//////////////////////////////////////////////////////////////////////////////
 	// Integer
-	// Rule '<integer> ::= [0..9]+'
+	// Rule '<integer> ::= [0..9]+ | '<char>' | "<string>"'
+	// String literal is loaded as handle of interned string, character literal as its code
 	void Integer();
 
 	//////////////////////////////////////////////////////////////////////////////
 	// Identifier
 	// Rule '<ident> ::= [A..z _][A..z 0..1 _]*'
-	// Param 'declare' specifies whether we declare the identifier or not
-	void Ident(bool declare, bool lvalue);
+	// Param 'declare' specifies whether we declare the identifier (of given type) or not
+	void Ident(bool declare, bool lvalue, Type type = TYPE_INT);
 
 	//////////////////////////////////////////////////////////////////////////////
-	// Factor
-	// Rule '<factor> ::= (<expr>) | <ident> | <integer>'
-	void Factor();
+	// Array element
+	// Rule '<element> ::= <ident>[<eq>]' (identifier is already matched)
+	// Element is read into r0, or value in r0 is written into it. Index is checked against array
+	// bounds - constant one at compile time, others at runtime
+	void Element(const Variable& variable, bool lvalue);
 
 	//////////////////////////////////////////////////////////////////////////////
-	// Term 
-	// Rule '<mul> ::= <factor> [<mul_op> <factor>]*'
-	void MulOp();
+	// Procedure call
+	// Rule '<call> ::= <ident>(<eq> [, <eq>]*)'
+	// Arguments are pushed on stack in order, result is in r0
+	void Call();
 
 	//////////////////////////////////////////////////////////////////////////////
-	// Sub-Expression (numerical - addition and subtraction ops)
-	// Rule '<add> ::= <mul> [<mul_op> <mul>]*'
-	void AddOp();
+	// Factor
+	// Rule '<factor> ::= (<assign>) | (<eq>) | <call> | <element> | <ident> | <integer>'
+	// Parentheses which don't enclose assignment are handled by expression itself
+	void Factor();
 
-	//////////////////////////////////////////////////////////////////////////////
-	// Sub-Expression (numerical - addition and subtraction ops)
-	// Rule '<cmp> ::= <add> [<cmp_op> <add>]*'
-	void CompareOp();
+	// Operator of token
+	static const Operator& GetOperator(Lexer::Token t);
+
+	// Combine left operand (on stack) of pending operator with right one (in r0)
+	void Reduce(const PendingOperator& pending);
 
 	//////////////////////////////////////////////////////////////////////////////
-	// Sub-Expression (numerical - addition and subtraction ops)
+	// Expression (precedence climbing driven by table of operators)
 	// Rule '<eq> ::= <cmp> [<eq_op> <cmp>]*'
+	// Rule '<cmp> ::= <add> [<cmp_op> <add>]*'
+	// Rule '<add> ::= <mul> [<add_op> <mul>]*'
+	// Rule '<mul> ::= <factor> [<mul_op> <factor>]*'
+	// Left operand is pushed on stack while right one is computed. Operators waiting for right operand
+	// and open parentheses are kept on explicit stack, so nesting of parentheses isn't limited
 	void EqOp();
 
 	// Generate new unique label
 	std::string NewLabel();
 
+	// Emit single line of assembly into current code buffer
+	void Emit(const std::string& line);
+
 	// Post label into code
 	void PostLabel(const std::string& label);
 
+	// Condition of control statement, jumps to label when condition result is equal to jumpIf
+	// (comparison at the root of condition is fused with the jump)
+	void Condition(const std::string& label, bool jumpIf);
+
+	// Check whether for loop condition and step (starting at current token) describe counted loop -
+	// variable compared with constant or variable and stepped by constant. Returns loop instruction
+	// stepping the variable and jumping to label while condition holds
+	bool CountedLoop(const std::string& label, std::string& instruction);
+
+	// Case value (integer, optionally negative, or literal of switch type)
+	int CaseValue(Type type);
+
+	// Jump to label of case with value in r0 (cases are sorted by value), otherwise to given label. Dense
+	// cases use jump table, sparse ones binary decision tree (which uses tables for its dense parts)
+	void Dispatch(const std::vector<std::pair<int, std::string> >& cases, size_t first, size_t last, const std::string& otherwise);
+
+	// Jump to label of case with handle of string in r0, otherwise to given label. Linker changes handles
+	// of relocatable unit (their order isn't known), so they're compared one by one
+	void DispatchStrings(const std::vector<std::pair<int, std::string> >& cases, const std::string& otherwise);
+
 	void ControlIf();
 	void ControlDo();
 	void ControlWhile();
 	void ControlFor();
+
+	//////////////////////////////////////////////////////////////////////////////
+	// Parallel loop
+	// Rule '<parallel> ::= parallel [(<ident> [, <ident>]*)]^ for(<type><ident> = <eq>; <ident> < <eq>; <ident> = <ident> + 1) <block>'
+	// Iterations run on worker threads, so they have to be independent - body assigns only its own
+	// variables, elements of arrays indexed by counter (which aren't accessed by other index) and sums
+	// listed after parallel. Procedures called in body can't access arrays of program
+	void ControlParallel();
+
+	//////////////////////////////////////////////////////////////////////////////
+	// Switch
+	// Rule '<switch> ::= switch(<eq>) { [case <integer>: | default: | <command>]* }'
+	// Cases fall through into following ones, break jumps past the end of switch
+	void ControlSwitch();
 	void Control();
 
 	//////////////////////////////////////////////////////////////////////////////
 	// Assignment
 	// Rule '<assign> ::= <ident> [<assign_op> <ident>]* [<assign_op> <sub>]^ | <sub>'
+	// Assigned identifier may be an array element
 	void Assign();
 	
 	//////////////////////////////////////////////////////////////////////////////
 	// Variable declaration
-	// Rule '<decl> ::= <type><ident> [<assign_op> <assign>]^'
+	// Rule '<decl> ::= <type><ident> [<assign_op> <assign>]^ | <array>'
 	void Declaration();
+
+	//////////////////////////////////////////////////////////////////////////////
+	// Array declaration
+	// Rule '<array> ::= <type><ident>[<integer>] [<assign_op> {[<eq> [, <eq>]*]^}]^' (type is already matched)
+	// Elements without initializer are set to 0 (empty string for string array, all of them are undefined
+	// without initializer list)
+	void ArrayDeclaration(Type type);
 	
+	//////////////////////////////////////////////////////////////////////////////
+	// Return from procedure
+	// Rule '<return> ::= return [<eq>]^'
+	void Return();
+
+	//////////////////////////////////////////////////////////////////////////////
+	// Break out of switch
+	// Rule '<break> ::= break'
+	void Break();
+
 	//////////////////////////////////////////////////////////////////////////////
 	// Expression
-	// Rule '<expr> ::= <decl><punct> | <assign><punct>'
+	// Rule '<expr> ::= <decl><punct> | <return><punct> | <assign><punct>'
 	void Expression();
 
 	//////////////////////////////////////////////////////////////////////////////
@@ -127,9 +377,25 @@ private:
 	// Processes single command of the program
 	void Command();
 
-	// Block
+	// Block (has its own scope)
 	void Block();
 
+	//////////////////////////////////////////////////////////////////////////////
+	// Procedure definition
+	// Rule '<proc> ::= <type><ident>([<type><ident> [, <type><ident>]*]^) [<block> | <punct>]'
+	// Arguments are the first variables of procedure frame, procedure returns 0 unless it returns value.
+	// Declaration without body allows calling procedure before its definition (or defined by other unit)
+	void Procedure();
+
+	// Properties of procedure including procedures it calls which are defined in unit, procedures which
+	// aren't defined are added to external ones
+	void Summarize(const std::string& name, bool& globals, bool& parallel, std::set<std::string>& external,
+		std::set<std::string>& visited) const;
+
+	// Check calls whose properties weren't known when they were compiled, report procedures which are
+	// called but never defined (unless other units may define them)
+	void ResolveCalls();
+
 	// Program
 	void Program();
 
@@ -137,8 +403,41 @@ public:
 	// Construct from lexer, specify output file
 	Compiler(const Lexer& l, const std::string& output);
 
-	// Build
-	void Compile();
+	// Construct from lexer, assembly is kept in memory only
+	Compiler(const Lexer& l);
+
+	// Allow procedures which are only declared to be defined by other units (unit is linked with them)
+	void AllowExternals(bool allow);
+
+	// Build, returns false when any error was reported
+	bool Compile();
+
+	// Store properties of unit and of its procedures into object (code and tables come from disassembler)
+	void Export(ObjectFile& object) const;
+
+	// Precedence of binary operator token, higher binds tighter (0 for tokens which aren't operators)
+	static int GetPrecedence(Lexer::Token t)
+	{
+		return GetOperator(t).precedence;
+	}
+
+	// Get generated assembly (line by line)
+	const std::vector<std::string>& GetAssembly() const
+	{
+		return mOutput;
+	}
+
+	// Get reported errors
+	const std::vector<Diagnostic>& GetDiagnostics() const
+	{
+		return mDiagnostics;
+	}
+
+	// Get interned strings (by handle)
+	const std::map<int, std::string>& GetStrings() const
+	{
+		return mStringPool;
+	}
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,89 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DIAGNOSTIC_H__
+#define __DIAGNOSTIC_H__
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+// Single message reported during compilation (instead of terminating the process, all stages
+// collect their messages so caller decides what to do with them)
+class Diagnostic
+{
+public:
+	// Severity of message
+	enum Severity
+	{
+		SEVERITY_WARNING,		// Compilation continues, result is usable
+		SEVERITY_ERROR			// Result of compilation is not usable
+	};
+
+private:
+	Severity mSeverity;			// Severity of message
+	std::string mMessage;		// Message text
+	std::string mFilename;		// File in which message originates (empty when unknown)
+	size_t mLine;				// Line in that file
+
+public:
+	// Constructor from severity, message and location
+	Diagnostic(Severity severity, const std::string& message, const std::string& filename, size_t line)
+	{
+		mSeverity = severity;
+		mMessage = message;
+		mFilename = filename;
+		mLine = line;
+	}
+
+	Severity GetSeverity() const
+	{
+		return mSeverity;
+	}
+
+	const std::string& GetText() const
+	{
+		return mMessage;
+	}
+
+	const std::string& GetFilename() const
+	{
+		return mFilename;
+	}
+
+	size_t GetLine() const
+	{
+		return mLine;
+	}
+
+	// Print message in the same format as it was printed by compiler itself
+	void Print(std::ostream& os) const
+	{
+		os << (mSeverity == SEVERITY_ERROR ? "Error: " : "Warning: ") << mMessage << std::endl;
+		if (!mFilename.empty())
+		{
+			os << "At line " << mLine << " in file " << mFilename << std::endl;
+		}
+	}
+
+	// Check whether any of messages is an error
+	static bool HasErrors(const std::vector<Diagnostic>& diagnostics)
+	{
+		for (const Diagnostic& d : diagnostics)
+		{
+			if (d.mSeverity == SEVERITY_ERROR)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+#endif
\ No newline at end of file
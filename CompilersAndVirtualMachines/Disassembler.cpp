@@ -8,31 +8,116 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "Disassembler.h"
+#include "ScriptCompiler.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 
 // Build opcodes database
-void Disassembler::BuildOpcodes()
+std::map<std::string, int> Disassembler::BuildOpcodes()
 {
+	std::map<std::string, int> opcodes;
+
 	// Pairs string to opcode
-	mOpcodes["add.i32"] = ADD_I32;
-	mOpcodes["sub.i32"] = SUB_I32;
-	mOpcodes["mul.i32"] = MUL_I32;
-	mOpcodes["div.i32"] = DIV_I32;
-	mOpcodes["push.i32"] = PUSH_I32;
-	mOpcodes["pop.i32"] = POP_I32;
-	mOpcodes["mov.reg.i32"] = MOV_REG_I32;
-	mOpcodes["mov.reg.reg"] = MOV_REG_REG;
-	mOpcodes["neg.i32"] = NEG_I32;
-	mOpcodes["mov.mem.reg.i32"] = MOV_MEM_REG_I32;
-	mOpcodes["mov.reg.mem.i32"] = MOV_REG_MEM_I32;
-	mOpcodes["cmpleq.i32"] = CMPLEQ_I32;
-	mOpcodes["cmpgeq.i32"] = CMPGEQ_I32;
-	mOpcodes["cmpless.i32"] = CMPLESS_I32;
-	mOpcodes["cmpgreater.i32"] = CMPGREATER_I32;
-	mOpcodes["cmpeq.i32"] = CMPEQ_I32;
-	mOpcodes["cmpneq.i32"] = CMPNEQ_I32;
-	mOpcodes["jmp"] = JMP;
-	mOpcodes["jz"] = JZ;
-	mOpcodes["jnz"] = JNZ;
+	opcodes["add.i32"] = ADD_I32;
+	opcodes["sub.i32"] = SUB_I32;
+	opcodes["mul.i32"] = MUL_I32;
+	opcodes["div.i32"] = DIV_I32;
+	opcodes["push.i32"] = PUSH_I32;
+	opcodes["pop.i32"] = POP_I32;
+	opcodes["mov.reg.i32"] = MOV_REG_I32;
+	opcodes["mov.reg.str"] = MOV_REG_I32;	// Handle of interned string (rewritten by linker in relocatable code)
+	opcodes["mov.reg.reg"] = MOV_REG_REG;
+	opcodes["neg.i32"] = NEG_I32;
+	opcodes["mov.mem.reg.i32"] = MOV_MEM_REG_I32;
+	opcodes["mov.reg.mem.i32"] = MOV_REG_MEM_I32;
+	opcodes["cmpleq.i32"] = CMPLEQ_I32;
+	opcodes["cmpgeq.i32"] = CMPGEQ_I32;
+	opcodes["cmpless.i32"] = CMPLESS_I32;
+	opcodes["cmpgreater.i32"] = CMPGREATER_I32;
+	opcodes["cmpeq.i32"] = CMPEQ_I32;
+	opcodes["cmpneq.i32"] = CMPNEQ_I32;
+	opcodes["jmp"] = JMP;
+	opcodes["jz"] = JZ;
+	opcodes["jnz"] = JNZ;
+	opcodes["shl.i32"] = SHL_I32;
+	opcodes["shr.i32"] = SHR_I32;
+	opcodes["sar.i32"] = SAR_I32;
+	opcodes["and.i32"] = AND_I32;
+	opcodes["or.i32"] = OR_I32;
+	opcodes["xor.i32"] = XOR_I32;
+	opcodes["mulhi.i32"] = MULHI_I32;
+	opcodes["jlt.reg.reg"] = JLT_REG_REG;
+	opcodes["jle.reg.reg"] = JLE_REG_REG;
+	opcodes["jgt.reg.reg"] = JGT_REG_REG;
+	opcodes["jge.reg.reg"] = JGE_REG_REG;
+	opcodes["jeq.reg.reg"] = JEQ_REG_REG;
+	opcodes["jne.reg.reg"] = JNE_REG_REG;
+	opcodes["jlt.reg.i32"] = JLT_REG_I32;
+	opcodes["jle.reg.i32"] = JLE_REG_I32;
+	opcodes["jgt.reg.i32"] = JGT_REG_I32;
+	opcodes["jge.reg.i32"] = JGE_REG_I32;
+	opcodes["jeq.reg.i32"] = JEQ_REG_I32;
+	opcodes["jne.reg.i32"] = JNE_REG_I32;
+	opcodes["loop.lt.i32"] = LOOP_LT_I32;
+	opcodes["loop.le.i32"] = LOOP_LE_I32;
+	opcodes["loop.gt.i32"] = LOOP_GT_I32;
+	opcodes["loop.ge.i32"] = LOOP_GE_I32;
+	opcodes["loop.eq.i32"] = LOOP_EQ_I32;
+	opcodes["loop.ne.i32"] = LOOP_NE_I32;
+	opcodes["loop.lt.mem"] = LOOP_LT_MEM;
+	opcodes["loop.le.mem"] = LOOP_LE_MEM;
+	opcodes["loop.gt.mem"] = LOOP_GT_MEM;
+	opcodes["loop.ge.mem"] = LOOP_GE_MEM;
+	opcodes["loop.eq.mem"] = LOOP_EQ_MEM;
+	opcodes["loop.ne.mem"] = LOOP_NE_MEM;
+	opcodes["call"] = CALL;
+	opcodes["ret"] = RET;
+	opcodes["halt"] = HALT;
+	opcodes["reserve"] = RESERVE;
+	opcodes["release"] = RELEASE;
+	opcodes["jmp.table"] = JMP_TABLE;
+	opcodes["pfor"] = PFOR;
+	opcodes["pend"] = PEND;
+	opcodes["select.i32"] = SELECT_I32;
+	opcodes["mov.reg.idx.i32"] = MOV_REG_IDX_I32;
+	opcodes["mov.idx.reg.i32"] = MOV_IDX_REG_I32;
+	opcodes["mov.reg.idx.nc.i32"] = MOV_REG_IDX_NC_I32;
+	opcodes["mov.idx.reg.nc.i32"] = MOV_IDX_REG_NC_I32;
+
+	// Vector instructions exist for both widths
+	static const char* vector[] =
+	{
+		"vload", "vstore", "vsplat", "vseq", "vadd", "vsub", "vmul",
+		"vcmpleq", "vcmpgeq", "vcmpless", "vcmpgreater", "vcmpeq", "vcmpneq", "vsum"
+	};
+	for (int i = 0; i <= VSUM_I32X4 - VLOAD_I32X4; i++)
+	{
+		opcodes[std::string(vector[i]) + ".i32x4"] = VLOAD_I32X4 + i;
+		opcodes[std::string(vector[i]) + ".i32x8"] = VLOAD_I32X8 + i;
+	}
+
+	return opcodes;
+}
+
+// Get opcodes database (shared by all instances, built only once)
+const std::map<std::string, int>& Disassembler::GetOpcodes()
+{
+	static const std::map<std::string, int> opcodes = BuildOpcodes();
+	return opcodes;
+}
+
+// Get opcode of instruction
+int Disassembler::GetOpcode(const std::string& name)
+{
+	auto it = mOpcodes.find(name);
+	if (it == mOpcodes.end())
+	{
+		return ADD_I32;
+	}
+	return it->second;
 }
 
 // Get register ID from string
@@ -54,10 +139,25 @@ int Disassembler::GetRegister(const std::string& reg)
 	{
 		return 3;
 	}
+	else if (reg == "gp")
+	{
+		return 4;
+	}
 
 	return -1;
 }
 
+// Get vector register ID from string (-1 when it isn't vector register)
+int Disassembler::GetVectorRegister(const std::string& reg)
+{
+	if (reg.length() != 2 || reg[0] != 'v' || reg[1] < '0' || reg[1] >= '0' + VECTOR_REGISTERS)
+	{
+		return -1;
+	}
+
+	return reg[1] - '0';
+}
+
 // Parse address
 int Disassembler::ParseAddress(const std::string& token, int& reg, int& offset)
 {
@@ -87,14 +187,18 @@ int Disassembler::ParseAddress(const std::string& token, int& reg, int& offset)
 		offset = -offset;
 	}
 
-	offset += mOffset;
+	// Only stack pointer moves with pushes (gp always points to the beginning of program frame)
+	if (reg != GetRegister("gp"))
+	{
+		offset += mOffset;
+	}
 
 	return 0;
 }
 
 int Disassembler::GetLabel(const std::string& name)
 {
-	std::cout << "GET LABEL " << name;
+	(*mLog) << "GET LABEL " << name;
 
 	auto it = mLabels.find(name);
 	if (it == mLabels.end())
@@ -104,13 +208,13 @@ int Disassembler::GetLabel(const std::string& name)
 		mLabels.insert(std::pair<std::string, int>(name, labelId));
 		mLabelOffset.insert(std::pair<int, int>(labelId, -1));
 
-		std::cout << " resolved to (" << labelId << ")" << std::endl;
+		(*mLog) << " resolved to (" << labelId << ")" << std::endl;
 
 		return labelId;
 	}
 	else
 	{
-		std::cout << " resolved to (" << mLabels[name] << ")" << std::endl;
+		(*mLog) << " resolved to (" << mLabels[name] << ")" << std::endl;
 
 		return mLabels[name];
 	}
@@ -118,7 +222,7 @@ int Disassembler::GetLabel(const std::string& name)
 
 int Disassembler::GetLabelOffset(int labelID)
 {
-	std::cout << "\tLABEL (" << labelID << ") at " << (mLabelOffset[labelID] / 4) << std::endl;
+	(*mLog) << "\tLABEL (" << labelID << ") at " << (mLabelOffset[labelID] / 4) << std::endl;
 	return mLabelOffset[labelID];
 }
 
@@ -127,12 +231,45 @@ void Disassembler::StoreLabel(const std::string& name, int position)
 	int labelId = GetLabel(name);
 	mLabelOffset[labelId] = position;
 
-	std::cout << "LABEL (" << labelId << ") " << name << " at " << (position / 4) << std::endl;
+	(*mLog) << "LABEL (" << labelId << ") " << name << " at " << (position / 4) << std::endl;
+}
+
+// Replace label at given position with its offset, position is recorded for relocation (or as reference
+// when label isn't defined) in relocatable code
+void Disassembler::Fixup(size_t position)
+{
+	int label = mCode[position];
+	mCode[position] = GetLabelOffset(label);
+	if (!mRelocatable)
+	{
+		return;
+	}
+
+	if (mCode[position] >= 0)
+	{
+		mRelocations.push_back(position);
+		return;
+	}
+
+	// Procedure of other unit, linker writes its offset
+	for (const auto& l : mLabels)
+	{
+		if (l.second == label)
+		{
+			ObjectFile::Reference reference;
+			reference.label = l.first;
+			reference.position = position;
+			mReferences.push_back(reference);
+			break;
+		}
+	}
+	mCode[position] = 0;
 }
 
 void Disassembler::ResolveLabels()
 {
-	rewind(mOutput);
+	// Code begins after constant pool
+	size_t position = mPoolSize;
 
 	// Line by line disassembly
 	for (auto l : mAssembly)
@@ -146,13 +283,17 @@ void Disassembler::ResolveLabels()
 			StringUtil::trim(s);
 		}
 
+		// Labels (and array declarations and strings) don't produce any code
+		if (t[0][t[0].length() - 1] == ':' || t[0] == "proc" || t[0] == "array" || t[0] == "string")
+		{
+			continue;
+		}
+
 		// Write opcode
-		int opcode = mOpcodes[t[0]];
-		fseek(mOutput, sizeof(int) * 1, SEEK_CUR);
+		int opcode = GetOpcode(t[0]);
+		position += 1;
 
 		// Write argument(s)
-		int temp[2] = { 0, 0 };
-		size_t offset = 0;
 		switch (opcode)
 		{
 		case ADD_I32:
@@ -166,45 +307,178 @@ void Disassembler::ResolveLabels()
 		case CMPGREATER_I32:
 		case CMPEQ_I32:
 		case CMPNEQ_I32:
-			fseek(mOutput, sizeof(int) * 2, SEEK_CUR);
+		case SHL_I32:
+		case SHR_I32:
+		case SAR_I32:
+		case AND_I32:
+		case OR_I32:
+		case XOR_I32:
+		case MULHI_I32:
+			position += 2;
 			break;
 
 		case PUSH_I32:
-			fseek(mOutput, sizeof(int) * 1, SEEK_CUR);
+			position += 1;
 			break;
 
 		case POP_I32:
-			fseek(mOutput, sizeof(int) * 1, SEEK_CUR);
+			position += 1;
 			break;
 
 		case NEG_I32:
-			fseek(mOutput, sizeof(int) * 1, SEEK_CUR);
+			position += 1;
 			break;
 
 		case MOV_REG_I32:
-			fseek(mOutput, sizeof(int) * 2, SEEK_CUR);
+			position += 2;
 			break;
 
 		case MOV_MEM_REG_I32:
-			fseek(mOutput, sizeof(int) * 3, SEEK_CUR);
+			position += 3;
 			break;
 
 		case MOV_REG_MEM_I32:
-			fseek(mOutput, sizeof(int) * 3, SEEK_CUR);
+			position += 3;
 			break;
 
 		case JMP:
 		case JZ:
 		case JNZ:
-			std::cout << "JUMP ";
-			offset = ftell(mOutput);
-			std::cout << offset << std::endl;
-			fread(&temp[0], sizeof(int), 1, mOutput);
-			std::cout << "\tVALUE OF (INSTR " << opcode << ")" << temp[0] << std::endl;
-			temp[1] = GetLabelOffset(temp[0]);
-			std::cout << "\tOFFSET TO " << temp[1] << std::endl;
-			fseek(mOutput, offset, SEEK_SET);
-			fwrite(&temp[1], sizeof(int), 1, mOutput);
+			(*mLog) << "JUMP ";
+			(*mLog) << position * sizeof(int) << std::endl;
+			(*mLog) << "\tVALUE OF (INSTR " << opcode << ")" << mCode[position] << std::endl;
+			Fixup(position);
+			(*mLog) << "\tOFFSET TO " << mCode[position] << std::endl;
+			position++;
+			break;
+
+		case JLT_REG_REG:
+		case JLE_REG_REG:
+		case JGT_REG_REG:
+		case JGE_REG_REG:
+		case JEQ_REG_REG:
+		case JNE_REG_REG:
+		case JLT_REG_I32:
+		case JLE_REG_I32:
+		case JGT_REG_I32:
+		case JGE_REG_I32:
+		case JEQ_REG_I32:
+		case JNE_REG_I32:
+			// Label is the last argument
+			position += 2;
+			Fixup(position);
+			position++;
+			break;
+
+		case LOOP_LT_I32:
+		case LOOP_LE_I32:
+		case LOOP_GT_I32:
+		case LOOP_GE_I32:
+		case LOOP_EQ_I32:
+		case LOOP_NE_I32:
+			position += 4;
+			Fixup(position);
+			position++;
+			break;
+
+		case LOOP_LT_MEM:
+		case LOOP_LE_MEM:
+		case LOOP_GT_MEM:
+		case LOOP_GE_MEM:
+		case LOOP_EQ_MEM:
+		case LOOP_NE_MEM:
+			position += 5;
+			Fixup(position);
+			position++;
+			break;
+
+		case CALL:
+			Fixup(position);
+			position++;
+			break;
+
+		case RET:
+			position += 1;
+			break;
+
+		case HALT:
+			break;
+
+		case RESERVE:
+		case RELEASE:
+			position += 1;
+			break;
+
+		case MOV_REG_IDX_I32:
+		case MOV_IDX_REG_I32:
+		case MOV_REG_IDX_NC_I32:
+		case MOV_IDX_REG_NC_I32:
+			position += 5;
+			break;
+
+		case VLOAD_I32X4:
+		case VSTORE_I32X4:
+		case VLOAD_I32X8:
+		case VSTORE_I32X8:
+			position += 4;
+			break;
+
+		case VSPLAT_I32X4:
+		case VSEQ_I32X4:
+		case VADD_I32X4:
+		case VSUB_I32X4:
+		case VMUL_I32X4:
+		case VCMPLEQ_I32X4:
+		case VCMPGEQ_I32X4:
+		case VCMPLESS_I32X4:
+		case VCMPGREATER_I32X4:
+		case VCMPEQ_I32X4:
+		case VCMPNEQ_I32X4:
+		case VSUM_I32X4:
+		case VSPLAT_I32X8:
+		case VSEQ_I32X8:
+		case VADD_I32X8:
+		case VSUB_I32X8:
+		case VMUL_I32X8:
+		case VCMPLEQ_I32X8:
+		case VCMPGEQ_I32X8:
+		case VCMPLESS_I32X8:
+		case VCMPGREATER_I32X8:
+		case VCMPEQ_I32X8:
+		case VCMPNEQ_I32X8:
+		case VSUM_I32X8:
+			position += 2;
+			break;
+
+		case JMP_TABLE:
+		{
+			// Register, base and entries count are followed by default label and table itself
+			int count = mCode[position + 2];
+			position += 3;
+			for (int i = 0; i <= count; i++)
+			{
+				Fixup(position);
+				position++;
+			}
+		}
+			break;
+
+		case PFOR:
+		{
+			// Counter, written arrays (address and count), reductions (address) and frame size are followed by label
+			int writes = mCode[position + 2];
+			int reductions = mCode[position + 3 + 3 * writes];
+			position += 5 + 3 * writes + 2 * reductions;
+			Fixup(position);
+			position++;
+		}
+			break;
+
+		case PEND:
+			break;
+
+		case SELECT_I32:
+			position += 4;
 			break;
 		}
 	}
@@ -226,14 +500,31 @@ void Disassembler::ProcessLine(const std::string& l)
 	if (t[0][t[0].length() - 1] == ':')
 	{
 		std::string label = t[0].substr(0, t[0].length() - 1);
-		size_t offset = ftell(mOutput);
-		StoreLabel(label, (int)offset);
+		StoreLabel(label, (int)(mCode.size() * sizeof(int)));
+		return;
+	}
+
+	// Procedure is a label with its arguments already on stack (they're the first variables of its frame)
+	if (t[0] == "proc")
+	{
+		StoreLabel(t[1], (int)(mCode.size() * sizeof(int)));
+		mOffset = (size_t)(-4 * std::stoi(t[2]));
+		if (mRelocatable)
+		{
+			mSymbols.push_back(std::make_pair(t[1], (int)(mCode.size() * sizeof(int))));
+		}
+		return;
+	}
+
+	// Array declaration is just a hint for optimizer, strings are in constant pool
+	if (t[0] == "array" || t[0] == "string")
+	{
 		return;
 	}
 
 	// Write opcode
-	int opcode = mOpcodes[t[0]];
-	fwrite(&opcode, sizeof(int), 1, mOutput);
+	int opcode = GetOpcode(t[0]);
+	mCode.push_back(opcode);
 
 	// Write argument(s)
 	int temp[3];
@@ -250,91 +541,899 @@ void Disassembler::ProcessLine(const std::string& l)
 	case CMPGREATER_I32:
 	case CMPEQ_I32:
 	case CMPNEQ_I32:
+	case SHL_I32:
+	case SHR_I32:
+	case SAR_I32:
+	case AND_I32:
+	case OR_I32:
+	case XOR_I32:
+	case MULHI_I32:
 		temp[0] = GetRegister(t[1]);
 		temp[1] = GetRegister(t[2]);
-		fwrite(&temp[0], sizeof(int), 1, mOutput);
-		fwrite(&temp[1], sizeof(int), 1, mOutput);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
 		break;
 
 	case PUSH_I32:
 		temp[0] = GetRegister(t[1]);
-		fwrite(&temp[0], sizeof(int), 1, mOutput);
+		mCode.push_back(temp[0]);
 		mOffset -= 4;
 		break;
 
 	case POP_I32:
 		temp[0] = GetRegister(t[1]);
-		fwrite(&temp[0], sizeof(int), 1, mOutput);
+		mCode.push_back(temp[0]);
 		mOffset += 4;
 		break;
 
 	case NEG_I32:
 		temp[0] = GetRegister(t[1]);
-		fwrite(&temp[0], sizeof(int), 1, mOutput);
+		mCode.push_back(temp[0]);
 		break;
 
 	case MOV_REG_I32:
 		temp[0] = GetRegister(t[1]);
 		temp[1] = std::stoi(t[2]);
-		fwrite(&temp[0], sizeof(int), 1, mOutput);
-		fwrite(&temp[1], sizeof(int), 1, mOutput);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		if (mRelocatable && t[0] == "mov.reg.str")
+		{
+			mHandles.push_back(mCode.size() - 1);
+		}
 		break;
 
 	case MOV_MEM_REG_I32:
 		ParseAddress(t[1], temp[0], temp[1]);
 		temp[2] = GetRegister(t[2]);
-		fwrite(&temp[0], sizeof(int), 1, mOutput);
-		fwrite(&temp[1], sizeof(int), 1, mOutput);
-		fwrite(&temp[2], sizeof(int), 1, mOutput);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		mCode.push_back(temp[2]);
 		break;
 
 	case MOV_REG_MEM_I32:
 		temp[0] = GetRegister(t[1]);
 		ParseAddress(t[2], temp[1], temp[2]);
-		fwrite(&temp[0], sizeof(int), 1, mOutput);
-		fwrite(&temp[1], sizeof(int), 1, mOutput);
-		fwrite(&temp[2], sizeof(int), 1, mOutput);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		mCode.push_back(temp[2]);
 		break;
 
 	case JMP:
 	case JZ:
 	case JNZ:
 		temp[0] = GetLabel(t[1]);
-		fwrite(&temp[0], sizeof(int), 1, mOutput);
-		std::cout << "\tWRITING " << opcode << ", " << temp[0] << " at " << ftell(mOutput) << std::endl;
+		mCode.push_back(temp[0]);
+		(*mLog) << "\tWRITING " << opcode << ", " << temp[0] << " at " << mCode.size() * sizeof(int) << std::endl;
+		break;
+
+	case JLT_REG_REG:
+	case JLE_REG_REG:
+	case JGT_REG_REG:
+	case JGE_REG_REG:
+	case JEQ_REG_REG:
+	case JNE_REG_REG:
+		temp[0] = GetRegister(t[1]);
+		temp[1] = GetRegister(t[2]);
+		temp[2] = GetLabel(t[3]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		mCode.push_back(temp[2]);
+		break;
+
+	case JLT_REG_I32:
+	case JLE_REG_I32:
+	case JGT_REG_I32:
+	case JGE_REG_I32:
+	case JEQ_REG_I32:
+	case JNE_REG_I32:
+		temp[0] = GetRegister(t[1]);
+		temp[1] = std::stoi(t[2]);
+		temp[2] = GetLabel(t[3]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		mCode.push_back(temp[2]);
+		break;
+
+	case LOOP_LT_I32:
+	case LOOP_LE_I32:
+	case LOOP_GT_I32:
+	case LOOP_GE_I32:
+	case LOOP_EQ_I32:
+	case LOOP_NE_I32:
+		ParseAddress(t[1], temp[0], temp[1]);
+		temp[2] = std::stoi(t[2]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		mCode.push_back(temp[2]);
+		temp[0] = std::stoi(t[3]);
+		temp[1] = GetLabel(t[4]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		break;
+
+	case LOOP_LT_MEM:
+	case LOOP_LE_MEM:
+	case LOOP_GT_MEM:
+	case LOOP_GE_MEM:
+	case LOOP_EQ_MEM:
+	case LOOP_NE_MEM:
+		ParseAddress(t[1], temp[0], temp[1]);
+		temp[2] = std::stoi(t[2]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		mCode.push_back(temp[2]);
+		ParseAddress(t[3], temp[0], temp[1]);
+		temp[2] = GetLabel(t[4]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		mCode.push_back(temp[2]);
+		break;
+
+	case CALL:
+		// Arguments are removed from stack by callee
+		temp[0] = GetLabel(t[1]);
+		mCode.push_back(temp[0]);
+		mOffset += 4 * std::stoi(t[2]);
+		break;
+
+	case RET:
+		// Whole frame is removed (everything pushed since the beginning of procedure)
+		mCode.push_back((int)(0 - mOffset));
+		break;
+
+	case HALT:
+		break;
+
+	case RESERVE:
+		// Operand is number of slots, machine code holds number of bytes
+		temp[0] = 4 * std::stoi(t[1]);
+		mCode.push_back(temp[0]);
+		mOffset -= temp[0];
+		break;
+
+	case RELEASE:
+		temp[0] = 4 * std::stoi(t[1]);
+		mCode.push_back(temp[0]);
+		mOffset += temp[0];
+		break;
+
+	case MOV_REG_IDX_I32:
+	case MOV_REG_IDX_NC_I32:
+		// 'mov.reg.idx.i32 <reg> <address> <index reg> <count>', address is the first element of array
+		temp[0] = GetRegister(t[1]);
+		ParseAddress(t[2], temp[1], temp[2]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		mCode.push_back(temp[2]);
+		mCode.push_back(GetRegister(t[3]));
+		mCode.push_back(std::stoi(t[4]));
+		break;
+
+	case MOV_IDX_REG_I32:
+	case MOV_IDX_REG_NC_I32:
+		// 'mov.idx.reg.i32 <address> <index reg> <count> <reg>'
+		ParseAddress(t[1], temp[0], temp[1]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		mCode.push_back(GetRegister(t[2]));
+		mCode.push_back(std::stoi(t[3]));
+		mCode.push_back(GetRegister(t[4]));
+		break;
+
+	case VLOAD_I32X4:
+	case VLOAD_I32X8:
+		// 'vload.i32x4 <vreg> <address> <index reg>', address is the first element of array
+		temp[0] = GetVectorRegister(t[1]);
+		ParseAddress(t[2], temp[1], temp[2]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		mCode.push_back(temp[2]);
+		mCode.push_back(GetRegister(t[3]));
+		break;
+
+	case VSTORE_I32X4:
+	case VSTORE_I32X8:
+		// 'vstore.i32x4 <address> <index reg> <vreg>'
+		ParseAddress(t[1], temp[0], temp[1]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		mCode.push_back(GetRegister(t[2]));
+		mCode.push_back(GetVectorRegister(t[3]));
+		break;
+
+	case VSPLAT_I32X4:
+	case VSEQ_I32X4:
+	case VSPLAT_I32X8:
+	case VSEQ_I32X8:
+		mCode.push_back(GetVectorRegister(t[1]));
+		mCode.push_back(GetRegister(t[2]));
+		break;
+
+	case VSUM_I32X4:
+	case VSUM_I32X8:
+		mCode.push_back(GetRegister(t[1]));
+		mCode.push_back(GetVectorRegister(t[2]));
+		break;
+
+	case VADD_I32X4:
+	case VSUB_I32X4:
+	case VMUL_I32X4:
+	case VCMPLEQ_I32X4:
+	case VCMPGEQ_I32X4:
+	case VCMPLESS_I32X4:
+	case VCMPGREATER_I32X4:
+	case VCMPEQ_I32X4:
+	case VCMPNEQ_I32X4:
+	case VADD_I32X8:
+	case VSUB_I32X8:
+	case VMUL_I32X8:
+	case VCMPLEQ_I32X8:
+	case VCMPGEQ_I32X8:
+	case VCMPLESS_I32X8:
+	case VCMPGREATER_I32X8:
+	case VCMPEQ_I32X8:
+	case VCMPNEQ_I32X8:
+		mCode.push_back(GetVectorRegister(t[1]));
+		mCode.push_back(GetVectorRegister(t[2]));
+		break;
+
+	case JMP_TABLE:
+		// 'jmp.table <reg> <base> <default> <label>*', machine code holds number of table entries
+		temp[0] = GetRegister(t[1]);
+		temp[1] = std::stoi(t[2]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		mCode.push_back((int)t.size() - 4);
+		for (size_t i = 3; i < t.size(); i++)
+		{
+			mCode.push_back(GetLabel(t[i]));
+		}
+		break;
+
+	case PFOR:
+	{
+		// 'pfor <counter> <writes> (<array> <count>)* <reductions> <address>* <label>', size of frame (bytes
+		// below stack pointer, which is all of the frame body can access) is placed before label
+		ParseAddress(t[1], temp[0], temp[1]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		size_t k = 2;
+		int writes = std::stoi(t[k++]);
+		mCode.push_back(writes);
+		for (int i = 0; i < writes; i++, k += 2)
+		{
+			ParseAddress(t[k], temp[0], temp[1]);
+			mCode.push_back(temp[0]);
+			mCode.push_back(temp[1]);
+			mCode.push_back(std::stoi(t[k + 1]));
+		}
+		int reductions = std::stoi(t[k++]);
+		mCode.push_back(reductions);
+		for (int i = 0; i < reductions; i++, k++)
+		{
+			ParseAddress(t[k], temp[0], temp[1]);
+			mCode.push_back(temp[0]);
+			mCode.push_back(temp[1]);
+		}
+		mCode.push_back((int)(0 - mOffset));
+		mCode.push_back(GetLabel(t[k]));
+	}
+		break;
+
+	case PEND:
+		break;
+
+	case SELECT_I32:
+		temp[0] = GetRegister(t[1]);
+		temp[1] = GetRegister(t[2]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
+		ParseAddress(t[3], temp[0], temp[1]);
+		mCode.push_back(temp[0]);
+		mCode.push_back(temp[1]);
 		break;
 	}
 }
 
-// Constructor, pass in binary file and path to output file
-Disassembler::Disassembler(const std::string& filename, const std::string& output)
+// Constructor, pass in assembly file and path to output file
+Disassembler::Disassembler(const std::string& filename, const std::string& output) : mOpcodes(GetOpcodes()), mNull(nullptr)
 {
 	mOutputFilename = output;
+	mLog = &std::cout;
 
-	BuildOpcodes();
-	
 	mLabelsCount = 0;
+	mOffset = 0;
+	mPoolSize = 0;
+	mRelocatable = false;
 	mLabels.clear();
 	mLabelOffset.clear();
 
 	mAssembly = Reader::ReadFile(filename);
-	fopen_s(&mOutput, output.c_str(), "wb");
+}
+
+// Constructor from assembly lines, binary is kept in memory only (and nothing is logged)
+Disassembler::Disassembler(const std::vector<std::string>& assembly) : mOpcodes(GetOpcodes()), mNull(nullptr)
+{
+	mLog = &mNull;
+
+	mLabelsCount = 0;
+	mOffset = 0;
+	mPoolSize = 0;
+	mRelocatable = false;
+
+	mAssembly = assembly;
+}
+
+// Build constant pool from 'string <handle> "<text>"' lines (empty string has no line, its handle is 0)
+void Disassembler::BuildPool()
+{
+	mPoolSize = 0;
+	mStrings.clear();
+
+	for (const std::string& l : mAssembly)
+	{
+		std::string lt = l;
+		StringUtil::trim(lt);
+		if (!StringUtil::starts_with(lt, "string "))
+		{
+			continue;
+		}
+
+		// Text is between the first and the last quote (it may contain spaces)
+		size_t first = lt.find('"');
+		size_t last = lt.rfind('"');
+		int handle = std::stoi(lt.substr(7));
+		if (first == std::string::npos || last == first || handle <= 0)
+		{
+			continue;
+		}
+		mStrings[handle] = lt.substr(first + 1, last - first - 1);
+	}
+
+	// Relocatable code gets its header and pool when it's linked
+	if (!mRelocatable)
+	{
+		EmitHeader(mCode);
+		EmitPool(mStrings, mCode);
+		mPoolSize = mCode.size();
+	}
+}
+
+// Append constant pool with given strings (by handle) to code, nothing is appended when there are none
+void Disassembler::EmitPool(const std::map<int, std::string>& strings, std::vector<int>& code)
+{
+	if (strings.empty())
+	{
+		return;
+	}
+
+	// Handles (sorted) are paired with offsets of their strings
+	std::vector<int> entries;
+	std::string characters;
+	for (const auto& s : strings)
+	{
+		entries.push_back(s.first);
+		entries.push_back((int)characters.length());
+		characters += s.second;
+		characters += '\0';
+	}
+
+	size_t begin = code.size();
+	code.push_back(STRINGS);
+	code.push_back(0);
+	code.push_back((int)strings.size());
+	code.insert(code.end(), entries.begin(), entries.end());
+
+	size_t words = (characters.length() + sizeof(int) - 1) / sizeof(int);
+	size_t start = code.size();
+	code.resize(start + words, 0);
+	memcpy(&code[start], characters.data(), characters.length());
+
+	code[begin + 1] = (int)(code.size() - begin);
+}
+
+// Append header of executable binary to code (it's completed by FinishHeader once code is complete)
+void Disassembler::EmitHeader(std::vector<int>& code)
+{
+	code.push_back(HEADER);
+	code.push_back(HEADER_SIZE);
+	code.push_back(0);
+	code.push_back(-1);
+}
+
+// Write number of words and maximum stack depth of complete binary into its header
+void Disassembler::FinishHeader(std::vector<int>& code)
+{
+	if (code.size() < HEADER_SIZE || code[0] != HEADER)
+	{
+		return;
+	}
+
+	code[2] = (int)code.size();
+	code[3] = GetStackDepth(code);
+}
+
+// Number of words of instruction at given word of code, 0 when it isn't valid instruction
+size_t Disassembler::GetInstructionSize(const std::vector<int>& code, size_t ip)
+{
+	size_t size = 0;
+	switch (code[ip])
+	{
+	case HALT:
+	case PEND:
+		size = 1;
+		break;
+
+	case PUSH_I32:
+	case POP_I32:
+	case NEG_I32:
+	case JMP:
+	case JZ:
+	case JNZ:
+	case CALL:
+	case RET:
+	case RESERVE:
+	case RELEASE:
+		size = 2;
+		break;
+
+	case MOV_MEM_REG_I32:
+	case MOV_REG_MEM_I32:
+	case JLT_REG_REG:
+	case JLE_REG_REG:
+	case JGT_REG_REG:
+	case JGE_REG_REG:
+	case JEQ_REG_REG:
+	case JNE_REG_REG:
+	case JLT_REG_I32:
+	case JLE_REG_I32:
+	case JGT_REG_I32:
+	case JGE_REG_I32:
+	case JEQ_REG_I32:
+	case JNE_REG_I32:
+		size = 4;
+		break;
+
+	case VLOAD_I32X4:
+	case VSTORE_I32X4:
+	case VLOAD_I32X8:
+	case VSTORE_I32X8:
+	case SELECT_I32:
+		size = 5;
+		break;
+
+	case LOOP_LT_I32:
+	case LOOP_LE_I32:
+	case LOOP_GT_I32:
+	case LOOP_GE_I32:
+	case LOOP_EQ_I32:
+	case LOOP_NE_I32:
+	case MOV_REG_IDX_I32:
+	case MOV_IDX_REG_I32:
+	case MOV_REG_IDX_NC_I32:
+	case MOV_IDX_REG_NC_I32:
+		size = 6;
+		break;
+
+	case LOOP_LT_MEM:
+	case LOOP_LE_MEM:
+	case LOOP_GT_MEM:
+	case LOOP_GE_MEM:
+	case LOOP_EQ_MEM:
+	case LOOP_NE_MEM:
+		size = 7;
+		break;
+
+	case JMP_TABLE:
+		// Register, base and entries count are followed by default label and table itself
+		if (ip + 3 < code.size() && code[ip + 3] >= 0)
+		{
+			size = 5 + (size_t)code[ip + 3];
+		}
+		break;
+
+	case PFOR:
+		// Counter, written arrays (address and count), reductions (address) and frame size are followed by label
+		if (ip + 3 < code.size() && code[ip + 3] >= 0)
+		{
+			size_t reductions = ip + 4 + 3 * (size_t)code[ip + 3];
+			if (reductions < code.size() && code[reductions] >= 0)
+			{
+				size = 7 + 3 * (size_t)code[ip + 3] + 2 * (size_t)code[reductions];
+			}
+		}
+		break;
+
+	case STRINGS:
+	case HEADER:
+		if (ip + 1 < code.size() && code[ip + 1] >= 2)
+		{
+			size = (size_t)code[ip + 1];
+		}
+		break;
+
+	default:
+		if ((code[ip] >= ADD_I32 && code[ip] <= CMPNEQ_I32) || (code[ip] >= SHL_I32 && code[ip] <= MULHI_I32) ||
+			(code[ip] >= VSPLAT_I32X4 && code[ip] <= VSUM_I32X4) || (code[ip] >= VSPLAT_I32X8 && code[ip] <= VSUM_I32X8))
+		{
+			size = 3;
+		}
+		break;
+	}
+
+	return (ip + size <= code.size()) ? size : 0;
+}
+
+// Maximum stack depth reached by procedure at given word (in bytes, relative to stack pointer at its
+// entry) and change of stack pointer once it returns, returns false when it isn't bounded (procedure
+// is recursive or its stack depth differs between paths)
+bool Disassembler::GetProcedureDepth(const std::vector<int>& code, size_t entry, std::map<size_t, std::pair<int, int> >& procedures, std::set<size_t>& active, int& depth, int& net)
+{
+	auto known = procedures.find(entry);
+	if (known != procedures.end())
+	{
+		depth = known->second.first;
+		net = known->second.second;
+		return true;
+	}
+
+	// Recursion has no bound
+	if (!active.insert(entry).second)
+	{
+		return false;
+	}
+
+	// Instructions are followed from entry along all paths, each one is reached with the same depth
+	// on all of them (compiler balances stack at every label)
+	std::map<size_t, int> reached;
+	std::vector<std::pair<size_t, int> > pending(1, std::make_pair(entry, 0));
+	bool returns = false;
+	bool result = true;
+	depth = 0;
+	net = 0;
+	while (result && !pending.empty())
+	{
+		size_t ip = pending.back().first;
+		int current = pending.back().second;
+		pending.pop_back();
+
+		auto it = reached.find(ip);
+		if (it != reached.end())
+		{
+			result = it->second == current;
+			continue;
+		}
+
+		// Program ends once it reaches the end of code
+		if (ip == code.size())
+		{
+			continue;
+		}
+
+		size_t size = (ip < code.size()) ? GetInstructionSize(code, ip) : 0;
+		if (size == 0 || current < 0)
+		{
+			result = false;
+			break;
+		}
+		reached[ip] = current;
+		depth = std::max(depth, current);
+
+		// Jump targets are offsets in bytes
+		std::vector<int> targets;
+		int next = current;
+		bool falls = true;
+		switch (code[ip])
+		{
+		case PUSH_I32:
+			next = current + (int)sizeof(int);
+			break;
+
+		case POP_I32:
+			next = current - (int)sizeof(int);
+			break;
+
+		case RESERVE:
+			next = current + code[ip + 1];
+			break;
+
+		case RELEASE:
+			next = current - code[ip + 1];
+			break;
+
+		case JMP:
+			targets.push_back(code[ip + 1]);
+			falls = false;
+			break;
+
+		case JZ:
+		case JNZ:
+			targets.push_back(code[ip + 1]);
+			break;
+
+		case JLT_REG_REG:
+		case JLE_REG_REG:
+		case JGT_REG_REG:
+		case JGE_REG_REG:
+		case JEQ_REG_REG:
+		case JNE_REG_REG:
+		case JLT_REG_I32:
+		case JLE_REG_I32:
+		case JGT_REG_I32:
+		case JGE_REG_I32:
+		case JEQ_REG_I32:
+		case JNE_REG_I32:
+		case LOOP_LT_I32:
+		case LOOP_LE_I32:
+		case LOOP_GT_I32:
+		case LOOP_GE_I32:
+		case LOOP_EQ_I32:
+		case LOOP_NE_I32:
+		case LOOP_LT_MEM:
+		case LOOP_LE_MEM:
+		case LOOP_GT_MEM:
+		case LOOP_GE_MEM:
+		case LOOP_EQ_MEM:
+		case LOOP_NE_MEM:
+		case PFOR:
+			// Label is the last operand, parallel loop continues into its body too
+			targets.push_back(code[ip + size - 1]);
+			break;
+
+		case JMP_TABLE:
+			targets.assign(code.begin() + ip + 4, code.begin() + ip + size);
+			falls = false;
+			break;
+
+		case CALL:
+		{
+			// Frame of callee is above the current depth, its arguments are removed once it returns
+			int address = code[ip + 1];
+			int calleeDepth = 0;
+			int calleeNet = 0;
+			if (address < 0 || address % sizeof(int) != 0 || !GetProcedureDepth(code, address / sizeof(int), procedures, active, calleeDepth, calleeNet))
+			{
+				result = false;
+				break;
+			}
+			depth = std::max(depth, current + calleeDepth);
+			next = current + calleeNet;
+		}
+			break;
+
+		case RET:
+		{
+			// All returns remove the same frame
+			int returned = current - code[ip + 1];
+			result = !returns || returned == net;
+			returns = true;
+			net = returned;
+			falls = false;
+		}
+			break;
+
+		case HALT:
+		case PEND:
+			falls = false;
+			break;
+		}
+
+		if (falls)
+		{
+			pending.push_back(std::make_pair(ip + size, next));
+		}
+		for (int t : targets)
+		{
+			if (t < 0 || t % sizeof(int) != 0)
+			{
+				result = false;
+				break;
+			}
+			pending.push_back(std::make_pair(t / sizeof(int), current));
+		}
+	}
+
+	active.erase(entry);
+	if (result)
+	{
+		procedures[entry] = std::make_pair(depth, net);
+	}
+	return result;
+}
+
+// Maximum stack depth of binary (in bytes above the end of code), -1 when it isn't bounded
+int Disassembler::GetStackDepth(const std::vector<int>& code)
+{
+	// Program is followed from the beginning of code like a procedure
+	std::map<size_t, std::pair<int, int> > procedures;
+	std::set<size_t> active;
+	int depth = 0;
+	int net = 0;
+	if (code.empty() || !GetProcedureDepth(code, 0, procedures, active, depth, net))
+	{
+		return -1;
+	}
+	return depth;
+}
+
+// Produce relocatable object instead of executable binary
+void Disassembler::SetRelocatable(bool relocatable)
+{
+	mRelocatable = relocatable;
 }
 
 // Perform disassembly
 void Disassembler::Disassemble()
 {
+	mCode.clear();
+	mRelocations.clear();
+	mReferences.clear();
+	mHandles.clear();
+	mSymbols.clear();
+	BuildPool();
+
 	// Line by line disassembly
 	for (auto l : mAssembly)
 	{
 		ProcessLine(l);
 	}
 
-	fclose(mOutput);
+	ResolveLabels();
+	if (!mRelocatable)
+	{
+		FinishHeader(mCode);
+	}
 
-	fopen_s(&mOutput, mOutputFilename.c_str(), "rb+");
+	if (!mOutputFilename.empty())
+	{
+		Save(mCode, mOutputFilename);
+	}
+}
 
-	ResolveLabels();
+// Get relocatable object (code and its tables) of the last disassembly
+void Disassembler::GetObject(ObjectFile& object) const
+{
+	object.code = mCode;
+	object.strings = mStrings;
+	object.relocations = mRelocations;
+	object.references = mReferences;
+	object.handles = mHandles;
+	object.symbols.clear();
+	for (const auto& s : mSymbols)
+	{
+		ObjectFile::Symbol symbol;
+		symbol.label = s.first;
+		symbol.offset = s.second;
+		symbol.globals = false;
+		symbol.parallel = false;
+		object.symbols.push_back(symbol);
+	}
+}
+
+// Save binary into file, returns false when file can't be written
+bool Disassembler::Save(const std::vector<int>& code, const std::string& filename)
+{
+	FILE* output = nullptr;
+	fopen_s(&output, filename.c_str(), "wb");
+	if (output == nullptr)
+	{
+		return false;
+	}
+
+	bool result = fwrite(code.data(), sizeof(int), code.size(), output) == code.size();
+	fclose(output);
+	return result;
+}
+
+// Save binary as C++ header defining constant array of given name (std::array<int32_t, N>), so host
+// application gets compiled script at build time. Returns false when file can't be written
+bool Disassembler::SaveEmbedded(const std::vector<int>& code, const std::string& name, const std::string& source, const std::string& filename)
+{
+	std::string guard = "__EMBEDDED_";
+	for (char c : name)
+	{
+		guard += (char)toupper((unsigned char)c);
+	}
+	guard += "_H__";
+
+	std::ostringstream header;
+	header << "// Binary of " << source << " compiled by script compiler " << ScriptCompiler::GetVersion() << " (generated, don't edit)\n";
+	header << "#ifndef " << guard << "\n";
+	header << "#define " << guard << "\n\n";
+	header << "#include <array>\n";
+	header << "#include <cstdint>\n\n";
+	header << "static constexpr std::array<int32_t, " << code.size() << "> " << name << " =\n{ {";
+
+	// The lowest value has no literal (its negation doesn't fit)
+	for (size_t i = 0; i < code.size(); i++)
+	{
+		header << ((i % 16 == 0) ? "\n\t" : " ");
+		if (code[i] == INT_MIN)
+		{
+			header << "(-2147483647 - 1)";
+		}
+		else
+		{
+			header << code[i];
+		}
+		header << ((i + 1 < code.size()) ? "," : "");
+	}
+	header << "\n} };\n\n";
+	header << "#endif\n";
+
+	std::ofstream f(filename, std::ios::binary | std::ios::out);
+	if (!f.good())
+	{
+		return false;
+	}
+
+	std::string h = header.str();
+	f.write(h.c_str(), h.length());
+	return f.good();
+}
+
+// Get string of given handle from constant pool at the beginning of code (of given number of words),
+// returns false when there is no such string
+bool Disassembler::GetString(const int* code, size_t size, int handle, std::string& text)
+{
+	// Empty string is there even without constant pool
+	text.clear();
+	if (handle == 0)
+	{
+		return true;
+	}
+
+	// Constant pool follows header of executable binary
+	if (size >= HEADER_SIZE && code[0] == HEADER)
+	{
+		if (code[1] < HEADER_SIZE || (size_t)code[1] > size)
+		{
+			return false;
+		}
+		size -= code[1];
+		code += code[1];
+	}
+
+	if (size < 3 || code[0] != STRINGS || code[1] < 3 || (size_t)code[1] > size)
+	{
+		return false;
+	}
+
+	int count = code[2];
+	if (count < 0 || 3 + 2 * (long long)count > code[1])
+	{
+		return false;
+	}
+
+	// Entries are sorted by handle
+	const int* entries = code + 3;
+	int low = 0;
+	int high = count;
+	while (low < high)
+	{
+		int middle = low + (high - low) / 2;
+		if (entries[2 * middle] < handle)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	if (low == count || entries[2 * low] != handle)
+	{
+		return false;
+	}
+
+	const char* characters = (const char*)(code + 3 + 2 * count);
+	size_t length = (code[1] - 3 - 2 * count) * sizeof(int);
+	size_t offset = (size_t)entries[2 * low + 1];
+	if (offset >= length)
+	{
+		return false;
+	}
 
-	fclose(mOutput);
+	text.assign(characters + offset, strnlen(characters + offset, length - offset));
+	return true;
 }
\ No newline at end of file
@@ -11,7 +11,11 @@
 #define __DISASSEMBLER_H__
 
 #include "Reader.h"
+#include "ObjectFile.h"
 #include <map>
+#include <set>
+#include <vector>
+#include <ostream>
 //#include <boost/algorithm/string.hpp>
 //#include <boost/lexical_cast.hpp>
 //#include <boost/tokenizer.hpp>
@@ -41,29 +45,135 @@ public:
 		CMPNEQ_I32,
 		JMP,
 		JZ,
-		JNZ
+		JNZ,
+		SHL_I32,			// Shift int register left by value of another one
+		SHR_I32,			// Shift int register right (logical - fills in zeroes)
+		SAR_I32,			// Shift int register right (arithmetic - keeps sign)
+		AND_I32,			// Bitwise and of 2 int registers
+		OR_I32,				// Bitwise or of 2 int registers
+		XOR_I32,			// Bitwise xor of 2 int registers
+		MULHI_I32,			// Upper 32 bits of 64-bit product of 2 int registers
+		JLT_REG_REG,		// Jump when register is less than another register
+		JLE_REG_REG,		// Jump when register is less or equal to another register
+		JGT_REG_REG,		// Jump when register is greater than another register
+		JGE_REG_REG,		// Jump when register is greater or equal to another register
+		JEQ_REG_REG,		// Jump when registers are equal
+		JNE_REG_REG,		// Jump when registers are not equal
+		JLT_REG_I32,		// Jump when register is less than constant
+		JLE_REG_I32,		// Jump when register is less or equal to constant
+		JGT_REG_I32,		// Jump when register is greater than constant
+		JGE_REG_I32,		// Jump when register is greater or equal to constant
+		JEQ_REG_I32,		// Jump when register is equal to constant
+		JNE_REG_I32,		// Jump when register is not equal to constant
+		LOOP_LT_I32,		// Add constant to counter in memory, jump when it is less than constant
+		LOOP_LE_I32,		// Add constant to counter in memory, jump when it is less or equal to constant
+		LOOP_GT_I32,		// Add constant to counter in memory, jump when it is greater than constant
+		LOOP_GE_I32,		// Add constant to counter in memory, jump when it is greater or equal to constant
+		LOOP_EQ_I32,		// Add constant to counter in memory, jump when it is equal to constant
+		LOOP_NE_I32,		// Add constant to counter in memory, jump when it is not equal to constant
+		LOOP_LT_MEM,		// Add constant to counter in memory, jump when it is less than value in memory
+		LOOP_LE_MEM,		// Add constant to counter in memory, jump when it is less or equal to value in memory
+		LOOP_GT_MEM,		// Add constant to counter in memory, jump when it is greater than value in memory
+		LOOP_GE_MEM,		// Add constant to counter in memory, jump when it is greater or equal to value in memory
+		LOOP_EQ_MEM,		// Add constant to counter in memory, jump when it is equal to value in memory
+		LOOP_NE_MEM,		// Add constant to counter in memory, jump when it is not equal to value in memory
+		CALL,				// Call procedure (return address is kept on call stack)
+		RET,				// Remove frame of procedure from stack and return to caller
+		HALT,				// End program
+		RESERVE,			// Reserve stack space (frame of variables) by moving stack pointer
+		RELEASE,			// Release stack space by moving stack pointer back
+		JMP_TABLE,			// Jump to entry of table indexed by register minus base (default when out of range)
+		MOV_REG_IDX_I32,	// Move array element (indexed by register) into register, index is checked against array size
+		MOV_IDX_REG_I32,	// Move register into array element (indexed by register), index is checked against array size
+		MOV_REG_IDX_NC_I32,	// Move array element into register, index is known to be in bounds
+		MOV_IDX_REG_NC_I32,	// Move register into array element, index is known to be in bounds
+		VLOAD_I32X4,		// Load 4 array elements (the first one indexed by register) into vector register, known to be in bounds
+		VSTORE_I32X4,		// Store vector register into 4 array elements (the first one indexed by register)
+		VSPLAT_I32X4,		// Fill all lanes of vector register with int register
+		VSEQ_I32X4,			// Fill lanes of vector register with int register plus lane index
+		VADD_I32X4,			// Add 2 vector registers lane-wise (result in the first one)
+		VSUB_I32X4,			// Subtract 2 vector registers lane-wise (result in the first one)
+		VMUL_I32X4,			// Multiply 2 vector registers lane-wise (result in the first one)
+		VCMPLEQ_I32X4,		// Lane-wise comparisons of 2 vector registers (1 where it holds, 0 elsewhere)
+		VCMPGEQ_I32X4,
+		VCMPLESS_I32X4,
+		VCMPGREATER_I32X4,
+		VCMPEQ_I32X4,
+		VCMPNEQ_I32X4,
+		VSUM_I32X4,			// Sum of lanes of vector register into int register
+		VLOAD_I32X8,		// The same vector instructions working on 8 lanes
+		VSTORE_I32X8,
+		VSPLAT_I32X8,
+		VSEQ_I32X8,
+		VADD_I32X8,
+		VSUB_I32X8,
+		VMUL_I32X8,
+		VCMPLEQ_I32X8,
+		VCMPGEQ_I32X8,
+		VCMPLESS_I32X8,
+		VCMPGREATER_I32X8,
+		VCMPEQ_I32X8,
+		VCMPNEQ_I32X8,
+		VSUM_I32X8,
+		STRINGS,			// Constant pool of interned strings, skipped when executed (size in words, count, handles of
+							// strings paired with their offsets in bytes sorted by handle and characters terminated by 0)
+		PFOR,				// Parallel loop from counter in memory up to register r0, body follows (ends with pend) and
+							// is run on worker threads, then jumps to label (written arrays and reductions are merged,
+							// size of frame below stack pointer precedes label)
+		PEND,				// End of parallel loop body (ends iteration of worker)
+		SELECT_I32,			// Keep value of the second register in the first one when the first one is non-zero, value
+							// in memory otherwise (branchless conditional move)
+		HEADER				// Header of executable binary at its beginning, skipped when executed (size in words, number
+							// of words of binary and maximum stack depth in bytes, -1 when it isn't bounded)
+	};
+
+	enum
+	{
+		VECTOR_REGISTERS = 8,	// Number of vector registers (v0 - v7)
+		VECTOR_LANES = 8,		// Maximum number of 32-bit lanes of vector register
+		HEADER_SIZE = 4			// Number of words of binary header
 	};
 
 private:
-	FILE* mOutput;							// Disassembled output
+	std::vector<int> mCode;					// Disassembled output
 	std::vector<std::string> mAssembly;		// Assembly input
 
-	std::map<std::string, int> mOpcodes;	// Opcodes database
+	const std::map<std::string, int>& mOpcodes;	// Opcodes database
 
 	std::map<std::string, int> mLabels;
 	int mLabelsCount;
 	std::map<int, int> mLabelOffset;
 
 	size_t mOffset;							
+	size_t mPoolSize;						// Number of words of header and constant pool (at the beginning of code)
+	std::map<int, std::string> mStrings;	// Interned strings (by handle)
+
+	bool mRelocatable;						// Code is object linked with other units later (it has no constant pool)
+	std::vector<size_t> mRelocations;		// Words holding code offsets (relocatable code only)
+	std::vector<ObjectFile::Reference> mReferences;	// Words holding offsets of labels which aren't defined (relocatable code only)
+	std::vector<size_t> mHandles;			// Words holding handles of interned strings (relocatable code only)
+	std::vector<std::pair<std::string, int> > mSymbols;	// Procedures and their offsets (relocatable code only)
 
 	std::string mOutputFilename;
 
+	std::ostream mNull;						// Stream discarding everything (log disabled)
+	std::ostream* mLog;						// Log of labels and jumps
+
 	// Build opcodes database
-	void BuildOpcodes();
+	static std::map<std::string, int> BuildOpcodes();
+
+	// Get opcodes database (shared by all instances, built only once)
+	static const std::map<std::string, int>& GetOpcodes();
+
+	// Get opcode of instruction
+	int GetOpcode(const std::string& name);
 
 	// Get register ID from string
 	int GetRegister(const std::string& reg);
 
+	// Get vector register ID from string (-1 when it isn't vector register)
+	int GetVectorRegister(const std::string& reg);
+
 	// Parse address
 	int ParseAddress(const std::string& token, int& reg, int& offset);
 
@@ -76,14 +186,67 @@ private:
 
 	void StoreLabel(const std::string& name, int position);
 
+	// Replace label at given position with its offset, position is recorded for relocation (or as reference
+	// when label isn't defined) in relocatable code
+	void Fixup(size_t position);
+
 	void ResolveLabels();
 
+	// Build constant pool from 'string <handle> "<text>"' lines (empty string has no line, its handle is 0)
+	void BuildPool();
+
+	// Number of words of instruction at given word of code, 0 when it isn't valid instruction
+	static size_t GetInstructionSize(const std::vector<int>& code, size_t ip);
+
+	// Maximum stack depth reached by procedure at given word (in bytes, relative to stack pointer at its
+	// entry) and change of stack pointer once it returns, returns false when it isn't bounded (procedure
+	// is recursive or its stack depth differs between paths)
+	static bool GetProcedureDepth(const std::vector<int>& code, size_t entry, std::map<size_t, std::pair<int, int> >& procedures, std::set<size_t>& active, int& depth, int& net);
+
 public:
-	// Constructor, pass in binary file and path to output file
+	// Constructor, pass in assembly file and path to output file
 	Disassembler(const std::string& filename, const std::string& output);
 
+	// Constructor from assembly lines, binary is kept in memory only (and nothing is logged)
+	Disassembler(const std::vector<std::string>& assembly);
+
+	// Produce relocatable object instead of executable binary
+	void SetRelocatable(bool relocatable);
+
 	// Perform disassembly
 	void Disassemble();
+
+	// Get relocatable object (code and its tables) of the last disassembly
+	void GetObject(ObjectFile& object) const;
+
+	// Get disassembled binary
+	const std::vector<int>& GetCode() const
+	{
+		return mCode;
+	}
+
+	// Save binary into file, returns false when file can't be written
+	static bool Save(const std::vector<int>& code, const std::string& filename);
+
+	// Save binary as C++ header defining constant array of given name (std::array<int32_t, N>), so host
+	// application gets compiled script at build time. Returns false when file can't be written
+	static bool SaveEmbedded(const std::vector<int>& code, const std::string& name, const std::string& source, const std::string& filename);
+
+	// Append constant pool with given strings (by handle) to code, nothing is appended when there are none
+	static void EmitPool(const std::map<int, std::string>& strings, std::vector<int>& code);
+
+	// Append header of executable binary to code (it's completed by FinishHeader once code is complete)
+	static void EmitHeader(std::vector<int>& code);
+
+	// Write number of words and maximum stack depth of complete binary into its header
+	static void FinishHeader(std::vector<int>& code);
+
+	// Maximum stack depth of binary (in bytes above the end of code), -1 when it isn't bounded
+	static int GetStackDepth(const std::vector<int>& code);
+
+	// Get string of given handle from constant pool at the beginning of code (of given number of words),
+	// returns false when there is no such string
+	static bool GetString(const int* code, size_t size, int handle, std::string& text);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,282 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Expression.h"
+#include "Compiler.h"
+#include <algorithm>
+#include <climits>
+
+// Report error into compiled expression
+void Expression::Error(CompiledExpression& expression, const std::string& error)
+{
+	expression.diagnostics.push_back(Diagnostic(Diagnostic::SEVERITY_ERROR, error, "", 0));
+	expression.success = false;
+}
+
+// Apply operator to values, returns false when it divides by zero
+bool Expression::Apply(int op, int left, int right, int& result)
+{
+	// Overflow wraps around like in virtual machine
+	switch (op)
+	{
+	case Lexer::ADDITION:
+		result = (int)((unsigned int)left + (unsigned int)right);
+		break;
+
+	case Lexer::SUBTRACTION:
+		result = (int)((unsigned int)left - (unsigned int)right);
+		break;
+
+	case Lexer::MULTIPLICATION:
+		result = (int)((unsigned int)left * (unsigned int)right);
+		break;
+
+	case Lexer::DIVISION:
+		if (right == 0)
+		{
+			result = 0;
+			return false;
+		}
+		result = (left == INT_MIN && right == -1) ? INT_MIN : left / right;
+		break;
+
+	case Lexer::LEQUAL:
+		result = left <= right;
+		break;
+
+	case Lexer::GEQUAL:
+		result = left >= right;
+		break;
+
+	case Lexer::LESS:
+		result = left < right;
+		break;
+
+	case Lexer::GREATER:
+		result = left > right;
+		break;
+
+	case Lexer::EQUAL:
+		result = left == right;
+		break;
+
+	case Lexer::NOTEQUAL:
+		result = left != right;
+		break;
+	}
+	return true;
+}
+
+// Combine the two topmost operands by operator, constants are folded and operations which don't
+// change value are removed. Returns false when expression is too complex
+bool Expression::Reduce(CompiledExpression& expression, std::vector<CompiledExpression::Operand>& operands, int op, size_t& depth)
+{
+	CompiledExpression::Operand right = operands.back();
+	operands.pop_back();
+	CompiledExpression::Operand left = operands.back();
+	operands.pop_back();
+
+	bool leftConstant = left.kind == CompiledExpression::OPERAND_CONSTANT;
+	bool rightConstant = right.kind == CompiledExpression::OPERAND_CONSTANT;
+	int folded = 0;
+
+	// Division by zero is left for evaluation, so it's reported there
+	if (leftConstant && rightConstant && Apply(op, left.value, right.value, folded))
+	{
+		CompiledExpression::Operand result = { CompiledExpression::OPERAND_CONSTANT, folded };
+		operands.push_back(result);
+		return true;
+	}
+
+	// Adding 0 and multiplying by 1 keeps the other operand
+	if (rightConstant && ((right.value == 0 && (op == Lexer::ADDITION || op == Lexer::SUBTRACTION)) ||
+		(right.value == 1 && (op == Lexer::MULTIPLICATION || op == Lexer::DIVISION))))
+	{
+		operands.push_back(left);
+		return true;
+	}
+	if (leftConstant && ((left.value == 0 && op == Lexer::ADDITION) || (left.value == 1 && op == Lexer::MULTIPLICATION)))
+	{
+		operands.push_back(right);
+		return true;
+	}
+
+	// Operands on stack are replaced by result
+	depth -= (left.kind == CompiledExpression::OPERAND_STACK) ? 1 : 0;
+	depth -= (right.kind == CompiledExpression::OPERAND_STACK) ? 1 : 0;
+	depth++;
+	if (depth > MAX_DEPTH)
+	{
+		Error(expression, "Expression is too complex");
+		return false;
+	}
+	expression.depth = std::max(expression.depth, depth);
+
+	CompiledExpression::Instruction instruction = { op, left, right };
+	expression.code.push_back(instruction);
+
+	CompiledExpression::Operand result = { CompiledExpression::OPERAND_STACK, 0 };
+	operands.push_back(result);
+	return true;
+}
+
+// Compile expression with variables of given layout
+CompiledExpression Expression::Compile(const std::string& text, const VariableLayout& layout)
+{
+	CompiledExpression expression;
+	expression.success = true;
+
+	Lexer lexer(std::vector<std::string>(1, text));
+	expression.diagnostics = lexer.GetDiagnostics();
+	if (Diagnostic::HasErrors(expression.diagnostics))
+	{
+		expression.success = false;
+		return expression;
+	}
+
+	const std::vector<Lexer::Token>& tokens = lexer.GetTokens();
+	const std::vector<std::string>& data = lexer.GetData();
+
+	// Precedence climbing like in compiler, operands are kept on stack until their operator is known
+	std::vector<PendingOperator> pending;
+	std::vector<CompiledExpression::Operand> operands;
+	size_t depth = 0;
+	size_t position = 0;
+	while (true)
+	{
+		while (position < tokens.size() && tokens[position] == Lexer::LPAREN)
+		{
+			PendingOperator parenthesis = { -1, 0 };
+			pending.push_back(parenthesis);
+			position++;
+		}
+
+		if (position == tokens.size())
+		{
+			Error(expression, "Unexpected end of expression");
+			return expression;
+		}
+
+		// Operand is literal or variable of layout
+		const std::string& value = data[position];
+		CompiledExpression::Operand operand = { CompiledExpression::OPERAND_CONSTANT, 0 };
+		if (tokens[position] == Lexer::VALUE && value.length() == 3 && value[0] == '\'')
+		{
+			operand.value = (unsigned char)value[1];
+		}
+		else if (tokens[position] == Lexer::VALUE && value.length() <= 10 && value.find_first_not_of("0123456789") == std::string::npos &&
+			std::stoll(value) <= INT_MAX)
+		{
+			operand.value = std::stoi(value);
+		}
+		else if (tokens[position] == Lexer::IDENT)
+		{
+			auto it = layout.offsets.find(value);
+			if (it == layout.offsets.end() || it->second > INT_MAX)
+			{
+				Error(expression, "Variable " + value + " isn't in layout");
+				return expression;
+			}
+			operand.kind = CompiledExpression::OPERAND_VARIABLE;
+			operand.value = (int)it->second;
+		}
+		else
+		{
+			Error(expression, "Expected integer, character or variable at " + value);
+			return expression;
+		}
+		operands.push_back(operand);
+		position++;
+
+		// Once next operator is known, pending operators which bind at least as tight have both operands,
+		// closing parenthesis completes everything since the opening one
+		int precedence = 0;
+		while (precedence == 0)
+		{
+			precedence = (position < tokens.size()) ? Compiler::GetPrecedence(tokens[position]) : 0;
+			while (!pending.empty() && pending.back().op >= 0 && pending.back().precedence >= precedence)
+			{
+				if (!Reduce(expression, operands, pending.back().op, depth))
+				{
+					return expression;
+				}
+				pending.pop_back();
+			}
+
+			if (precedence > 0)
+			{
+				break;
+			}
+
+			if (pending.empty())
+			{
+				if (position < tokens.size())
+				{
+					Error(expression, "Unexpected " + data[position] + " after expression");
+					return expression;
+				}
+
+				// Expression without operators has no code
+				if (operands.back().kind != CompiledExpression::OPERAND_STACK)
+				{
+					expression.result = operands.back();
+				}
+				return expression;
+			}
+
+			if (position == tokens.size() || tokens[position] != Lexer::RPAREN)
+			{
+				Error(expression, "Expected )");
+				return expression;
+			}
+			pending.pop_back();
+			position++;
+		}
+
+		PendingOperator op = { (int)tokens[position], precedence };
+		pending.push_back(op);
+		position++;
+	}
+}
+
+// Evaluate compiled expression with variables in given memory, failed is set when it divides by zero
+// (result is 0 then)
+int Expression::Evaluate(const CompiledExpression& expression, const int* variables, bool* failed)
+{
+	if (failed != nullptr)
+	{
+		*failed = false;
+	}
+
+	if (expression.code.empty())
+	{
+		return (expression.result.kind == CompiledExpression::OPERAND_VARIABLE) ? variables[expression.result.value] : expression.result.value;
+	}
+
+	int stack[MAX_DEPTH];
+	int top = 0;
+	for (const CompiledExpression::Instruction& i : expression.code)
+	{
+		int right = (i.right.kind == CompiledExpression::OPERAND_STACK) ? stack[--top] :
+			(i.right.kind == CompiledExpression::OPERAND_CONSTANT) ? i.right.value : variables[i.right.value];
+		int left = (i.left.kind == CompiledExpression::OPERAND_STACK) ? stack[--top] :
+			(i.left.kind == CompiledExpression::OPERAND_CONSTANT) ? i.left.value : variables[i.left.value];
+
+		if (!Apply(i.op, left, right, stack[top]))
+		{
+			if (failed != nullptr)
+			{
+				*failed = true;
+			}
+			return 0;
+		}
+		top++;
+	}
+	return stack[top - 1];
+}
\ No newline at end of file
@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __EXPRESSION_H__
+#define __EXPRESSION_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include "Diagnostic.h"
+#include "Lexer.h"
+
+// Binding of expression variables to host memory - each name is bound to offset (in ints) of its value
+// in memory passed to evaluation
+struct VariableLayout
+{
+	std::map<std::string, size_t> offsets;		// Offsets of variables (by name)
+
+	// Bind variable to offset
+	void Bind(const std::string& name, size_t offset)
+	{
+		offsets[name] = offset;
+	}
+};
+
+// Expression compiled for evaluation. Constants and variables are read by operators directly, only
+// values computed by operators are kept on stack (its maximum depth is known)
+struct CompiledExpression
+{
+	// Kinds of operands
+	enum Kind
+	{
+		OPERAND_STACK,							// Value computed by previous operator (top of stack)
+		OPERAND_CONSTANT,						// Constant value
+		OPERAND_VARIABLE						// Value in host memory (value is its offset)
+	};
+
+	// Operand of instruction (or result of expression without operators)
+	struct Operand
+	{
+		int kind;								// Kind of operand
+		int value;								// Constant or offset of variable
+	};
+
+	// Binary operator, its result is pushed on stack (right operand is popped before left one)
+	struct Instruction
+	{
+		int op;									// Token of operator
+		Operand left;							// Left operand
+		Operand right;							// Right operand
+	};
+
+	bool success;								// No error was reported
+	std::vector<Diagnostic> diagnostics;		// Reported errors
+	std::vector<Instruction> code;				// Operators in order of evaluation (result is on stack)
+	Operand result;								// Result of expression without operators
+	size_t depth;								// Maximum stack depth
+
+	CompiledExpression()
+	{
+		success = false;
+		result.kind = OPERAND_CONSTANT;
+		result.value = 0;
+		depth = 0;
+	}
+};
+
+// Compilation and evaluation of single expressions of the language (integer and character literals,
+// variables, parentheses and binary operators with the same precedence as in scripts) for hosts which
+// evaluate lots of them. Expression is compiled once (constant parts are folded), then it's evaluated
+// against host memory without allocating anything
+class Expression
+{
+public:
+	enum
+	{
+		MAX_DEPTH = 64							// Maximum stack depth of compiled expression
+	};
+
+private:
+	// Operator waiting for its right operand, or open parenthesis
+	struct PendingOperator
+	{
+		int op;									// Token of operator (-1 for parenthesis)
+		int precedence;							// Precedence of operator
+	};
+
+	// Report error into compiled expression
+	static void Error(CompiledExpression& expression, const std::string& error);
+
+	// Apply operator to values, returns false when it divides by zero
+	static bool Apply(int op, int left, int right, int& result);
+
+	// Combine the two topmost operands by operator, constants are folded and operations which don't
+	// change value are removed. Returns false when expression is too complex
+	static bool Reduce(CompiledExpression& expression, std::vector<CompiledExpression::Operand>& operands, int op, size_t& depth);
+
+public:
+	// Compile expression with variables of given layout
+	static CompiledExpression Compile(const std::string& text, const VariableLayout& layout);
+
+	// Evaluate compiled expression with variables in given memory, failed is set when it divides by zero
+	// (result is 0 then)
+	static int Evaluate(const CompiledExpression& expression, const int* variables, bool* failed = nullptr);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,140 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ExpressionCache.h"
+#include <algorithm>
+#include <iterator>
+
+// Constructor, specify maximum number of cached expressions
+ExpressionCache::ExpressionCache(size_t capacity)
+{
+	mCapacity = std::max(capacity, (size_t)1);
+	mHits = 0;
+	mMisses = 0;
+}
+
+// Hash of expression text and layout of its variables (FNV-1a, nothing is allocated)
+unsigned long long ExpressionCache::Hash(const std::string& text, const VariableLayout& layout)
+{
+	// Text and names are followed by zero, so neither of them can be confused with what follows
+	unsigned long long hash = 14695981039346656037ULL;
+	auto Add = [&hash](const char* data, size_t length)
+	{
+		for (size_t i = 0; i < length; i++)
+		{
+			hash ^= (unsigned char)data[i];
+			hash *= 1099511628211ULL;
+		}
+	};
+
+	Add(text.c_str(), text.length() + 1);
+	for (const auto& v : layout.offsets)
+	{
+		Add(v.first.c_str(), v.first.length() + 1);
+		Add((const char*)&v.second, sizeof(v.second));
+	}
+	return hash;
+}
+
+// Find cached expression with given hash, text and layout, returns end of entries when there is none
+std::list<ExpressionCache::Entry>::iterator ExpressionCache::Find(unsigned long long hash, const std::string& text, const VariableLayout& layout)
+{
+	auto range = mIndex.equal_range(hash);
+	for (auto it = range.first; it != range.second; it++)
+	{
+		if (it->second->text == text && it->second->layout.offsets == layout.offsets)
+		{
+			return it->second;
+		}
+	}
+	return mEntries.end();
+}
+
+// Get compiled expression with variables of given layout (compilation may have failed, see its diagnostics)
+std::shared_ptr<const CompiledExpression> ExpressionCache::Get(const std::string& text, const VariableLayout& layout)
+{
+	// Lookup compares hash first, then text and layout of entries with the same hash
+	unsigned long long hash = Hash(text, layout);
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		auto it = Find(hash, text, layout);
+		if (it != mEntries.end())
+		{
+			mEntries.splice(mEntries.begin(), mEntries, it);
+			mHits++;
+			return it->expression;
+		}
+		mMisses++;
+	}
+
+	// Expression is compiled outside of lock, so other lookups aren't blocked by it (when two of them
+	// compile the same expression at once, the first one stored is kept)
+	std::shared_ptr<const CompiledExpression> expression = std::make_shared<const CompiledExpression>(Expression::Compile(text, layout));
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	auto it = Find(hash, text, layout);
+	if (it != mEntries.end())
+	{
+		return it->expression;
+	}
+
+	Entry e;
+	e.hash = hash;
+	e.text = text;
+	e.layout = layout;
+	e.expression = expression;
+	mEntries.push_front(e);
+	mIndex.insert(std::make_pair(hash, mEntries.begin()));
+
+	while (mEntries.size() > mCapacity)
+	{
+		auto last = std::prev(mEntries.end());
+		auto range = mIndex.equal_range(last->hash);
+		for (auto i = range.first; i != range.second; i++)
+		{
+			if (i->second == last)
+			{
+				mIndex.erase(i);
+				break;
+			}
+		}
+		mEntries.pop_back();
+	}
+	return expression;
+}
+
+// Remove all cached expressions
+void ExpressionCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mEntries.clear();
+	mIndex.clear();
+}
+
+// Get number of cached expressions
+size_t ExpressionCache::GetSize() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mEntries.size();
+}
+
+// Get number of lookups served from cache
+size_t ExpressionCache::GetHits() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mHits;
+}
+
+// Get number of lookups which compiled expression
+size_t ExpressionCache::GetMisses() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mMisses;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __EXPRESSION_CACHE_H__
+#define __EXPRESSION_CACHE_H__
+
+#include <string>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "Expression.h"
+
+// Cache of compiled expressions keyed by their text and layout of their variables (thread-safe). Once it
+// holds given number of expressions, the least recently used one is removed for each new one (callers
+// holding it can still evaluate it)
+class ExpressionCache
+{
+private:
+	// Cached expression
+	struct Entry
+	{
+		unsigned long long hash;								// Hash of text and layout
+		std::string text;										// Text of expression
+		VariableLayout layout;									// Layout of its variables
+		std::shared_ptr<const CompiledExpression> expression;	// Compiled expression
+	};
+
+	std::list<Entry> mEntries;								// Cached expressions (most recently used first)
+	std::multimap<unsigned long long, std::list<Entry>::iterator> mIndex;	// Cached expressions (by hash)
+	size_t mCapacity;										// Maximum number of cached expressions
+	mutable std::mutex mMutex;								// Guards entries and statistics
+	size_t mHits;											// Number of lookups served from cache
+	size_t mMisses;											// Number of lookups which compiled expression
+
+	// Hash of expression text and layout of its variables (FNV-1a, nothing is allocated)
+	static unsigned long long Hash(const std::string& text, const VariableLayout& layout);
+
+	// Find cached expression with given hash, text and layout, returns end of entries when there is none
+	std::list<Entry>::iterator Find(unsigned long long hash, const std::string& text, const VariableLayout& layout);
+
+public:
+	// Constructor, specify maximum number of cached expressions
+	ExpressionCache(size_t capacity = 4096);
+
+	// Get compiled expression with variables of given layout (compilation may have failed, see its diagnostics)
+	std::shared_ptr<const CompiledExpression> Get(const std::string& text, const VariableLayout& layout);
+
+	// Remove all cached expressions
+	void Clear();
+
+	// Get number of cached expressions
+	size_t GetSize() const;
+
+	// Get number of lookups served from cache
+	size_t GetHits() const;
+
+	// Get number of lookups which compiled expression
+	size_t GetMisses() const;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,2769 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "IR.h"
+#include <algorithm>
+#include <climits>
+
+// Parse stack slot address (only [sp+N] is supported)
+bool IR::ParseSlot(const std::string& token, int& slot)
+{
+	if (!StringUtil::starts_with(token, "[sp+") || token[token.length() - 1] != ']')
+	{
+		return false;
+	}
+
+	std::string offset = token.substr(4, token.length() - 5);
+	if (offset.length() == 0)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < offset.length(); i++)
+	{
+		if (!isdigit(offset[i]))
+		{
+			return false;
+		}
+	}
+
+	int value = std::stoi(offset);
+	if (value % 4 != 0)
+	{
+		return false;
+	}
+
+	slot = value / 4;
+	return true;
+}
+
+// Parse stack slot address or address in program frame ([gp+N] sets global)
+bool IR::ParseSlot(const std::string& token, int& slot, bool& global)
+{
+	global = StringUtil::starts_with(token, "[gp+");
+	return ParseSlot(global ? "[sp+" + token.substr(4) : token, slot);
+}
+
+// Get array (it's added when it isn't known yet)
+int IR::GetArrayIndex(int slot, int count, bool global)
+{
+	for (size_t i = 0; i < mArrays.size(); i++)
+	{
+		if (mArrays[i].slot == slot && mArrays[i].count == count && mArrays[i].global == global)
+		{
+			return (int)i;
+		}
+	}
+
+	Array a;
+	a.slot = slot;
+	a.count = count;
+	a.global = global;
+	mArrays.push_back(a);
+	return (int)mArrays.size() - 1;
+}
+
+// Parse integer constant
+bool IR::ParseInteger(const std::string& token, int& value)
+{
+	size_t start = (token.length() > 1 && token[0] == '-') ? 1 : 0;
+	if (token.length() == start)
+	{
+		return false;
+	}
+
+	for (size_t i = start; i < token.length(); i++)
+	{
+		if (!isdigit(token[i]))
+		{
+			return false;
+		}
+	}
+
+	value = (int)std::stoll(token);
+	return true;
+}
+
+// Parse register (only r0 and r1 are variables)
+int IR::ParseRegister(const std::string& token)
+{
+	if (token == "r0")
+	{
+		return VAR_R0;
+	}
+	else if (token == "r1")
+	{
+		return VAR_R1;
+	}
+
+	return -1;
+}
+
+// Parse arithmetic instruction (writing result into its first operand)
+bool IR::ParseArithmetic(const std::string& token, Opcode& op)
+{
+	static const std::map<std::string, Opcode> opcodes =
+	{
+		{ "add.i32", ADD }, { "sub.i32", SUB }, { "mul.i32", MUL }, { "div.i32", DIV },
+		{ "shl.i32", SHL }, { "shr.i32", SHR }, { "sar.i32", SAR },
+		{ "and.i32", AND }, { "or.i32", OR }, { "xor.i32", XOR }, { "mulhi.i32", MULHI }
+	};
+
+	auto it = opcodes.find(token);
+	if (it == opcodes.end())
+	{
+		return false;
+	}
+
+	op = it->second;
+	return true;
+}
+
+// Parse fused compare and jump instruction (second operand is either register or constant)
+bool IR::ParseCompareJump(const std::string& token, Opcode& op, bool& immediate)
+{
+	static const std::map<std::string, Opcode> opcodes =
+	{
+		{ "jlt", CMPLESS }, { "jle", CMPLEQ }, { "jgt", CMPGREATER },
+		{ "jge", CMPGEQ }, { "jeq", CMPEQ }, { "jne", CMPNEQ }
+	};
+
+	size_t dot = token.find('.');
+	if (dot == std::string::npos)
+	{
+		return false;
+	}
+
+	auto it = opcodes.find(token.substr(0, dot));
+	std::string operands = token.substr(dot);
+	if (it == opcodes.end() || (operands != ".reg.reg" && operands != ".reg.i32"))
+	{
+		return false;
+	}
+
+	op = it->second;
+	immediate = (operands == ".reg.i32");
+	return true;
+}
+
+// Parse counted loop instruction (bound is either constant or variable in memory)
+bool IR::ParseLoop(const std::string& token, Opcode& op, bool& immediate)
+{
+	static const std::map<std::string, Opcode> opcodes =
+	{
+		{ "loop.lt", CMPLESS }, { "loop.le", CMPLEQ }, { "loop.gt", CMPGREATER },
+		{ "loop.ge", CMPGEQ }, { "loop.eq", CMPEQ }, { "loop.ne", CMPNEQ }
+	};
+
+	size_t dot = token.rfind('.');
+	if (dot == std::string::npos)
+	{
+		return false;
+	}
+
+	auto it = opcodes.find(token.substr(0, dot));
+	std::string operands = token.substr(dot);
+	if (it == opcodes.end() || (operands != ".i32" && operands != ".mem"))
+	{
+		return false;
+	}
+
+	op = it->second;
+	immediate = (operands == ".i32");
+	return true;
+}
+
+IR::IR()
+{
+	mSlots = 0;
+	mExitSlots = 0;
+	mUndef = -1;
+}
+
+// Create new value in block (not inserted into block code)
+int IR::NewValue(Opcode op, int block, int imm, const std::vector<int>& operands, int lanes)
+{
+	Value v;
+	v.op = op;
+	v.block = block;
+	v.imm = imm;
+	v.lanes = lanes;
+	v.operands = operands;
+	v.forward = -1;
+	v.removed = false;
+	mValues.push_back(v);
+	return (int)mValues.size() - 1;
+}
+
+// Create new block (appended to layout)
+int IR::NewBlock()
+{
+	Block b;
+	b.term = EXIT;
+	b.cond = -1;
+	b.removed = false;
+	mBlocks.push_back(b);
+	mLayout.push_back((int)mBlocks.size() - 1);
+	return (int)mBlocks.size() - 1;
+}
+
+// Create new variable (stack slot which isn't used by original program), returns its index
+int IR::NewVariable()
+{
+	int vars = GetVariablesCount();
+	mSlots++;
+
+	for (Block& b : mBlocks)
+	{
+		if ((int)b.entry.size() == vars)
+		{
+			b.entry.push_back(-1);
+		}
+
+		if ((int)b.exit.size() == vars)
+		{
+			b.exit.push_back(-1);
+		}
+	}
+
+	return vars;
+}
+
+// Move block in layout right after another block
+void IR::MoveBlockAfter(int block, int after)
+{
+	mLayout.erase(std::find(mLayout.begin(), mLayout.end(), block));
+	mLayout.insert(std::find(mLayout.begin(), mLayout.end(), after) + 1, block);
+}
+
+// Move block in layout right before another block
+void IR::MoveBlockBefore(int block, int before)
+{
+	mLayout.erase(std::find(mLayout.begin(), mLayout.end(), block));
+	mLayout.insert(std::find(mLayout.begin(), mLayout.end(), before), block);
+}
+
+// Remove (single occurrence of) predecessor of block, together with its phi operands
+void IR::RemovePredecessor(int block, int pred)
+{
+	Block& b = mBlocks[block];
+	auto it = std::find(b.preds.begin(), b.preds.end(), pred);
+	if (it == b.preds.end())
+	{
+		return;
+	}
+
+	size_t index = it - b.preds.begin();
+	b.preds.erase(it);
+	for (int p : b.phis)
+	{
+		mValues[p].operands.erase(mValues[p].operands.begin() + index);
+	}
+}
+
+// Replace predecessor of block with another one (phi operands stay as they are)
+void IR::ReplacePredecessor(int block, int pred, int by)
+{
+	Block& b = mBlocks[block];
+	auto it = std::find(b.preds.begin(), b.preds.end(), pred);
+	if (it != b.preds.end())
+	{
+		*it = by;
+	}
+}
+
+// Remove blocks which can't be reached from entry, returns true if any was removed
+bool IR::RemoveUnreachable()
+{
+	std::vector<bool> reachable(mBlocks.size(), false);
+	std::vector<int> stack;
+	stack.push_back(0);
+	reachable[0] = true;
+	while (!stack.empty())
+	{
+		int b = stack.back();
+		stack.pop_back();
+		for (int s : mBlocks[b].succs)
+		{
+			if (!reachable[s])
+			{
+				reachable[s] = true;
+				stack.push_back(s);
+			}
+		}
+	}
+
+	bool changed = false;
+	for (size_t b = 0; b < mBlocks.size(); b++)
+	{
+		Block& blk = mBlocks[b];
+		if (reachable[b] || blk.removed)
+		{
+			continue;
+		}
+
+		for (int s : blk.succs)
+		{
+			if (reachable[s])
+			{
+				RemovePredecessor(s, (int)b);
+			}
+		}
+
+		for (int p : blk.phis)
+		{
+			mValues[p].removed = true;
+		}
+
+		for (int c : blk.code)
+		{
+			mValues[c].removed = true;
+		}
+
+		blk.removed = true;
+		blk.succs.clear();
+		blk.preds.clear();
+		changed = true;
+	}
+
+	return changed;
+}
+
+// Build IR from assembly, returns false in case assembly can't be represented
+bool IR::Build(const std::vector<std::string>& assembly)
+{
+	// Single instruction of block, with stack depth (in slots) before it
+	struct Instruction
+	{
+		std::vector<std::string> tokens;
+		int depth;
+	};
+
+	enum Jump
+	{
+		JUMP_NONE,
+		JUMP_JMP,
+		JUMP_JZ,
+		JUMP_JNZ,
+		JUMP_COMPARE,
+		JUMP_RETURN,
+		JUMP_TABLE
+	};
+
+	mValues.clear();
+	mBlocks.clear();
+	mLayout.clear();
+	mSlots = 0;
+	mExitSlots = 0;
+	mProcedure.clear();
+	mArguments.clear();
+	mCallTargets.clear();
+	mArrays.clear();
+	mMemory.clear();
+
+	std::vector<std::vector<Instruction> > code;
+	std::vector<Jump> jumps;
+	std::vector<std::string> targets;
+	std::map<int, std::vector<std::string> > tables;
+	std::vector<int> jumpDepths;
+	std::map<std::string, int> labels;
+	std::map<std::string, int> labelDepths;
+
+	// Split assembly into basic blocks, block 0 is an entry block (never target of a jump)
+	int current = NewBlock();
+	code.push_back(std::vector<Instruction>());
+	jumps.push_back(JUMP_NONE);
+	targets.push_back("");
+	jumpDepths.push_back(0);
+
+	// Array accessed by element index (slots of array in frame of this unit are used)
+	auto AddArray = [this](const std::string& address, const std::string& elements)
+	{
+		int slot = 0;
+		int count = 0;
+		bool global = false;
+		if (!ParseSlot(address, slot, global) || !ParseInteger(elements, count) || count <= 0)
+		{
+			return false;
+		}
+
+		GetArrayIndex(slot, count, global);
+		if (!global)
+		{
+			mSlots = std::max(mSlots, slot + count);
+		}
+		return true;
+	};
+
+	bool closed = false;
+	bool global = false;
+	int depth = 0;
+	int arguments = 0;
+	for (const std::string& line : assembly)
+	{
+		std::string l = line;
+		StringUtil::trim(l);
+		if (l.length() == 0)
+		{
+			continue;
+		}
+
+		std::vector<std::string> t;
+		for (std::string& s : StringUtil::split(l, ' '))
+		{
+			StringUtil::trim(s);
+			if (s.length() > 0)
+			{
+				t.push_back(s);
+			}
+		}
+
+		// Label begins new block (unless we're at the beginning of an unlabeled one)
+		if (t[0][t[0].length() - 1] == ':')
+		{
+			std::string label = t[0].substr(0, t[0].length() - 1);
+			if (labels.find(label) != labels.end())
+			{
+				return false;
+			}
+
+			if (current == 0 || closed || !code[current].empty() || !mBlocks[current].label.empty())
+			{
+				current = NewBlock();
+				code.push_back(std::vector<Instruction>());
+				jumps.push_back(JUMP_NONE);
+				targets.push_back("");
+				jumpDepths.push_back(0);
+			}
+			closed = false;
+
+			mBlocks[current].label = label;
+			labels[label] = current;
+			labelDepths[label] = depth;
+			continue;
+		}
+
+		// Procedure begins with its arguments on stack
+		if (t[0] == "proc")
+		{
+			if (t.size() != 3 || current != 0 || !code[current].empty() || !mProcedure.empty() ||
+				!ParseInteger(t[2], arguments) || arguments < 0)
+			{
+				return false;
+			}
+
+			mProcedure = t[1];
+			depth = arguments;
+			mSlots = std::max(mSlots, depth);
+			continue;
+		}
+
+		if (closed)
+		{
+			current = NewBlock();
+			code.push_back(std::vector<Instruction>());
+			jumps.push_back(JUMP_NONE);
+			targets.push_back("");
+			jumpDepths.push_back(0);
+			closed = false;
+		}
+
+		Instruction i;
+		i.tokens = t;
+		i.depth = depth;
+		code[current].push_back(i);
+
+		// Track stack depth and used slots
+		int slot = 0;
+		Opcode compare = UNDEF;
+		bool immediate = false;
+		if (t[0] == "push.i32")
+		{
+			depth++;
+			mSlots = std::max(mSlots, depth);
+		}
+		else if (t[0] == "pop.i32")
+		{
+			depth--;
+			if (depth < 0)
+			{
+				return false;
+			}
+		}
+		else if (t[0] == "reserve" || t[0] == "release")
+		{
+			int count = 0;
+			if (t.size() != 2 || !ParseInteger(t[1], count) || count < 0)
+			{
+				return false;
+			}
+
+			depth += (t[0] == "reserve") ? count : -count;
+			if (depth < 0)
+			{
+				return false;
+			}
+			mSlots = std::max(mSlots, depth);
+		}
+		else if (t[0] == "mov.mem.reg.i32" && t.size() == 3)
+		{
+			if (!ParseSlot(t[1], slot, global))
+			{
+				return false;
+			}
+			mSlots = global ? mSlots : std::max(mSlots, slot + 1);
+		}
+		else if (t[0] == "mov.reg.mem.i32" && t.size() == 3)
+		{
+			if (!ParseSlot(t[2], slot, global))
+			{
+				return false;
+			}
+			mSlots = global ? mSlots : std::max(mSlots, slot + 1);
+		}
+		else if (t[0] == "array")
+		{
+			// Declared array doesn't have to be indexed by variable, its slots are elements anyway
+			if (t.size() != 3 || !ParseSlot(t[1], slot) || !AddArray(t[1], t[2]))
+			{
+				return false;
+			}
+		}
+		else if ((t[0] == "mov.reg.idx.i32" || t[0] == "mov.reg.idx.nc.i32") && t.size() == 5)
+		{
+			if (!AddArray(t[2], t[4]))
+			{
+				return false;
+			}
+		}
+		else if ((t[0] == "mov.idx.reg.i32" || t[0] == "mov.idx.reg.nc.i32") && t.size() == 5)
+		{
+			if (!AddArray(t[1], t[3]))
+			{
+				return false;
+			}
+		}
+		else if ((t[0] == "jmp" || t[0] == "jz" || t[0] == "jnz") && t.size() == 2)
+		{
+			jumps[current] = (t[0] == "jmp") ? JUMP_JMP : ((t[0] == "jz") ? JUMP_JZ : JUMP_JNZ);
+			targets[current] = t[1];
+			jumpDepths[current] = depth;
+			closed = true;
+		}
+		else if (ParseCompareJump(t[0], compare, immediate) && t.size() == 4)
+		{
+			jumps[current] = JUMP_COMPARE;
+			targets[current] = t[3];
+			jumpDepths[current] = depth;
+			closed = true;
+		}
+		else if (ParseLoop(t[0], compare, immediate) && t.size() == 5)
+		{
+			int bound = 0;
+			if (!ParseSlot(t[1], slot) || (!immediate && !ParseSlot(t[3], bound)))
+			{
+				return false;
+			}
+			mSlots = std::max(mSlots, std::max(slot, bound) + 1);
+
+			jumps[current] = JUMP_COMPARE;
+			targets[current] = t[4];
+			jumpDepths[current] = depth;
+			closed = true;
+		}
+		else if (t[0] == "jmp.table" && t.size() >= 4)
+		{
+			// Default is the first target, followed by table entries
+			jumps[current] = JUMP_TABLE;
+			targets[current] = t[3];
+			tables[current].assign(t.begin() + 4, t.end());
+			jumpDepths[current] = depth;
+			closed = true;
+		}
+		else if (t[0] == "call" && t.size() == 3)
+		{
+			// Callee removes arguments from stack
+			int count = 0;
+			if (!ParseInteger(t[2], count) || count < 0 || count > depth)
+			{
+				return false;
+			}
+			depth -= count;
+		}
+		else if (t[0] == "ret" && mProcedure.empty())
+		{
+			return false;
+		}
+		else if (t[0] == "ret")
+		{
+			jumps[current] = JUMP_RETURN;
+			closed = true;
+		}
+	}
+
+	mExitSlots = depth;
+
+	// Elements of arrays are kept in memory
+	mMemory.assign(mSlots, false);
+	for (const Array& a : mArrays)
+	{
+		for (int x = 0; x < a.count && !a.global; x++)
+		{
+			mMemory[a.slot + x] = true;
+		}
+	}
+
+	// Last block is always an empty exit block, so everything has a block to fall through into
+	current = NewBlock();
+	code.push_back(std::vector<Instruction>());
+	jumps.push_back(JUMP_NONE);
+	targets.push_back("");
+	jumpDepths.push_back(0);
+
+	// Connect blocks
+	for (size_t b = 0; b < mBlocks.size(); b++)
+	{
+		int target = -1;
+		if (jumps[b] != JUMP_NONE && jumps[b] != JUMP_RETURN)
+		{
+			auto it = labels.find(targets[b]);
+			if (it == labels.end())
+			{
+				return false;
+			}
+
+			// Stack slots are addressed statically, jump has to keep stack depth (declaration
+			// inside of a loop grows the stack on each iteration)
+			if (labelDepths[targets[b]] != jumpDepths[b])
+			{
+				return false;
+			}
+			target = it->second;
+		}
+
+		std::vector<int> entries;
+		for (const std::string& label : tables[(int)b])
+		{
+			auto it = labels.find(label);
+			if (it == labels.end() || labelDepths[label] != jumpDepths[b])
+			{
+				return false;
+			}
+			entries.push_back(it->second);
+		}
+
+		int next = (int)b + 1;
+		switch (jumps[b])
+		{
+		case JUMP_NONE:
+			if (next < (int)mBlocks.size())
+			{
+				mBlocks[b].term = GOTO;
+				mBlocks[b].succs.push_back(next);
+			}
+			else
+			{
+				mBlocks[b].term = EXIT;
+			}
+			break;
+
+		case JUMP_JMP:
+			mBlocks[b].term = GOTO;
+			mBlocks[b].succs.push_back(target);
+			break;
+
+		case JUMP_JZ:
+			mBlocks[b].term = BRANCH;
+			mBlocks[b].succs.push_back(next);
+			mBlocks[b].succs.push_back(target);
+			break;
+
+		case JUMP_JNZ:
+		case JUMP_COMPARE:
+			mBlocks[b].term = BRANCH;
+			mBlocks[b].succs.push_back(target);
+			mBlocks[b].succs.push_back(next);
+			break;
+
+		case JUMP_RETURN:
+			mBlocks[b].term = RETURN;
+			break;
+
+		case JUMP_TABLE:
+			mBlocks[b].term = SWITCH;
+			mBlocks[b].succs.push_back(target);
+			mBlocks[b].succs.insert(mBlocks[b].succs.end(), entries.begin(), entries.end());
+			break;
+		}
+	}
+
+	// Remove unreachable blocks
+	std::vector<bool> reachable(mBlocks.size(), false);
+	std::vector<int> stack;
+	stack.push_back(0);
+	reachable[0] = true;
+	while (!stack.empty())
+	{
+		int b = stack.back();
+		stack.pop_back();
+		for (int s : mBlocks[b].succs)
+		{
+			if (!reachable[s])
+			{
+				reachable[s] = true;
+				stack.push_back(s);
+			}
+		}
+	}
+
+	for (size_t b = 0; b < mBlocks.size(); b++)
+	{
+		if (!reachable[b])
+		{
+			mBlocks[b].removed = true;
+			mBlocks[b].succs.clear();
+			code[b].clear();
+		}
+	}
+
+	// Procedure can be left only by return
+	if (!mProcedure.empty() && reachable[current])
+	{
+		return false;
+	}
+
+	ComputePredecessors();
+
+	// Construct SSA - blocks are processed in layout order, blocks which have single already
+	// processed predecessor inherit its variables, all other blocks get phi node for each variable
+	int vars = GetVariablesCount();
+	mUndef = NewValue(UNDEF, 0, 0, std::vector<int>());
+	std::vector<bool> done(mBlocks.size(), false);
+
+	for (size_t b = 0; b < mBlocks.size(); b++)
+	{
+		if (mBlocks[b].removed)
+		{
+			continue;
+		}
+
+		std::vector<int> cur(vars, mUndef);
+		for (int x = VAR_SLOTS; x < vars; x++)
+		{
+			cur[x] = IsMemory(x) ? -1 : cur[x];
+		}
+
+		if (b == 0)
+		{
+			for (int x = 0; x < arguments; x++)
+			{
+				cur[VAR_SLOTS + x] = NewValue(ARG, 0, x, std::vector<int>());
+				mArguments.push_back(cur[VAR_SLOTS + x]);
+			}
+		}
+		else
+		{
+			if (mBlocks[b].preds.size() == 1 && done[mBlocks[b].preds[0]])
+			{
+				cur = mBlocks[mBlocks[b].preds[0]].exit;
+			}
+			else
+			{
+				for (int x = 0; x < vars; x++)
+				{
+					if (!IsMemory(x))
+					{
+						cur[x] = NewValue(PHI, (int)b, x, std::vector<int>());
+						mBlocks[b].phis.push_back(cur[x]);
+					}
+				}
+			}
+		}
+		mBlocks[b].entry = cur;
+
+		for (const Instruction& i : code[b])
+		{
+			const std::vector<std::string>& t = i.tokens;
+			const std::string& op = t[0];
+
+			int slot = 0;
+			int imm = 0;
+			Opcode arithmetic = UNDEF;
+			Opcode compare = UNDEF;
+			bool immediate = false;
+			int a = (t.size() > 1) ? ParseRegister(t[1]) : -1;
+			int c = (t.size() > 2) ? ParseRegister(t[2]) : -1;
+
+			// Element at constant address (global one is accessed as array of single element)
+			auto Element = [&](int address, bool inProgram, int& array)
+			{
+				int index = 0;
+				array = inProgram ? GetArrayIndex(address, 1, true) : -1;
+				for (size_t x = 0; x < mArrays.size() && array == -1; x++)
+				{
+					if (!mArrays[x].global && address >= mArrays[x].slot && address < mArrays[x].slot + mArrays[x].count)
+					{
+						array = (int)x;
+						index = address - mArrays[x].slot;
+					}
+				}
+
+				int element = NewValue(CONST, (int)b, index, std::vector<int>());
+				mBlocks[b].code.push_back(element);
+				return element;
+			};
+
+			// Read and write of stack slot, slots which are elements of arrays (they may be reused by
+			// variables of other scopes) are accessed in memory
+			auto Read = [&](int address, bool inProgram)
+			{
+				if (!inProgram && !IsMemory(VAR_SLOTS + address))
+				{
+					return cur[VAR_SLOTS + address];
+				}
+
+				int array = 0;
+				int element = Element(address, inProgram, array);
+				int value = NewValue(LOAD_UNCHECKED, (int)b, array, { element });
+				mBlocks[b].code.push_back(value);
+				return value;
+			};
+
+			auto Write = [&](int address, bool inProgram, int value)
+			{
+				if (!inProgram && !IsMemory(VAR_SLOTS + address))
+				{
+					cur[VAR_SLOTS + address] = value;
+					return;
+				}
+
+				int array = 0;
+				int element = Element(address, inProgram, array);
+				mBlocks[b].code.push_back(NewValue(STORE_UNCHECKED, (int)b, array, { element, value }));
+			};
+
+			// Access of element indexed by register
+			auto Indexed = [&](const std::string& address, const std::string& elements, int& array)
+			{
+				int count = 0;
+				ParseSlot(address, slot, global);
+				ParseInteger(elements, count);
+				array = GetArrayIndex(slot, count, global);
+			};
+
+			if (op == "mov.reg.i32" && t.size() == 3 && a >= 0 && ParseInteger(t[2], imm))
+			{
+				cur[a] = NewValue(CONST, (int)b, imm, std::vector<int>());
+				mBlocks[b].code.push_back(cur[a]);
+			}
+			else if (op == "mov.reg.str" && t.size() == 3 && a >= 0 && ParseInteger(t[2], imm))
+			{
+				cur[a] = NewValue(STRING, (int)b, imm, std::vector<int>());
+				mBlocks[b].code.push_back(cur[a]);
+			}
+			else if (op == "mov.reg.reg" && t.size() == 3 && a >= 0 && c >= 0)
+			{
+				cur[a] = cur[c];
+			}
+			else if (ParseArithmetic(op, arithmetic) && t.size() == 3 && a >= 0 && c >= 0)
+			{
+				cur[a] = NewValue(arithmetic, (int)b, 0, { cur[a], cur[c] });
+				mBlocks[b].code.push_back(cur[a]);
+			}
+			else if (op == "neg.i32" && t.size() == 2 && a >= 0)
+			{
+				cur[a] = NewValue(NEG, (int)b, 0, { cur[a] });
+				mBlocks[b].code.push_back(cur[a]);
+			}
+			else if ((op == "cmpleq.i32" || op == "cmpgeq.i32" || op == "cmpless.i32" ||
+				op == "cmpgreater.i32" || op == "cmpeq.i32" || op == "cmpneq.i32") && t.size() == 3 && a >= 0 && c >= 0)
+			{
+				Opcode o = CMPNEQ;
+				if (op == "cmpleq.i32") o = CMPLEQ;
+				else if (op == "cmpgeq.i32") o = CMPGEQ;
+				else if (op == "cmpless.i32") o = CMPLESS;
+				else if (op == "cmpgreater.i32") o = CMPGREATER;
+				else if (op == "cmpeq.i32") o = CMPEQ;
+				cur[VAR_R0] = NewValue(o, (int)b, 0, { cur[a], cur[c] });
+				mBlocks[b].code.push_back(cur[VAR_R0]);
+			}
+			else if (op == "push.i32" && t.size() == 2 && a >= 0)
+			{
+				Write(i.depth, false, cur[a]);
+			}
+			else if (op == "pop.i32" && t.size() == 2 && a >= 0)
+			{
+				cur[a] = Read(i.depth - 1, false);
+			}
+			else if (op == "reserve" && ParseInteger(t[1], imm))
+			{
+				// Reserved slots aren't initialized
+				for (int s = 0; s < imm; s++)
+				{
+					cur[VAR_SLOTS + i.depth + s] = IsMemory(VAR_SLOTS + i.depth + s) ? -1 : mUndef;
+				}
+			}
+			else if (op == "release" || op == "array")
+			{
+				// Released slots are dead, declared arrays were already found, nothing to do
+			}
+			else if (op == "mov.mem.reg.i32" && t.size() == 3 && c >= 0 && ParseSlot(t[1], slot, global))
+			{
+				Write(slot, global, cur[c]);
+			}
+			else if (op == "mov.reg.mem.i32" && t.size() == 3 && a >= 0 && ParseSlot(t[2], slot, global))
+			{
+				cur[a] = Read(slot, global);
+			}
+			else if ((op == "mov.reg.idx.i32" || op == "mov.reg.idx.nc.i32") && t.size() == 5 && a >= 0 && ParseRegister(t[3]) >= 0)
+			{
+				int array = 0;
+				Indexed(t[2], t[4], array);
+				cur[a] = NewValue((op == "mov.reg.idx.i32") ? LOAD : LOAD_UNCHECKED, (int)b, array, { cur[ParseRegister(t[3])] });
+				mBlocks[b].code.push_back(cur[a]);
+			}
+			else if ((op == "mov.idx.reg.i32" || op == "mov.idx.reg.nc.i32") && t.size() == 5 && ParseRegister(t[2]) >= 0 && ParseRegister(t[4]) >= 0)
+			{
+				int array = 0;
+				Indexed(t[1], t[3], array);
+				int value = NewValue((op == "mov.idx.reg.i32") ? STORE : STORE_UNCHECKED, (int)b, array, { cur[ParseRegister(t[2])], cur[ParseRegister(t[4])] });
+				mBlocks[b].code.push_back(value);
+			}
+			else if (op == "jmp" && t.size() == 2)
+			{
+				// Handled by block terminator
+			}
+			else if ((op == "jz" || op == "jnz") && t.size() == 2)
+			{
+				mBlocks[b].cond = cur[VAR_R0];
+			}
+			else if (op == "jmp.table" && t.size() >= 4 && a >= 0 && ParseInteger(t[2], imm))
+			{
+				// Switch selects by index into table, base is subtracted first
+				mBlocks[b].cond = cur[a];
+				if (imm != 0)
+				{
+					int base = NewValue(CONST, (int)b, imm, std::vector<int>());
+					mBlocks[b].code.push_back(base);
+					mBlocks[b].cond = NewValue(SUB, (int)b, 0, { cur[a], base });
+					mBlocks[b].code.push_back(mBlocks[b].cond);
+				}
+			}
+			else if (ParseCompareJump(op, compare, immediate) && t.size() == 4 && a >= 0 && (immediate || c >= 0))
+			{
+				// Result of fused comparison isn't stored in any register
+				int right = immediate ? -1 : cur[c];
+				if (immediate)
+				{
+					if (!ParseInteger(t[2], imm))
+					{
+						return false;
+					}
+					right = NewValue(CONST, (int)b, imm, std::vector<int>());
+					mBlocks[b].code.push_back(right);
+				}
+				mBlocks[b].cond = NewValue(compare, (int)b, 0, { cur[a], right });
+				mBlocks[b].code.push_back(mBlocks[b].cond);
+			}
+			else if (ParseLoop(op, compare, immediate) && t.size() == 5 && ParseSlot(t[1], slot) && ParseInteger(t[2], imm))
+			{
+				// Counter is stepped in memory first, then compared against bound
+				int step = NewValue(CONST, (int)b, imm, std::vector<int>());
+				mBlocks[b].code.push_back(step);
+				int counter = NewValue(ADD, (int)b, 0, { Read(slot, false), step });
+				mBlocks[b].code.push_back(counter);
+				Write(slot, false, counter);
+
+				int bound = 0;
+				if (immediate)
+				{
+					if (!ParseInteger(t[3], imm))
+					{
+						return false;
+					}
+					bound = NewValue(CONST, (int)b, imm, std::vector<int>());
+					mBlocks[b].code.push_back(bound);
+				}
+				else
+				{
+					if (!ParseSlot(t[3], bound))
+					{
+						return false;
+					}
+					bound = Read(bound, false);
+				}
+				mBlocks[b].cond = NewValue(compare, (int)b, 0, { counter, bound });
+				mBlocks[b].code.push_back(mBlocks[b].cond);
+			}
+			else if (op == "call" && t.size() == 3 && ParseInteger(t[2], imm))
+			{
+				// Arguments are the topmost stack slots, result is returned in r0 and r1 isn't preserved
+				std::vector<int> operands;
+				for (int x = i.depth - imm; x < i.depth; x++)
+				{
+					operands.push_back(Read(x, false));
+				}
+				mCallTargets.push_back(t[1]);
+				cur[VAR_R0] = NewValue(CALL, (int)b, (int)mCallTargets.size() - 1, operands);
+				cur[VAR_R1] = mUndef;
+				mBlocks[b].code.push_back(cur[VAR_R0]);
+			}
+			else if (op == "ret" && t.size() == 1)
+			{
+				mBlocks[b].cond = cur[VAR_R0];
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		mBlocks[b].exit = cur;
+		done[b] = true;
+	}
+
+	// Fill in phi operands
+	for (Block& blk : mBlocks)
+	{
+		for (int p : blk.phis)
+		{
+			for (int pred : blk.preds)
+			{
+				mValues[p].operands.push_back(mBlocks[pred].exit[mValues[p].imm]);
+			}
+		}
+	}
+
+	return true;
+}
+
+// Get value following replacements
+int IR::Resolve(int value)
+{
+	if (value < 0)
+	{
+		return value;
+	}
+
+	int result = value;
+	while (mValues[result].forward != -1)
+	{
+		result = mValues[result].forward;
+	}
+
+	// Shorten the chain for next time
+	while (mValues[value].forward != -1 && mValues[value].forward != result)
+	{
+		int next = mValues[value].forward;
+		mValues[value].forward = result;
+		value = next;
+	}
+
+	return result;
+}
+
+// Replace value with another one
+void IR::Replace(int value, int by)
+{
+	by = Resolve(by);
+	if (value == by)
+	{
+		return;
+	}
+
+	mValues[value].forward = by;
+	mValues[value].removed = true;
+}
+
+// Rewrite all references to replaced values
+void IR::Canonicalize()
+{
+	for (Value& v : mValues)
+	{
+		if (v.removed)
+		{
+			continue;
+		}
+
+		for (int& o : v.operands)
+		{
+			o = Resolve(o);
+		}
+	}
+
+	for (Block& b : mBlocks)
+	{
+		if (b.removed)
+		{
+			continue;
+		}
+
+		b.cond = Resolve(b.cond);
+
+		for (int& e : b.entry)
+		{
+			e = Resolve(e);
+			if (e >= 0 && mValues[e].removed)
+			{
+				e = -1;
+			}
+		}
+
+		for (int& e : b.exit)
+		{
+			e = Resolve(e);
+			if (e >= 0 && mValues[e].removed)
+			{
+				e = -1;
+			}
+		}
+
+		b.phis.erase(std::remove_if(b.phis.begin(), b.phis.end(), [this](int v) { return mValues[v].removed; }), b.phis.end());
+		b.code.erase(std::remove_if(b.code.begin(), b.code.end(), [this](int v) { return mValues[v].removed; }), b.code.end());
+	}
+}
+
+// Compute predecessors from successors
+void IR::ComputePredecessors()
+{
+	for (Block& b : mBlocks)
+	{
+		b.preds.clear();
+	}
+
+	for (size_t b = 0; b < mBlocks.size(); b++)
+	{
+		if (mBlocks[b].removed)
+		{
+			continue;
+		}
+
+		for (int s : mBlocks[b].succs)
+		{
+			mBlocks[s].preds.push_back((int)b);
+		}
+	}
+}
+
+// Blocks in reverse postorder
+std::vector<int> IR::ReversePostorder()
+{
+	std::vector<int> order;
+	std::vector<bool> visited(mBlocks.size(), false);
+	std::vector<std::pair<int, size_t> > stack;
+
+	stack.push_back(std::pair<int, size_t>(0, 0));
+	visited[0] = true;
+	while (!stack.empty())
+	{
+		int b = stack.back().first;
+		size_t& next = stack.back().second;
+		if (next < mBlocks[b].succs.size())
+		{
+			int s = mBlocks[b].succs[next++];
+			if (!visited[s])
+			{
+				visited[s] = true;
+				stack.push_back(std::pair<int, size_t>(s, 0));
+			}
+		}
+		else
+		{
+			order.push_back(b);
+			stack.pop_back();
+		}
+	}
+
+	std::reverse(order.begin(), order.end());
+	return order;
+}
+
+// Compute dominator tree (Cooper, Harvey & Kennedy iterative algorithm)
+void IR::ComputeDominators()
+{
+	std::vector<int> order = ReversePostorder();
+	std::vector<int> index(mBlocks.size(), -1);
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		index[order[i]] = (int)i;
+	}
+
+	mIdom.assign(mBlocks.size(), -1);
+	mIdom[0] = 0;
+
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (size_t i = 1; i < order.size(); i++)
+		{
+			int b = order[i];
+			int idom = -1;
+			for (int p : mBlocks[b].preds)
+			{
+				if (mIdom[p] == -1)
+				{
+					continue;
+				}
+
+				if (idom == -1)
+				{
+					idom = p;
+					continue;
+				}
+
+				// Intersect
+				int f1 = p;
+				int f2 = idom;
+				while (f1 != f2)
+				{
+					while (index[f1] > index[f2])
+					{
+						f1 = mIdom[f1];
+					}
+					while (index[f2] > index[f1])
+					{
+						f2 = mIdom[f2];
+					}
+				}
+				idom = f1;
+			}
+
+			if (mIdom[b] != idom)
+			{
+				mIdom[b] = idom;
+				changed = true;
+			}
+		}
+	}
+
+	mDomChildren.assign(mBlocks.size(), std::vector<int>());
+	for (int b : order)
+	{
+		if (b != 0 && mIdom[b] != -1)
+		{
+			mDomChildren[mIdom[b]].push_back(b);
+		}
+	}
+}
+
+// Returns true when block a dominates block b
+bool IR::Dominates(int a, int b)
+{
+	while (b != a)
+	{
+		if (b == 0 || mIdom[b] == -1)
+		{
+			return false;
+		}
+		b = mIdom[b];
+	}
+	return true;
+}
+
+bool IR::IsBinary(Opcode op)
+{
+	return op >= ADD && op <= MULHI && op != NEG;
+}
+
+bool IR::IsCommutative(Opcode op)
+{
+	return op == ADD || op == MUL || op == CMPEQ || op == CMPNEQ || op == AND || op == OR || op == XOR || op == MULHI;
+}
+
+bool IR::IsCompare(Opcode op)
+{
+	return op >= CMPLEQ && op <= CMPNEQ;
+}
+
+bool IR::IsLoad(Opcode op)
+{
+	return op == LOAD || op == LOAD_UNCHECKED || op == VLOAD;
+}
+
+bool IR::IsStore(Opcode op)
+{
+	return op == STORE || op == STORE_UNCHECKED || op == VSTORE;
+}
+
+bool IR::IsVector(Opcode op)
+{
+	return op >= VLOAD && op <= VCMPNEQ && op != VSTORE;
+}
+
+// Comparison with negated result (a < b turns into a >= b)
+IR::Opcode IR::NegateCompare(Opcode op)
+{
+	switch (op)
+	{
+	case CMPLEQ: return CMPGREATER;
+	case CMPGEQ: return CMPLESS;
+	case CMPLESS: return CMPGEQ;
+	case CMPGREATER: return CMPLEQ;
+	case CMPEQ: return CMPNEQ;
+	case CMPNEQ: return CMPEQ;
+	default: return op;
+	}
+}
+
+// Comparison with swapped operands (a < b turns into b > a)
+IR::Opcode IR::SwapCompare(Opcode op)
+{
+	switch (op)
+	{
+	case CMPLEQ: return CMPGEQ;
+	case CMPGEQ: return CMPLEQ;
+	case CMPLESS: return CMPGREATER;
+	case CMPGREATER: return CMPLESS;
+	default: return op;
+	}
+}
+
+// Index of successor taken by switch on given value
+size_t IR::SwitchTarget(int value, size_t succs)
+{
+	// Successor 0 is default, table entries follow it
+	return (value >= 0 && (size_t)value + 1 < succs) ? (size_t)value + 1 : 0;
+}
+
+// Evaluate binary operation on constants, returns false when it can't be evaluated at compile time
+bool IR::Evaluate(Opcode op, int a, int b, int& result)
+{
+	unsigned int ua = (unsigned int)a;
+	unsigned int ub = (unsigned int)b;
+	switch (op)
+	{
+	case ADD: result = (int)(ua + ub); break;
+	case SUB: result = (int)(ua - ub); break;
+	case MUL: result = (int)(ua * ub); break;
+	case DIV:
+		// Division by zero must happen at runtime
+		if (b == 0 || (a == INT_MIN && b == -1))
+		{
+			return false;
+		}
+		result = a / b;
+		break;
+	case CMPLEQ: result = a <= b ? 1 : 0; break;
+	case CMPGEQ: result = a >= b ? 1 : 0; break;
+	case CMPLESS: result = a < b ? 1 : 0; break;
+	case CMPGREATER: result = a > b ? 1 : 0; break;
+	case CMPEQ: result = a == b ? 1 : 0; break;
+	case CMPNEQ: result = a != b ? 1 : 0; break;
+	case SHL: result = (int)(ua << (b & 31)); break;
+	case SHR: result = (int)(ua >> (b & 31)); break;
+	case SAR: result = a >> (b & 31); break;
+	case AND: result = a & b; break;
+	case OR: result = a | b; break;
+	case XOR: result = a ^ b; break;
+	case MULHI: result = (int)(((long long)a * (long long)b) >> 32); break;
+	default: return false;
+	}
+
+	return true;
+}
+
+// Returns true if value must be computed even when its result is not used
+bool IR::HasSideEffect(int value)
+{
+	const Value& v = mValues[value];
+	if (v.op == DIV)
+	{
+		// Division by zero terminates the program
+		const Value& d = mValues[Resolve(v.operands[1])];
+		return d.op != CONST || d.imm == 0;
+	}
+
+	// Procedure may never return (or terminate the program), checked load terminates the program
+	// when index is out of bounds
+	return v.op == CALL || v.op == LOAD || IsStore(v.op);
+}
+
+// Print out IR
+void IR::Dump(std::ostream& os)
+{
+	static const char* names[] =
+	{
+		"undef", "const", "copy", "phi", "add", "sub", "mul", "div", "neg",
+		"cmpleq", "cmpgeq", "cmpless", "cmpgreater", "cmpeq", "cmpneq",
+		"shl", "shr", "sar", "and", "or", "xor", "mulhi", "arg", "call",
+		"load", "store", "load.unchecked", "store.unchecked", "vload", "vstore", "vsplat", "vseq",
+		"vadd", "vsub", "vmul", "vcmpleq", "vcmpgeq", "vcmpless", "vcmpgreater", "vcmpeq", "vcmpneq", "vsum", "select", "str"
+	};
+
+	if (!mProcedure.empty())
+	{
+		os << "procedure " << mProcedure << ", arguments " << mArguments.size() << std::endl;
+	}
+	os << "slots " << mSlots << ", alive at exit " << mExitSlots << std::endl;
+
+	for (int b : mLayout)
+	{
+		const Block& blk = mBlocks[b];
+		if (blk.removed)
+		{
+			continue;
+		}
+
+		os << "block " << b;
+		if (!blk.label.empty())
+		{
+			os << " (" << blk.label << ")";
+		}
+		os << " preds:";
+		for (int p : blk.preds)
+		{
+			os << " " << p;
+		}
+		os << std::endl;
+
+		std::vector<int> values = blk.phis;
+		if (b == 0)
+		{
+			values.insert(values.begin(), mArguments.begin(), mArguments.end());
+		}
+		values.insert(values.end(), blk.code.begin(), blk.code.end());
+		for (int v : values)
+		{
+			const Value& val = mValues[v];
+			os << "\tv" << v << " = " << names[val.op];
+			if (val.lanes > 0)
+			{
+				os << ".x" << val.lanes;
+			}
+
+			if (val.op == CONST)
+			{
+				os << " " << val.imm;
+			}
+			else if (val.op == PHI)
+			{
+				os << " <" << (val.imm < VAR_SLOTS ? (val.imm == VAR_R0 ? "r0" : "r1") : "[sp+" + std::to_string((val.imm - VAR_SLOTS) * 4) + "]") << ">";
+			}
+			else if (val.op == CALL)
+			{
+				os << " " << mCallTargets[val.imm];
+			}
+			else if (IsLoad(val.op) || IsStore(val.op))
+			{
+				const Array& a = mArrays[val.imm];
+				os << " " << (a.global ? "[gp+" : "[sp+") << a.slot * 4 << "]x" << a.count;
+			}
+
+			for (int o : val.operands)
+			{
+				os << " v" << o;
+			}
+			os << std::endl;
+		}
+
+		switch (blk.term)
+		{
+		case EXIT:
+			os << "\texit" << std::endl;
+			break;
+
+		case GOTO:
+			os << "\tgoto " << blk.succs[0] << std::endl;
+			break;
+
+		case BRANCH:
+			os << "\tbranch v" << blk.cond << " " << blk.succs[0] << " " << blk.succs[1] << std::endl;
+			break;
+
+		case RETURN:
+			os << "\treturn v" << blk.cond << std::endl;
+			break;
+
+		case SWITCH:
+			os << "\tswitch v" << blk.cond;
+			for (int s : blk.succs)
+			{
+				os << " " << s;
+			}
+			os << std::endl;
+			break;
+		}
+	}
+}
+
+// Lowering of IR back into assembly. All variables get fixed place in stack frame, which is
+// allocated at the beginning of program. Values used only once inside their block are computed
+// at the place of use (as expression trees), others are stored into their own frame slot.
+class IRLowering
+{
+private:
+	IR& mIR;
+	std::vector<std::string>& mOut;
+
+	std::vector<int> mLocation;					// Frame slot of each variable
+	std::vector<int> mHome;						// Frame slot of values stored into frame (-1 when none)
+	std::vector<bool> mNeedsHome;				// Value is used where no variable holds it
+	std::vector<bool> mInline;					// Value is computed at place of its single use
+	std::vector<std::map<int, int> > mSource;	// For each block value -> variable holding it at block entry
+	std::map<int, int> mScratch;				// Frame slot of each select whose other value is constant (it's stored
+												// there at the beginning, as select reads it from memory)
+	int mFrame;									// Frame size (in slots)
+
+	// Branch on variable stepped by constant, which is done by single loop instruction
+	struct CountedLoop
+	{
+		int value;								// Stepped value (neither computed nor written by block)
+		int location;							// Frame slot of counter
+		int step;								// Step added to counter
+		IR::Opcode op;							// Comparison of stepped counter with bound
+		bool immediate;							// Bound is constant (otherwise frame slot)
+		int bound;								// Constant or frame slot of bound
+	};
+
+	std::map<int, CountedLoop> mCounted;		// Counted loop branches of blocks
+
+	// Memory accesses of value
+	enum MemoryAccess
+	{
+		ACCESS_READ = 1,
+		ACCESS_WRITE = 2
+	};
+
+	// Kind of value when used in block
+	enum Kind
+	{
+		KIND_CONST,				// Constant
+		KIND_UNDEF,				// Undefined
+		KIND_LOCAL,				// Computed in this block
+		KIND_OUTSIDE			// Comes from outside of block (or phi of this block)
+	};
+
+	Kind GetKind(int value, int block)
+	{
+		const IR::Value& v = mIR.GetValue(value);
+		if (v.op == IR::CONST)
+		{
+			return KIND_CONST;
+		}
+		else if (v.op == IR::UNDEF)
+		{
+			return KIND_UNDEF;
+		}
+		else if (v.op != IR::PHI && v.op != IR::ARG && v.block == block)
+		{
+			return KIND_LOCAL;
+		}
+		return KIND_OUTSIDE;
+	}
+
+	std::string Slot(int slot)
+	{
+		return "[sp+" + std::to_string(slot * 4) + "]";
+	}
+
+	// Frame slot holding value (-1 when value isn't in frame)
+	int GetSlot(int value, int block)
+	{
+		switch (GetKind(value, block))
+		{
+		case KIND_LOCAL:
+			return mHome[value];
+
+		case KIND_OUTSIDE:
+			return (mHome[value] != -1) ? mHome[value] : mLocation[mSource[block][value]];
+
+		default:
+			return -1;
+		}
+	}
+
+	// Value can be loaded with single instruction
+	bool IsLeaf(int value, int block)
+	{
+		Kind k = GetKind(value, block);
+		return k != KIND_LOCAL || !mInline[value];
+	}
+
+	// Load leaf value into register
+	void Load(int value, int block, const std::string& reg)
+	{
+		const IR::Value& v = mIR.GetValue(value);
+		switch (GetKind(value, block))
+		{
+		case KIND_CONST:
+			mOut.push_back("mov.reg.i32 " + reg + " " + std::to_string(v.imm));
+			break;
+
+		case KIND_UNDEF:
+			break;
+
+		case KIND_LOCAL:
+			mOut.push_back("mov.reg.mem.i32 " + reg + " " + Slot(mHome[value]));
+			break;
+
+		case KIND_OUTSIDE:
+			if (mHome[value] != -1)
+			{
+				mOut.push_back("mov.reg.mem.i32 " + reg + " " + Slot(mHome[value]));
+			}
+			else
+			{
+				mOut.push_back("mov.reg.mem.i32 " + reg + " " + Slot(mLocation[mSource[block][value]]));
+			}
+			break;
+		}
+	}
+
+	// Generate code computing value into r0
+	void Generate(int value, int block)
+	{
+		if (IsLeaf(value, block))
+		{
+			Load(value, block, "r0");
+			return;
+		}
+
+		Compute(value, block);
+	}
+
+	// Generate code of operation itself into r0 (operands are either leaves or inlined values)
+	void Compute(int value, int block)
+	{
+		static const char* names[] =
+		{
+			"", "", "", "", "add.i32", "sub.i32", "mul.i32", "div.i32", "neg.i32",
+			"cmpleq.i32", "cmpgeq.i32", "cmpless.i32", "cmpgreater.i32", "cmpeq.i32", "cmpneq.i32",
+			"shl.i32", "shr.i32", "sar.i32", "and.i32", "or.i32", "xor.i32", "mulhi.i32"
+		};
+
+		const IR::Value& v = mIR.GetValue(value);
+		if (v.op == IR::COPY)
+		{
+			Generate(v.operands[0], block);
+			return;
+		}
+		else if (v.op == IR::CALL)
+		{
+			for (int o : v.operands)
+			{
+				Generate(o, block);
+				mOut.push_back("push.i32 r0");
+			}
+			mOut.push_back("call " + mIR.GetCallTarget(value) + " " + std::to_string(v.operands.size()));
+			return;
+		}
+		else if (v.op == IR::NEG)
+		{
+			Generate(v.operands[0], block);
+			mOut.push_back("neg.i32 r0");
+			return;
+		}
+		else if (v.op == IR::VSTORE)
+		{
+			// Stored vector is computed into v0, address into r0
+			GenerateVector(v.operands[1], block, 0);
+			Generate(v.operands[0], block);
+			mOut.push_back("vstore.i32x" + std::to_string(v.lanes) + " " + Address(value) + " r0 v0");
+			return;
+		}
+		else if (v.op == IR::VSUM)
+		{
+			GenerateVector(v.operands[0], block, 0);
+			mOut.push_back("vsum.i32x" + std::to_string(v.lanes) + " r0 v0");
+			return;
+		}
+		else if (IR::IsLoad(v.op) || IR::IsStore(v.op))
+		{
+			Access(value, block);
+			return;
+		}
+		else if (v.op == IR::SELECT)
+		{
+			Select(value, block);
+			return;
+		}
+		else if (v.op == IR::STRING)
+		{
+			mOut.push_back("mov.reg.str r0 " + std::to_string(v.imm));
+			return;
+		}
+
+		int a = v.operands[0];
+		int b = v.operands[1];
+		if (IsLeaf(b, block))
+		{
+			// r0 = a, r1 = b
+			Generate(a, block);
+			Load(b, block, "r1");
+			mOut.push_back(std::string(names[v.op]) + " r0 r1");
+			return;
+		}
+
+		if (IsLeaf(a, block))
+		{
+			// r0 = b, r1 = a
+			Generate(b, block);
+			Load(a, block, "r1");
+		}
+		else
+		{
+			// r0 = b, r1 = a (through stack)
+			Generate(a, block);
+			mOut.push_back("push.i32 r0");
+			Generate(b, block);
+			mOut.push_back("pop.i32 r1");
+		}
+
+		// Operands are swapped
+		switch (v.op)
+		{
+		case IR::SUB:
+			mOut.push_back("sub.i32 r0 r1");
+			mOut.push_back("neg.i32 r0");
+			break;
+
+		case IR::DIV:
+		case IR::SHL:
+		case IR::SHR:
+		case IR::SAR:
+			mOut.push_back(std::string(names[v.op]) + " r1 r0");
+			mOut.push_back("mov.reg.reg r0 r1");
+			break;
+
+		case IR::CMPLEQ:
+			mOut.push_back("cmpgeq.i32 r0 r1");
+			break;
+
+		case IR::CMPGEQ:
+			mOut.push_back("cmpleq.i32 r0 r1");
+			break;
+
+		case IR::CMPLESS:
+			mOut.push_back("cmpgreater.i32 r0 r1");
+			break;
+
+		case IR::CMPGREATER:
+			mOut.push_back("cmpless.i32 r0 r1");
+			break;
+
+		default:
+			mOut.push_back(std::string(names[v.op]) + " r0 r1");
+			break;
+		}
+	}
+
+	// Generate select into r0 - condition goes into r0, value taken when it holds into r1 and the other
+	// one is read from memory (constant one from frame slot of select)
+	void Select(int value, int block)
+	{
+		const IR::Value& v = mIR.GetValue(value);
+		int cond = v.operands[0];
+		int a = v.operands[1];
+		int slot = GetSlot(v.operands[2], block);
+		if (slot == -1)
+		{
+			slot = mScratch[value];
+		}
+
+		if (IsLeaf(a, block))
+		{
+			Generate(cond, block);
+			Load(a, block, "r1");
+		}
+		else if (IsLeaf(cond, block))
+		{
+			Generate(a, block);
+			mOut.push_back("mov.reg.reg r1 r0");
+			Load(cond, block, "r0");
+		}
+		else
+		{
+			Generate(a, block);
+			mOut.push_back("push.i32 r0");
+			Generate(cond, block);
+			mOut.push_back("pop.i32 r1");
+		}
+		mOut.push_back("select.i32 r0 r1 " + Slot(slot));
+	}
+
+	// Address of the first element of array accessed by value
+	std::string Address(int value)
+	{
+		const IR::Array& a = mIR.GetArray(value);
+		return (a.global ? "[gp+" : "[sp+") + std::to_string(a.slot * 4) + "]";
+	}
+
+	// Generate code computing vector value into vector register reg, the second operand of operation
+	// goes into the following register (vector values are always computed at place of their single use)
+	void GenerateVector(int value, int block, int reg)
+	{
+		static const char* names[] =
+		{
+			"vadd", "vsub", "vmul", "vcmpleq", "vcmpgeq", "vcmpless", "vcmpgreater", "vcmpeq", "vcmpneq"
+		};
+
+		const IR::Value& v = mIR.GetValue(value);
+		std::string type = ".i32x" + std::to_string(v.lanes) + " v" + std::to_string(reg);
+		switch (v.op)
+		{
+		case IR::VLOAD:
+			Generate(v.operands[0], block);
+			mOut.push_back("vload" + type + " " + Address(value) + " r0");
+			break;
+
+		case IR::VSPLAT:
+		case IR::VSEQ:
+			Generate(v.operands[0], block);
+			mOut.push_back((v.op == IR::VSPLAT ? "vsplat" : "vseq") + type + " r0");
+			break;
+
+		default:
+			GenerateVector(v.operands[0], block, reg);
+			GenerateVector(v.operands[1], block, reg + 1);
+			mOut.push_back(names[v.op - IR::VADD] + type + " v" + std::to_string(reg + 1));
+			break;
+		}
+	}
+
+	// Generate load (into r0) or store of array element, element at constant index within bounds is
+	// accessed directly
+	void Access(int value, int block)
+	{
+		const IR::Value& v = mIR.GetValue(value);
+		const IR::Array& a = mIR.GetArray(value);
+		std::string base = a.global ? "[gp+" : "[sp+";
+		std::string suffix = (v.op == IR::LOAD || v.op == IR::STORE) ? ".i32 " : ".nc.i32 ";
+		std::string count = std::to_string(a.count);
+		int index = v.operands[0];
+
+		if (GetKind(index, block) == KIND_CONST && mIR.GetValue(index).imm >= 0 && mIR.GetValue(index).imm < a.count)
+		{
+			std::string address = base + std::to_string((a.slot + mIR.GetValue(index).imm) * 4) + "]";
+			if (IR::IsLoad(v.op))
+			{
+				mOut.push_back("mov.reg.mem.i32 r0 " + address);
+			}
+			else
+			{
+				Generate(v.operands[1], block);
+				mOut.push_back("mov.mem.reg.i32 " + address + " r0");
+			}
+			return;
+		}
+
+		std::string address = Address(value);
+		if (IR::IsLoad(v.op))
+		{
+			Generate(index, block);
+			mOut.push_back("mov.reg.idx" + suffix + "r0 " + address + " r0 " + count);
+			return;
+		}
+
+		int stored = v.operands[1];
+		if (IsLeaf(stored, block))
+		{
+			// r0 = index, r1 = stored value
+			Generate(index, block);
+			Load(stored, block, "r1");
+			mOut.push_back("mov.idx.reg" + suffix + address + " r0 " + count + " r1");
+			return;
+		}
+
+		if (IsLeaf(index, block))
+		{
+			// r0 = stored value, r1 = index
+			Generate(stored, block);
+			Load(index, block, "r1");
+		}
+		else
+		{
+			// r0 = stored value, r1 = index (through stack)
+			Generate(index, block);
+			mOut.push_back("push.i32 r0");
+			Generate(stored, block);
+			mOut.push_back("pop.i32 r1");
+		}
+		mOut.push_back("mov.idx.reg" + suffix + address + " r1 " + count + " r0");
+	}
+
+	// Memory accesses done by value including its inlined operands (calls both read and write memory)
+	int GetAccesses(int value, int block)
+	{
+		const IR::Value& v = mIR.GetValue(value);
+		int accesses = (v.op == IR::CALL) ? (ACCESS_READ | ACCESS_WRITE) : IR::IsLoad(v.op) ? ACCESS_READ : IR::IsStore(v.op) ? ACCESS_WRITE : 0;
+		for (int o : v.operands)
+		{
+			if (GetKind(o, block) == KIND_LOCAL && mInline[o])
+			{
+				accesses |= GetAccesses(o, block);
+			}
+		}
+		return accesses;
+	}
+
+	// Check whether value can be computed at place of its single use, it can't be moved past code
+	// accessing memory in conflicting way (one of them writes)
+	bool CanMove(int value, int block)
+	{
+		int accesses = GetAccesses(value, block);
+		if (accesses == 0)
+		{
+			return true;
+		}
+
+		const std::vector<int>& code = mIR.GetBlock(block).code;
+		for (size_t i = std::find(code.begin(), code.end(), value) - code.begin() + 1; i < code.size(); i++)
+		{
+			const std::vector<int>& operands = mIR.GetValue(code[i]).operands;
+			if (std::find(operands.begin(), operands.end(), value) != operands.end())
+			{
+				return true;
+			}
+
+			int other = GetAccesses(code[i], block);
+			if (((accesses & ACCESS_WRITE) && other != 0) || ((other & ACCESS_WRITE) && accesses != 0))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Generate conditional jump to label, taken when cond is non-zero (zero when negate is set). Inlined
+	// comparison is fused with the jump, unless its result was already computed into r0
+	void Jump(int cond, int block, bool computed, bool negate, const std::string& label)
+	{
+		static const char* names[] =
+		{
+			"jle", "jge", "jlt", "jgt", "jeq", "jne"
+		};
+
+		const IR::Value& v = mIR.GetValue(cond);
+		if (computed || GetKind(cond, block) != KIND_LOCAL || !mInline[cond] || !IR::IsCompare(v.op))
+		{
+			if (!computed)
+			{
+				Generate(cond, block);
+			}
+			mOut.push_back((negate ? "jz " : "jnz ") + label);
+			return;
+		}
+
+		IR::Opcode op = negate ? IR::NegateCompare(v.op) : v.op;
+		int a = v.operands[0];
+		int b = v.operands[1];
+
+		// Constant is part of instruction
+		if (GetKind(a, block) == KIND_CONST && GetKind(b, block) != KIND_CONST)
+		{
+			std::swap(a, b);
+			op = IR::SwapCompare(op);
+		}
+
+		std::string name = names[op - IR::CMPLEQ];
+		if (GetKind(b, block) == KIND_CONST)
+		{
+			Generate(a, block);
+			mOut.push_back(name + ".reg.i32 r0 " + std::to_string(mIR.GetValue(b).imm) + " " + label);
+		}
+		else if (IsLeaf(b, block))
+		{
+			Generate(a, block);
+			Load(b, block, "r1");
+			mOut.push_back(name + ".reg.reg r0 r1 " + label);
+		}
+		else
+		{
+			// r0 = b, r1 = a
+			if (IsLeaf(a, block))
+			{
+				Generate(b, block);
+				Load(a, block, "r1");
+			}
+			else
+			{
+				Generate(a, block);
+				mOut.push_back("push.i32 r0");
+				Generate(b, block);
+				mOut.push_back("pop.i32 r1");
+			}
+			mOut.push_back(name + ".reg.reg r1 r0 " + label);
+		}
+	}
+
+	// Generate jump table of switch, inlined subtraction of constant (from table base) is part of instruction
+	void Switch(const IR::Block& blk, int block, bool computed)
+	{
+		const IR::Value& v = mIR.GetValue(blk.cond);
+		int base = 0;
+		if (computed)
+		{
+			// Index is already in r0
+		}
+		else if (GetKind(blk.cond, block) == KIND_LOCAL && mInline[blk.cond] && v.op == IR::SUB && GetKind(v.operands[1], block) == KIND_CONST)
+		{
+			Generate(v.operands[0], block);
+			base = mIR.GetValue(v.operands[1]).imm;
+		}
+		else if (GetKind(blk.cond, block) == KIND_LOCAL && mInline[blk.cond] && v.op == IR::ADD && GetKind(v.operands[1], block) == KIND_CONST)
+		{
+			Generate(v.operands[0], block);
+			base = (int)(0u - (unsigned int)mIR.GetValue(v.operands[1]).imm);
+		}
+		else
+		{
+			Generate(blk.cond, block);
+		}
+
+		std::string table = "jmp.table r0 " + std::to_string(base);
+		for (int s : blk.succs)
+		{
+			table += " " + Label(s);
+		}
+		mOut.push_back(table);
+	}
+
+	// Generate counted loop instruction jumping to label when comparison holds (fails when negate is set)
+	void Loop(int block, bool negate, const std::string& label)
+	{
+		static const char* names[] =
+		{
+			"le", "ge", "lt", "gt", "eq", "ne"
+		};
+
+		const CountedLoop& c = mCounted[block];
+		IR::Opcode op = negate ? IR::NegateCompare(c.op) : c.op;
+		mOut.push_back(std::string("loop.") + names[op - IR::CMPLEQ] + (c.immediate ? ".i32 " : ".mem ") + Slot(c.location) + " " +
+			std::to_string(c.step) + " " + (c.immediate ? std::to_string(c.bound) : Slot(c.bound)) + " " + label);
+	}
+
+	// Check whether block branches on comparison of variable stepped by constant, the stepped value
+	// has to be written back into the same variable and used nowhere else
+	bool IsCountedLoop(int block, const std::vector<std::pair<int, std::vector<int> > >& writes, const std::vector<int>& localUses, CountedLoop& loop)
+	{
+		const IR::Block& blk = mIR.GetBlock(block);
+		if (blk.term != IR::BRANCH || GetKind(blk.cond, block) != KIND_LOCAL || localUses[blk.cond] != 1 || mNeedsHome[blk.cond])
+		{
+			return false;
+		}
+
+		const IR::Value& cond = mIR.GetValue(blk.cond);
+		if (!IR::IsCompare(cond.op) || cond.operands[0] == cond.operands[1])
+		{
+			return false;
+		}
+
+		int bound = cond.operands[1];
+		loop.value = cond.operands[0];
+		loop.op = cond.op;
+		const IR::Value* v = &mIR.GetValue(loop.value);
+		if (v->op != IR::ADD && v->op != IR::SUB)
+		{
+			bound = cond.operands[0];
+			loop.value = cond.operands[1];
+			loop.op = IR::SwapCompare(cond.op);
+			v = &mIR.GetValue(loop.value);
+		}
+
+		if ((v->op != IR::ADD && v->op != IR::SUB) || GetKind(loop.value, block) != KIND_LOCAL ||
+			localUses[loop.value] != 2 || mNeedsHome[loop.value])
+		{
+			return false;
+		}
+
+		// Counter is one operand, step the other one
+		int counter = v->operands[0];
+		int step = v->operands[1];
+		if (v->op == IR::ADD && GetKind(counter, block) == KIND_CONST)
+		{
+			std::swap(counter, step);
+		}
+
+		if (GetKind(step, block) != KIND_CONST || GetKind(counter, block) != KIND_OUTSIDE)
+		{
+			return false;
+		}
+
+		int imm = mIR.GetValue(step).imm;
+		loop.step = (v->op == IR::ADD) ? imm : (int)(0u - (unsigned int)imm);
+
+		auto source = mSource[block].find(counter);
+		if (source == mSource[block].end())
+		{
+			return false;
+		}
+		loop.location = mLocation[source->second];
+
+		// Stepped value goes back into counter only, bound is kept intact by block writes
+		bool found = false;
+		std::set<int> written;
+		for (const auto& w : writes)
+		{
+			for (int x : w.second)
+			{
+				written.insert(mLocation[x]);
+			}
+
+			if (w.first == loop.value)
+			{
+				if (w.second.size() != 1 || mLocation[w.second[0]] != loop.location)
+				{
+					return false;
+				}
+				found = true;
+			}
+		}
+
+		if (!found)
+		{
+			return false;
+		}
+
+		switch (GetKind(bound, block))
+		{
+		case KIND_CONST:
+			loop.immediate = true;
+			loop.bound = mIR.GetValue(bound).imm;
+			return true;
+
+		case KIND_OUTSIDE:
+			source = mSource[block].find(bound);
+			if (source == mSource[block].end() || written.find(mLocation[source->second]) != written.end())
+			{
+				return false;
+			}
+			loop.immediate = false;
+			loop.bound = mLocation[source->second];
+			return true;
+
+		default:
+			return false;
+		}
+	}
+
+	// Collect frame slots of variables read when generating value
+	void CollectReads(int value, int block, std::set<int>& reads)
+	{
+		Kind k = GetKind(value, block);
+		if (k == KIND_OUTSIDE && mHome[value] == -1)
+		{
+			reads.insert(mLocation[mSource[block][value]]);
+		}
+		else if (k == KIND_LOCAL && mInline[value])
+		{
+			for (int o : mIR.GetValue(value).operands)
+			{
+				CollectReads(o, block, reads);
+			}
+		}
+	}
+
+	// Operands of value which are used by block code
+	void CollectUses(int block, std::vector<int>& uses)
+	{
+		IR::Block& blk = mIR.GetBlock(block);
+		for (int v : blk.code)
+		{
+			for (int o : mIR.GetValue(v).operands)
+			{
+				uses.push_back(o);
+			}
+		}
+
+		if (blk.term == IR::BRANCH || blk.term == IR::RETURN || blk.term == IR::SWITCH)
+		{
+			uses.push_back(blk.cond);
+		}
+	}
+
+public:
+	IRLowering(IR& ir, std::vector<std::string>& out) : mIR(ir), mOut(out)
+	{
+		mFrame = 0;
+	}
+
+	void Lower()
+	{
+		int vars = mIR.GetVariablesCount();
+		size_t blocks = mIR.GetBlocksCount();
+		size_t values = mIR.GetValuesCount();
+
+		std::vector<int> layout;
+		for (int b : mIR.GetLayout())
+		{
+			if (!mIR.GetBlock(b).removed)
+			{
+				layout.push_back(b);
+			}
+		}
+
+		// Stack slots are variables themselves, registers get their place in frame only when needed
+		mLocation.assign(vars, -1);
+		for (int x = IR::VAR_SLOTS; x < vars; x++)
+		{
+			mLocation[x] = x - IR::VAR_SLOTS;
+		}
+		mFrame = vars - IR::VAR_SLOTS;
+
+		mHome.assign(values, -1);
+		mNeedsHome.assign(values, false);
+		mInline.assign(values, false);
+
+		// Where can be values found at block entry (prefer stack slots over registers)
+		mSource.assign(blocks, std::map<int, int>());
+		for (int b : layout)
+		{
+			const IR::Block& blk = mIR.GetBlock(b);
+			for (int x = IR::VAR_SLOTS; x < vars; x++)
+			{
+				if (blk.entry[x] >= 0)
+				{
+					mSource[b].insert(std::pair<int, int>(blk.entry[x], x));
+				}
+			}
+			for (int x = 0; x < IR::VAR_SLOTS; x++)
+			{
+				if (blk.entry[x] >= 0)
+				{
+					mSource[b].insert(std::pair<int, int>(blk.entry[x], x));
+				}
+			}
+		}
+
+		// Variables read by block code, values not available in any variable need their own home
+		std::vector<std::vector<bool> > gen(blocks, std::vector<bool>(vars, false));
+		for (int b : layout)
+		{
+			std::vector<int> uses;
+			CollectUses(b, uses);
+			for (int u : uses)
+			{
+				if (GetKind(u, b) != KIND_OUTSIDE)
+				{
+					continue;
+				}
+
+				auto it = mSource[b].find(u);
+				if (it != mSource[b].end())
+				{
+					gen[b][it->second] = true;
+				}
+				else
+				{
+					mNeedsHome[u] = true;
+				}
+			}
+		}
+
+		// Liveness of variables - variable is alive when its value is read later, variables are written
+		// only at the end of block (when their value differs from the one at the block entry)
+		std::vector<std::vector<bool> > liveIn(blocks, std::vector<bool>(vars, false));
+		std::vector<std::vector<bool> > liveOut(blocks, std::vector<bool>(vars, false));
+		bool changed = true;
+		while (changed)
+		{
+			changed = false;
+			for (auto it = layout.rbegin(); it != layout.rend(); it++)
+			{
+				int b = *it;
+				IR::Block& blk = mIR.GetBlock(b);
+
+				std::vector<bool> out(vars, false);
+				for (int s : blk.succs)
+				{
+					for (int x = 0; x < vars; x++)
+					{
+						out[x] = out[x] || liveIn[s][x];
+					}
+				}
+
+				if (blk.term == IR::EXIT)
+				{
+					for (int x = 0; x < mIR.GetExitSlots(); x++)
+					{
+						out[IR::VAR_SLOTS + x] = true;
+					}
+				}
+
+				// Phi nodes which need their own home are copied there at block entry
+				std::vector<bool> in = gen[b];
+				for (int p : blk.phis)
+				{
+					if (mNeedsHome[p])
+					{
+						in[mSource[b][p]] = true;
+					}
+				}
+
+				for (int x = 0; x < vars; x++)
+				{
+					if (!out[x])
+					{
+						continue;
+					}
+
+					int v = blk.exit[x];
+					if (v < 0 || mIR.GetValue(v).op == IR::UNDEF)
+					{
+						continue;
+					}
+
+					if (v == blk.entry[x])
+					{
+						in[x] = true;
+					}
+					else if (GetKind(v, b) == KIND_OUTSIDE)
+					{
+						auto src = mSource[b].find(v);
+						if (src != mSource[b].end())
+						{
+							in[src->second] = true;
+						}
+						else
+						{
+							mNeedsHome[v] = true;
+						}
+					}
+				}
+
+				if (in != liveIn[b] || out != liveOut[b])
+				{
+					liveIn[b] = in;
+					liveOut[b] = out;
+					changed = true;
+				}
+			}
+		}
+
+		// Writes at the end of each block, grouped by value
+		std::vector<std::vector<std::pair<int, std::vector<int> > > > writes(blocks);
+		for (int b : layout)
+		{
+			IR::Block& blk = mIR.GetBlock(b);
+			for (int x = 0; x < vars; x++)
+			{
+				int v = blk.exit[x];
+				if (!liveOut[b][x] || v < 0 || v == blk.entry[x] || mIR.GetValue(v).op == IR::UNDEF)
+				{
+					continue;
+				}
+
+				bool found = false;
+				for (auto& w : writes[b])
+				{
+					if (w.first == v)
+					{
+						w.second.push_back(x);
+						found = true;
+						break;
+					}
+				}
+
+				if (!found)
+				{
+					writes[b].push_back(std::pair<int, std::vector<int> >(v, std::vector<int>(1, x)));
+				}
+			}
+		}
+
+		// Registers alive across blocks need place in frame
+		for (int x = 0; x < IR::VAR_SLOTS; x++)
+		{
+			for (int b : layout)
+			{
+				if (liveIn[b][x] || liveOut[b][x])
+				{
+					mLocation[x] = mFrame++;
+					break;
+				}
+			}
+		}
+
+		// Decide which values are inlined and which get their own home
+		std::vector<int> localUses(values, 0);
+		std::vector<bool> effectOnly(values, false);
+		for (int b : layout)
+		{
+			std::vector<int> uses;
+			CollectUses(b, uses);
+			for (const auto& w : writes[b])
+			{
+				uses.push_back(w.first);
+			}
+
+			for (int u : uses)
+			{
+				if (GetKind(u, b) == KIND_LOCAL)
+				{
+					localUses[u]++;
+				}
+			}
+		}
+
+		// The other value of select is read from memory, so the computed one needs its home and constant one
+		// is stored into frame slot of select
+		mScratch.clear();
+		for (int b : layout)
+		{
+			for (int v : mIR.GetBlock(b).code)
+			{
+				if (mIR.GetValue(v).op != IR::SELECT)
+				{
+					continue;
+				}
+
+				int other = mIR.GetValue(v).operands[2];
+				Kind k = GetKind(other, b);
+				if (k == KIND_LOCAL)
+				{
+					mNeedsHome[other] = true;
+				}
+				else if (k != KIND_OUTSIDE)
+				{
+					mScratch[v] = mFrame++;
+				}
+			}
+		}
+
+		mCounted.clear();
+		for (int b : layout)
+		{
+			CountedLoop loop;
+			if (IsCountedLoop(b, writes[b], localUses, loop))
+			{
+				mCounted[b] = loop;
+			}
+		}
+
+		for (int a : mIR.GetArguments())
+		{
+			if (mNeedsHome[a])
+			{
+				mHome[a] = mFrame++;
+			}
+		}
+
+		for (int b : layout)
+		{
+			for (int p : mIR.GetBlock(b).phis)
+			{
+				if (mNeedsHome[p])
+				{
+					mHome[p] = mFrame++;
+				}
+			}
+
+			auto counted = mCounted.find(b);
+			for (int v : mIR.GetBlock(b).code)
+			{
+				if (counted != mCounted.end() && counted->second.value == v)
+				{
+					// Computed and written by loop instruction
+					continue;
+				}
+				else if (IR::IsVector(mIR.GetValue(v).op))
+				{
+					// Vector values live only in vector registers
+					mInline[v] = true;
+				}
+				else if (mNeedsHome[v] || localUses[v] > 1 || (localUses[v] == 1 && !CanMove(v, b)))
+				{
+					mHome[v] = mFrame++;
+				}
+				else if (localUses[v] == 1)
+				{
+					mInline[v] = true;
+				}
+				else if (mIR.HasSideEffect(v))
+				{
+					effectOnly[v] = true;
+				}
+			}
+		}
+
+		// Generate code
+		bool endLabel = false;
+		for (size_t i = 0; i < layout.size(); i++)
+		{
+			int b = layout[i];
+			IR::Block& blk = mIR.GetBlock(b);
+			int next = (i + 1 < layout.size()) ? layout[i + 1] : -1;
+
+			if (i == 0 && !mIR.GetProcedure().empty())
+			{
+				mOut.push_back("proc " + mIR.GetProcedure() + " " + std::to_string(mIR.GetArguments().size()));
+			}
+			mOut.push_back(Label(b) + ":");
+
+			// Whole frame is allocated at once (arguments of procedure are already there)
+			if (i == 0)
+			{
+				if (mFrame > (int)mIR.GetArguments().size())
+				{
+					mOut.push_back("reserve " + std::to_string(mFrame - (int)mIR.GetArguments().size()));
+				}
+
+				for (const IR::Array& a : mIR.GetArrays())
+				{
+					if (!a.global)
+					{
+						mOut.push_back("array " + Slot(a.slot) + " " + std::to_string(a.count));
+					}
+				}
+
+				for (int a : mIR.GetArguments())
+				{
+					if (mHome[a] != -1)
+					{
+						mOut.push_back("mov.reg.mem.i32 r0 " + Slot(mLocation[mSource[b][a]]));
+						mOut.push_back("mov.mem.reg.i32 " + Slot(mHome[a]) + " r0");
+					}
+				}
+
+				for (const auto& c : mScratch)
+				{
+					const IR::Value& other = mIR.GetValue(mIR.GetValue(c.first).operands[2]);
+					if (other.op == IR::CONST)
+					{
+						mOut.push_back("mov.reg.i32 r0 " + std::to_string(other.imm));
+						mOut.push_back("mov.mem.reg.i32 " + Slot(c.second) + " r0");
+					}
+				}
+			}
+
+			for (int p : blk.phis)
+			{
+				if (mHome[p] != -1)
+				{
+					mOut.push_back("mov.reg.mem.i32 r0 " + Slot(mLocation[mSource[b][p]]));
+					mOut.push_back("mov.mem.reg.i32 " + Slot(mHome[p]) + " r0");
+				}
+			}
+
+			for (int v : blk.code)
+			{
+				if (mHome[v] != -1)
+				{
+					Compute(v, b);
+					mOut.push_back("mov.mem.reg.i32 " + Slot(mHome[v]) + " r0");
+				}
+				else if (effectOnly[v])
+				{
+					Compute(v, b);
+				}
+			}
+
+			// Variables written at the end of block (in parallel, reads of old values happen first)
+			struct Write
+			{
+				int value;
+				std::vector<int> targets;
+				std::set<int> reads;
+			};
+
+			auto counted = mCounted.find(b);
+			std::vector<Write> pending;
+			std::set<int> written;
+			for (const auto& w : writes[b])
+			{
+				if (counted != mCounted.end() && counted->second.value == w.first)
+				{
+					continue;
+				}
+
+				Write pw;
+				pw.value = w.first;
+				for (int x : w.second)
+				{
+					pw.targets.push_back(mLocation[x]);
+					written.insert(mLocation[x]);
+				}
+				CollectReads(pw.value, b, pw.reads);
+				pending.push_back(pw);
+			}
+
+			bool early = false;
+			if ((blk.term == IR::BRANCH && counted == mCounted.end()) || blk.term == IR::SWITCH)
+			{
+				std::set<int> reads;
+				CollectReads(blk.cond, b, reads);
+				for (int r : reads)
+				{
+					if (written.find(r) != written.end())
+					{
+						early = true;
+					}
+				}
+
+				if (early)
+				{
+					Generate(blk.cond, b);
+					mOut.push_back("push.i32 r0");
+				}
+			}
+
+			while (!pending.empty())
+			{
+				bool found = false;
+				for (size_t w = 0; w < pending.size(); w++)
+				{
+					bool blocked = false;
+					for (size_t o = 0; o < pending.size() && !blocked; o++)
+					{
+						if (o == w)
+						{
+							continue;
+						}
+
+						for (int t : pending[w].targets)
+						{
+							if (pending[o].reads.find(t) != pending[o].reads.end())
+							{
+								blocked = true;
+								break;
+							}
+						}
+					}
+
+					if (!blocked)
+					{
+						Generate(pending[w].value, b);
+						for (int t : pending[w].targets)
+						{
+							mOut.push_back("mov.mem.reg.i32 " + Slot(t) + " r0");
+						}
+						pending.erase(pending.begin() + w);
+						found = true;
+						break;
+					}
+				}
+
+				if (!found)
+				{
+					break;
+				}
+			}
+
+			// Cyclic dependencies are resolved through stack
+			for (const Write& w : pending)
+			{
+				Generate(w.value, b);
+				mOut.push_back("push.i32 r0");
+			}
+
+			for (auto it = pending.rbegin(); it != pending.rend(); it++)
+			{
+				mOut.push_back("pop.i32 r0");
+				for (int t : it->targets)
+				{
+					mOut.push_back("mov.mem.reg.i32 " + Slot(t) + " r0");
+				}
+			}
+
+			// Terminator
+			switch (blk.term)
+			{
+			case IR::EXIT:
+				if (mFrame > mIR.GetExitSlots())
+				{
+					mOut.push_back("release " + std::to_string(mFrame - mIR.GetExitSlots()));
+				}
+				if (next != -1)
+				{
+					mOut.push_back("jmp " + Prefix() + "LEND");
+					endLabel = true;
+				}
+				break;
+
+			case IR::RETURN:
+				Generate(blk.cond, b);
+				mOut.push_back("ret");
+				break;
+
+			case IR::GOTO:
+				if (blk.succs[0] != next)
+				{
+					mOut.push_back("jmp " + Label(blk.succs[0]));
+				}
+				break;
+
+			case IR::BRANCH:
+				if (counted != mCounted.end())
+				{
+					if (blk.succs[1] == next)
+					{
+						Loop(b, false, Label(blk.succs[0]));
+					}
+					else
+					{
+						Loop(b, true, Label(blk.succs[1]));
+						if (blk.succs[0] != next)
+						{
+							mOut.push_back("jmp " + Label(blk.succs[0]));
+						}
+					}
+					break;
+				}
+
+				if (early)
+				{
+					mOut.push_back("pop.i32 r0");
+				}
+
+				if (blk.succs[1] == next)
+				{
+					Jump(blk.cond, b, early, false, Label(blk.succs[0]));
+				}
+				else
+				{
+					Jump(blk.cond, b, early, true, Label(blk.succs[1]));
+					if (blk.succs[0] != next)
+					{
+						mOut.push_back("jmp " + Label(blk.succs[0]));
+					}
+				}
+				break;
+
+			case IR::SWITCH:
+				if (early)
+				{
+					mOut.push_back("pop.i32 r0");
+				}
+				Switch(blk, b, early);
+				break;
+			}
+		}
+
+		if (endLabel)
+		{
+			mOut.push_back(Prefix() + "LEND:");
+		}
+	}
+
+	// Prefix of generated labels, so labels of procedures don't collide with labels of program
+	std::string Prefix()
+	{
+		return mIR.GetProcedure().empty() ? "" : mIR.GetProcedure() + ".";
+	}
+
+	std::string Label(int block)
+	{
+		const IR::Block& blk = mIR.GetBlock(block);
+		if (blk.label.empty())
+		{
+			return Prefix() + "B" + std::to_string(block);
+		}
+		return blk.label;
+	}
+};
+
+// Lower IR back into assembly
+std::vector<std::string> IR::Lower()
+{
+	std::vector<std::string> result;
+	IRLowering lowering(*this, result);
+	lowering.Lower();
+	return result;
+}
\ No newline at end of file
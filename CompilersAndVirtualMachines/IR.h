@@ -0,0 +1,344 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __IR_H__
+#define __IR_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <ostream>
+#include "Reader.h"
+
+// Intermediate representation in SSA form
+//
+// Program is built from the assembly generated by compiler. Variables of the program
+// are both registers (r0, r1) and stack slots ([sp+N] is slot N/4, push/pop write and
+// read the slot at current stack depth), so temporaries passed through the stack
+// become plain values too. Each block remembers which value every variable holds at
+// its entry and exit, which allows lowering back into assembly with fixed stack frame.
+// Procedure is built separately from program, its arguments are the first stack slots.
+// Slots of arrays aren't variables - elements are loaded and stored in program order.
+class IR
+{
+public:
+	// Value operations
+	enum Opcode
+	{
+		UNDEF = 0,			// Undefined value (uninitialized variable)
+		CONST,				// Integer constant (in imm)
+		COPY,				// Copy of operand
+		PHI,				// Phi node, one operand per predecessor (variable in imm)
+		ADD,				// operand[0] + operand[1]
+		SUB,				// operand[0] - operand[1]
+		MUL,				// operand[0] * operand[1]
+		DIV,				// operand[0] / operand[1] (terminates program on division by zero)
+		NEG,				// -operand[0]
+		CMPLEQ,				// operand[0] <= operand[1]
+		CMPGEQ,				// operand[0] >= operand[1]
+		CMPLESS,			// operand[0] < operand[1]
+		CMPGREATER,			// operand[0] > operand[1]
+		CMPEQ,				// operand[0] == operand[1]
+		CMPNEQ,				// operand[0] != operand[1]
+		SHL,				// operand[0] << operand[1]
+		SHR,				// operand[0] >> operand[1] (logical)
+		SAR,				// operand[0] >> operand[1] (arithmetic)
+		AND,				// operand[0] & operand[1]
+		OR,					// operand[0] | operand[1]
+		XOR,				// operand[0] ^ operand[1]
+		MULHI,				// Upper 32 bits of operand[0] * operand[1]
+		ARG,				// Argument of procedure (stack slot in imm), defined at procedure entry
+		CALL,				// Call of procedure (call target in imm) with operands as arguments
+		LOAD,				// Element operand[0] of array (array in imm), terminates program when out of bounds
+		STORE,				// Write operand[1] into element operand[0] of array, terminates program when out of bounds
+		LOAD_UNCHECKED,		// Load of element which is known to be in bounds
+		STORE_UNCHECKED,	// Store into element which is known to be in bounds
+		VLOAD,				// Vector of consecutive elements of array starting at operand[0] (known to be in bounds)
+		VSTORE,				// Write vector operand[1] into consecutive elements starting at operand[0]
+		VSPLAT,				// Vector with all lanes equal to operand[0]
+		VSEQ,				// Vector of operand[0] + lane index
+		VADD,				// Lane-wise operand[0] + operand[1]
+		VSUB,				// Lane-wise operand[0] - operand[1]
+		VMUL,				// Lane-wise operand[0] * operand[1]
+		VCMPLEQ,			// Lane-wise comparisons (in the same order as scalar ones)
+		VCMPGEQ,
+		VCMPLESS,
+		VCMPGREATER,
+		VCMPEQ,
+		VCMPNEQ,
+		VSUM,				// Sum of lanes of vector operand[0]
+		SELECT,				// operand[1] when operand[0] is non-zero, otherwise operand[2] (both are computed)
+		STRING				// Handle of string of relocatable unit (in imm), linker rewrites it, so it's not a constant
+	};
+
+	// Block terminators
+	enum Terminator
+	{
+		EXIT = 0,			// End of program
+		GOTO,				// Continue in succs[0]
+		BRANCH,				// Continue in succs[0] when cond is non-zero, otherwise in succs[1]
+		RETURN,				// Return cond from procedure
+		SWITCH				// Continue in succs[cond + 1] when it exists, otherwise in succs[0]
+	};
+
+	// Single SSA value
+	struct Value
+	{
+		Opcode op;					// Operation
+		int block;					// Block in which value is defined
+		int imm;					// Constant for CONST, variable for PHI
+		int lanes;					// Number of lanes of vector operation (0 for scalar ones)
+		std::vector<int> operands;	// Operands
+		int forward;				// Value which replaced this one (-1 if none)
+		bool removed;				// Value is no longer part of program
+	};
+
+	// Basic block
+	struct Block
+	{
+		std::string label;			// Label of block
+		std::vector<int> phis;		// Phi nodes
+		std::vector<int> code;		// Values computed in block (in order)
+		std::vector<int> preds;		// Predecessors
+		std::vector<int> succs;		// Successors
+		Terminator term;			// Terminator
+		int cond;					// Branch condition
+		std::vector<int> entry;		// Value of each variable at entry (-1 when nobody cares)
+		std::vector<int> exit;		// Value of each variable at exit (-1 when nobody cares)
+		bool removed;				// Block is no longer part of program
+	};
+
+	// Array accessed by loads and stores
+	struct Array
+	{
+		int slot;					// First slot (of program frame for global array)
+		int count;					// Number of elements
+		bool global;				// Array of program used by procedure (addressed relative to gp)
+	};
+
+	// Variables (registers first, then stack slots)
+	enum
+	{
+		VAR_R0 = 0,
+		VAR_R1,
+		VAR_SLOTS
+	};
+
+private:
+	std::vector<Value> mValues;		// All values
+	std::vector<Block> mBlocks;		// All blocks (block 0 is entry)
+	std::vector<int> mLayout;		// Order of blocks in generated code
+	int mSlots;						// Number of stack slots used by program
+	int mExitSlots;					// Number of stack slots alive at the end of program
+	int mUndef;						// Undefined value
+	std::string mProcedure;			// Label of procedure (empty for program)
+	std::vector<int> mArguments;	// Argument values of procedure
+	std::vector<std::string> mCallTargets;	// Labels of called procedures
+	std::vector<Array> mArrays;		// Arrays accessed by loads and stores
+	std::vector<bool> mMemory;		// Stack slots which are elements of arrays (not variables)
+
+	// Dominator tree
+	std::vector<int> mIdom;
+	std::vector<std::vector<int> > mDomChildren;
+
+	// Parse stack slot address (only [sp+N] is supported)
+	static bool ParseSlot(const std::string& token, int& slot);
+
+	// Parse stack slot address or address in program frame ([gp+N] sets global)
+	static bool ParseSlot(const std::string& token, int& slot, bool& global);
+
+	// Get array (it's added when it isn't known yet)
+	int GetArrayIndex(int slot, int count, bool global);
+
+	// Parse integer constant
+	static bool ParseInteger(const std::string& token, int& value);
+
+	// Parse register (only r0 and r1 are variables)
+	static int ParseRegister(const std::string& token);
+
+	// Parse arithmetic instruction (writing result into its first operand)
+	static bool ParseArithmetic(const std::string& token, Opcode& op);
+
+	// Parse fused compare and jump instruction (second operand is either register or constant)
+	static bool ParseCompareJump(const std::string& token, Opcode& op, bool& immediate);
+
+	// Parse counted loop instruction (bound is either constant or variable in memory)
+	static bool ParseLoop(const std::string& token, Opcode& op, bool& immediate);
+
+public:
+	IR();
+
+	// Build IR from assembly, returns false in case assembly can't be represented
+	bool Build(const std::vector<std::string>& assembly);
+
+	// Lower IR back into assembly
+	std::vector<std::string> Lower();
+
+	// Print out IR
+	void Dump(std::ostream& os);
+
+	// Create new value in block (not inserted into block code)
+	int NewValue(Opcode op, int block, int imm, const std::vector<int>& operands, int lanes = 0);
+
+	// Create new block (appended to layout)
+	int NewBlock();
+
+	// Create new variable (stack slot which isn't used by original program), returns its index
+	int NewVariable();
+
+	// Move block in layout right after/before another block
+	void MoveBlockAfter(int block, int after);
+	void MoveBlockBefore(int block, int before);
+
+	// Remove (single occurrence of) predecessor of block, together with its phi operands
+	void RemovePredecessor(int block, int pred);
+
+	// Replace predecessor of block with another one (phi operands stay as they are)
+	void ReplacePredecessor(int block, int pred, int by);
+
+	// Remove blocks which can't be reached from entry, returns true if any was removed
+	bool RemoveUnreachable();
+
+	// Get value following replacements
+	int Resolve(int value);
+
+	// Replace value with another one
+	void Replace(int value, int by);
+
+	// Rewrite all references to replaced values
+	void Canonicalize();
+
+	// Compute predecessors from successors
+	void ComputePredecessors();
+
+	// Compute dominator tree
+	void ComputeDominators();
+
+	// Returns true when block a dominates block b
+	bool Dominates(int a, int b);
+
+	// Blocks in reverse postorder
+	std::vector<int> ReversePostorder();
+
+	// Number of variables
+	int GetVariablesCount() const
+	{
+		return VAR_SLOTS + mSlots;
+	}
+
+	// Number of stack slots alive at the end of program
+	int GetExitSlots() const
+	{
+		return mExitSlots;
+	}
+
+	// Undefined value
+	int GetUndef() const
+	{
+		return mUndef;
+	}
+
+	// Label of procedure (empty when IR holds program)
+	const std::string& GetProcedure() const
+	{
+		return mProcedure;
+	}
+
+	// Argument values of procedure (held by the first stack slots at entry)
+	const std::vector<int>& GetArguments() const
+	{
+		return mArguments;
+	}
+
+	// Label of procedure called by call value
+	const std::string& GetCallTarget(int call) const
+	{
+		return mCallTargets[mValues[call].imm];
+	}
+
+	// Arrays accessed by loads and stores
+	const std::vector<Array>& GetArrays() const
+	{
+		return mArrays;
+	}
+
+	// Array accessed by load or store value
+	const Array& GetArray(int access) const
+	{
+		return mArrays[mValues[access].imm];
+	}
+
+	// Returns true when variable is an element of array (it has no value)
+	bool IsMemory(int variable) const
+	{
+		return variable >= VAR_SLOTS && variable - VAR_SLOTS < (int)mMemory.size() && mMemory[variable - VAR_SLOTS];
+	}
+
+	Value& GetValue(int value)
+	{
+		return mValues[value];
+	}
+
+	Block& GetBlock(int block)
+	{
+		return mBlocks[block];
+	}
+
+	size_t GetValuesCount() const
+	{
+		return mValues.size();
+	}
+
+	size_t GetBlocksCount() const
+	{
+		return mBlocks.size();
+	}
+
+	const std::vector<int>& GetLayout() const
+	{
+		return mLayout;
+	}
+
+	int GetIdom(int block) const
+	{
+		return mIdom[block];
+	}
+
+	const std::vector<int>& GetDomChildren(int block) const
+	{
+		return mDomChildren[block];
+	}
+
+	// Operation properties
+	static bool IsBinary(Opcode op);
+	static bool IsCommutative(Opcode op);
+	static bool IsCompare(Opcode op);
+	static bool IsLoad(Opcode op);
+	static bool IsStore(Opcode op);
+	static bool IsVector(Opcode op);
+
+	// Comparison with negated result (a < b turns into a >= b)
+	static Opcode NegateCompare(Opcode op);
+
+	// Comparison with swapped operands (a < b turns into b > a)
+	static Opcode SwapCompare(Opcode op);
+
+	// Evaluate binary operation on constants (arithmetic wraps around as it does in virtual
+	// machine), returns false when it can't be evaluated at compile time (division by zero)
+	static bool Evaluate(Opcode op, int a, int b, int& result);
+
+	// Index of successor taken by switch on given value
+	static size_t SwitchTarget(int value, size_t succs);
+
+	// Returns true if value must be computed even when its result is not used
+	bool HasSideEffect(int value);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,143 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "IncludeCache.h"
+#include "Reader.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <ctime>
+
+// Modification time of file in nanoseconds (only seconds are available on Windows)
+#if defined(_WIN32)
+#define MODIFIED_NANOSECONDS(info) ((long long)(info).st_mtime * 1000000000LL)
+#elif defined(__APPLE__)
+#define MODIFIED_NANOSECONDS(info) ((long long)(info).st_mtimespec.tv_sec * 1000000000LL + (info).st_mtimespec.tv_nsec)
+#else
+#define MODIFIED_NANOSECONDS(info) ((long long)(info).st_mtim.tv_sec * 1000000000LL + (info).st_mtim.tv_nsec)
+#endif
+
+IncludeCache::IncludeCache()
+{
+	mHits = 0;
+	mMisses = 0;
+}
+
+// Hash of file content (FNV-1a over its lines)
+unsigned long long IncludeCache::Hash(const std::vector<std::string>& content)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (const std::string& line : content)
+	{
+		for (size_t i = 0; i <= line.length(); i++)
+		{
+			// Terminating zero separates lines
+			hash ^= (unsigned char)line.c_str()[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+// Get processed lines of file, returns nullptr when file doesn't exist
+std::shared_ptr<const IncludeCache::Lines> IncludeCache::Get(const std::string& filename, const Processor& process)
+{
+	// Time is taken before file is examined, so file modified while it's being loaded is never trusted
+	long long now = (long long)time(nullptr);
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mEntries.erase(filename);
+		return nullptr;
+	}
+	long long modified = MODIFIED_NANOSECONDS(info);
+
+	// Entry whose file was modified within a second before it was loaded has to be verified by content
+	std::shared_ptr<const Lines> unverified;
+	unsigned long long unverifiedHash = 0;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		auto it = mEntries.find(filename);
+		if (it != mEntries.end() && it->second.modified == modified && it->second.size == (long long)info.st_size)
+		{
+			if (modified / 1000000000LL + 1 < it->second.loaded)
+			{
+				mHits++;
+				return it->second.lines;
+			}
+			unverified = it->second.lines;
+			unverifiedHash = it->second.hash;
+		}
+		else
+		{
+			mMisses++;
+		}
+	}
+
+	// File is loaded outside of lock, so other compilations aren't blocked by it (when two of them load
+	// the same file at once, both get the same result)
+	std::vector<std::string> content = Reader::ReadFile(filename);
+	unsigned long long hash = Hash(content);
+	if (unverified != nullptr && hash == unverifiedHash)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		auto it = mEntries.find(filename);
+		if (it != mEntries.end() && it->second.lines == unverified)
+		{
+			it->second.loaded = now;
+		}
+		mHits++;
+		return unverified;
+	}
+
+	std::shared_ptr<Lines> lines = std::make_shared<Lines>();
+	size_t lineNo = 0;
+	for (const std::string& s : content)
+	{
+		lines->push_back(std::pair<LineInfo, std::string>(LineInfo(filename, lineNo), s));
+		lineNo++;
+	}
+	process(*lines);
+
+	Entry e;
+	e.modified = modified;
+	e.size = (long long)info.st_size;
+	e.loaded = now;
+	e.hash = hash;
+	e.lines = lines;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (unverified != nullptr)
+	{
+		mMisses++;
+	}
+	mEntries[filename] = e;
+	return lines;
+}
+
+// Remove all cached files
+void IncludeCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mEntries.clear();
+}
+
+// Get number of lookups served from cache
+size_t IncludeCache::GetHits() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mHits;
+}
+
+// Get number of lookups which loaded file
+size_t IncludeCache::GetMisses() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mMisses;
+}
\ No newline at end of file
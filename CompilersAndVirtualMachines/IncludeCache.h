@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __INCLUDE_CACHE_H__
+#define __INCLUDE_CACHE_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include "LineInfo.h"
+
+// Cache of included files shared between compilations (thread-safe). File is loaded only when it
+// isn't cached yet or when its modification time or size changed since it was cached. File modified
+// within a second before it was loaded may be modified again without visible change of its time, so
+// its content is read and compared by hash until it gets older
+class IncludeCache
+{
+public:
+	typedef std::vector<std::pair<LineInfo, std::string> > Lines;
+
+	// Processing applied to lines of file when it's loaded (e.g. removal of comments)
+	typedef std::function<void(Lines&)> Processor;
+
+private:
+	// Cached file
+	struct Entry
+	{
+		long long modified;						// Modification time of file when it was loaded (in nanoseconds)
+		long long size;							// Size of file when it was loaded
+		long long loaded;						// Time when file was loaded or verified (in seconds)
+		unsigned long long hash;				// Hash of file content
+		std::shared_ptr<const Lines> lines;		// Processed lines of file
+	};
+
+	std::map<std::string, Entry> mEntries;		// Cached files
+	mutable std::mutex mMutex;					// Guards entries and statistics
+	size_t mHits;								// Number of lookups served from cache
+	size_t mMisses;								// Number of lookups which loaded file
+
+	// Hash of file content (FNV-1a over its lines)
+	static unsigned long long Hash(const std::vector<std::string>& content);
+
+public:
+	IncludeCache();
+
+	// Get processed lines of file, returns nullptr when file doesn't exist
+	std::shared_ptr<const Lines> Get(const std::string& filename, const Processor& process);
+
+	// Remove all cached files
+	void Clear();
+
+	// Get number of lookups served from cache
+	size_t GetHits() const;
+
+	// Get number of lookups which loaded file
+	size_t GetMisses() const;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,349 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Inliner.h"
+#include <set>
+
+// Split line into tokens
+std::vector<std::string> Inliner::Tokenize(const std::string& line)
+{
+	std::vector<std::string> tokens;
+	for (std::string& s : StringUtil::split(line, ' '))
+	{
+		StringUtil::trim(s);
+		if (s.length() > 0)
+		{
+			tokens.push_back(s);
+		}
+	}
+	return tokens;
+}
+
+// Number of instructions of procedure, -1 when procedure calls another one
+int Inliner::GetSize(const Procedure& procedure)
+{
+	int size = 0;
+	for (size_t i = 1; i < procedure.code.size(); i++)
+	{
+		std::vector<std::string> t = Tokenize(procedure.code[i]);
+		if (t.empty() || t[0][t[0].length() - 1] == ':' || t[0] == "array")
+		{
+			continue;
+		}
+
+		if (t[0] == "call")
+		{
+			return -1;
+		}
+		size++;
+	}
+	return size;
+}
+
+// Replace calls of inlined procedures in code with their bodies, depth is stack depth (in slots)
+// at the beginning of code. Returns true if any call was replaced
+bool Inliner::InlineCalls(std::vector<std::string>& code, int depth, const std::map<std::string, size_t>& inlined)
+{
+	bool changed = false;
+	std::vector<std::string> out;
+	for (const std::string& line : code)
+	{
+		std::vector<std::string> t = Tokenize(line);
+		if (t.empty())
+		{
+			continue;
+		}
+
+		if (t[0] == "proc" && t.size() == 3)
+		{
+			depth = std::stoi(t[2]);
+		}
+		else if (t[0] == "push.i32")
+		{
+			depth++;
+		}
+		else if (t[0] == "pop.i32")
+		{
+			depth--;
+		}
+		else if (t[0] == "reserve" && t.size() == 2)
+		{
+			depth += std::stoi(t[1]);
+		}
+		else if (t[0] == "release" && t.size() == 2)
+		{
+			depth -= std::stoi(t[1]);
+		}
+		else if (t[0] == "call" && t.size() == 3)
+		{
+			int count = std::stoi(t[2]);
+			auto it = inlined.find(t[1]);
+			if (it != inlined.end() && mProcedures[it->second].arguments == count)
+			{
+				Expand(mProcedures[it->second], depth, out);
+				depth -= count;
+				changed = true;
+				continue;
+			}
+			depth -= count;
+		}
+
+		out.push_back(line);
+	}
+
+	code.swap(out);
+	return changed;
+}
+
+// Append body of procedure called at given stack depth (arguments included), its frame is
+// placed where caller pushed arguments and removed at each return
+void Inliner::Expand(const Procedure& procedure, int depth, std::vector<std::string>& out)
+{
+	std::string suffix = ".i" + std::to_string(mInstances++);
+	std::string end = procedure.label + suffix;
+	int base = 4 * (depth - procedure.arguments);
+
+	// Last instruction is return, which just continues after the body
+	size_t last = procedure.code.size();
+	while (last > 1 && Tokenize(procedure.code[last - 1]).empty())
+	{
+		last--;
+	}
+
+	bool endLabel = false;
+	int frame = procedure.arguments;
+	for (size_t i = 1; i < procedure.code.size(); i++)
+	{
+		std::vector<std::string> t = Tokenize(procedure.code[i]);
+		if (t.empty())
+		{
+			continue;
+		}
+
+		// Labels of each copy are unique
+		if (t[0][t[0].length() - 1] == ':')
+		{
+			out.push_back(t[0].substr(0, t[0].length() - 1) + suffix + ":");
+			continue;
+		}
+
+		if (t[0] == "ret")
+		{
+			// Frame is removed (result stays in r0)
+			if (frame > 0)
+			{
+				out.push_back("release " + std::to_string(frame));
+			}
+
+			if (i + 1 < last)
+			{
+				out.push_back("jmp " + end);
+				endLabel = true;
+
+				// Code following return is reached with the frame still on stack, unreachable reserve
+				// keeps stack depth (which is tracked line by line) in sync with it
+				if (frame > 0)
+				{
+					out.push_back("reserve " + std::to_string(frame));
+				}
+			}
+			continue;
+		}
+
+		if (t[0] == "push.i32")
+		{
+			frame++;
+		}
+		else if (t[0] == "pop.i32")
+		{
+			frame--;
+		}
+		else if (t[0] == "reserve" && t.size() == 2)
+		{
+			frame += std::stoi(t[1]);
+		}
+		else if (t[0] == "release" && t.size() == 2)
+		{
+			frame -= std::stoi(t[1]);
+		}
+
+		// Frame slots are rebased, jump targets renamed (jump table has default and table entries, parallel
+		// loop has end of body as its last operand)
+		bool jump = t[0][0] == 'j' || StringUtil::starts_with(t[0], "loop.") || t[0] == "pfor";
+		bool table = t[0] == "jmp.table";
+		std::string line = t[0];
+		for (size_t k = 1; k < t.size(); k++)
+		{
+			std::string& token = t[k];
+			if (StringUtil::starts_with(token, "[sp+") && token[token.length() - 1] == ']')
+			{
+				token = "[sp+" + std::to_string(std::stoi(token.substr(4, token.length() - 5)) + base) + "]";
+			}
+			else if ((jump && k + 1 == t.size()) || (table && k >= 3))
+			{
+				token += suffix;
+			}
+			line += " " + token;
+		}
+		out.push_back(line);
+	}
+
+	if (endLabel)
+	{
+		out.push_back(end + ":");
+	}
+}
+
+// Remove procedures which are no longer called
+void Inliner::RemoveUnused()
+{
+	std::map<std::string, size_t> index;
+	for (size_t i = 0; i < mProcedures.size(); i++)
+	{
+		index[mProcedures[i].label] = i;
+	}
+
+	// Procedures reachable from program through calls
+	std::set<std::string> called;
+	std::vector<const std::vector<std::string>*> worklist;
+	worklist.push_back(&mProgram);
+	while (!worklist.empty())
+	{
+		const std::vector<std::string>* code = worklist.back();
+		worklist.pop_back();
+
+		for (const std::string& line : *code)
+		{
+			std::vector<std::string> t = Tokenize(line);
+			if (t.size() < 2 || t[0] != "call" || called.find(t[1]) != called.end())
+			{
+				continue;
+			}
+
+			called.insert(t[1]);
+			auto it = index.find(t[1]);
+			if (it != index.end())
+			{
+				worklist.push_back(&mProcedures[it->second].code);
+			}
+		}
+	}
+
+	std::vector<Procedure> procedures;
+	for (Procedure& p : mProcedures)
+	{
+		if (called.find(p.label) != called.end())
+		{
+			procedures.push_back(std::move(p));
+		}
+	}
+	mProcedures.swap(procedures);
+}
+
+// Constructor from assembly lines, budget is maximum number of instructions of inlined procedure
+// (0 disables inlining), exported procedures may be called by other units
+Inliner::Inliner(const std::vector<std::string>& assembly, size_t budget, bool exported)
+{
+	mBudget = budget;
+	mInstances = 0;
+	mExported = exported;
+
+	for (const std::string& line : assembly)
+	{
+		std::vector<std::string> t = Tokenize(line);
+		if (!t.empty() && t[0] == "proc" && t.size() == 3)
+		{
+			Procedure p;
+			p.label = t[1];
+			p.arguments = std::stoi(t[2]);
+			mProcedures.push_back(p);
+		}
+
+		if (mProcedures.empty())
+		{
+			mProgram.push_back(line);
+		}
+		else
+		{
+			mProcedures.back().code.push_back(line);
+		}
+	}
+
+	// Program ends with halt when it's followed by procedures
+	while (!mProgram.empty() && Tokenize(mProgram.back()).empty())
+	{
+		mProgram.pop_back();
+	}
+	if (!mProcedures.empty() && !mProgram.empty() && Tokenize(mProgram.back())[0] == "halt")
+	{
+		mProgram.pop_back();
+	}
+}
+
+// Perform inlining, returns true if any call was inlined
+bool Inliner::Inline()
+{
+	bool result = false;
+
+	// Each round inlines all current leaf procedures, which removes calls from their callers
+	while (true)
+	{
+		std::map<std::string, size_t> inlined;
+		for (size_t i = 0; i < mProcedures.size(); i++)
+		{
+			int size = GetSize(mProcedures[i]);
+			if (size >= 0 && (size_t)size <= mBudget)
+			{
+				inlined[mProcedures[i].label] = i;
+			}
+		}
+
+		if (inlined.empty())
+		{
+			break;
+		}
+
+		bool changed = InlineCalls(mProgram, 0, inlined);
+		for (size_t i = 0; i < mProcedures.size(); i++)
+		{
+			if (inlined.find(mProcedures[i].label) == inlined.end() && InlineCalls(mProcedures[i].code, 0, inlined))
+			{
+				changed = true;
+			}
+		}
+
+		if (!changed)
+		{
+			break;
+		}
+		result = true;
+	}
+
+	if (!mExported)
+	{
+		RemoveUnused();
+	}
+
+	return result;
+}
+
+// Get whole assembly (program followed by procedures)
+std::vector<std::string> Inliner::GetAssembly() const
+{
+	std::vector<std::string> assembly = mProgram;
+	if (!mProcedures.empty())
+	{
+		assembly.push_back("halt");
+		for (const Procedure& p : mProcedures)
+		{
+			assembly.insert(assembly.end(), p.code.begin(), p.code.end());
+		}
+	}
+	return assembly;
+}
\ No newline at end of file
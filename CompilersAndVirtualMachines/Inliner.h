@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __INLINER_H__
+#define __INLINER_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include "Reader.h"
+
+// Inlining of small procedures into their callers, done on assembly generated by compiler (before
+// it's built into IR). Assembly is split into program (ending with halt) and procedures, each of
+// them starting with 'proc <label> <arguments>' line. Only leaf procedures (which don't call any
+// other one) not larger than budget are inlined - once all their calls were inlined, their callers
+// may become leaf procedures too. Procedures which are no longer called are removed (unless they're
+// exported to other units).
+class Inliner
+{
+public:
+	// Procedure of program
+	struct Procedure
+	{
+		std::string label;					// Label of procedure
+		int arguments;						// Number of arguments
+		std::vector<std::string> code;		// Code of procedure (starting with proc line)
+	};
+
+	enum
+	{
+		DEFAULT_BUDGET = 32					// Default maximum number of instructions of inlined procedure
+	};
+
+private:
+	std::vector<std::string> mProgram;		// Code of program (without halt)
+	std::vector<Procedure> mProcedures;		// Procedures (in order of definition)
+	size_t mBudget;							// Maximum number of instructions of inlined procedure
+	size_t mInstances;						// Number of inlined calls (makes labels of each copy unique)
+	bool mExported;							// Procedures may be called by other units (they're never removed)
+
+	// Split line into tokens
+	static std::vector<std::string> Tokenize(const std::string& line);
+
+	// Number of instructions of procedure, -1 when procedure calls another one
+	static int GetSize(const Procedure& procedure);
+
+	// Replace calls of inlined procedures in code with their bodies, depth is stack depth (in slots)
+	// at the beginning of code. Returns true if any call was replaced
+	bool InlineCalls(std::vector<std::string>& code, int depth, const std::map<std::string, size_t>& inlined);
+
+	// Append body of procedure called at given stack depth (arguments included), its frame is
+	// placed where caller pushed arguments and removed at each return
+	void Expand(const Procedure& procedure, int depth, std::vector<std::string>& out);
+
+	// Remove procedures which are no longer called
+	void RemoveUnused();
+
+public:
+	// Constructor from assembly lines, budget is maximum number of instructions of inlined procedure
+	// (0 disables inlining), exported procedures may be called by other units
+	Inliner(const std::vector<std::string>& assembly, size_t budget = DEFAULT_BUDGET, bool exported = false);
+
+	// Perform inlining, returns true if any call was inlined
+	bool Inline();
+
+	// Get code of program (without halt)
+	const std::vector<std::string>& GetProgram() const
+	{
+		return mProgram;
+	}
+
+	// Get procedures which are still called (or exported)
+	const std::vector<Procedure>& GetProcedures() const
+	{
+		return mProcedures;
+	}
+
+	// Get whole assembly (program followed by procedures)
+	std::vector<std::string> GetAssembly() const;
+};
+
+#endif
\ No newline at end of file
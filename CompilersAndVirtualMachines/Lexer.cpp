@@ -9,59 +9,92 @@
 
 #include "Lexer.h"
 
-void Lexer::PrepareTokens()
+// Build tables of tokens
+Lexer::TokenTables Lexer::PrepareTokens()
 {
-	mTokensMap.push_back(std::pair<Token, std::string>(ADDITION, "<add>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(SUBTRACTION, "<sub>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(MULTIPLICATION, "<mul>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(DIVISION, "<div>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(LPAREN, "<paren_l>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(RPAREN, "<paren_r>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(LEQUAL, "<lequal>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(GEQUAL, "<gequal>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(LESS, "<less>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(GREATER, "<greater>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(EQUAL, "<equal>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(NOTEQUAL, "<notequal>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(IF, "<if>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(ELSE, "<else>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(DO, "<do>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(WHILE, "<while>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(FOR, "<for>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(LBRACE, "<brace_l>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(RBRACE, "<brace_r>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(IDENT, "<ident>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(VALUE, "<value>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(ASSIGN, "<assign>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(PUNCT, "<punct>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(TYPE, "<type>"));
-	mTokensMap.push_back(std::pair<Token, std::string>(DEBUG, "<debug>"));
-
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "+" }, ADDITION));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "-" }, SUBTRACTION));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "*" }, MULTIPLICATION));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "/" }, DIVISION));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "(" }, LPAREN));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ ")" }, RPAREN));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "<=" }, LEQUAL));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ ">=" }, GEQUAL));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "<" }, LESS));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ ">" }, GREATER));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "==" }, EQUAL));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "!=" }, NOTEQUAL));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "if" }, IF));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "else" }, ELSE));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "do" }, DO));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "while" }, WHILE));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "for" }, FOR));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "{" }, LBRACE));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "}" }, RBRACE));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({}, IDENT));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({}, VALUE));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "=" }, ASSIGN));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({ ";" }, PUNCT));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({}, TYPE));
-	mTokensVars.push_back(std::pair<std::vector<std::string>, Token>({}, DEBUG));
+	TokenTables tables;
+
+	tables.tokensMap.push_back(std::pair<Token, std::string>(ADDITION, "<add>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(SUBTRACTION, "<sub>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(MULTIPLICATION, "<mul>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(DIVISION, "<div>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(LPAREN, "<paren_l>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(RPAREN, "<paren_r>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(LEQUAL, "<lequal>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(GEQUAL, "<gequal>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(LESS, "<less>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(GREATER, "<greater>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(EQUAL, "<equal>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(NOTEQUAL, "<notequal>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(IF, "<if>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(ELSE, "<else>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(DO, "<do>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(WHILE, "<while>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(FOR, "<for>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(LBRACE, "<brace_l>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(RBRACE, "<brace_r>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(IDENT, "<ident>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(VALUE, "<value>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(ASSIGN, "<assign>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(PUNCT, "<punct>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(TYPE, "<type>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(DEBUG, "<debug>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(RETURN, "<return>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(COMMA, "<comma>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(SWITCH, "<switch>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(CASE, "<case>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(DEFAULT, "<default>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(BREAK, "<break>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(COLON, "<colon>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(LBRACKET, "<bracket_l>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(RBRACKET, "<bracket_r>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(PARALLEL, "<parallel>"));
+	tables.tokensMap.push_back(std::pair<Token, std::string>(END, "<end>"));
+
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "+" }, ADDITION));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "-" }, SUBTRACTION));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "*" }, MULTIPLICATION));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "/" }, DIVISION));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "(" }, LPAREN));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ ")" }, RPAREN));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "<=" }, LEQUAL));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ ">=" }, GEQUAL));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "<" }, LESS));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ ">" }, GREATER));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "==" }, EQUAL));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "!=" }, NOTEQUAL));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "if" }, IF));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "else" }, ELSE));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "do" }, DO));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "while" }, WHILE));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "for" }, FOR));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "{" }, LBRACE));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "}" }, RBRACE));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({}, IDENT));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({}, VALUE));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "=" }, ASSIGN));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ ";" }, PUNCT));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({}, TYPE));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({}, DEBUG));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "return" }, RETURN));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "," }, COMMA));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "switch" }, SWITCH));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "case" }, CASE));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "default" }, DEFAULT));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "break" }, BREAK));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ ":" }, COLON));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "[" }, LBRACKET));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "]" }, RBRACKET));
+	tables.tokensVars.push_back(std::pair<std::vector<std::string>, Token>({ "parallel" }, PARALLEL));
+
+	return tables;
+}
+
+// Get tables of tokens (shared by all lexers, built only once)
+const Lexer::TokenTables& Lexer::GetTokenTables()
+{
+	static const TokenTables tables = PrepareTokens();
+	return tables;
 }
 
 // Determine whether string is a valid identifier
@@ -161,7 +194,7 @@ bool Lexer::IsValue(const std::string& value)
 
 bool Lexer::IsType(const std::string& value)
 {
-	if (value == "int")
+	if (value == "int" || value == "string")
 	{
 		return true;
 	}
@@ -169,27 +202,52 @@ bool Lexer::IsType(const std::string& value)
 	return false;
 }
 
+// Determine whether keyword is at given position of source as a whole word
 bool Lexer::KeyWord(const std::string& keyword, const std::string& source, size_t pos)
 {
-	if (source.substr(pos, 3) == "int" &&
-		(pos == 0 || source[pos - 1] == '#' || source[pos - 1] == ' ' || source[pos - 1] == ';') &&
-		(pos == source.length() - 3 || source[pos + 3] == '#' || source[pos + 3] == ' ' || source[pos + 3] == ';'))
+	// Keyword can't be part of longer identifier
+	auto IsIdentChar = [](char c)
 	{
-		return true;
-	}
+		return isalnum((unsigned char)c) || c == '_';
+	};
 
-	return false;
+	return source.compare(pos, keyword.length(), keyword) == 0 &&
+		(pos == 0 || !IsIdentChar(source[pos - 1])) &&
+		(pos + keyword.length() >= source.length() || !IsIdentChar(source[pos + keyword.length()]));
 }
 
-Lexer::Lexer(const std::string& filename)
+// Construct from preprocessed file
+Lexer::Lexer(const std::string& filename) : mTokensMap(GetTokenTables().tokensMap), mTokensVars(GetTokenTables().tokensVars)
 {
-	PrepareTokens();
+	std::ifstream f(filename, std::ios::in);
+	std::stringstream strStream;
+	strStream << f.rdbuf();
+	f.close();
 
+	Tokenize(strStream.str());
+}
+
+// Construct from preprocessed lines (see Preprocessor::GetOutput)
+Lexer::Lexer(const std::vector<std::string>& source) : mTokensMap(GetTokenTables().tokensMap), mTokensVars(GetTokenTables().tokensVars)
+{
+	std::string joined;
+	for (const std::string& s : source)
+	{
+		joined += s;
+		joined += '\n';
+	}
+
+	Tokenize(joined);
+}
+
+// Split preprocessed source (joined into single string) into tokens
+void Lexer::Tokenize(std::string joined)
+{
 	// Get maximum length token
 	size_t MAX_LENGTH_TOKEN = 0;
-	for (auto j : mTokensVars)
+	for (const auto& j : mTokensVars)
 	{
-		for (auto k : j.first)
+		for (const auto& k : j.first)
 		{
 			if (k.length() > MAX_LENGTH_TOKEN)
 			{
@@ -198,12 +256,6 @@ Lexer::Lexer(const std::string& filename)
 		}
 	}
 
-	std::ifstream f(filename, std::ios::in);
-	std::stringstream strStream;
-	strStream << f.rdbuf();
-	std::string joined = strStream.str();
-	f.close();
-
 	bool lineInfo = false;
 	bool match = true;
 	for (size_t i = 0; i < joined.length(); i++)
@@ -251,12 +303,13 @@ Lexer::Lexer(const std::string& filename)
 			continue;
 		}
 
+		// Operators and punctuators (keywords are matched as whole words below)
 		std::string tmp = joined.substr(i, MAX_LENGTH_TOKEN);
-		for (auto j : mTokensVars)
+		for (const auto& j : mTokensVars)
 		{
-			for (auto k : j.first)
+			for (const auto& k : j.first)
 			{
-				if (StringUtil::starts_with(tmp, k))
+				if (!isalpha((unsigned char)k[0]) && StringUtil::starts_with(tmp, k))
 				{
 					joined.insert(i, "#");
 					joined.insert(i + k.length() + 1, "#");
@@ -267,41 +320,17 @@ Lexer::Lexer(const std::string& filename)
 		}
 
 		// Matching keywords
-		if (KeyWord("int", joined, i))
-		{
-			joined.insert(i, "#");
-			joined.insert(i + 4, "#");
-			i += 4;
-		}
-		else if (KeyWord("if", joined, i))
-		{
-			joined.insert(i, "#");
-			joined.insert(i + 3, "#");
-			i += 3;
-		}
-		else if (KeyWord("else", joined, i))
+		static const char* keywords[] = { "int", "string", "if", "else", "do", "while", "for", "return", "switch", "case", "default", "break", "parallel" };
+		for (const char* k : keywords)
 		{
-			joined.insert(i, "#");
-			joined.insert(i + 5, "#");
-			i += 5;
-		}
-		else if (KeyWord("do", joined, i))
-		{
-			joined.insert(i, "#");
-			joined.insert(i + 3, "#");
-			i += 3;
-		}
-		else if (KeyWord("while", joined, i))
-		{
-			joined.insert(i, "#");
-			joined.insert(i + 6, "#");
-			i += 6;
-		}
-		else if (KeyWord("for", joined, i))
-		{
-			joined.insert(i, "#");
-			joined.insert(i + 4, "#");
-			i += 4;
+			std::string keyword = k;
+			if (KeyWord(keyword, joined, i))
+			{
+				joined.insert(i, "#");
+				joined.insert(i + keyword.length() + 1, "#");
+				i += keyword.length() + 1;
+				break;
+			}
 		}
 	}
 
@@ -331,9 +360,9 @@ Lexer::Lexer(const std::string& filename)
 
 		bool ident = true;
 		const std::string& token = mData[i];
-		for (auto j : mTokensVars)
+		for (const auto& j : mTokensVars)
 		{
-			for (auto k : j.first)
+			for (const auto& k : j.first)
 			{
 				if (k == token)
 				{
@@ -377,8 +406,8 @@ Lexer::Lexer(const std::string& filename)
 			}
 			else
 			{
-				std::cout << "Error: Invalid token at " << token << std::endl;
-				std::exit(-1);
+				// Invalid token is reported and skipped, so the rest of source still gets tokenized
+				mDiagnostics.push_back(Diagnostic(Diagnostic::SEVERITY_ERROR, "Invalid token at " + token, debugInfo.GetFilename(), debugInfo.GetLine()));
 			}
 		}
 	}
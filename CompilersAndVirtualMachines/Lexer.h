@@ -22,6 +22,7 @@
 
 #include "Reader.h"
 #include "LineInfo.h"
+#include "Diagnostic.h"
 
 class Lexer
 {
@@ -52,20 +53,46 @@ public:
 		VALUE,				// any value
 		ASSIGN,				// = -> assignment operator
 		PUNCT,				// ; -> punctuator (semicolon commonly), denotes end of command
-		TYPE,				// int -> so far only integers are supported
-		DEBUG				// debug info (line number and filename)
+		TYPE,				// int or string
+		DEBUG,				// debug info (line number and filename)
+		RETURN,				// return
+		COMMA,				// , -> separates arguments of procedure
+		SWITCH,				// switch
+		CASE,				// case
+		DEFAULT,			// default
+		BREAK,				// break
+		COLON,				// : -> ends case label
+		LBRACKET,			// [
+		RBRACKET,			// ]
+		PARALLEL,			// parallel
+		END					// end of input (sentinel following the last token, never produced by lexer)
 	};
 
 private:
-	std::vector<std::pair<Token, std::string> > mTokensMap;
-	std::vector<std::pair<std::vector<std::string>, Token> > mTokensVars;
+	// Tables of tokens
+	struct TokenTables
+	{
+		std::vector<std::pair<Token, std::string> > tokensMap;
+		std::vector<std::pair<std::vector<std::string>, Token> > tokensVars;
+	};
+
+	const std::vector<std::pair<Token, std::string> >& mTokensMap;
+	const std::vector<std::pair<std::vector<std::string>, Token> >& mTokensVars;
 
 	std::vector<std::string> mData;
 	std::vector<std::string> mCompilerData;
 	std::map<size_t, LineInfo> mDebugInfo;
 	std::vector<Token> mTokens;
+	std::vector<Diagnostic> mDiagnostics;	// Invalid tokens (skipped)
+
+	// Build tables of tokens
+	static TokenTables PrepareTokens();
+
+	// Get tables of tokens (shared by all lexers, built only once)
+	static const TokenTables& GetTokenTables();
 
-	void PrepareTokens();
+	// Split preprocessed source (joined into single string) into tokens
+	void Tokenize(std::string joined);
 
 	// Determine whether string is a valid identifier
 	bool IsIdent(const std::string& ident);
@@ -76,11 +103,16 @@ private:
 	// Determine whether string holds a type
 	bool IsType(const std::string& value);
 
+	// Determine whether keyword is at given position of source as a whole word
 	bool KeyWord(const std::string& keyword, const std::string& source, size_t pos);
 
 public:
+	// Construct from preprocessed file
 	Lexer(const std::string& filename);
 
+	// Construct from preprocessed lines (see Preprocessor::GetOutput)
+	Lexer(const std::vector<std::string>& source);
+
 	// Print out file
 	void SaveFile(const std::string& filename);
 
@@ -101,6 +133,12 @@ public:
 	{
 		return mDebugInfo;
 	}
+
+	// Get messages about invalid tokens
+	const std::vector<Diagnostic>& GetDiagnostics() const
+	{
+		return mDiagnostics;
+	}
 };
 
 #endif
\ No newline at end of file
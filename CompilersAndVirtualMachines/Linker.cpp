@@ -0,0 +1,410 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Linker.h"
+#include "Disassembler.h"
+#include "Optimizer.h"
+#include <sstream>
+
+// Report error in given unit
+void Linker::Error(const std::string& error, const std::string& unit)
+{
+	mDiagnostics.push_back(Diagnostic(Diagnostic::SEVERITY_ERROR, error, unit, 0));
+}
+
+// Properties of procedure including procedures it calls in all units
+void Linker::Summarize(const std::string& label, bool& globals, bool& parallel, std::set<std::string>& visited) const
+{
+	if (!visited.insert(label).second)
+	{
+		return;
+	}
+
+	auto it = mDefinitions.find(label);
+	if (it == mDefinitions.end())
+	{
+		return;
+	}
+
+	globals = globals || it->second.symbol->globals;
+	parallel = parallel || it->second.symbol->parallel;
+	for (const std::string& c : it->second.symbol->calls)
+	{
+		Summarize(c, globals, parallel, visited);
+	}
+}
+
+// Name of procedure with given label
+std::string Linker::GetName(const std::string& label)
+{
+	return label.substr(1);
+}
+
+// Rename local labels (defined or used as jump target) of assembly line by appending suffix, labels of
+// procedures are shared by all units
+std::string Linker::RenameLabels(const std::string& line, const std::string& suffix)
+{
+	std::vector<std::string> t;
+	for (std::string& s : StringUtil::split(line, ' '))
+	{
+		StringUtil::trim(s);
+		if (s.length() > 0)
+		{
+			t.push_back(s);
+		}
+	}
+	if (t.empty())
+	{
+		return line;
+	}
+
+	if (t[0][t[0].length() - 1] == ':')
+	{
+		return t[0].substr(0, t[0].length() - 1) + suffix + ":";
+	}
+
+	// Jump target is the last operand (jump table has default and table entries after register and base)
+	bool jump = t[0][0] == 'j' || StringUtil::starts_with(t[0], "loop.") || t[0] == "pfor";
+	bool table = t[0] == "jmp.table";
+	if (!jump)
+	{
+		return line;
+	}
+
+	std::string result = t[0];
+	for (size_t k = 1; k < t.size(); k++)
+	{
+		result += " " + t[k];
+		if ((table && k >= 3) || (!table && k + 1 == t.size()))
+		{
+			result += suffix;
+		}
+	}
+	return result;
+}
+
+// Replace handle of string loaded by assembly line with its handle in binary (by given handles of
+// unit), returns false when unit has no such string
+bool Linker::RenameString(std::string& line, const std::map<int, int>& handles)
+{
+	if (!StringUtil::starts_with(line, "mov.reg.str "))
+	{
+		return true;
+	}
+
+	// 'mov.reg.str <reg> <handle>' loads constant once handle is known
+	std::istringstream ss(line.substr(12));
+	std::string reg;
+	int handle = 0;
+	ss >> reg >> handle;
+	auto it = handles.find(handle);
+	if (it == handles.end())
+	{
+		return false;
+	}
+	line = "mov.reg.i32 " + reg + " " + std::to_string(it->second);
+	return true;
+}
+
+// Merge assemblies of units into one program, optimize it and assemble it into binary
+void Linker::Optimize(size_t program)
+{
+	for (const ObjectFile& o : mObjects)
+	{
+		if (o.assembly.empty())
+		{
+			mDiagnostics.push_back(Diagnostic(Diagnostic::SEVERITY_WARNING, "Unit wasn't compiled for link-time optimization, units are linked as they are", o.unit, 0));
+			return;
+		}
+	}
+
+	// Strings get their handles in binary (they're merged already), program is followed by procedures of
+	// all units (other units have no program, their code before procedures is just halt)
+	std::vector<std::string> strings;
+	std::vector<std::string> code;
+	std::vector<std::string> procedures;
+	for (const auto& s : mStrings)
+	{
+		strings.push_back("string " + std::to_string(s.first) + " \"" + s.second + "\"");
+	}
+
+	for (size_t i = 0; i < mObjects.size(); i++)
+	{
+		std::string suffix = ".u" + std::to_string(i);
+		bool procedure = false;
+		for (const std::string& line : mObjects[i].assembly)
+		{
+			std::string lt = line;
+			StringUtil::trim(lt);
+			if (lt.empty())
+			{
+				continue;
+			}
+
+			if (StringUtil::starts_with(lt, "string "))
+			{
+				continue;
+			}
+
+			if (!RenameString(lt, mHandles[i]))
+			{
+				mDiagnostics.push_back(Diagnostic(Diagnostic::SEVERITY_WARNING, "Unit loads string it doesn't have, units are linked as they are", mObjects[i].unit, 0));
+				return;
+			}
+
+			procedure = procedure || StringUtil::starts_with(lt, "proc ");
+			if (procedure)
+			{
+				procedures.push_back(RenameLabels(lt, suffix));
+			}
+			else if (i == program)
+			{
+				code.push_back(RenameLabels(lt, suffix));
+			}
+		}
+
+		// Program ends with halt when its unit has procedures
+		if (i == program && !code.empty() && code.back() == "halt")
+		{
+			code.pop_back();
+		}
+	}
+
+	std::vector<std::string> assembly = strings;
+	assembly.insert(assembly.end(), code.begin(), code.end());
+	if (!procedures.empty())
+	{
+		assembly.push_back("halt");
+		assembly.insert(assembly.end(), procedures.begin(), procedures.end());
+	}
+
+	// Unused procedures are removed by inliner, as they aren't called from program
+	Optimizer o(assembly);
+	o.SetInlineBudget(mInlineBudget);
+	o.SetLoopEvaluation(mEvaluateLoops);
+	o.Optimize();
+	if (!o.IsOptimized())
+	{
+		mDiagnostics.push_back(Diagnostic(Diagnostic::SEVERITY_WARNING, "Assembly can't be represented in IR, leaving it unoptimized", "", 0));
+	}
+	mAssembly = o.GetOptimized();
+
+	Disassembler d(mAssembly);
+	d.Disassemble();
+	mBinary = d.GetCode();
+}
+
+// Constructor
+Linker::Linker()
+{
+	mOptimize = false;
+	mInlineBudget = Inliner::DEFAULT_BUDGET;
+	mEvaluateLoops = true;
+}
+
+// Optimize whole program (objects need to carry their assembly, otherwise they're linked as they are)
+void Linker::EnableOptimization(size_t inlineBudget, bool evaluateLoops)
+{
+	mOptimize = true;
+	mInlineBudget = inlineBudget;
+	mEvaluateLoops = evaluateLoops;
+}
+
+// Add unit to link
+void Linker::Add(const ObjectFile& object)
+{
+	mObjects.push_back(object);
+}
+
+// Add unit loaded from object file, returns false when it can't be loaded
+bool Linker::AddFile(const std::string& filename)
+{
+	ObjectFile object;
+	if (!object.Load(filename))
+	{
+		Error("Can't load object " + filename + " (or it was compiled by different compiler version)", "");
+		return false;
+	}
+
+	mObjects.push_back(object);
+	return true;
+}
+
+// Link added units, returns false when any error was reported
+bool Linker::Link()
+{
+	mBinary.clear();
+	mAssembly.clear();
+	mDefinitions.clear();
+	mStrings.clear();
+	mHandles.clear();
+
+	// Exactly one unit has program, it's executed from the beginning of binary
+	size_t program = mObjects.size();
+	for (size_t i = 0; i < mObjects.size(); i++)
+	{
+		if (!mObjects[i].program)
+		{
+			continue;
+		}
+
+		if (program < mObjects.size())
+		{
+			Error("Unit has program, but it's already in " + mObjects[program].unit, mObjects[i].unit);
+			continue;
+		}
+		program = i;
+	}
+	if (program == mObjects.size())
+	{
+		Error("None of linked units has program", "");
+	}
+
+	if (Diagnostic::HasErrors(mDiagnostics))
+	{
+		return false;
+	}
+
+	// Units are placed one after another (program first), base is offset of unit in binary
+	std::vector<size_t> order;
+	order.push_back(program);
+	for (size_t i = 0; i < mObjects.size(); i++)
+	{
+		if (i != program)
+		{
+			order.push_back(i);
+		}
+	}
+
+	// Strings of units get handles in order of units (handles of program don't change), equal strings
+	// of different units share handle. Empty string is 0 in all units
+	std::map<std::string, int> interned;
+	interned[""] = 0;
+	mHandles.resize(mObjects.size());
+	for (size_t i : order)
+	{
+		for (const auto& s : mObjects[i].strings)
+		{
+			auto it = interned.find(s.second);
+			if (it == interned.end())
+			{
+				it = interned.insert(std::make_pair(s.second, (int)interned.size())).first;
+				mStrings[it->second] = s.second;
+			}
+			mHandles[i][s.first] = it->second;
+		}
+	}
+
+	std::vector<int> binary;
+	Disassembler::EmitHeader(binary);
+	Disassembler::EmitPool(mStrings, binary);
+
+	std::vector<size_t> bases(mObjects.size());
+	for (size_t i : order)
+	{
+		const ObjectFile& o = mObjects[i];
+		bases[i] = binary.size();
+		binary.insert(binary.end(), o.code.begin(), o.code.end());
+
+		// Program ends before procedures of other units
+		if (i == program)
+		{
+			binary.push_back(Disassembler::HALT);
+		}
+
+		for (const ObjectFile::Symbol& s : o.symbols)
+		{
+			if (s.offset < 0 || s.offset % sizeof(int) != 0 || (size_t)s.offset >= o.code.size() * sizeof(int))
+			{
+				Error("Procedure " + GetName(s.label) + " is out of code of its unit", o.unit);
+				continue;
+			}
+
+			auto it = mDefinitions.find(s.label);
+			if (it != mDefinitions.end())
+			{
+				Error("Procedure " + GetName(s.label) + " is already defined in " + mObjects[it->second.object].unit, o.unit);
+				continue;
+			}
+
+			Definition d;
+			d.object = i;
+			d.symbol = &s;
+			d.address = (int)(bases[i] * sizeof(int)) + s.offset;
+			mDefinitions[s.label] = d;
+		}
+	}
+
+	// Offsets within unit are moved by its base, calls of other units get address of procedure and handles
+	// of strings are changed to their handles in binary
+	for (size_t i = 0; i < mObjects.size(); i++)
+	{
+		const ObjectFile& o = mObjects[i];
+		for (size_t r : o.relocations)
+		{
+			binary[bases[i] + r] += (int)(bases[i] * sizeof(int));
+		}
+
+		for (size_t h : o.handles)
+		{
+			auto it = mHandles[i].find(binary[bases[i] + h]);
+			if (it == mHandles[i].end())
+			{
+				Error("Code loads string " + std::to_string(binary[bases[i] + h]) + " which isn't in unit", o.unit);
+				continue;
+			}
+			binary[bases[i] + h] = it->second;
+		}
+
+		for (const ObjectFile::Reference& r : o.references)
+		{
+			auto it = mDefinitions.find(r.label);
+			if (it == mDefinitions.end())
+			{
+				Error("Procedure " + GetName(r.label) + " isn't defined in any of linked units", o.unit);
+				continue;
+			}
+			binary[bases[i] + r.position] = it->second.address;
+		}
+
+		// Procedures called in parallel loops weren't known to unit, so their properties are checked now
+		for (const std::string& p : o.parallelCalls)
+		{
+			bool globals = false;
+			bool parallel = false;
+			std::set<std::string> visited;
+			Summarize(p, globals, parallel, visited);
+
+			if (globals)
+			{
+				Error("Procedure " + GetName(p) + " called in parallel loop can't access arrays of program", o.unit);
+			}
+			if (parallel)
+			{
+				Error("Procedure " + GetName(p) + " called in parallel loop contains parallel loop (they can't be nested)", o.unit);
+			}
+		}
+	}
+
+	if (Diagnostic::HasErrors(mDiagnostics))
+	{
+		return false;
+	}
+
+	// Stack depth is known once calls are resolved
+	Disassembler::FinishHeader(binary);
+	mBinary.swap(binary);
+
+	// Units were checked by linking them as they are, whole program replaces them
+	if (mOptimize)
+	{
+		Optimize(program);
+	}
+	return true;
+}
\ No newline at end of file
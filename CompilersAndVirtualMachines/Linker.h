@@ -0,0 +1,107 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __LINKER_H__
+#define __LINKER_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "ObjectFile.h"
+#include "Diagnostic.h"
+#include "Inliner.h"
+
+// Linker combines relocatable objects into single executable binary. Binary starts with header and
+// constant pool merged from strings of all units (equal strings share handle, handles in code of each
+// unit are rewritten), followed by the unit which has program (and halt ending it) and then by other
+// units in order they were added. Each unit is relocated by its offset in binary, calls of procedures
+// of other units are resolved through symbols of all units.
+// With link-time optimization, assemblies of all units are merged into one program (their labels are
+// renamed apart) which is optimized as a whole - procedures no program uses are removed, small ones
+// are inlined into callers in other units and constants propagate through them
+class Linker
+{
+private:
+	// Procedure defined by any of units
+	struct Definition
+	{
+		size_t object;							// Object defining procedure
+		const ObjectFile::Symbol* symbol;		// Symbol of procedure
+		int address;							// Offset of procedure in binary (in bytes)
+	};
+
+	std::vector<ObjectFile> mObjects;			// Linked units
+	std::map<std::string, Definition> mDefinitions;	// Procedures of all units (by label)
+	std::map<int, std::string> mStrings;		// Strings of all units (by handle in binary)
+	std::vector<std::map<int, int> > mHandles;	// Handles in binary of strings of each unit (by handle in unit)
+	std::vector<int> mBinary;					// Executable binary
+	std::vector<std::string> mAssembly;			// Optimized assembly of whole program (link-time optimization only)
+	std::vector<Diagnostic> mDiagnostics;		// Reported errors
+
+	bool mOptimize;								// Optimize whole program
+	size_t mInlineBudget;						// Maximum number of instructions of inlined procedure
+	bool mEvaluateLoops;						// Evaluate loops depending only on constants at compile time
+
+	// Report error in given unit
+	void Error(const std::string& error, const std::string& unit);
+
+	// Properties of procedure including procedures it calls in all units
+	void Summarize(const std::string& label, bool& globals, bool& parallel, std::set<std::string>& visited) const;
+
+	// Name of procedure with given label
+	static std::string GetName(const std::string& label);
+
+	// Rename local labels (defined or used as jump target) of assembly line by appending suffix, labels of
+	// procedures are shared by all units
+	static std::string RenameLabels(const std::string& line, const std::string& suffix);
+
+	// Replace handle of string loaded by assembly line with its handle in binary (by given handles of
+	// unit), returns false when unit has no such string
+	static bool RenameString(std::string& line, const std::map<int, int>& handles);
+
+	// Merge assemblies of units into one program, optimize it and assemble it into binary
+	void Optimize(size_t program);
+
+public:
+	// Constructor
+	Linker();
+
+	// Optimize whole program (objects need to carry their assembly, otherwise they're linked as they are)
+	void EnableOptimization(size_t inlineBudget = Inliner::DEFAULT_BUDGET, bool evaluateLoops = true);
+
+	// Add unit to link
+	void Add(const ObjectFile& object);
+
+	// Add unit loaded from object file, returns false when it can't be loaded
+	bool AddFile(const std::string& filename);
+
+	// Link added units, returns false when any error was reported
+	bool Link();
+
+	// Get executable binary (empty when linking failed)
+	const std::vector<int>& GetBinary() const
+	{
+		return mBinary;
+	}
+
+	// Get optimized assembly of whole program (empty without link-time optimization)
+	const std::vector<std::string>& GetAssembly() const
+	{
+		return mAssembly;
+	}
+
+	// Get reported errors
+	const std::vector<Diagnostic>& GetDiagnostics() const
+	{
+		return mDiagnostics;
+	}
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,2017 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "LoopOptimizer.h"
+#include "Disassembler.h"
+#include <algorithm>
+#include <functional>
+#include <climits>
+
+LoopOptimizer::LoopOptimizer(IR& ir) : mIR(ir)
+{
+}
+
+// Find all natural loops (computes dominators)
+void LoopOptimizer::FindLoops()
+{
+	mLoops.clear();
+	mIR.ComputeDominators();
+
+	size_t blocks = mIR.GetBlocksCount();
+	std::vector<int> order = mIR.ReversePostorder();
+	std::vector<bool> reachable(blocks, false);
+	for (int b : order)
+	{
+		reachable[b] = true;
+	}
+
+	for (int h : order)
+	{
+		Loop loop;
+		loop.header = h;
+		loop.contains.assign(blocks, false);
+		loop.contains[h] = true;
+
+		// Back edge is jump to block which dominates the jumping one
+		std::vector<int> stack;
+		for (int p : mIR.GetBlock(h).preds)
+		{
+			if (reachable[p] && mIR.Dominates(h, p) && std::find(loop.latches.begin(), loop.latches.end(), p) == loop.latches.end())
+			{
+				loop.latches.push_back(p);
+				if (!loop.contains[p])
+				{
+					loop.contains[p] = true;
+					stack.push_back(p);
+				}
+			}
+		}
+
+		if (loop.latches.empty())
+		{
+			continue;
+		}
+
+		// Loop consists of blocks from which latches can be reached without passing through header
+		while (!stack.empty())
+		{
+			int b = stack.back();
+			stack.pop_back();
+			for (int p : mIR.GetBlock(b).preds)
+			{
+				if (reachable[p] && !loop.contains[p])
+				{
+					loop.contains[p] = true;
+					stack.push_back(p);
+				}
+			}
+		}
+
+		for (int b : order)
+		{
+			if (loop.contains[b])
+			{
+				loop.blocks.push_back(b);
+			}
+		}
+
+		mLoops.push_back(loop);
+	}
+
+	// Inner loops are always smaller than the ones containing them
+	std::stable_sort(mLoops.begin(), mLoops.end(), [](const Loop& a, const Loop& b) { return a.blocks.size() < b.blocks.size(); });
+}
+
+// Returns true if loop doesn't contain any other loop
+bool LoopOptimizer::IsInnermost(const Loop& loop)
+{
+	for (const Loop& other : mLoops)
+	{
+		if (other.header != loop.header && loop.contains[other.header])
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Get block through which loop is entered, it is created when create is set (returns -1 if
+// loop is entered from multiple blocks)
+int LoopOptimizer::GetPreheader(const Loop& loop, bool create)
+{
+	int h = loop.header;
+	int pred = -1;
+	for (int p : mIR.GetBlock(h).preds)
+	{
+		if (loop.contains[p])
+		{
+			continue;
+		}
+
+		if (pred != -1)
+		{
+			return -1;
+		}
+		pred = p;
+	}
+
+	if (pred == -1)
+	{
+		return -1;
+	}
+
+	if (mIR.GetBlock(pred).succs.size() == 1)
+	{
+		return pred;
+	}
+
+	if (!create)
+	{
+		return -1;
+	}
+
+	// Predecessor branches, empty block is inserted on the edge into loop
+	int preheader = mIR.NewBlock();
+	IR::Block& ph = mIR.GetBlock(preheader);
+	IR::Block& p = mIR.GetBlock(pred);
+	ph.term = IR::GOTO;
+	ph.succs.push_back(h);
+	ph.preds.push_back(pred);
+	ph.entry = p.exit;
+	ph.exit = p.exit;
+	std::replace(p.succs.begin(), p.succs.end(), h, preheader);
+	mIR.ReplacePredecessor(h, pred, preheader);
+	mIR.MoveBlockBefore(preheader, h);
+
+	return preheader;
+}
+
+// Rotate while loop into do-while loop guarded by copy of its condition
+bool LoopOptimizer::Rotate(const Loop& loop)
+{
+	int h = loop.header;
+	const IR::Block& header = mIR.GetBlock(h);
+	if (header.term != IR::BRANCH || header.preds.size() != 2 || loop.latches.size() != 1 || header.code.size() > MAX_ROTATED_HEADER)
+	{
+		return false;
+	}
+
+	int latch = loop.latches[0];
+	int pred = (header.preds[0] == latch) ? header.preds[1] : header.preds[0];
+	if (pred == latch || mIR.GetBlock(latch).term != IR::GOTO)
+	{
+		return false;
+	}
+
+	// Header has to decide between staying in loop and leaving it
+	int in = loop.contains[header.succs[0]] ? 0 : 1;
+	int body = header.succs[in];
+	int exit = header.succs[1 - in];
+	if (body == h || !loop.contains[body] || loop.contains[exit])
+	{
+		return false;
+	}
+
+	const IR::Block& bodyBlock = mIR.GetBlock(body);
+	const IR::Block& exitBlock = mIR.GetBlock(exit);
+	if (bodyBlock.preds.size() != 1 || exitBlock.preds.size() != 1 || !bodyBlock.phis.empty() || !exitBlock.phis.empty())
+	{
+		return false;
+	}
+
+	// Blocks dominated by header are either in loop (dominated by body) or after it (dominated by exit)
+	std::vector<int> side(mIR.GetBlocksCount(), -1);
+	for (int b : mIR.GetLayout())
+	{
+		if (mIR.GetBlock(b).removed || mIR.GetIdom(b) == -1)
+		{
+			continue;
+		}
+
+		if (mIR.Dominates(body, b))
+		{
+			side[b] = 0;
+		}
+		else if (mIR.Dominates(exit, b))
+		{
+			side[b] = 1;
+		}
+		else if (b != h && mIR.Dominates(h, b))
+		{
+			return false;
+		}
+	}
+
+	// Guard is copy of header evaluated when entering the loop, header phis are replaced by
+	// values coming from outside of loop
+	int guard = mIR.NewBlock();
+	std::map<int, int> sigma;
+	auto Map = [&sigma](int value)
+	{
+		auto it = sigma.find(value);
+		return (it == sigma.end()) ? value : it->second;
+	};
+
+	size_t predIndex = std::find(mIR.GetBlock(h).preds.begin(), mIR.GetBlock(h).preds.end(), pred) - mIR.GetBlock(h).preds.begin();
+	for (int p : mIR.GetBlock(h).phis)
+	{
+		sigma[p] = mIR.GetValue(p).operands[predIndex];
+	}
+
+	for (int c : mIR.GetBlock(h).code)
+	{
+		IR::Value v = mIR.GetValue(c);
+		for (int& o : v.operands)
+		{
+			o = Map(o);
+		}
+
+		int copy = mIR.NewValue(v.op, guard, v.imm, v.operands, v.lanes);
+		mIR.GetBlock(guard).code.push_back(copy);
+		sigma[c] = copy;
+	}
+
+	IR::Block& g = mIR.GetBlock(guard);
+	IR::Block& hb = mIR.GetBlock(h);
+	for (int e : hb.entry)
+	{
+		g.entry.push_back(Map(e));
+	}
+	for (int e : hb.exit)
+	{
+		g.exit.push_back(Map(e));
+	}
+	g.term = IR::BRANCH;
+	g.cond = Map(hb.cond);
+	g.succs = hb.succs;
+	g.preds.push_back(pred);
+
+	IR::Block& pb = mIR.GetBlock(pred);
+	std::replace(pb.succs.begin(), pb.succs.end(), h, guard);
+	mIR.RemovePredecessor(h, pred);
+
+	// Header becomes the test at the end of loop
+	int last = latch;
+	for (int b : mIR.GetLayout())
+	{
+		if (b != h && b < (int)loop.contains.size() && loop.contains[b])
+		{
+			last = b;
+		}
+	}
+	mIR.MoveBlockBefore(guard, h);
+	mIR.MoveBlockAfter(h, last);
+
+	// Body and exit are entered from both guard and header now, values of header used there
+	// are merged with their copies from guard
+	int targets[2] = { body, exit };
+	std::map<int, int> merged[2];
+	std::vector<int> phis[2];
+	auto Merge = [&](int s, int value)
+	{
+		if (value < 0 || sigma.find(value) == sigma.end())
+		{
+			return value;
+		}
+
+		auto it = merged[s].find(value);
+		if (it != merged[s].end())
+		{
+			return it->second;
+		}
+
+		// Phi needs variable which carries the value, when there is none new one is created
+		int var = -1;
+		const std::vector<int>& exitMap = mIR.GetBlock(h).exit;
+		for (size_t x = 0; x < exitMap.size(); x++)
+		{
+			if (exitMap[x] == value)
+			{
+				var = (int)x;
+				break;
+			}
+		}
+
+		if (var == -1)
+		{
+			var = mIR.NewVariable();
+			mIR.GetBlock(h).exit[var] = value;
+			mIR.GetBlock(guard).exit[var] = sigma[value];
+		}
+
+		int phi = mIR.NewValue(IR::PHI, targets[s], var, { sigma[value], value });
+		mIR.GetBlock(targets[s]).entry[var] = phi;
+		phis[s].push_back(phi);
+		merged[s][value] = phi;
+		return phi;
+	};
+
+	for (int b : mIR.GetLayout())
+	{
+		if (mIR.GetBlock(b).removed)
+		{
+			continue;
+		}
+
+		int s = (b < (int)side.size()) ? side[b] : -1;
+		if (s != -1)
+		{
+			for (int c : mIR.GetBlock(b).code)
+			{
+				for (size_t i = 0; i < mIR.GetValue(c).operands.size(); i++)
+				{
+					int o = Merge(s, mIR.GetValue(c).operands[i]);
+					mIR.GetValue(c).operands[i] = o;
+				}
+			}
+
+			int cond = Merge(s, mIR.GetBlock(b).cond);
+			mIR.GetBlock(b).cond = cond;
+
+			for (size_t x = 0; x < mIR.GetBlock(b).entry.size(); x++)
+			{
+				int e = Merge(s, mIR.GetBlock(b).entry[x]);
+				mIR.GetBlock(b).entry[x] = e;
+			}
+
+			for (size_t x = 0; x < mIR.GetBlock(b).exit.size(); x++)
+			{
+				int e = Merge(s, mIR.GetBlock(b).exit[x]);
+				mIR.GetBlock(b).exit[x] = e;
+			}
+		}
+
+		// Phi operands are used at the end of predecessors
+		for (int p : mIR.GetBlock(b).phis)
+		{
+			for (size_t i = 0; i < mIR.GetValue(p).operands.size(); i++)
+			{
+				int pred = mIR.GetBlock(b).preds[i];
+				if (pred < (int)side.size() && side[pred] != -1)
+				{
+					int o = Merge(side[pred], mIR.GetValue(p).operands[i]);
+					mIR.GetValue(p).operands[i] = o;
+				}
+			}
+		}
+	}
+
+	for (int s = 0; s < 2; s++)
+	{
+		IR::Block& t = mIR.GetBlock(targets[s]);
+		t.phis = phis[s];
+		t.preds.clear();
+		t.preds.push_back(guard);
+		t.preds.push_back(h);
+	}
+
+	return true;
+}
+
+// Hoist loop invariant values into preheader
+bool LoopOptimizer::Hoist(const Loop& loop)
+{
+	int preheader = GetPreheader(loop, false);
+	if (preheader == -1)
+	{
+		return false;
+	}
+
+	// Value is invariant when all its operands are computed outside of loop (or are invariant too)
+	std::vector<int> hoisted;
+	std::set<int> moved;
+	for (int b : loop.blocks)
+	{
+		for (int c : mIR.GetBlock(b).code)
+		{
+			const IR::Value& v = mIR.GetValue(c);
+			if (v.op == IR::CONST || v.op == IR::UNDEF || v.op == IR::COPY || mIR.HasSideEffect(c) || IR::IsLoad(v.op))
+			{
+				continue;
+			}
+
+			bool invariant = true;
+			for (int o : v.operands)
+			{
+				const IR::Value& operand = mIR.GetValue(o);
+				if (operand.op != IR::CONST && loop.contains[operand.block] && moved.find(o) == moved.end())
+				{
+					invariant = false;
+				}
+			}
+
+			if (!invariant)
+			{
+				continue;
+			}
+
+			// Constants are part of instructions, but they have to dominate their uses too
+			for (int o : v.operands)
+			{
+				const IR::Value& operand = mIR.GetValue(o);
+				if (operand.op == IR::CONST && loop.contains[operand.block] && moved.find(o) == moved.end())
+				{
+					hoisted.push_back(o);
+					moved.insert(o);
+				}
+			}
+
+			hoisted.push_back(c);
+			moved.insert(c);
+		}
+	}
+
+	if (hoisted.empty())
+	{
+		return false;
+	}
+
+	for (int b : loop.blocks)
+	{
+		std::vector<int>& code = mIR.GetBlock(b).code;
+		code.erase(std::remove_if(code.begin(), code.end(), [&moved](int v) { return moved.find(v) != moved.end(); }), code.end());
+	}
+
+	for (int v : hoisted)
+	{
+		mIR.GetValue(v).block = preheader;
+		mIR.GetBlock(preheader).code.push_back(v);
+	}
+
+	return true;
+}
+
+// Number of iterations of loop with single latch (-1 when unknown), its induction variable (header
+// phi) is stored into induction when given
+int LoopOptimizer::TripCount(const Loop& loop, int* induction)
+{
+	int h = loop.header;
+	const IR::Block& header = mIR.GetBlock(h);
+	if (loop.latches.size() != 1 || header.preds.size() != 2)
+	{
+		return -1;
+	}
+
+	int latch = loop.latches[0];
+	const IR::Block& lb = mIR.GetBlock(latch);
+	if (lb.term != IR::BRANCH || header.preds[0] == header.preds[1])
+	{
+		return -1;
+	}
+
+	int li = (header.preds[0] == latch) ? 0 : 1;
+	bool continueIfTrue = (lb.succs[0] == h);
+
+	// Condition is either induction variable itself, or its comparison with constant
+	const IR::Value& cond = mIR.GetValue(lb.cond);
+	int iv = lb.cond;
+	int bound = 0;
+	bool ivFirst = true;
+	IR::Opcode op = IR::CMPNEQ;
+	if (IR::IsCompare(cond.op))
+	{
+		const IR::Value& a = mIR.GetValue(cond.operands[0]);
+		const IR::Value& b = mIR.GetValue(cond.operands[1]);
+		if (b.op == IR::CONST)
+		{
+			iv = cond.operands[0];
+			bound = b.imm;
+		}
+		else if (a.op == IR::CONST)
+		{
+			iv = cond.operands[1];
+			bound = a.imm;
+			ivFirst = false;
+		}
+		else
+		{
+			return -1;
+		}
+		op = cond.op;
+	}
+
+	// Induction variable is header phi (or its next value), incremented by constant
+	int phi = -1;
+	int next = iv;
+	if (mIR.GetValue(iv).op == IR::PHI && mIR.GetValue(iv).block == h)
+	{
+		phi = iv;
+		next = mIR.GetValue(iv).operands[li];
+	}
+
+	const IR::Value& n = mIR.GetValue(next);
+	if (n.op != IR::ADD && n.op != IR::SUB)
+	{
+		return -1;
+	}
+
+	int step = 0;
+	int base = -1;
+	const IR::Value& x = mIR.GetValue(n.operands[0]);
+	const IR::Value& y = mIR.GetValue(n.operands[1]);
+	if (y.op == IR::CONST)
+	{
+		base = n.operands[0];
+		step = (n.op == IR::ADD) ? y.imm : (int)(0u - (unsigned int)y.imm);
+	}
+	else if (n.op == IR::ADD && x.op == IR::CONST)
+	{
+		base = n.operands[1];
+		step = x.imm;
+	}
+	else
+	{
+		return -1;
+	}
+
+	if (phi == -1)
+	{
+		phi = base;
+	}
+
+	const IR::Value& p = mIR.GetValue(phi);
+	if (phi != base || p.op != IR::PHI || p.block != h || p.operands[li] != next)
+	{
+		return -1;
+	}
+
+	const IR::Value& init = mIR.GetValue(p.operands[1 - li]);
+	if (init.op != IR::CONST)
+	{
+		return -1;
+	}
+
+	// Run the loop
+	int value = init.imm;
+	for (int count = 1; count <= MAX_TRIP_COUNT; count++)
+	{
+		int updated = (int)((unsigned int)value + (unsigned int)step);
+		int tested = (iv == phi) ? value : updated;
+		int result = 0;
+		IR::Evaluate(op, ivFirst ? tested : bound, ivFirst ? bound : tested, result);
+		if ((result != 0) != continueIfTrue)
+		{
+			if (induction != nullptr)
+			{
+				*induction = phi;
+			}
+			return count;
+		}
+		value = updated;
+	}
+
+	return -1;
+}
+
+// Partially unroll loop with known trip count
+bool LoopOptimizer::Unroll(const Loop& loop)
+{
+	int h = loop.header;
+	if (mUnrolled.find(h) != mUnrolled.end() || !IsInnermost(loop))
+	{
+		return false;
+	}
+
+	int trips = TripCount(loop);
+	if (trips < 2)
+	{
+		return false;
+	}
+
+	// Loop can be left only from latch
+	int latch = loop.latches[0];
+	int size = 0;
+	for (int b : loop.blocks)
+	{
+		for (int s : mIR.GetBlock(b).succs)
+		{
+			if (!loop.contains[s] && b != latch)
+			{
+				return false;
+			}
+		}
+		size += (int)(mIR.GetBlock(b).phis.size() + mIR.GetBlock(b).code.size());
+	}
+
+	// Number of iterations has to be multiple of unroll factor, so only the last copy needs the test
+	int factor = 0;
+	for (int k = MAX_UNROLL_FACTOR; k >= 2; k--)
+	{
+		if (trips % k == 0 && size * k <= MAX_UNROLLED_SIZE)
+		{
+			factor = k;
+			break;
+		}
+	}
+
+	if (factor == 0)
+	{
+		return false;
+	}
+
+	const IR::Block& lb = mIR.GetBlock(latch);
+	int exit = (lb.succs[0] == h) ? lb.succs[1] : lb.succs[0];
+	int li = (mIR.GetBlock(h).preds[0] == latch) ? 0 : 1;
+
+	// Blocks of copies are placed after the loop
+	std::vector<std::map<int, int> > blockCopy(factor);
+	std::vector<std::map<int, int> > sigma(factor);
+	int last = latch;
+	for (int b : mIR.GetLayout())
+	{
+		if (b < (int)loop.contains.size() && loop.contains[b])
+		{
+			last = b;
+		}
+	}
+
+	for (int j = 1; j < factor; j++)
+	{
+		for (int b : loop.blocks)
+		{
+			int copy = mIR.NewBlock();
+			mIR.MoveBlockAfter(copy, last);
+			last = copy;
+			blockCopy[j][b] = copy;
+		}
+	}
+
+	auto Map = [&sigma](int j, int value)
+	{
+		auto it = sigma[j].find(value);
+		return (value < 0 || it == sigma[j].end()) ? value : it->second;
+	};
+
+	for (int j = 1; j < factor; j++)
+	{
+		// Header phis of copy hold values from the end of previous copy
+		for (int p : mIR.GetBlock(h).phis)
+		{
+			sigma[j][p] = Map(j - 1, mIR.GetValue(p).operands[li]);
+		}
+
+		std::vector<int> cloned;
+		for (int b : loop.blocks)
+		{
+			int copy = blockCopy[j][b];
+			if (b != h)
+			{
+				for (int p : mIR.GetBlock(b).phis)
+				{
+					int v = mIR.NewValue(IR::PHI, copy, mIR.GetValue(p).imm, std::vector<int>());
+					mIR.GetBlock(copy).phis.push_back(v);
+					sigma[j][p] = v;
+					cloned.push_back(p);
+				}
+			}
+
+			for (int c : mIR.GetBlock(b).code)
+			{
+				int v = mIR.NewValue(mIR.GetValue(c).op, copy, mIR.GetValue(c).imm, std::vector<int>(), mIR.GetValue(c).lanes);
+				mIR.GetBlock(copy).code.push_back(v);
+				sigma[j][c] = v;
+				cloned.push_back(c);
+			}
+		}
+
+		for (int v : cloned)
+		{
+			std::vector<int> operands = mIR.GetValue(v).operands;
+			for (int& o : operands)
+			{
+				o = Map(j, o);
+			}
+			mIR.GetValue(sigma[j][v]).operands = operands;
+		}
+
+		for (int b : loop.blocks)
+		{
+			const IR::Block& src = mIR.GetBlock(b);
+			IR::Block& dst = mIR.GetBlock(blockCopy[j][b]);
+			dst.term = src.term;
+			dst.cond = Map(j, src.cond);
+			for (int s : src.succs)
+			{
+				dst.succs.push_back((s == h || !loop.contains[s]) ? s : blockCopy[j][s]);
+			}
+
+			if (b == h)
+			{
+				dst.preds.push_back((j == 1) ? latch : blockCopy[j - 1][latch]);
+			}
+			else
+			{
+				for (int p : src.preds)
+				{
+					dst.preds.push_back(blockCopy[j][p]);
+				}
+			}
+
+			for (int e : src.entry)
+			{
+				dst.entry.push_back(Map(j, e));
+			}
+			for (int e : src.exit)
+			{
+				dst.exit.push_back(Map(j, e));
+			}
+		}
+	}
+
+	// All copies but the last one continue into next copy without any test
+	for (int j = 0; j < factor - 1; j++)
+	{
+		IR::Block& l = mIR.GetBlock((j == 0) ? latch : blockCopy[j][latch]);
+		l.term = IR::GOTO;
+		l.cond = -1;
+		l.succs.assign(1, blockCopy[j + 1][h]);
+	}
+
+	int lastLatch = blockCopy[factor - 1][latch];
+	mIR.ReplacePredecessor(h, latch, lastLatch);
+	mIR.ReplacePredecessor(exit, latch, lastLatch);
+	for (int p : mIR.GetBlock(h).phis)
+	{
+		int o = Map(factor - 1, mIR.GetValue(p).operands[li]);
+		mIR.GetValue(p).operands[li] = o;
+	}
+
+	// Code after loop sees values of the last copy
+	std::set<int> copies;
+	for (int j = 1; j < factor; j++)
+	{
+		for (const auto& c : blockCopy[j])
+		{
+			copies.insert(c.second);
+		}
+	}
+
+	for (int b : mIR.GetLayout())
+	{
+		IR::Block& blk = mIR.GetBlock(b);
+		if (blk.removed || (b < (int)loop.contains.size() && loop.contains[b]) || copies.find(b) != copies.end())
+		{
+			continue;
+		}
+
+		for (int c : blk.code)
+		{
+			for (int& o : mIR.GetValue(c).operands)
+			{
+				o = Map(factor - 1, o);
+			}
+		}
+
+		for (int p : blk.phis)
+		{
+			for (int& o : mIR.GetValue(p).operands)
+			{
+				o = Map(factor - 1, o);
+			}
+		}
+
+		blk.cond = Map(factor - 1, blk.cond);
+		for (int& e : blk.entry)
+		{
+			e = Map(factor - 1, e);
+		}
+		for (int& e : blk.exit)
+		{
+			e = Map(factor - 1, e);
+		}
+	}
+
+	mUnrolled.insert(h);
+
+	return true;
+}
+
+// Replace affine functions of induction variables with new induction variables
+bool LoopOptimizer::ReduceInduction(const Loop& loop)
+{
+	int h = loop.header;
+	int preheader = GetPreheader(loop, false);
+	const IR::Block& header = mIR.GetBlock(h);
+	if (preheader == -1 || loop.latches.size() != 1 || header.preds.size() != 2 || header.preds[0] == header.preds[1])
+	{
+		return false;
+	}
+
+	int latch = loop.latches[0];
+	int li = (header.preds[0] == latch) ? 0 : 1;
+	auto Wrap = [](long long value)
+	{
+		return (int)(unsigned int)value;
+	};
+
+	// Basic induction variables are header phis incremented by constant in each iteration
+	std::map<int, Affine> affine;
+	std::map<int, int> steps;
+	for (int p : header.phis)
+	{
+		const IR::Value& next = mIR.GetValue(mIR.GetValue(p).operands[li]);
+		if (next.op != IR::ADD && next.op != IR::SUB)
+		{
+			continue;
+		}
+
+		const IR::Value& a = mIR.GetValue(next.operands[0]);
+		const IR::Value& b = mIR.GetValue(next.operands[1]);
+		if (next.operands[0] == p && b.op == IR::CONST)
+		{
+			steps[p] = (next.op == IR::ADD) ? b.imm : Wrap(-(long long)b.imm);
+		}
+		else if (next.op == IR::ADD && next.operands[1] == p && a.op == IR::CONST)
+		{
+			steps[p] = a.imm;
+		}
+		else
+		{
+			continue;
+		}
+
+		Affine f = { p, 1, 0, 0 };
+		affine[p] = f;
+	}
+
+	if (steps.empty())
+	{
+		return false;
+	}
+
+	// Derived induction variables are computed from basic ones by operations with constants
+	auto Get = [&](int value, Affine& f)
+	{
+		const IR::Value& v = mIR.GetValue(value);
+		if (v.op == IR::CONST)
+		{
+			f.phi = -1;
+			f.scale = 0;
+			f.offset = v.imm;
+			f.cost = 0;
+			return true;
+		}
+
+		auto it = affine.find(value);
+		if (it == affine.end())
+		{
+			return false;
+		}
+		f = it->second;
+		return true;
+	};
+
+	std::vector<int> derived;
+	for (int b : loop.blocks)
+	{
+		for (int c : mIR.GetBlock(b).code)
+		{
+			const IR::Value& v = mIR.GetValue(c);
+			Affine x = { -1, 0, 0, 0 };
+			Affine y = { -1, 0, 0, 0 };
+			if (v.op != IR::ADD && v.op != IR::SUB && v.op != IR::MUL && v.op != IR::SHL && v.op != IR::NEG)
+			{
+				continue;
+			}
+
+			if (!Get(v.operands[0], x) || (v.operands.size() > 1 && !Get(v.operands[1], y)))
+			{
+				continue;
+			}
+
+			if (x.phi != -1 && y.phi != -1 && x.phi != y.phi)
+			{
+				continue;
+			}
+
+			Affine f = { (x.phi != -1) ? x.phi : y.phi, 0, 0, x.cost + y.cost + 1 };
+			switch (v.op)
+			{
+			case IR::ADD:
+				f.scale = Wrap((long long)x.scale + y.scale);
+				f.offset = Wrap((long long)x.offset + y.offset);
+				break;
+
+			case IR::SUB:
+				f.scale = Wrap((long long)x.scale - y.scale);
+				f.offset = Wrap((long long)x.offset - y.offset);
+				break;
+
+			case IR::NEG:
+				f.scale = Wrap(-(long long)x.scale);
+				f.offset = Wrap(-(long long)x.offset);
+				break;
+
+			case IR::MUL:
+				if (x.phi != -1 && y.phi != -1)
+				{
+					continue;
+				}
+				f.scale = Wrap((long long)x.scale * (y.phi != -1 ? y.scale : y.offset) + (long long)y.scale * x.offset);
+				f.offset = Wrap((long long)x.offset * y.offset);
+				break;
+
+			case IR::SHL:
+				if (y.phi != -1)
+				{
+					continue;
+				}
+				f.scale = (int)((unsigned int)x.scale << (y.offset & 31));
+				f.offset = (int)((unsigned int)x.offset << (y.offset & 31));
+				break;
+
+			default:
+				break;
+			}
+
+			if (f.phi == -1 || f.scale == 0)
+			{
+				continue;
+			}
+
+			affine[c] = f;
+			derived.push_back(c);
+		}
+	}
+
+	// Only values used by something else than another derived induction variable are replaced
+	std::set<int> used;
+	auto Use = [&](int user, int value)
+	{
+		if (user == -1 || affine.find(user) == affine.end())
+		{
+			used.insert(value);
+		}
+	};
+
+	for (int b : mIR.GetLayout())
+	{
+		const IR::Block& blk = mIR.GetBlock(b);
+		if (blk.removed)
+		{
+			continue;
+		}
+
+		for (int p : blk.phis)
+		{
+			for (int o : mIR.GetValue(p).operands)
+			{
+				Use(-1, o);
+			}
+		}
+
+		for (int c : blk.code)
+		{
+			for (int o : mIR.GetValue(c).operands)
+			{
+				Use(c, o);
+			}
+		}
+
+		Use(-1, blk.cond);
+		for (int e : blk.exit)
+		{
+			Use(-1, e);
+		}
+	}
+
+	// Values with the same function share induction variable, it's created only when it removes
+	// enough operations from loop
+	std::map<std::vector<int>, std::vector<int> > groups;
+	std::map<std::vector<int>, int> costs;
+	for (int c : derived)
+	{
+		const Affine& f = affine[c];
+		if (f.cost < 2 || used.find(c) == used.end())
+		{
+			continue;
+		}
+
+		std::vector<int> key = { f.phi, f.scale, f.offset };
+		groups[key].push_back(c);
+		costs[key] += f.cost;
+	}
+
+	bool changed = false;
+	for (const auto& g : groups)
+	{
+		if (costs[g.first] < MIN_REDUCED_COST)
+		{
+			continue;
+		}
+
+		int phi = g.first[0];
+		int scale = g.first[1];
+		int offset = g.first[2];
+		int var = mIR.NewVariable();
+
+		// Initial value is computed in preheader
+		int init = mIR.GetValue(phi).operands[1 - li];
+		std::vector<int>& pre = mIR.GetBlock(preheader).code;
+		int start = -1;
+		if (mIR.GetValue(init).op == IR::CONST)
+		{
+			start = mIR.NewValue(IR::CONST, preheader, Wrap((long long)scale * mIR.GetValue(init).imm + offset), std::vector<int>());
+			pre.push_back(start);
+		}
+		else
+		{
+			int s = mIR.NewValue(IR::CONST, preheader, scale, std::vector<int>());
+			int o = mIR.NewValue(IR::CONST, preheader, offset, std::vector<int>());
+			int m = mIR.NewValue(IR::MUL, preheader, 0, { init, s });
+			start = mIR.NewValue(IR::ADD, preheader, 0, { m, o });
+			pre.insert(pre.end(), { s, o, m, start });
+		}
+
+		// Induction variable is incremented at the end of latch
+		int iv = mIR.NewValue(IR::PHI, h, var, std::vector<int>(2, -1));
+		int step = mIR.NewValue(IR::CONST, latch, Wrap((long long)scale * steps[phi]), std::vector<int>());
+		int next = mIR.NewValue(IR::ADD, latch, 0, { iv, step });
+		mIR.GetBlock(latch).code.push_back(step);
+		mIR.GetBlock(latch).code.push_back(next);
+		mIR.GetValue(iv).operands[li] = next;
+		mIR.GetValue(iv).operands[1 - li] = start;
+		mIR.GetBlock(h).phis.push_back(iv);
+
+		for (int b : loop.blocks)
+		{
+			mIR.GetBlock(b).entry[var] = iv;
+			mIR.GetBlock(b).exit[var] = iv;
+		}
+		mIR.GetBlock(latch).exit[var] = next;
+		mIR.GetBlock(preheader).exit[var] = start;
+
+		for (int c : g.second)
+		{
+			mIR.Replace(c, iv);
+		}
+		changed = true;
+	}
+
+	return changed;
+}
+
+// Evaluate loop whose values depend only on constants at compile time, loop is replaced by its
+// results (returns false when it can't be evaluated within limit or would fail at runtime)
+bool LoopOptimizer::Evaluate(const Loop& loop)
+{
+	int h = loop.header;
+
+	// Loop is entered from single block
+	int entry = -1;
+	for (int p : mIR.GetBlock(h).preds)
+	{
+		if (!loop.contains[p])
+		{
+			if (entry != -1)
+			{
+				return false;
+			}
+			entry = p;
+		}
+	}
+	if (entry == -1)
+	{
+		return false;
+	}
+
+	// Everything computed in loop has to be known - values from outside of loop are constants and
+	// there are no calls (nor anything else unknown)
+	auto IsKnown = [this, &loop](int o)
+	{
+		const IR::Value& v = mIR.GetValue(o);
+		return loop.contains[v.block] ? (v.op != IR::UNDEF && v.op != IR::ARG) : v.op == IR::CONST;
+	};
+
+	for (int b : loop.blocks)
+	{
+		const IR::Block& blk = mIR.GetBlock(b);
+		if (blk.term != IR::GOTO && blk.term != IR::BRANCH)
+		{
+			return false;
+		}
+
+		for (int p : blk.phis)
+		{
+			for (int o : mIR.GetValue(p).operands)
+			{
+				if (!IsKnown(o))
+				{
+					return false;
+				}
+			}
+		}
+
+		for (int c : blk.code)
+		{
+			const IR::Value& v = mIR.GetValue(c);
+			if (v.op != IR::CONST && v.op != IR::COPY && v.op != IR::NEG && !IR::IsBinary(v.op))
+			{
+				return false;
+			}
+
+			for (int o : v.operands)
+			{
+				if (!IsKnown(o))
+				{
+					return false;
+				}
+			}
+		}
+	}
+
+	// Run loop from its entry until it's left
+	std::vector<int> env(mIR.GetValuesCount(), 0);
+	auto Get = [this, &env, &loop](int o)
+	{
+		const IR::Value& v = mIR.GetValue(o);
+		return loop.contains[v.block] ? env[o] : v.imm;
+	};
+
+	int evaluated = 0;
+	int from = entry;
+	int b = h;
+	while (loop.contains[b])
+	{
+		const IR::Block& blk = mIR.GetBlock(b);
+
+		// Phi nodes take their operands at once
+		size_t index = std::find(blk.preds.begin(), blk.preds.end(), from) - blk.preds.begin();
+		std::vector<int> phis;
+		for (int p : blk.phis)
+		{
+			phis.push_back(Get(mIR.GetValue(p).operands[index]));
+		}
+		for (size_t i = 0; i < blk.phis.size(); i++)
+		{
+			env[blk.phis[i]] = phis[i];
+		}
+
+		for (int c : blk.code)
+		{
+			const IR::Value& v = mIR.GetValue(c);
+			if (v.op == IR::CONST)
+			{
+				env[c] = v.imm;
+			}
+			else if (v.op == IR::COPY)
+			{
+				env[c] = Get(v.operands[0]);
+			}
+			else if (v.op == IR::NEG)
+			{
+				env[c] = (int)(0u - (unsigned int)Get(v.operands[0]));
+			}
+			else if (!IR::Evaluate(v.op, Get(v.operands[0]), Get(v.operands[1]), env[c]))
+			{
+				// Division by zero has to happen at runtime
+				return false;
+			}
+		}
+
+		evaluated += (int)(blk.phis.size() + blk.code.size()) + 1;
+		if (evaluated > MAX_EVALUATED)
+		{
+			return false;
+		}
+
+		from = b;
+		b = (blk.term == IR::GOTO || Get(blk.cond) != 0) ? blk.succs[0] : blk.succs[1];
+	}
+
+	// Loop is left from block 'from' into block 'b', entry continues there directly with values
+	// computed by loop turned into constants
+	int preheader = GetPreheader(loop, true);
+	for (int l : loop.blocks)
+	{
+		const IR::Block& blk = mIR.GetBlock(l);
+		for (const std::vector<int>* list : { &blk.phis, &blk.code })
+		{
+			for (int v : *list)
+			{
+				int c = mIR.NewValue(IR::CONST, preheader, env[v], std::vector<int>());
+				mIR.GetBlock(preheader).code.push_back(c);
+				mIR.Replace(v, c);
+			}
+		}
+	}
+
+	IR::Block& exit = mIR.GetBlock(from);
+	IR::Block& pre = mIR.GetBlock(preheader);
+	pre.exit = exit.exit;
+	pre.succs.assign(1, b);
+	mIR.RemovePredecessor(h, preheader);
+	mIR.ReplacePredecessor(b, from, preheader);
+	mIR.RemoveUnreachable();
+	mIR.Canonicalize();
+
+	return true;
+}
+
+// Vectorize single block loop counting by one with known trip count - every iteration accesses
+// array elements at its counter (plus constant) only and carries nothing but sums into the next
+// one, code after loop uses only counter, sums and values not changed by it. Vector loop is placed
+// before the original loop, which does the remaining iterations
+bool LoopOptimizer::Vectorize(const Loop& loop)
+{
+	int h = loop.header;
+	int phi = -1;
+	int preheader = GetPreheader(loop, false);
+	if (loop.blocks.size() != 1 || preheader == -1 || !IsInnermost(loop))
+	{
+		return false;
+	}
+
+	int trips = TripCount(loop, &phi);
+	if (trips < Disassembler::VECTOR_LANES / 2 || phi == -1)
+	{
+		return false;
+	}
+
+	const IR::Block& body = mIR.GetBlock(h);
+	int li = (body.preds[0] == h) ? 0 : 1;
+	int next = mIR.GetValue(phi).operands[li];
+	int init = mIR.GetValue(phi).operands[1 - li];
+	int start = mIR.GetValue(init).imm;
+	bool continueIfTrue = (body.succs[0] == h);
+	int exit = body.succs[continueIfTrue ? 1 : 0];
+
+	// Counter is incremented by one and stays within integers
+	auto IsConst = [this](int value, int c)
+	{
+		return mIR.GetValue(value).op == IR::CONST && mIR.GetValue(value).imm == c;
+	};
+
+	const IR::Value& n = mIR.GetValue(next);
+	if (n.op != IR::ADD || !((n.operands[0] == phi && IsConst(n.operands[1], 1)) || (n.operands[1] == phi && IsConst(n.operands[0], 1))) ||
+		(long long)start + trips > INT_MAX || body.exit[mIR.GetValue(phi).imm] != next)
+	{
+		return false;
+	}
+
+	const IR::Value& cond = mIR.GetValue(body.cond);
+	if (cond.block != h || !IR::IsCompare(cond.op))
+	{
+		return false;
+	}
+
+	// Users of values of loop inside of it, values used outside (including variables visible at the end
+	// of program) are marked
+	size_t values = mIR.GetValuesCount();
+	std::vector<std::vector<int> > users(values);
+	std::vector<bool> outside(values, false);
+	for (int b : mIR.GetLayout())
+	{
+		const IR::Block& blk = mIR.GetBlock(b);
+		if (blk.removed)
+		{
+			continue;
+		}
+
+		for (const std::vector<int>* list : { &blk.phis, &blk.code })
+		{
+			for (int v : *list)
+			{
+				for (int o : mIR.GetValue(v).operands)
+				{
+					if (mIR.GetValue(o).block != h)
+					{
+						continue;
+					}
+
+					if (b == h)
+					{
+						users[o].push_back(v);
+					}
+					else
+					{
+						outside[o] = true;
+					}
+				}
+			}
+		}
+
+		if (b != h && blk.cond >= 0 && mIR.GetValue(blk.cond).block == h)
+		{
+			outside[blk.cond] = true;
+		}
+
+		if (blk.term == IR::EXIT)
+		{
+			for (int x = IR::VAR_SLOTS; x < IR::VAR_SLOTS + mIR.GetExitSlots(); x++)
+			{
+				if (blk.exit[x] >= 0 && mIR.GetValue(blk.exit[x]).block == h)
+				{
+					outside[blk.exit[x]] = true;
+				}
+			}
+		}
+	}
+
+	if (!users[body.cond].empty() || outside[body.cond])
+	{
+		return false;
+	}
+
+	// Other phi nodes are sums - chains of additions starting at phi, each link used only by the next one
+	struct Sum
+	{
+		int phi;
+		int last;
+		std::vector<int> elements;
+	};
+
+	std::vector<Sum> sums;
+	std::set<int> chain;
+	for (int p : body.phis)
+	{
+		if (p == phi)
+		{
+			continue;
+		}
+
+		Sum sum;
+		sum.phi = p;
+		sum.last = mIR.GetValue(p).operands[li];
+		if (body.exit[mIR.GetValue(p).imm] != sum.last || sum.last == p)
+		{
+			return false;
+		}
+
+		int cur = p;
+		chain.insert(p);
+		while (cur != sum.last)
+		{
+			if (users[cur].size() != 1 || outside[cur] || sum.elements.size() > body.code.size())
+			{
+				return false;
+			}
+
+			int link = users[cur][0];
+			const IR::Value& a = mIR.GetValue(link);
+			if (a.op != IR::ADD || a.operands[0] == a.operands[1])
+			{
+				return false;
+			}
+
+			sum.elements.push_back((a.operands[0] == cur) ? a.operands[1] : a.operands[0]);
+			chain.insert(link);
+			cur = link;
+		}
+
+		if (users[sum.last].size() != 1 || users[sum.last][0] != p)
+		{
+			return false;
+		}
+		sums.push_back(sum);
+	}
+
+	for (const Sum& sum : sums)
+	{
+		for (int e : sum.elements)
+		{
+			if (chain.find(e) != chain.end())
+			{
+				return false;
+			}
+		}
+	}
+
+	// Values depending on counter are computed on vectors (counter plus constant is used as index),
+	// the others stay scalar and are computed once per vector iteration
+	std::map<int, int> affine;
+	std::set<int> varying;
+	std::set<int> uniform;
+	affine[phi] = 0;
+	varying.insert(phi);
+	for (int c : body.code)
+	{
+		const IR::Value& v = mIR.GetValue(c);
+		if (c == body.cond || chain.find(c) != chain.end())
+		{
+			continue;
+		}
+
+		bool depends = false;
+		for (int o : v.operands)
+		{
+			if (chain.find(o) != chain.end())
+			{
+				return false;
+			}
+			depends = depends || varying.find(o) != varying.end();
+		}
+
+		if (!depends)
+		{
+			// Uniform loads must not fail, stores would be overwritten by each iteration
+			if (v.op == IR::CALL || v.op == IR::LOAD || v.op == IR::DIV || IR::IsStore(v.op))
+			{
+				return false;
+			}
+			uniform.insert(c);
+			continue;
+		}
+
+		switch (v.op)
+		{
+		case IR::ADD:
+		case IR::SUB:
+			{
+				auto a = affine.find(v.operands[0]);
+				if (a != affine.end() && mIR.GetValue(v.operands[1]).op == IR::CONST)
+				{
+					long long offset = (long long)a->second + ((v.op == IR::ADD) ? 1 : -1) * (long long)mIR.GetValue(v.operands[1]).imm;
+					if (offset >= INT_MIN && offset <= INT_MAX)
+					{
+						affine[c] = (int)offset;
+					}
+				}
+				else if (v.op == IR::ADD && mIR.GetValue(v.operands[0]).op == IR::CONST && affine.find(v.operands[1]) != affine.end())
+				{
+					long long offset = (long long)affine[v.operands[1]] + mIR.GetValue(v.operands[0]).imm;
+					if (offset >= INT_MIN && offset <= INT_MAX)
+					{
+						affine[c] = (int)offset;
+					}
+				}
+			}
+			break;
+
+		case IR::MUL:
+		case IR::NEG:
+		case IR::COPY:
+		case IR::CMPLEQ:
+		case IR::CMPGEQ:
+		case IR::CMPLESS:
+		case IR::CMPGREATER:
+		case IR::CMPEQ:
+		case IR::CMPNEQ:
+			break;
+
+		case IR::LOAD:
+		case IR::LOAD_UNCHECKED:
+		case IR::STORE:
+		case IR::STORE_UNCHECKED:
+			// Stored value may depend on counter, index has to be counter plus constant
+			if (affine.find(v.operands[0]) == affine.end())
+			{
+				return false;
+			}
+			break;
+
+		default:
+			return false;
+		}
+
+		varying.insert(c);
+	}
+
+	// Vector loop knows only values of counter after it, totals of sums and uniform values, anything else
+	// computed by loop (counter at the start of iteration too) can't be used after it
+	for (const std::vector<int>* list : { &body.phis, &body.code })
+	{
+		for (int v : *list)
+		{
+			bool total = false;
+			for (const Sum& sum : sums)
+			{
+				total = total || sum.last == v;
+			}
+
+			if (outside[v] && v != next && !total && uniform.find(v) == uniform.end())
+			{
+				return false;
+			}
+		}
+	}
+
+	// Each stored element is accessed by the same iteration only - any other access to overlapping array
+	// is made to the same array at the same offset from counter. Elements accessed by vector loop are
+	// always within bounds
+	auto Overlaps = [](const IR::Array& a, const IR::Array& b)
+	{
+		return a.global != b.global || (a.slot < b.slot + b.count && b.slot < a.slot + a.count);
+	};
+
+	std::vector<int> accesses;
+	for (int c : body.code)
+	{
+		const IR::Value& v = mIR.GetValue(c);
+		if (!IR::IsLoad(v.op) && !IR::IsStore(v.op))
+		{
+			continue;
+		}
+
+		if (varying.find(c) != varying.end())
+		{
+			const IR::Array& a = mIR.GetArray(c);
+			long long offset = affine[v.operands[0]];
+			if (start + offset < 0 || (long long)start + trips - 1 + offset >= a.count)
+			{
+				return false;
+			}
+		}
+		accesses.push_back(c);
+	}
+
+	for (int s : accesses)
+	{
+		if (!IR::IsStore(mIR.GetValue(s).op))
+		{
+			continue;
+		}
+
+		for (int a : accesses)
+		{
+			if (a == s || !Overlaps(mIR.GetArray(s), mIR.GetArray(a)))
+			{
+				continue;
+			}
+
+			if (uniform.find(a) != uniform.end() || mIR.GetValue(a).imm != mIR.GetValue(s).imm ||
+				affine[mIR.GetValue(a).operands[0]] != affine[mIR.GetValue(s).operands[0]])
+			{
+				return false;
+			}
+		}
+	}
+
+	// Vector trees are computed at place of stores and sums (their loads can't be moved past store into
+	// the same array) and fit into vector registers
+	std::map<int, size_t> position;
+	for (size_t i = 0; i < body.code.size(); i++)
+	{
+		position[body.code[i]] = i;
+	}
+
+	std::function<bool(int, size_t, int&, int&)> Check = [&](int value, size_t root, int& registers, int& size)
+	{
+		const IR::Value& v = mIR.GetValue(value);
+		if (affine.find(value) != affine.end() || varying.find(value) == varying.end())
+		{
+			registers = 1;
+			size = 1;
+			return true;
+		}
+
+		if (IR::IsLoad(v.op))
+		{
+			for (size_t i = position[value] + 1; i < root; i++)
+			{
+				int other = body.code[i];
+				if (IR::IsStore(mIR.GetValue(other).op) && Overlaps(mIR.GetArray(other), mIR.GetArray(value)))
+				{
+					return false;
+				}
+			}
+			registers = 1;
+			size = 1;
+			return true;
+		}
+
+		int ra = 0;
+		int sa = 0;
+		if (!Check(v.operands[0], root, ra, sa))
+		{
+			return false;
+		}
+
+		if (v.op == IR::COPY)
+		{
+			registers = ra;
+			size = sa;
+			return true;
+		}
+
+		// Negation subtracts from zero
+		int rb = 1;
+		int sb = 1;
+		if (v.op == IR::NEG)
+		{
+			std::swap(ra, rb);
+			std::swap(sa, sb);
+		}
+		else if (!Check(v.operands[1], root, rb, sb))
+		{
+			return false;
+		}
+
+		registers = std::max(ra, rb + 1);
+		size = sa + sb + 1;
+		return true;
+	};
+
+	for (int c : body.code)
+	{
+		int registers = 0;
+		int size = 0;
+		const IR::Value& v = mIR.GetValue(c);
+		if (IR::IsStore(v.op) && !Check(v.operands[1], position[c], registers, size))
+		{
+			return false;
+		}
+
+		if (registers > Disassembler::VECTOR_REGISTERS || size > MAX_VECTOR_TREE)
+		{
+			return false;
+		}
+	}
+
+	for (const Sum& sum : sums)
+	{
+		int registers = 0;
+		int size = 0;
+		for (size_t i = 0; i < sum.elements.size(); i++)
+		{
+			int r = 0;
+			int s = 0;
+			if (!Check(sum.elements[i], position[sum.last], r, s))
+			{
+				return false;
+			}
+			registers = (i == 0) ? r : std::max(registers, r + 1);
+			size += s + ((i == 0) ? 0 : 1);
+		}
+
+		if (registers > Disassembler::VECTOR_REGISTERS || size > MAX_VECTOR_TREE)
+		{
+			return false;
+		}
+	}
+
+	// Vector loop does as many iterations as fit into vectors
+	int lanes = (trips >= Disassembler::VECTOR_LANES) ? Disassembler::VECTOR_LANES : Disassembler::VECTOR_LANES / 2;
+	int vectorEnd = start + trips / lanes * lanes;
+	bool remainder = (trips % lanes != 0);
+
+	int vb = mIR.NewBlock();
+	mIR.MoveBlockBefore(vb, h);
+	std::map<int, int> sigma;
+	auto Emit = [this, vb](IR::Opcode op, int imm, const std::vector<int>& operands, int lanes)
+	{
+		int v = mIR.NewValue(op, vb, imm, operands, lanes);
+		mIR.GetBlock(vb).code.push_back(v);
+		return v;
+	};
+
+	auto Map = [&sigma](int value)
+	{
+		auto it = sigma.find(value);
+		return (it == sigma.end()) ? value : it->second;
+	};
+
+	int counter = mIR.NewValue(IR::PHI, vb, mIR.GetValue(phi).imm, { init, -1 });
+	mIR.GetBlock(vb).phis.push_back(counter);
+	sigma[phi] = counter;
+	for (const Sum& sum : sums)
+	{
+		const IR::Value& p = mIR.GetValue(sum.phi);
+		int v = mIR.NewValue(IR::PHI, vb, p.imm, { p.operands[1 - li], -1 });
+		mIR.GetBlock(vb).phis.push_back(v);
+		sigma[sum.phi] = v;
+	}
+
+	auto Index = [&](int offset)
+	{
+		return (offset == 0) ? counter : Emit(IR::ADD, 0, { counter, Emit(IR::CONST, offset, {}, 0) }, 0);
+	};
+
+	std::function<int(int)> Vector = [&](int value)
+	{
+		const IR::Value& v = mIR.GetValue(value);
+		auto a = affine.find(value);
+		if (a != affine.end())
+		{
+			return Emit(IR::VSEQ, 0, { Index(a->second) }, lanes);
+		}
+		else if (varying.find(value) == varying.end())
+		{
+			return Emit(IR::VSPLAT, 0, { Map(value) }, lanes);
+		}
+
+		int x = v.operands[0];
+		switch (v.op)
+		{
+		case IR::COPY:
+			return Vector(x);
+
+		case IR::NEG:
+			{
+				int zero = Emit(IR::VSPLAT, 0, { Emit(IR::CONST, 0, {}, 0) }, lanes);
+				return Emit(IR::VSUB, 0, { zero, Vector(x) }, lanes);
+			}
+
+		case IR::LOAD:
+		case IR::LOAD_UNCHECKED:
+			return Emit(IR::VLOAD, v.imm, { Index(affine[x]) }, lanes);
+
+		default:
+			{
+				IR::Opcode op = (v.op == IR::ADD) ? IR::VADD : (v.op == IR::SUB) ? IR::VSUB : (v.op == IR::MUL) ? IR::VMUL :
+					(IR::Opcode)(IR::VCMPLEQ + (v.op - IR::CMPLEQ));
+				int y = v.operands[1];
+				int vx = Vector(x);
+				int vy = Vector(y);
+				return Emit(op, 0, { vx, vy }, lanes);
+			}
+		}
+	};
+
+	// Uniform values are copied, stores and sums are computed on vectors
+	std::map<int, int> lasts;
+	for (int c : mIR.GetBlock(h).code)
+	{
+		IR::Value v = mIR.GetValue(c);
+		if (uniform.find(c) != uniform.end())
+		{
+			for (int& o : v.operands)
+			{
+				o = Map(o);
+			}
+			sigma[c] = Emit(v.op, v.imm, v.operands, 0);
+		}
+		else if (IR::IsStore(v.op))
+		{
+			int index = Index(affine[v.operands[0]]);
+			int stored = Vector(v.operands[1]);
+			Emit(IR::VSTORE, v.imm, { index, stored }, lanes);
+		}
+
+		for (const Sum& sum : sums)
+		{
+			if (sum.last != c)
+			{
+				continue;
+			}
+
+			int total = Vector(sum.elements[0]);
+			for (size_t i = 1; i < sum.elements.size(); i++)
+			{
+				int e = Vector(sum.elements[i]);
+				total = Emit(IR::VADD, 0, { total, e }, lanes);
+			}
+			int reduced = Emit(IR::VSUM, 0, { total }, lanes);
+			lasts[c] = Emit(IR::ADD, 0, { sigma[sum.phi], reduced }, 0);
+		}
+	}
+
+	int step = Emit(IR::CONST, lanes, {}, 0);
+	int stepped = Emit(IR::ADD, 0, { counter, step }, 0);
+	int bound = Emit(IR::CONST, vectorEnd, {}, 0);
+	int test = Emit(continueIfTrue ? IR::CMPLESS : IR::CMPGEQ, 0, { stepped, bound }, 0);
+	mIR.GetValue(counter).operands[1] = stepped;
+	for (const Sum& sum : sums)
+	{
+		mIR.GetValue(sigma[sum.phi]).operands[1] = lasts[sum.last];
+	}
+
+	// Variables hold the same values as in original loop (values computed only by it aren't available)
+	auto State = [&](int value)
+	{
+		if (value < 0)
+		{
+			return -1;
+		}
+		else if (value == next)
+		{
+			return stepped;
+		}
+		else if (lasts.find(value) != lasts.end())
+		{
+			return lasts[value];
+		}
+		else if (sigma.find(value) != sigma.end())
+		{
+			return sigma[value];
+		}
+		return (mIR.GetValue(value).block == h) ? -1 : value;
+	};
+
+	int target = remainder ? h : exit;
+	IR::Block& vector = mIR.GetBlock(vb);
+	const IR::Block& original = mIR.GetBlock(h);
+	for (size_t x = 0; x < original.entry.size(); x++)
+	{
+		vector.entry.push_back(State(original.entry[x]));
+		int e = State(original.exit[x]);
+		vector.exit.push_back((e == -1) ? vector.entry[x] : e);
+	}
+	vector.term = IR::BRANCH;
+	vector.cond = test;
+	vector.succs = continueIfTrue ? std::vector<int>{ vb, target } : std::vector<int>{ target, vb };
+	vector.preds = { preheader, vb };
+
+	IR::Block& pre = mIR.GetBlock(preheader);
+	std::replace(pre.succs.begin(), pre.succs.end(), h, vb);
+
+	if (remainder)
+	{
+		// Original loop continues where vector loop ended
+		size_t pi = 1 - li;
+		mIR.GetValue(phi).operands[pi] = stepped;
+		for (const Sum& sum : sums)
+		{
+			mIR.GetValue(sum.phi).operands[pi] = lasts[sum.last];
+		}
+		mIR.ReplacePredecessor(h, preheader, vb);
+	}
+	else
+	{
+		// Original loop is not needed, code after it uses results of vector loop
+		mIR.Replace(next, stepped);
+		for (const auto& l : lasts)
+		{
+			mIR.Replace(l.first, l.second);
+		}
+		for (int u : uniform)
+		{
+			if (outside[u])
+			{
+				mIR.Replace(u, sigma[u]);
+			}
+		}
+		mIR.ReplacePredecessor(exit, h, vb);
+		mIR.RemovePredecessor(h, preheader);
+		mIR.RemoveUnreachable();
+	}
+
+	mVectorized.insert(vb);
+	mVectorized.insert(h);
+
+	return true;
+}
+
+// Rotate all while loops, returns true if anything changed
+bool LoopOptimizer::RotateLoops()
+{
+	bool changed = false;
+	bool progress = true;
+
+	// Each rotation changes the control flow, so loops are searched again
+	while (progress)
+	{
+		progress = false;
+		mIR.Canonicalize();
+		FindLoops();
+		for (const Loop& loop : mLoops)
+		{
+			if (Rotate(loop))
+			{
+				progress = true;
+				changed = true;
+				break;
+			}
+		}
+	}
+
+	mIR.Canonicalize();
+
+	return changed;
+}
+
+// Hoist invariant code out of all loops, returns true if anything changed
+bool LoopOptimizer::HoistInvariants()
+{
+	bool changed = false;
+
+	// Every loop needs preheader
+	bool created = true;
+	while (created)
+	{
+		created = false;
+		mIR.Canonicalize();
+		FindLoops();
+		for (const Loop& loop : mLoops)
+		{
+			if (GetPreheader(loop, false) == -1 && GetPreheader(loop, true) != -1)
+			{
+				created = true;
+				break;
+			}
+		}
+	}
+
+	// Inner loops first, so values hoisted out of them can be hoisted further
+	for (const Loop& loop : mLoops)
+	{
+		if (Hoist(loop))
+		{
+			changed = true;
+		}
+	}
+
+	mIR.Canonicalize();
+
+	return changed;
+}
+
+// Reduce arithmetic on induction variables of all loops, returns true if anything changed
+bool LoopOptimizer::ReduceInductions()
+{
+	bool changed = false;
+
+	mIR.Canonicalize();
+	FindLoops();
+	for (const Loop& loop : mLoops)
+	{
+		if (ReduceInduction(loop))
+		{
+			mIR.Canonicalize();
+			changed = true;
+		}
+	}
+
+	mIR.Canonicalize();
+
+	return changed;
+}
+
+// Unroll small inner loops, returns true if anything changed
+bool LoopOptimizer::UnrollLoops()
+{
+	bool changed = false;
+	bool progress = true;
+
+	while (progress)
+	{
+		progress = false;
+		mIR.Canonicalize();
+		FindLoops();
+		for (const Loop& loop : mLoops)
+		{
+			if (Unroll(loop))
+			{
+				progress = true;
+				changed = true;
+				break;
+			}
+		}
+	}
+
+	mIR.Canonicalize();
+
+	return changed;
+}
+
+// Evaluate loops which don't depend on anything unknown at compile time (outer loops first), returns
+// true if anything changed
+bool LoopOptimizer::EvaluateLoops()
+{
+	bool changed = false;
+	bool progress = true;
+
+	while (progress)
+	{
+		progress = false;
+		mIR.Canonicalize();
+		FindLoops();
+		for (auto it = mLoops.rbegin(); it != mLoops.rend(); it++)
+		{
+			if (Evaluate(*it))
+			{
+				progress = true;
+				changed = true;
+				break;
+			}
+		}
+	}
+
+	mIR.Canonicalize();
+
+	return changed;
+}
+
+// Vectorize simple inner loops, returns true if anything changed
+bool LoopOptimizer::VectorizeLoops()
+{
+	bool changed = false;
+	bool progress = true;
+
+	while (progress)
+	{
+		progress = false;
+		mIR.Canonicalize();
+		FindLoops();
+		for (const Loop& loop : mLoops)
+		{
+			if (mVectorized.find(loop.header) == mVectorized.end() && Vectorize(loop))
+			{
+				progress = true;
+				changed = true;
+				break;
+			}
+		}
+	}
+
+	mIR.Canonicalize();
+
+	return changed;
+}
\ No newline at end of file
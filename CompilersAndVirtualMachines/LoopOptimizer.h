@@ -0,0 +1,121 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __LOOP_OPTIMIZER_H__
+#define __LOOP_OPTIMIZER_H__
+
+#include <vector>
+#include <map>
+#include <set>
+#include "IR.h"
+
+// Loop optimizations on IR. Natural loops are found from back edges of control flow graph
+// (jumps to the labels emitted by while and do loops), loop invariant computations are hoisted
+// into loop preheader, while loops are rotated into guarded do-while form (single branch per
+// iteration), multiplications of induction variables are replaced by additions and small loops
+// with known trip count are partially unrolled. Loops which don't depend on anything unknown at
+// compile time can be evaluated whole, leaving only their results. Simple counted loops without
+// loop-carried dependences (other than sums) are vectorized.
+class LoopOptimizer
+{
+private:
+	// Natural loop
+	struct Loop
+	{
+		int header;					// Loop header (target of back edges)
+		std::vector<int> latches;	// Blocks jumping back to header
+		std::vector<int> blocks;	// Blocks of loop (in reverse postorder)
+		std::vector<bool> contains;	// Is block part of loop
+	};
+
+	enum
+	{
+		MAX_ROTATED_HEADER = 16,	// Maximum number of values in header duplicated by rotation
+		MAX_UNROLL_FACTOR = 4,		// Maximum number of loop body copies
+		MAX_UNROLLED_SIZE = 64,		// Maximum number of values in unrolled loop
+		MAX_TRIP_COUNT = 65536,		// Maximum trip count evaluated at compile time
+		MAX_EVALUATED = 1 << 20,	// Maximum number of values computed when evaluating loop at compile time
+		MIN_REDUCED_COST = 3,		// Minimum number of operations per iteration replaced by new induction variable
+		MAX_VECTOR_TREE = 32		// Maximum number of vector operations computing single stored or summed vector
+	};
+
+	// Affine function of induction variable (scale * phi + offset), cost is number of operations computing it
+	struct Affine
+	{
+		int phi;
+		int scale;
+		int offset;
+		int cost;
+	};
+
+	IR& mIR;
+	std::vector<Loop> mLoops;		// Loops, inner loops first
+	std::set<int> mUnrolled;		// Headers of already unrolled loops
+	std::set<int> mVectorized;		// Headers of vector loops and of loops doing their remaining iterations
+
+	// Find all natural loops (computes dominators)
+	void FindLoops();
+
+	// Returns true if loop doesn't contain any other loop
+	bool IsInnermost(const Loop& loop);
+
+	// Get block through which loop is entered, it is created when create is set (returns -1 if
+	// loop is entered from multiple blocks)
+	int GetPreheader(const Loop& loop, bool create);
+
+	// Rotate while loop into do-while loop guarded by copy of its condition
+	bool Rotate(const Loop& loop);
+
+	// Hoist loop invariant values into preheader
+	bool Hoist(const Loop& loop);
+
+	// Number of iterations of loop with single latch (-1 when unknown), its induction variable (header
+	// phi) is stored into induction when given
+	int TripCount(const Loop& loop, int* induction = nullptr);
+
+	// Partially unroll loop with known trip count
+	bool Unroll(const Loop& loop);
+
+	// Replace affine functions of induction variables with new induction variables
+	bool ReduceInduction(const Loop& loop);
+
+	// Evaluate loop whose values depend only on constants at compile time, loop is replaced by its
+	// results (returns false when it can't be evaluated within limit or would fail at runtime)
+	bool Evaluate(const Loop& loop);
+
+	// Vectorize single block loop counting by one with known trip count - every iteration accesses
+	// array elements at its counter (plus constant) only and carries nothing but sums into the next
+	// one, code after loop uses only counter, sums and values not changed by it. Vector loop is placed
+	// before the original loop, which does the remaining iterations
+	bool Vectorize(const Loop& loop);
+
+public:
+	LoopOptimizer(IR& ir);
+
+	// Rotate all while loops, returns true if anything changed
+	bool RotateLoops();
+
+	// Hoist invariant code out of all loops, returns true if anything changed
+	bool HoistInvariants();
+
+	// Reduce arithmetic on induction variables of all loops, returns true if anything changed
+	bool ReduceInductions();
+
+	// Unroll small inner loops, returns true if anything changed
+	bool UnrollLoops();
+
+	// Evaluate loops which don't depend on anything unknown at compile time (outer loops first), returns
+	// true if anything changed
+	bool EvaluateLoops();
+
+	// Vectorize simple inner loops, returns true if anything changed
+	bool VectorizeLoops();
+};
+
+#endif
\ No newline at end of file
@@ -9,254 +9,181 @@
 
 #include "Main.h"
 
-class VirtualMachine
+int main(int argc, char** argv)
 {
-private:
-	unsigned char* memory;		// VM memory
-	int registers[4];			// VM registers (Reg 0, Reg 1, Instruction Pointer, Stack Pointer)
-
-	enum
-	{
-		R0 = 0,
-		R1,
-		IP,
-		SP
-	};
-
-	std::string registerName[4] =
-	{
-		"R0",
-		"R1",
-		"IP",
-		"SP"
-	};
-
-public:
-	// Constructor (specify how much memory you wish to alloc - defaults to 64K)
-	VirtualMachine(size_t memorySize = 65536)
-	{
-		memory = (unsigned char*)malloc(memorySize);
-	}
-
-	// D-tor
-	~VirtualMachine()
-	{
-		free(memory);
-	}
-
-	// Print out what is in registers (the ones we work with, not IP and SP)
-	void DumpRegisters()
-	{
-		std::cout << "Registers:" << std::endl;
-		std::cout << "\tr0 = " << registers[0] << std::endl;
-		std::cout << "\tr1 = " << registers[1] << std::endl;
-		std::cout << "\tip = " << registers[2] << std::endl;
-		std::cout << "\tsp = " << registers[3] << std::endl;
-		std::cout << std::endl;
-	}
-
-	// Print out stack from beginning address
-	void DumpStack(size_t size)
+	// Server mode - "--server <socket path> [--workers <count>]"
+	if (argc > 2 && std::string(argv[1]) == "--server")
 	{
-		std::cout << "Stack:" << std::endl;
+		size_t workers = 4;
+		if (argc > 4 && std::string(argv[3]) == "--workers")
+		{
+			workers = (size_t)std::max(1, atoi(argv[4]));
+		}
 
-		int* ptr = (int*)memory;
-		ptr += size / sizeof(int);
-		int position = size;
-		int offset = 0;
-		while (position < registers[SP])
+		CompileServer server(argv[2], workers);
+		std::cout << "Compile server listening on " << argv[2] << " with " << workers << " workers" << std::endl;
+		if (!server.Run())
 		{
-			std::cout << "\tsp + " << offset << " = " << *ptr << std::endl;
-			ptr++;
-			position += 4;
-			offset += 4;
+			std::cout << "Error: Can't listen on " << argv[2] << std::endl;
+			return -1;
 		}
-		std::cout << std::endl;
+		return 0;
 	}
 
-	// Execute the binary
-	void Execute(const std::string& filename)
+	// Batch mode - "--batch <manifest or directory> [--out <directory>] [--jobs <count>] [--cache <directory>] [--objects [--lto]]",
+	// scripts are compiled into relocatable objects with --objects (carrying assembly for link-time optimization with --lto)
+	if (argc > 2 && std::string(argv[1]) == "--batch")
 	{
-		// Load binary into beginning of memory
-		std::ifstream ifs(filename, std::ios::binary | std::ios::in);
-		std::filebuf* pbuf = ifs.rdbuf();
-		size_t size = (size_t)pbuf->pubseekoff(0, ifs.end, ifs.in);
-		pbuf->pubseekpos(0, ifs.in);
-
-		int* code = (int*)memory;
-		pbuf->sgetn((char*)code, size);
-
-		size_t instructionsCount = size / sizeof(int);
-		registers[IP] = 0;			// Set IP to 0
-		registers[SP] = size;		// Set SP to the end of code
-
-		// While IP doesn't reach end of code, process instruction by instruction
-		while ((size_t)(registers[IP]) < instructionsCount)
+		std::string outputDirectory;
+		std::string cacheDirectory;
+		size_t jobs = 0;
+		CompileOptions options;
+		for (int i = 3; i < argc; i++)
 		{
-			switch (code[registers[IP]])
+			if (std::string(argv[i]) == "--objects")
+			{
+				options.relocatable = true;
+			}
+			else if (std::string(argv[i]) == "--lto")
+			{
+				options.linkTimeOptimization = true;
+			}
+			else if (i + 1 == argc)
 			{
-			case Disassembler::ADD_I32:
-				std::cout << registers[IP] << " add.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
-				registers[code[registers[IP] + 1]] += registers[code[registers[IP] + 2]];
-				registers[IP] += 3;
-				break;
-
-			case Disassembler::SUB_I32:
-				std::cout << registers[IP] << " sub.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
-				registers[code[registers[IP] + 1]] -= registers[code[registers[IP] + 2]];
-				registers[IP] += 3;
-				break;
-
-			case Disassembler::MUL_I32:
-				std::cout << registers[IP] << " mul.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
-				registers[code[registers[IP] + 1]] *= registers[code[registers[IP] + 2]];
-				registers[IP] += 3;
-				break;
-
-			case Disassembler::DIV_I32:
-				std::cout << registers[IP] << " div.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
-				// Avoid division by 0 (print error and finish the program)
-				if (registers[code[registers[IP] + 2]] == 0)
-				{
-					std::cout << "Error: Division by Zero, terminating application\n" << std::endl;
-					registers[IP] = (int)instructionsCount;
-					break;
-				}
-				registers[code[registers[IP] + 1]] /= registers[code[registers[IP] + 2]];
-				registers[IP] += 3;
-				break;
-
-			case Disassembler::MOV_REG_REG:
-				std::cout << registers[IP] << " mov.reg.reg " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
-				registers[code[registers[IP] + 1]] = registers[code[registers[IP] + 2]];
-				registers[IP] += 3;
-				break;
-
-			case Disassembler::PUSH_I32:
-				std::cout << registers[IP] << " push.i32 " << registerName[code[registers[IP] + 1]] << std::endl;
-				((int*)(memory + registers[SP]))[0] = registers[code[registers[IP] + 1]];
-				registers[SP] += 4;
-				registers[IP] += 2;
-				break;
-
-			case Disassembler::POP_I32:
-				std::cout << registers[IP] << " pop.i32 " << registerName[code[registers[IP] + 1]] << std::endl;
-				registers[SP] -= 4;
-				registers[code[registers[IP] + 1]] = ((int*)(memory + registers[SP]))[0];
-				registers[IP] += 2;
 				break;
+			}
+			else if (std::string(argv[i]) == "--out")
+			{
+				outputDirectory = argv[++i];
+			}
+			else if (std::string(argv[i]) == "--jobs")
+			{
+				jobs = (size_t)std::max(1, atoi(argv[++i]));
+			}
+			else if (std::string(argv[i]) == "--cache")
+			{
+				cacheDirectory = argv[++i];
+			}
+			else
+			{
+				i++;
+			}
+		}
 
-			case Disassembler::NEG_I32:
-				std::cout << registers[IP] << " neg.i32 " << registerName[code[registers[IP] + 1]] << std::endl;
-				registers[code[registers[IP] + 1]] = -registers[code[registers[IP] + 1]];
-				registers[IP] += 2;
-				break;
+		BuildCache cache(cacheDirectory);
+		BatchCompiler batch(options, jobs);
+		if (!cacheDirectory.empty())
+		{
+			batch.SetCache(&cache);
+		}
+		bool loaded = BatchCompiler::IsDirectory(argv[2]) ? batch.AddDirectory(argv[2], outputDirectory) : batch.AddManifest(argv[2]);
+		if (!loaded)
+		{
+			std::cout << "Error: Can't read " << argv[2] << std::endl;
+			return -1;
+		}
 
-			case Disassembler::MOV_REG_I32:
-				std::cout << registers[IP] << " mov.reg.i32 " << registerName[code[registers[IP] + 1]] << " " << code[registers[IP] + 2] << std::endl;
-				registers[code[registers[IP] + 1]] = code[registers[IP] + 2];
-				registers[IP] += 3;
-				break;
+		bool success = batch.Run();
+		batch.Report(std::cout);
+		return success ? 0 : -1;
+	}
 
-			case Disassembler::MOV_MEM_REG_I32:
-				std::cout << registers[IP] << " mov.mem.reg.i32 [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << registerName[code[registers[IP] + 3]] << std::endl;
-				((int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]))[0] = registers[code[registers[IP] + 3]];
-				registers[IP] += 4;
-				break;
+	std::chrono::time_point<std::chrono::system_clock> start, end;
+	std::chrono::duration<double> elapsed_seconds;
 
-			case Disassembler::MOV_REG_MEM_I32:
+	// Link mode - "--link <output binary> [--lto] <object>+", objects are compiled in batch mode with --objects,
+	// whole program is optimized with --lto (when objects were compiled with it too)
+	if (argc > 3 && std::string(argv[1]) == "--link")
+	{
+		start = std::chrono::system_clock::now();
+		Linker linker;
+		bool loaded = true;
+		for (int i = 3; i < argc; i++)
+		{
+			if (std::string(argv[i]) == "--lto")
 			{
-				std::cout << registers[IP] << " mov.reg.mem.i32 " << registerName[code[registers[IP] + 1]] << " [" << registerName[code[registers[IP] + 2]] << " + " << code[registers[IP] + 3] << "]" << std::endl;
-				int reg1 = registers[code[registers[IP] + 2]];
-				int offset = code[registers[IP] + 3];
-				registers[code[registers[IP] + 1]] = ((int*)(memory + registers[code[registers[IP] + 2]] + code[registers[IP] + 3]))[0];
-				registers[IP] += 4;
+				linker.EnableOptimization();
+				continue;
 			}
-				break;
+			loaded = linker.AddFile(argv[i]) && loaded;
+		}
+		bool linked = loaded && linker.Link();
+		end = std::chrono::system_clock::now();
+		elapsed_seconds = end - start;
+		std::cout << "Linking took: " << elapsed_seconds.count() * 1000 << "ms\n";
 
-			case Disassembler::CMPLEQ_I32:
-				std::cout << registers[IP] << " cmpleq.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
-				registers[R0] = (registers[code[registers[IP] + 1]] <= registers[code[registers[IP] + 2]]) ? 1 : 0;
-				registers[IP] += 3;
-				break;
+		for (const Diagnostic& d : linker.GetDiagnostics())
+		{
+			d.Print(std::cout);
+		}
 
-			case Disassembler::CMPGEQ_I32:
-				std::cout << registers[IP] << " cmpgeq.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
-				registers[R0] = (registers[code[registers[IP] + 1]] >= registers[code[registers[IP] + 2]]) ? 1 : 0;
-				registers[IP] += 3;
-				break;
+		if (!linked || !Disassembler::Save(linker.GetBinary(), argv[2]))
+		{
+			return -1;
+		}
+		return 0;
+	}
 
-			case Disassembler::CMPLESS_I32:
-				std::cout << registers[IP] << " cmpless.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
-				registers[R0] = (registers[code[registers[IP] + 1]] < registers[code[registers[IP] + 2]]) ? 1 : 0;
-				registers[IP] += 3;
-				break;
+	// Embed mode - "--embed <script> <header> <name>", binary of script is written as C++ header defining constant
+	// array of given name, so host application built with it doesn't compile script at startup. Errors fail the build
+	if (argc > 4 && std::string(argv[1]) == "--embed")
+	{
+		std::string name = argv[4];
+		if (name.empty() || isdigit((unsigned char)name[0]) || !std::all_of(name.begin(), name.end(), [](char c) { return isalnum((unsigned char)c) || c == '_'; }))
+		{
+			std::cout << "Error: " << name << " isn't valid C++ identifier" << std::endl;
+			return -1;
+		}
 
-			case Disassembler::CMPGREATER_I32:
-				std::cout << registers[IP] << " cmpgreater.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
-				registers[R0] = (registers[code[registers[IP] + 1]] > registers[code[registers[IP] + 2]]) ? 1 : 0;
-				registers[IP] += 3;
-				break;
+		CompileOptions options;
+		options.assemble = true;
+		CompileResult result = ScriptCompiler::CompileFile(argv[2], options);
+		for (const Diagnostic& d : result.diagnostics)
+		{
+			d.Print(std::cout);
+		}
 
-			case Disassembler::CMPEQ_I32:
-				std::cout << registers[IP] << " cmpeq.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
-				registers[R0] = (registers[code[registers[IP] + 1]] == registers[code[registers[IP] + 2]]) ? 1 : 0;
-				registers[IP] += 3;
-				break;
+		if (!result.success || !Disassembler::SaveEmbedded(result.binary, name, argv[2], argv[3]))
+		{
+			return -1;
+		}
+		return 0;
+	}
 
-			case Disassembler::CMPNEQ_I32:
-				std::cout << registers[IP] << " cmpneq.i32" << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
-				registers[R0] = (registers[code[registers[IP] + 1]] != registers[code[registers[IP] + 2]]) ? 1 : 0;
-				registers[IP] += 3;
-				break;
+	// Cached mode - "--cache <directory>", script is compiled only when it or any of its includes changed
+	// (no intermediate files are written then)
+	if (argc > 2 && std::string(argv[1]) == "--cache")
+	{
+		BuildCache cache(argv[2]);
+		bool cached = false;
 
-			case Disassembler::JMP:
-				std::cout << registers[IP] << " jmp " << (code[registers[IP] + 1] / 4) << std::endl;
-				registers[IP] = (code[registers[IP] + 1] / 4);
-				break;
+		start = std::chrono::system_clock::now();
+		CompileResult result = cache.CompileFile("script.scs", CompileOptions(), &cached);
+		end = std::chrono::system_clock::now();
+		elapsed_seconds = end - start;
+		std::cout << (cached ? "Loading from cache took: " : "Compilation took: ") << elapsed_seconds.count() * 1000 << "ms\n";
 
-			case Disassembler::JZ:
-				std::cout << registers[IP] << " jz " << (code[registers[IP] + 1] / 4) << std::endl;
-				if (registers[R0] == 0)
-				{
-					registers[IP] = (code[registers[IP] + 1] / 4);
-				}
-				else
-				{
-					registers[IP] += 2;
-				}
-				break;
-
-			case Disassembler::JNZ:
-				std::cout << registers[IP] << " jnz " << (code[registers[IP] + 1] / 4) << std::endl;
-				if (registers[R0] != 0)
-				{
-					registers[IP] = (code[registers[IP] + 1] / 4);
-				}
-				else
-				{
-					registers[IP] += 2;
-				}
-				break;
+		for (const Diagnostic& d : result.diagnostics)
+		{
+			d.Print(std::cout);
+		}
 
-			default:
-				break;
-			}
+		if (!result.success)
+		{
+			return -1;
 		}
 
-		DumpStack(size);
-		DumpRegisters();
-	}
-};
+		Disassembler::Save(result.binary, "Script_binary.scbin");
 
-int main()
-{
-	std::chrono::time_point<std::chrono::system_clock> start, end;
-	std::chrono::duration<double> elapsed_seconds;
+		VirtualMachine v;
+		start = std::chrono::system_clock::now();
+		v.Execute(result.binary);
+		end = std::chrono::system_clock::now();
+		elapsed_seconds = end - start;
+		std::cout << "VM Execution took: " << elapsed_seconds.count() * 1000 << "ms\n";
 
-	int x = 5;
-	int y = 3;
-	int z = x < y;
+		return 0;
+	}
 
 	//////////////////////////////////////////////////////////////////////////////
 	// Preprocess source file (put includes into it, solve defines)
@@ -288,10 +215,37 @@ int main()
 	elapsed_seconds = end - start;
 	std::cout << "Compilation took: " << elapsed_seconds.count() * 1000 << "ms\n";
 
+	// All errors of lexer and compiler are reported at once
+	std::vector<Diagnostic> diagnostics = l.GetDiagnostics();
+	diagnostics.insert(diagnostics.end(), c.GetDiagnostics().begin(), c.GetDiagnostics().end());
+	for (const Diagnostic& d : diagnostics)
+	{
+		d.Print(std::cout);
+	}
+
+	if (Diagnostic::HasErrors(diagnostics))
+	{
+		return -1;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// Optimize assembly (through SSA form)
+	start = std::chrono::system_clock::now();
+	Optimizer o = Optimizer("Script_assembly.txt", "Script_optimized.txt");
+	o.Optimize();
+	if (!o.IsOptimized())
+	{
+		std::cout << "Optimizer: assembly can't be represented in IR, leaving it unoptimized" << std::endl;
+	}
+	end = std::chrono::system_clock::now();
+	elapsed_seconds = end - start;
+	std::cout << "Optimization took: " << elapsed_seconds.count() * 1000 << "ms\n";
+	o.SaveIR("Script_ir.txt");
+
 	//////////////////////////////////////////////////////////////////////////////
 	// Disassemble into machine code
 	start = std::chrono::system_clock::now();
-	Disassembler d = Disassembler("Script_assembly.txt", "Script_binary.scbin");
+	Disassembler d("Script_optimized.txt", "Script_binary.scbin");
 	d.Disassemble();
 	end = std::chrono::system_clock::now();
 	elapsed_seconds = end - start;
@@ -299,14 +253,12 @@ int main()
 
 	//////////////////////////////////////////////////////////////////////////////
 	// Execute machine code
-	VirtualMachine v = VirtualMachine();
+	VirtualMachine v;
 	start = std::chrono::system_clock::now();
 	v.Execute("Script_binary.scbin");
 	end = std::chrono::system_clock::now();
 	elapsed_seconds = end - start;
 	std::cout << "VM Execution took: " << elapsed_seconds.count() * 1000 << "ms\n";
 
-	std::cin.get();
-
 	return 0;
 }
\ No newline at end of file
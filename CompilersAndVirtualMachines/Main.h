@@ -16,6 +16,12 @@
 #include "Preprocessor.h"
 #include "Lexer.h"
 #include "Compiler.h"
+#include "Optimizer.h"
 #include "Disassembler.h"
+#include "VirtualMachine.h"
+#include "CompileServer.h"
+#include "BatchCompiler.h"
+#include "BuildCache.h"
+#include "Linker.h"
 
 #endif
\ No newline at end of file
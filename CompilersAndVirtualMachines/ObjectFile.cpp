@@ -0,0 +1,205 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ObjectFile.h"
+#include "ScriptCompiler.h"
+#include <fstream>
+#include <sstream>
+
+// Save object into file, returns false when file can't be written
+bool ObjectFile::Save(const std::string& filename) const
+{
+	// Tables are text lines, "relocations <count>" and "code <count>" are followed by their words
+	std::ostringstream header;
+	header << "scobject " << ScriptCompiler::GetVersion() << "\n";
+	header << "unit " << unit << "\n";
+	header << "program " << (program ? 1 : 0) << "\n";
+	for (const auto& s : strings)
+	{
+		header << "string " << s.first << " " << s.second << "\n";
+	}
+	for (const Symbol& s : symbols)
+	{
+		header << "symbol " << s.label << " " << s.offset << " " << (s.globals ? 1 : 0) << " " << (s.parallel ? 1 : 0);
+		for (const std::string& c : s.calls)
+		{
+			header << " " << c;
+		}
+		header << "\n";
+	}
+	for (const Reference& r : references)
+	{
+		header << "reference " << r.label << " " << r.position << "\n";
+	}
+	for (size_t h : handles)
+	{
+		header << "handle " << h << "\n";
+	}
+	for (const std::string& p : parallelCalls)
+	{
+		header << "parallel " << p << "\n";
+	}
+	for (const std::string& a : assembly)
+	{
+		header << "asm " << a << "\n";
+	}
+	header << "relocations " << relocations.size() << "\n";
+	header << "code " << code.size() << "\n";
+
+	std::ofstream f(filename, std::ios::binary | std::ios::out);
+	if (!f.good())
+	{
+		return false;
+	}
+
+	std::string h = header.str();
+	f.write(h.c_str(), h.length());
+	for (size_t r : relocations)
+	{
+		int word = (int)r;
+		f.write((const char*)&word, sizeof(int));
+	}
+	f.write((const char*)code.data(), code.size() * sizeof(int));
+	return f.good();
+}
+
+// Load object from file, returns false when file can't be read or it was written by different compiler version
+bool ObjectFile::Load(const std::string& filename)
+{
+	*this = ObjectFile();
+
+	std::ifstream f(filename, std::ios::binary | std::ios::in);
+	if (!f.good())
+	{
+		return false;
+	}
+
+	// Code generated by different compiler version may use different instructions
+	std::string line;
+	std::getline(f, line);
+	if (line != std::string("scobject ") + ScriptCompiler::GetVersion())
+	{
+		return false;
+	}
+
+	size_t relocationsCount = 0;
+	while (std::getline(f, line))
+	{
+		std::istringstream ss(line);
+		std::string type;
+		ss >> type;
+
+		if (type == "unit")
+		{
+			std::getline(ss >> std::ws, unit);
+			ss.clear();
+		}
+		else if (type == "program")
+		{
+			ss >> program;
+		}
+		else if (type == "string")
+		{
+			// Text is the rest of line (it may contain spaces)
+			int handle = 0;
+			ss >> handle;
+			ss.get();
+			std::getline(ss, strings[handle]);
+		}
+		else if (type == "symbol")
+		{
+			Symbol s;
+			ss >> s.label >> s.offset >> s.globals >> s.parallel;
+			std::string call;
+			while (!ss.eof() && ss >> call)
+			{
+				s.calls.push_back(call);
+			}
+			symbols.push_back(s);
+		}
+		else if (type == "reference")
+		{
+			Reference r;
+			ss >> r.label >> r.position;
+			references.push_back(r);
+		}
+		else if (type == "handle")
+		{
+			size_t position = 0;
+			ss >> position;
+			handles.push_back(position);
+		}
+		else if (type == "parallel")
+		{
+			std::string label;
+			ss >> label;
+			parallelCalls.push_back(label);
+		}
+		else if (type == "asm")
+		{
+			// Line is the rest (as it is)
+			assembly.push_back(line.length() > 4 ? line.substr(4) : "");
+		}
+		else if (type == "relocations")
+		{
+			ss >> relocationsCount;
+		}
+		else if (type == "code")
+		{
+			size_t count = 0;
+			ss >> count;
+
+			std::vector<int> words(relocationsCount);
+			f.read((char*)words.data(), relocationsCount * sizeof(int));
+			relocations.assign(words.begin(), words.end());
+
+			code.resize(count);
+			f.read((char*)code.data(), count * sizeof(int));
+			if ((size_t)f.gcount() != count * sizeof(int))
+			{
+				return false;
+			}
+
+			// Positions have to be within code, so linker never writes out of it
+			for (size_t r : relocations)
+			{
+				if (r >= count)
+				{
+					return false;
+				}
+			}
+			for (const Reference& r : references)
+			{
+				if (r.position >= count)
+				{
+					return false;
+				}
+			}
+			for (size_t h : handles)
+			{
+				if (h >= count)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+		else
+		{
+			return false;
+		}
+
+		if (ss.fail())
+		{
+			return false;
+		}
+	}
+
+	return false;
+}
\ No newline at end of file
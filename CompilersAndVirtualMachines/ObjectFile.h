@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __OBJECT_FILE_H__
+#define __OBJECT_FILE_H__
+
+#include <string>
+#include <vector>
+#include <map>
+
+// Relocatable object - machine code of single unit which is combined with other units by linker. Code
+// starts at offset 0 and has no constant pool (linker merges strings of all units and rewrites words
+// holding their handles, which are listed as handles). Words holding code offsets are listed as
+// relocations, calls of procedures which unit only declares are listed as references and procedures
+// unit defines are its symbols. Object compiled for link-time optimization carries assembly generated
+// by compiler too, so linker can optimize whole program
+struct ObjectFile
+{
+	// Procedure defined by unit
+	struct Symbol
+	{
+		std::string label;						// Label of procedure
+		int offset;								// Offset of procedure in code of unit (in bytes)
+		bool globals;							// Accesses arrays of program (directly or through calls within unit)
+		bool parallel;							// Contains parallel loop (directly or through calls within unit)
+		std::vector<std::string> calls;			// Labels of procedures it calls (directly or through calls within unit)
+												// which weren't defined when it was compiled, their properties aren't
+												// included in its own
+	};
+
+	// Call of procedure which isn't defined by unit
+	struct Reference
+	{
+		std::string label;						// Label of procedure
+		size_t position;						// Word holding its offset (it's 0 in object)
+	};
+
+	std::string unit;							// Name of unit (its source file)
+	bool program;								// Unit has program (otherwise it only defines procedures)
+	std::vector<int> code;						// Machine code
+	std::map<int, std::string> strings;			// Interned strings (by handle)
+	std::vector<size_t> relocations;			// Words holding offsets in code of unit
+	std::vector<size_t> handles;				// Words holding handles of strings of unit
+	std::vector<Symbol> symbols;				// Procedures defined by unit
+	std::vector<Reference> references;			// Calls of procedures of other units
+	std::vector<std::string> parallelCalls;		// Labels of procedures called in parallel loops (directly or through
+												// calls within unit) whose properties weren't known in unit
+	std::vector<std::string> assembly;			// Unoptimized assembly (empty unless it's for link-time optimization)
+
+	ObjectFile()
+	{
+		program = false;
+	}
+
+	// Save object into file, returns false when file can't be written
+	bool Save(const std::string& filename) const;
+
+	// Load object from file, returns false when file can't be read or it was written by different compiler version
+	bool Load(const std::string& filename);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,1901 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Optimizer.h"
+#include <algorithm>
+#include <climits>
+#include <set>
+
+// Copy propagation (removes copies and trivial phi nodes)
+bool Optimizer::CopyPropagation()
+{
+	bool changed = false;
+	bool progress = true;
+
+	while (progress)
+	{
+		progress = false;
+		for (size_t b = 0; b < mIR.GetBlocksCount(); b++)
+		{
+			IR::Block& blk = mIR.GetBlock((int)b);
+			if (blk.removed)
+			{
+				continue;
+			}
+
+			// Phi node which merges single value (or itself) is just a copy
+			for (int p : blk.phis)
+			{
+				IR::Value& v = mIR.GetValue(p);
+				if (v.removed)
+				{
+					continue;
+				}
+
+				int same = -1;
+				bool trivial = true;
+				for (int o : v.operands)
+				{
+					o = mIR.Resolve(o);
+					if (o == p || o == same)
+					{
+						continue;
+					}
+
+					if (same != -1)
+					{
+						trivial = false;
+						break;
+					}
+					same = o;
+				}
+
+				if (trivial)
+				{
+					mIR.Replace(p, same == -1 ? mIR.GetUndef() : same);
+					progress = true;
+				}
+			}
+
+			for (int c : blk.code)
+			{
+				IR::Value& v = mIR.GetValue(c);
+				if (!v.removed && v.op == IR::COPY)
+				{
+					mIR.Replace(c, v.operands[0]);
+					progress = true;
+				}
+			}
+		}
+
+		changed = changed || progress;
+	}
+
+	mIR.Canonicalize();
+
+	return changed;
+}
+
+// Simplify value (constant folding and algebraic identities), returns true if value changed
+bool Optimizer::Simplify(int value)
+{
+	IR::Value& v = mIR.GetValue(value);
+	if (v.op == IR::NEG)
+	{
+		const IR::Value& a = mIR.GetValue(v.operands[0]);
+		if (a.op == IR::CONST)
+		{
+			v.imm = (int)(0u - (unsigned int)a.imm);
+			v.op = IR::CONST;
+			v.operands.clear();
+			return true;
+		}
+		else if (a.op == IR::NEG)
+		{
+			// -(-x) = x
+			v.op = IR::COPY;
+			v.operands.assign(1, a.operands[0]);
+			return true;
+		}
+		else if (a.op == IR::SUB)
+		{
+			// -(x - y) = y - x (compiler generates subtraction with swapped operands followed by negation)
+			std::vector<int> operands = { a.operands[1], a.operands[0] };
+			v.op = IR::SUB;
+			v.operands = operands;
+			return true;
+		}
+		return false;
+	}
+
+	if (v.op == IR::SELECT)
+	{
+		const IR::Value& c = mIR.GetValue(v.operands[0]);
+		const IR::Value& a = mIR.GetValue(v.operands[1]);
+		const IR::Value& b = mIR.GetValue(v.operands[2]);
+		if (c.op == IR::CONST || v.operands[1] == v.operands[2])
+		{
+			int copy = (c.op == IR::CONST && c.imm == 0) ? v.operands[2] : v.operands[1];
+			v.op = IR::COPY;
+			v.operands.assign(1, copy);
+			return true;
+		}
+		else if (IR::IsCompare(c.op) && a.op == IR::CONST && b.op == IR::CONST && a.imm + b.imm == 1 && (a.imm == 1 || b.imm == 1))
+		{
+			// Selecting 1 or 0 by comparison is the comparison itself (or negated one)
+			IR::Opcode op = (a.imm == 1) ? c.op : IR::NegateCompare(c.op);
+			std::vector<int> operands = c.operands;
+			v.op = op;
+			v.operands = operands;
+			return true;
+		}
+		return false;
+	}
+
+	if (!IR::IsBinary(v.op))
+	{
+		return false;
+	}
+
+	int x = v.operands[0];
+	int y = v.operands[1];
+	const IR::Value& a = mIR.GetValue(x);
+	const IR::Value& b = mIR.GetValue(y);
+
+	// Constant folding
+	if (a.op == IR::CONST && b.op == IR::CONST)
+	{
+		int result = 0;
+		if (!IR::Evaluate(v.op, a.imm, b.imm, result))
+		{
+			return false;
+		}
+
+		v.op = IR::CONST;
+		v.imm = result;
+		v.operands.clear();
+		return true;
+	}
+
+	// Algebraic identities
+	bool aZero = a.op == IR::CONST && a.imm == 0;
+	bool bZero = b.op == IR::CONST && b.imm == 0;
+	bool aOne = a.op == IR::CONST && a.imm == 1;
+	bool bOne = b.op == IR::CONST && b.imm == 1;
+
+	int copy = -1;
+	int constant = 0;
+	bool isConstant = false;
+	switch (v.op)
+	{
+	case IR::ADD:
+		if (aZero) copy = y;
+		else if (bZero) copy = x;
+		break;
+
+	case IR::SUB:
+		if (bZero) copy = x;
+		else if (x == y) isConstant = true;
+		else if (aZero)
+		{
+			v.op = IR::NEG;
+			v.operands.erase(v.operands.begin());
+			return true;
+		}
+		break;
+
+	case IR::MUL:
+		if (aOne) copy = y;
+		else if (bOne) copy = x;
+		else if (aZero || bZero) isConstant = true;
+		break;
+
+	case IR::DIV:
+		if (bOne) copy = x;
+		else if (b.op == IR::CONST && b.imm == -1)
+		{
+			v.op = IR::NEG;
+			v.operands.pop_back();
+			return true;
+		}
+		break;
+
+	case IR::SHL:
+	case IR::SHR:
+	case IR::SAR:
+		if (bZero) copy = x;
+		else if (aZero) isConstant = true;
+		break;
+
+	case IR::AND:
+		if (x == y) copy = x;
+		else if (aZero || bZero) isConstant = true;
+		break;
+
+	case IR::OR:
+		if (x == y || bZero) copy = x;
+		else if (aZero) copy = y;
+		break;
+
+	case IR::XOR:
+		if (bZero) copy = x;
+		else if (aZero) copy = y;
+		else if (x == y) isConstant = true;
+		break;
+
+	case IR::MULHI:
+		if (aZero || bZero) isConstant = true;
+		break;
+
+	case IR::CMPLEQ:
+	case IR::CMPGEQ:
+	case IR::CMPEQ:
+		if (x == y)
+		{
+			isConstant = true;
+			constant = 1;
+		}
+		break;
+
+	case IR::CMPLESS:
+	case IR::CMPGREATER:
+	case IR::CMPNEQ:
+		if (x == y) isConstant = true;
+		break;
+
+	default:
+		break;
+	}
+
+	if (copy != -1)
+	{
+		v.op = IR::COPY;
+		v.operands.assign(1, copy);
+		return true;
+	}
+	else if (isConstant)
+	{
+		v.op = IR::CONST;
+		v.imm = constant;
+		v.operands.clear();
+		return true;
+	}
+
+	return false;
+}
+
+// Value numbering of single block and blocks it dominates
+bool Optimizer::ValueNumberBlock(int block, std::map<std::vector<int>, int>& table, std::map<int, int>& constants)
+{
+	bool changed = false;
+	std::vector<std::vector<int> > added;
+	std::vector<int> addedConstants;
+	IR::Block& blk = mIR.GetBlock(block);
+
+	// Phi nodes in the same block merging same values are equal
+	for (int p : blk.phis)
+	{
+		IR::Value& v = mIR.GetValue(p);
+		if (v.removed)
+		{
+			continue;
+		}
+
+		std::vector<int> key;
+		key.push_back(IR::PHI);
+		key.push_back(block);
+		for (int o : v.operands)
+		{
+			key.push_back(mIR.Resolve(o));
+		}
+
+		auto it = table.find(key);
+		if (it != table.end())
+		{
+			mIR.Replace(p, it->second);
+			changed = true;
+		}
+		else
+		{
+			table[key] = p;
+			added.push_back(key);
+		}
+	}
+
+	for (int c : blk.code)
+	{
+		IR::Value& v = mIR.GetValue(c);
+		if (v.removed)
+		{
+			continue;
+		}
+
+		for (int& o : v.operands)
+		{
+			o = mIR.Resolve(o);
+		}
+
+		if (Simplify(c))
+		{
+			changed = true;
+		}
+
+		if (v.op == IR::COPY)
+		{
+			mIR.Replace(c, v.operands[0]);
+			changed = true;
+			continue;
+		}
+
+		// Each call and memory access is executed on its own, vector values are computed at place of their
+		// single use
+		if (v.op == IR::CALL || IR::IsLoad(v.op) || IR::IsStore(v.op) || IR::IsVector(v.op))
+		{
+			continue;
+		}
+
+		if (v.op == IR::CONST)
+		{
+			auto it = constants.find(v.imm);
+			if (it != constants.end())
+			{
+				mIR.Replace(c, it->second);
+				changed = true;
+			}
+			else
+			{
+				constants[v.imm] = c;
+				addedConstants.push_back(v.imm);
+			}
+			continue;
+		}
+
+		// Canonical form - ordered operands of commutative operations, greater comparisons turned into less
+		IR::Opcode op = v.op;
+		std::vector<int> operands = v.operands;
+		if (IR::IsCommutative(op) && operands[0] > operands[1])
+		{
+			std::swap(operands[0], operands[1]);
+		}
+		else if (op == IR::CMPGREATER || op == IR::CMPGEQ)
+		{
+			op = (op == IR::CMPGREATER) ? IR::CMPLESS : IR::CMPLEQ;
+			std::swap(operands[0], operands[1]);
+		}
+
+		// Handles of different strings differ only in their imm
+		std::vector<int> key;
+		key.push_back(op);
+		key.push_back(v.imm);
+		key.insert(key.end(), operands.begin(), operands.end());
+
+		auto it = table.find(key);
+		if (it != table.end())
+		{
+			mIR.Replace(c, it->second);
+			changed = true;
+		}
+		else
+		{
+			table[key] = c;
+			added.push_back(key);
+		}
+	}
+
+	blk.cond = mIR.Resolve(blk.cond);
+
+	for (int child : mIR.GetDomChildren(block))
+	{
+		if (ValueNumberBlock(child, table, constants))
+		{
+			changed = true;
+		}
+	}
+
+	// Values of this block are not available outside of its dominator subtree
+	for (const std::vector<int>& key : added)
+	{
+		table.erase(key);
+	}
+
+	for (int imm : addedConstants)
+	{
+		constants.erase(imm);
+	}
+
+	return changed;
+}
+
+// Global value numbering (over dominator tree, removes redundant computations)
+bool Optimizer::ValueNumbering()
+{
+	std::map<std::vector<int>, int> table;
+	std::map<int, int> constants;
+
+	mIR.ComputeDominators();
+	bool changed = ValueNumberBlock(0, table, constants);
+	mIR.Canonicalize();
+
+	return changed;
+}
+
+// Dead code elimination
+bool Optimizer::DeadCodeElimination()
+{
+	std::vector<bool> live(mIR.GetValuesCount(), false);
+	std::vector<int> worklist;
+
+	// Roots are values with side effects, branch conditions and values of variables at program end
+	for (size_t b = 0; b < mIR.GetBlocksCount(); b++)
+	{
+		IR::Block& blk = mIR.GetBlock((int)b);
+		if (blk.removed)
+		{
+			continue;
+		}
+
+		for (int c : blk.code)
+		{
+			if (mIR.HasSideEffect(c))
+			{
+				worklist.push_back(c);
+			}
+		}
+
+		if (blk.term == IR::BRANCH || blk.term == IR::RETURN || blk.term == IR::SWITCH)
+		{
+			worklist.push_back(blk.cond);
+		}
+		else if (blk.term == IR::EXIT)
+		{
+			for (int x = 0; x < mIR.GetExitSlots(); x++)
+			{
+				if (blk.exit[IR::VAR_SLOTS + x] >= 0)
+				{
+					worklist.push_back(blk.exit[IR::VAR_SLOTS + x]);
+				}
+			}
+		}
+	}
+
+	while (!worklist.empty())
+	{
+		int v = worklist.back();
+		worklist.pop_back();
+		if (live[v])
+		{
+			continue;
+		}
+
+		live[v] = true;
+		for (int o : mIR.GetValue(v).operands)
+		{
+			if (!live[o])
+			{
+				worklist.push_back(o);
+			}
+		}
+	}
+
+	bool changed = false;
+	for (size_t b = 0; b < mIR.GetBlocksCount(); b++)
+	{
+		IR::Block& blk = mIR.GetBlock((int)b);
+		if (blk.removed)
+		{
+			continue;
+		}
+
+		for (int p : blk.phis)
+		{
+			if (!live[p])
+			{
+				mIR.GetValue(p).removed = true;
+				changed = true;
+			}
+		}
+
+		for (int c : blk.code)
+		{
+			if (!live[c])
+			{
+				mIR.GetValue(c).removed = true;
+				changed = true;
+			}
+		}
+	}
+
+	mIR.Canonicalize();
+
+	return changed;
+}
+
+// Control flow simplification (branches on constants, jumps to branches on the same condition, merging of blocks)
+bool Optimizer::SimplifyControlFlow()
+{
+	bool changed = false;
+	bool progress = true;
+
+	mIR.Canonicalize();
+
+	while (progress)
+	{
+		progress = false;
+		std::vector<int> layout = mIR.GetLayout();
+		for (int b : layout)
+		{
+			IR::Block& blk = mIR.GetBlock(b);
+			if (blk.removed)
+			{
+				continue;
+			}
+
+			if (blk.term == IR::BRANCH)
+			{
+				int cond = mIR.Resolve(blk.cond);
+				const IR::Value& c = mIR.GetValue(cond);
+
+				// Branch with known result continues only in one of successors
+				if (c.op == IR::CONST || blk.succs[0] == blk.succs[1])
+				{
+					int taken = (c.op == IR::CONST && c.imm == 0) ? 1 : 0;
+					mIR.RemovePredecessor(blk.succs[1 - taken], b);
+					blk.succs.assign(1, blk.succs[taken]);
+					blk.term = IR::GOTO;
+					blk.cond = -1;
+					progress = true;
+					continue;
+				}
+
+				// Empty successor branching on the same condition can be skipped, as its result is known
+				for (int i = 0; i < 2; i++)
+				{
+					int s = blk.succs[i];
+					IR::Block& succ = mIR.GetBlock(s);
+					if (s == b || succ.term != IR::BRANCH || mIR.Resolve(succ.cond) != cond ||
+						succ.preds.size() != 1 || !succ.phis.empty() || !succ.code.empty())
+					{
+						continue;
+					}
+
+					blk.succs[i] = succ.succs[i];
+					mIR.ReplacePredecessor(succ.succs[i], s, b);
+					mIR.RemovePredecessor(succ.succs[1 - i], s);
+					succ.succs.clear();
+					succ.preds.clear();
+					succ.removed = true;
+					progress = true;
+					break;
+				}
+			}
+			else if (blk.term == IR::SWITCH)
+			{
+				// Switch on known value (or with all targets the same) continues only in one of successors
+				const IR::Value& c = mIR.GetValue(mIR.Resolve(blk.cond));
+				size_t taken = (c.op == IR::CONST) ? IR::SwitchTarget(c.imm, blk.succs.size()) : 0;
+				if (c.op != IR::CONST && std::count(blk.succs.begin(), blk.succs.end(), blk.succs[0]) != (int)blk.succs.size())
+				{
+					continue;
+				}
+
+				for (size_t i = 0; i < blk.succs.size(); i++)
+				{
+					if (i != taken)
+					{
+						mIR.RemovePredecessor(blk.succs[i], b);
+					}
+				}
+				blk.succs.assign(1, blk.succs[taken]);
+				blk.term = IR::GOTO;
+				blk.cond = -1;
+				progress = true;
+			}
+			else if (blk.term == IR::GOTO)
+			{
+				// Successor with single predecessor is merged into block
+				int s = blk.succs[0];
+				IR::Block& succ = mIR.GetBlock(s);
+				if (s == b || s == 0 || succ.preds.size() != 1)
+				{
+					continue;
+				}
+
+				for (int p : succ.phis)
+				{
+					if (!mIR.GetValue(p).removed)
+					{
+						mIR.Replace(p, mIR.GetValue(p).operands[0]);
+					}
+				}
+
+				for (int c : succ.code)
+				{
+					mIR.GetValue(c).block = b;
+					blk.code.push_back(c);
+				}
+
+				blk.term = succ.term;
+				blk.cond = succ.cond;
+				blk.succs = succ.succs;
+				blk.exit = succ.exit;
+				for (int t : succ.succs)
+				{
+					mIR.ReplacePredecessor(t, s, b);
+				}
+
+				succ.phis.clear();
+				succ.code.clear();
+				succ.succs.clear();
+				succ.preds.clear();
+				succ.removed = true;
+				progress = true;
+			}
+		}
+
+		if (mIR.RemoveUnreachable())
+		{
+			progress = true;
+		}
+
+		changed = changed || progress;
+	}
+
+	mIR.Canonicalize();
+
+	return changed;
+}
+
+// Sparse conditional constant propagation - values are assumed constant until proven otherwise and
+// only edges which can be taken are followed, so constants propagate through phi nodes of loops and
+// branches which are never taken don't spoil them
+bool Optimizer::ConstantPropagation()
+{
+	enum Lattice
+	{
+		LATTICE_TOP = 0,					// No value seen yet
+		LATTICE_CONST,						// Single constant
+		LATTICE_BOTTOM						// Not a constant
+	};
+
+	mIR.Canonicalize();
+
+	size_t values = mIR.GetValuesCount();
+	size_t blocks = mIR.GetBlocksCount();
+	std::vector<int> state(values, LATTICE_TOP);
+	std::vector<int> constant(values, 0);
+	std::vector<bool> executable(blocks, false);
+	std::set<std::pair<int, int> > edges;
+
+	// Undefined values and arguments aren't computed by any block, they're never constants (nor are
+	// handles of strings linker rewrites)
+	for (size_t v = 0; v < values; v++)
+	{
+		IR::Opcode op = mIR.GetValue((int)v).op;
+		if (op == IR::UNDEF || op == IR::ARG || op == IR::STRING)
+		{
+			state[v] = LATTICE_BOTTOM;
+		}
+	}
+
+	// Users of each value (values and blocks branching on it)
+	std::vector<std::vector<int> > users(values);
+	std::vector<std::vector<int> > branches(values);
+	for (size_t b = 0; b < blocks; b++)
+	{
+		const IR::Block& blk = mIR.GetBlock((int)b);
+		if (blk.removed)
+		{
+			continue;
+		}
+
+		for (const std::vector<int>* list : { &blk.phis, &blk.code })
+		{
+			for (int v : *list)
+			{
+				for (int o : mIR.GetValue(v).operands)
+				{
+					users[o].push_back(v);
+				}
+			}
+		}
+
+		if (blk.term == IR::BRANCH || blk.term == IR::SWITCH)
+		{
+			branches[blk.cond].push_back((int)b);
+		}
+	}
+
+	std::vector<int> blockWorklist;
+	std::vector<int> valueWorklist;
+
+	// Lower value in lattice (it can only go down), users are revisited when it changes
+	auto Lower = [&](int v, int s, int c)
+	{
+		if (s == LATTICE_CONST && state[v] == LATTICE_CONST && constant[v] != c)
+		{
+			s = LATTICE_BOTTOM;
+		}
+
+		if (s > state[v])
+		{
+			state[v] = s;
+			constant[v] = c;
+			valueWorklist.push_back(v);
+		}
+	};
+
+	// Evaluate value from lattice of its operands
+	auto Visit = [&](int v)
+	{
+		const IR::Value& value = mIR.GetValue(v);
+		if (!executable[value.block])
+		{
+			return;
+		}
+
+		if (value.op == IR::PHI)
+		{
+			// Only operands flowing through executable edges are merged
+			const IR::Block& blk = mIR.GetBlock(value.block);
+			for (size_t i = 0; i < value.operands.size(); i++)
+			{
+				int o = value.operands[i];
+				if (edges.find(std::pair<int, int>(blk.preds[i], value.block)) != edges.end() && state[o] != LATTICE_TOP)
+				{
+					Lower(v, state[o], constant[o]);
+				}
+			}
+			return;
+		}
+
+		int result = 0;
+		switch (value.op)
+		{
+		case IR::CONST:
+			Lower(v, LATTICE_CONST, value.imm);
+			break;
+
+		case IR::COPY:
+		case IR::NEG:
+			{
+				int o = value.operands[0];
+				if (state[o] != LATTICE_TOP)
+				{
+					Lower(v, state[o], (value.op == IR::NEG) ? (int)(0u - (unsigned int)constant[o]) : constant[o]);
+				}
+			}
+			break;
+
+		case IR::SELECT:
+			{
+				// Unknown condition merges both values (as phi node does)
+				int c = value.operands[0];
+				for (int i = 1; i <= 2; i++)
+				{
+					int o = value.operands[i];
+					bool taken = state[c] == LATTICE_BOTTOM || (state[c] == LATTICE_CONST && (constant[c] != 0) == (i == 1));
+					if (taken && state[o] != LATTICE_TOP)
+					{
+						Lower(v, state[o], constant[o]);
+					}
+				}
+			}
+			break;
+
+		default:
+			if (IR::IsBinary(value.op))
+			{
+				int a = value.operands[0];
+				int b = value.operands[1];
+				if (state[a] == LATTICE_BOTTOM || state[b] == LATTICE_BOTTOM)
+				{
+					Lower(v, LATTICE_BOTTOM, 0);
+				}
+				else if (state[a] == LATTICE_CONST && state[b] == LATTICE_CONST)
+				{
+					// Division by zero isn't a constant, it happens at runtime
+					if (IR::Evaluate(value.op, constant[a], constant[b], result))
+					{
+						Lower(v, LATTICE_CONST, result);
+					}
+					else
+					{
+						Lower(v, LATTICE_BOTTOM, 0);
+					}
+				}
+			}
+			else
+			{
+				// Undefined values, arguments and results of calls are never constants
+				Lower(v, LATTICE_BOTTOM, 0);
+			}
+			break;
+		}
+	};
+
+	// Mark edge as executable, its target is visited (whole when it becomes executable, otherwise
+	// its phi nodes get new operand)
+	auto MarkEdge = [&](int from, int to)
+	{
+		if (!edges.insert(std::pair<int, int>(from, to)).second)
+		{
+			return;
+		}
+
+		if (!executable[to])
+		{
+			executable[to] = true;
+			blockWorklist.push_back(to);
+		}
+		else
+		{
+			for (int p : mIR.GetBlock(to).phis)
+			{
+				Visit(p);
+			}
+		}
+	};
+
+	// Follow successors which can be taken
+	auto VisitTerminator = [&](int b)
+	{
+		const IR::Block& blk = mIR.GetBlock(b);
+		if (blk.term == IR::GOTO)
+		{
+			MarkEdge(b, blk.succs[0]);
+		}
+		else if (blk.term == IR::BRANCH)
+		{
+			if (state[blk.cond] == LATTICE_CONST)
+			{
+				MarkEdge(b, blk.succs[constant[blk.cond] != 0 ? 0 : 1]);
+			}
+			else if (state[blk.cond] == LATTICE_BOTTOM)
+			{
+				MarkEdge(b, blk.succs[0]);
+				MarkEdge(b, blk.succs[1]);
+			}
+		}
+		else if (blk.term == IR::SWITCH)
+		{
+			if (state[blk.cond] == LATTICE_CONST)
+			{
+				MarkEdge(b, blk.succs[IR::SwitchTarget(constant[blk.cond], blk.succs.size())]);
+			}
+			else if (state[blk.cond] == LATTICE_BOTTOM)
+			{
+				for (int s : blk.succs)
+				{
+					MarkEdge(b, s);
+				}
+			}
+		}
+	};
+
+	executable[0] = true;
+	blockWorklist.push_back(0);
+	while (!blockWorklist.empty() || !valueWorklist.empty())
+	{
+		while (!blockWorklist.empty())
+		{
+			int b = blockWorklist.back();
+			blockWorklist.pop_back();
+
+			const IR::Block& blk = mIR.GetBlock(b);
+			for (int p : blk.phis)
+			{
+				Visit(p);
+			}
+			for (int c : blk.code)
+			{
+				Visit(c);
+			}
+			VisitTerminator(b);
+		}
+
+		while (!valueWorklist.empty())
+		{
+			int v = valueWorklist.back();
+			valueWorklist.pop_back();
+
+			for (int u : users[v])
+			{
+				Visit(u);
+			}
+			for (int b : branches[v])
+			{
+				if (executable[b])
+				{
+					VisitTerminator(b);
+				}
+			}
+		}
+	}
+
+	// Constant values are replaced (branches on them are folded by control flow simplification)
+	bool changed = false;
+	for (size_t b = 0; b < blocks; b++)
+	{
+		IR::Block& blk = mIR.GetBlock((int)b);
+		if (blk.removed || !executable[b])
+		{
+			continue;
+		}
+
+		std::vector<int> phiConstants;
+		for (int p : blk.phis)
+		{
+			if (state[p] == LATTICE_CONST)
+			{
+				int c = mIR.NewValue(IR::CONST, (int)b, constant[p], std::vector<int>());
+				phiConstants.push_back(c);
+				mIR.Replace(p, c);
+				changed = true;
+
+				// Constant is computed in block, so variable no longer holds it at block entry
+				std::replace(blk.entry.begin(), blk.entry.end(), p, -1);
+			}
+		}
+
+		for (int c : blk.code)
+		{
+			IR::Value& v = mIR.GetValue(c);
+			if (state[c] == LATTICE_CONST && v.op != IR::CONST)
+			{
+				v.op = IR::CONST;
+				v.imm = constant[c];
+				v.operands.clear();
+				changed = true;
+			}
+		}
+
+		blk.code.insert(blk.code.begin(), phiConstants.begin(), phiConstants.end());
+	}
+
+	mIR.Canonicalize();
+
+	return changed;
+}
+
+// Run scalar passes and control flow simplification while anything changes
+void Optimizer::Cleanup()
+{
+	// Passes enable each other, repeat them while anything changes
+	for (int i = 0; i < 16; i++)
+	{
+		bool changed = false;
+		changed = CopyPropagation() || changed;
+		changed = ConstantPropagation() || changed;
+		changed = ValueNumbering() || changed;
+		changed = CopyPropagation() || changed;
+		changed = DeadCodeElimination() || changed;
+		changed = SimplifyControlFlow() || changed;
+		if (!changed)
+		{
+			break;
+		}
+	}
+}
+
+// Returns true when value is never negative (according to its operands)
+bool Optimizer::IsNonNegative(int value)
+{
+	const IR::Value& v = mIR.GetValue(value);
+	switch (v.op)
+	{
+	case IR::CONST:
+		return v.imm >= 0;
+
+	case IR::COPY:
+	case IR::PHI:
+		for (int o : v.operands)
+		{
+			if (!mNonNegative[o])
+			{
+				return false;
+			}
+		}
+		return true;
+
+	case IR::CMPLEQ:
+	case IR::CMPGEQ:
+	case IR::CMPLESS:
+	case IR::CMPGREATER:
+	case IR::CMPEQ:
+	case IR::CMPNEQ:
+		return true;
+
+	case IR::AND:
+		return mNonNegative[v.operands[0]] || mNonNegative[v.operands[1]];
+
+	case IR::OR:
+	case IR::XOR:
+	case IR::DIV:
+	case IR::MULHI:
+		return mNonNegative[v.operands[0]] && mNonNegative[v.operands[1]];
+
+	case IR::SHR:
+	{
+		const IR::Value& b = mIR.GetValue(v.operands[1]);
+		return mNonNegative[v.operands[0]] || (b.op == IR::CONST && (b.imm & 31) != 0);
+	}
+
+	case IR::SAR:
+		return mNonNegative[v.operands[0]];
+
+	case IR::SELECT:
+		return mNonNegative[v.operands[1]] && mNonNegative[v.operands[2]];
+
+	default:
+		// Addition, subtraction, multiplication and shift left may overflow
+		return false;
+	}
+}
+
+// Find values which are never negative
+void Optimizer::ComputeNonNegative()
+{
+	// Optimistic - all values are assumed to be non-negative until proven otherwise, so phi
+	// nodes of loops merging non-negative values keep the property
+	mNonNegative.assign(mIR.GetValuesCount(), false);
+	for (size_t b = 0; b < mIR.GetBlocksCount(); b++)
+	{
+		const IR::Block& blk = mIR.GetBlock((int)b);
+		if (blk.removed)
+		{
+			continue;
+		}
+
+		for (int p : blk.phis)
+		{
+			mNonNegative[p] = true;
+		}
+
+		for (int c : blk.code)
+		{
+			mNonNegative[c] = true;
+		}
+	}
+
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (size_t v = 0; v < mNonNegative.size(); v++)
+		{
+			if (mNonNegative[v] && !IsNonNegative((int)v))
+			{
+				mNonNegative[v] = false;
+				changed = true;
+			}
+		}
+	}
+}
+
+// Multiplier and shift for signed division by constant (at least 2) through multiply-high
+// (Hacker's Delight, chapter 10)
+void Optimizer::DivisionMagic(int divisor, int& multiplier, int& shift)
+{
+	const unsigned int two31 = 0x80000000u;
+	unsigned int ad = (unsigned int)divisor;
+	unsigned int anc = two31 - 1 - two31 % ad;
+	unsigned int q1 = two31 / anc;
+	unsigned int r1 = two31 - q1 * anc;
+	unsigned int q2 = two31 / ad;
+	unsigned int r2 = two31 - q2 * ad;
+	unsigned int delta = 0;
+	int p = 31;
+
+	do
+	{
+		p++;
+		q1 = 2 * q1;
+		r1 = 2 * r1;
+		if (r1 >= anc)
+		{
+			q1++;
+			r1 -= anc;
+		}
+
+		q2 = 2 * q2;
+		r2 = 2 * r2;
+		if (r2 >= ad)
+		{
+			q2++;
+			r2 -= ad;
+		}
+
+		delta = ad - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+
+	multiplier = (int)(q2 + 1);
+	shift = p - 32;
+}
+
+// Replace multiplication or division by constant with cheaper operations (new values are
+// appended to code), returns true if value changed
+bool Optimizer::ReduceValue(int value, std::vector<int>& code)
+{
+	int block = mIR.GetValue(value).block;
+	auto Emit = [&](IR::Opcode op, int imm, const std::vector<int>& operands)
+	{
+		int v = mIR.NewValue(op, block, imm, operands);
+		code.push_back(v);
+		return v;
+	};
+	auto Constant = [&](int imm)
+	{
+		return Emit(IR::CONST, imm, std::vector<int>());
+	};
+
+	IR::Opcode op = mIR.GetValue(value).op;
+	if (op != IR::MUL && op != IR::DIV)
+	{
+		return false;
+	}
+
+	int x = mIR.GetValue(value).operands[0];
+	int y = mIR.GetValue(value).operands[1];
+	if (op == IR::MUL && mIR.GetValue(x).op == IR::CONST)
+	{
+		std::swap(x, y);
+	}
+
+	if (mIR.GetValue(y).op != IR::CONST)
+	{
+		return false;
+	}
+
+	int c = mIR.GetValue(y).imm;
+	unsigned int d = (c < 0) ? 0u - (unsigned int)c : (unsigned int)c;
+	bool power = d != 0 && (d & (d - 1)) == 0;
+	int k = 0;
+	while (power && (1u << k) != d)
+	{
+		k++;
+	}
+
+	// Multiplication is single instruction, only multiplication by power of two is turned into shift
+	if (op == IR::MUL)
+	{
+		if (c <= 1 || !power)
+		{
+			return false;
+		}
+
+		int shift = Constant(k);
+		IR::Value& v = mIR.GetValue(value);
+		v.op = IR::SHL;
+		v.operands = { x, shift };
+		return true;
+	}
+
+	// Division by zero has to happen at runtime, division by 1 and -1 is simplified
+	if (d <= 1 || d == 0x80000000u)
+	{
+		return false;
+	}
+
+	// Negative dividend would need bias or sign correction on top of shift or multiply-high (division rounds
+	// towards zero), which is never cheaper than division itself
+	if (!mNonNegative[x])
+	{
+		return false;
+	}
+
+	int multiplier = 0;
+	int shift = 0;
+	int cost = (c < 0) ? 1 : 0;
+	if (power)
+	{
+		cost += 1;
+	}
+	else
+	{
+		DivisionMagic((int)d, multiplier, shift);
+		cost += 1 + (multiplier < 0 ? 1 : 0) + (shift > 0 ? 1 : 0);
+	}
+
+	if (cost > DIVISION_COST)
+	{
+		return false;
+	}
+
+	int q = -1;
+	if (power)
+	{
+		q = Emit(IR::SHR, 0, { x, Constant(k) });
+	}
+	else
+	{
+		q = Emit(IR::MULHI, 0, { x, Constant(multiplier) });
+		if (multiplier < 0)
+		{
+			q = Emit(IR::ADD, 0, { q, x });
+		}
+
+		if (shift > 0)
+		{
+			q = Emit(IR::SAR, 0, { q, Constant(shift) });
+		}
+	}
+
+	if (c < 0)
+	{
+		q = Emit(IR::NEG, 0, { q });
+	}
+
+	IR::Value& v = mIR.GetValue(value);
+	v.op = IR::COPY;
+	v.operands.assign(1, q);
+	return true;
+}
+
+// Strength reduction (multiplication and division by constants)
+bool Optimizer::StrengthReduction()
+{
+	bool changed = false;
+
+	ComputeNonNegative();
+
+	for (size_t b = 0; b < mIR.GetBlocksCount(); b++)
+	{
+		if (mIR.GetBlock((int)b).removed)
+		{
+			continue;
+		}
+
+		// Operations replacing value are placed right before it
+		std::vector<int> code;
+		std::vector<int> original = mIR.GetBlock((int)b).code;
+		for (int c : original)
+		{
+			if (ReduceValue(c, code))
+			{
+				changed = true;
+			}
+			code.push_back(c);
+		}
+		mIR.GetBlock((int)b).code = code;
+	}
+
+	return changed;
+}
+
+// Bounds check elimination - ranges of values are found over SSA form (refined by branches dominating
+// their uses), accesses whose index is always within array or which are dominated by access checking
+// the same index against the same size aren't checked
+bool Optimizer::BoundsCheckElimination()
+{
+	// Interval of values, empty one (low > high) belongs to value which wasn't reached yet
+	struct Range
+	{
+		long long low;
+		long long high;
+	};
+
+	mIR.Canonicalize();
+	mIR.ComputeDominators();
+
+	size_t values = mIR.GetValuesCount();
+	const Range full = { INT_MIN, INT_MAX };
+	const Range empty = { 1, 0 };
+	std::vector<Range> range(values, empty);
+
+	// Undefined values and arguments aren't computed by any block, they can be anything
+	for (size_t v = 0; v < values; v++)
+	{
+		IR::Opcode op = mIR.GetValue((int)v).op;
+		if (op == IR::UNDEF || op == IR::ARG)
+		{
+			range[v] = full;
+		}
+	}
+
+	// Range of result which doesn't fit into int is unknown (arithmetic wraps around)
+	auto Make = [&](long long low, long long high)
+	{
+		Range r = { low, high };
+		return (low < INT_MIN || high > INT_MAX) ? full : r;
+	};
+
+	// Refine range of value by condition of branch taken on edge between blocks
+	auto RefineEdge = [&](Range r, int value, int from, int to)
+	{
+		const IR::Block& blk = mIR.GetBlock(from);
+		if (blk.term != IR::BRANCH || blk.succs[0] == blk.succs[1] || !IR::IsCompare(mIR.GetValue(blk.cond).op))
+		{
+			return r;
+		}
+
+		const IR::Value& cond = mIR.GetValue(blk.cond);
+		IR::Opcode op = (to == blk.succs[0]) ? cond.op : IR::NegateCompare(cond.op);
+		int other = cond.operands[1];
+		if (cond.operands[0] != value)
+		{
+			other = cond.operands[0];
+			op = IR::SwapCompare(op);
+		}
+
+		const Range& o = range[other];
+		if ((cond.operands[0] != value && cond.operands[1] != value) || other == value || o.low > o.high)
+		{
+			return r;
+		}
+
+		switch (op)
+		{
+		case IR::CMPLESS:
+			r.high = std::min(r.high, o.high - 1);
+			break;
+
+		case IR::CMPLEQ:
+			r.high = std::min(r.high, o.high);
+			break;
+
+		case IR::CMPGREATER:
+			r.low = std::max(r.low, o.low + 1);
+			break;
+
+		case IR::CMPGEQ:
+			r.low = std::max(r.low, o.low);
+			break;
+
+		case IR::CMPEQ:
+			r.low = std::max(r.low, o.low);
+			r.high = std::min(r.high, o.high);
+			break;
+
+		default:
+			break;
+		}
+		return r;
+	};
+
+	// Range of value used in block, refined by branches to blocks (with single predecessor) dominating it
+	auto RangeIn = [&](Range r, int value, int block)
+	{
+		while (block != 0 && block != -1)
+		{
+			const IR::Block& blk = mIR.GetBlock(block);
+			if (blk.preds.size() == 1)
+			{
+				r = RefineEdge(r, value, blk.preds[0], block);
+			}
+			block = mIR.GetIdom(block);
+		}
+		return r;
+	};
+
+	// Range of value computed from ranges of its operands
+	auto Evaluate = [&](int value)
+	{
+		const IR::Value& v = mIR.GetValue(value);
+		if (v.op == IR::PHI)
+		{
+			// Operand coming from predecessor is refined by the edge too
+			const IR::Block& blk = mIR.GetBlock(v.block);
+			Range r = empty;
+			for (size_t i = 0; i < v.operands.size(); i++)
+			{
+				Range o = RangeIn(RefineEdge(range[v.operands[i]], v.operands[i], blk.preds[i], v.block), v.operands[i], blk.preds[i]);
+				if (o.low <= o.high)
+				{
+					r = (r.low > r.high) ? o : Make(std::min(r.low, o.low), std::max(r.high, o.high));
+				}
+			}
+			return r;
+		}
+		else if (v.op == IR::CONST)
+		{
+			return Make(v.imm, v.imm);
+		}
+		else if (v.op != IR::COPY && v.op != IR::NEG && !IR::IsBinary(v.op))
+		{
+			return full;
+		}
+
+		Range a = RangeIn(range[v.operands[0]], v.operands[0], v.block);
+		Range b = (v.operands.size() > 1) ? RangeIn(range[v.operands[1]], v.operands[1], v.block) : a;
+		const IR::Value& operand = mIR.GetValue(v.operands.back());
+		if (a.low > a.high || b.low > b.high)
+		{
+			return empty;
+		}
+
+		switch (v.op)
+		{
+		case IR::COPY:
+			return a;
+
+		case IR::NEG:
+			return Make(-a.high, -a.low);
+
+		case IR::ADD:
+			return Make(a.low + b.low, a.high + b.high);
+
+		case IR::SUB:
+			return Make(a.low - b.high, a.high - b.low);
+
+		case IR::MUL:
+		{
+			long long p[] = { a.low * b.low, a.low * b.high, a.high * b.low, a.high * b.high };
+			return Make(*std::min_element(p, p + 4), *std::max_element(p, p + 4));
+		}
+
+		case IR::DIV:
+			// Division by positive constant truncates, which keeps order
+			if (operand.op == IR::CONST && operand.imm > 0)
+			{
+				return Make(a.low / operand.imm, a.high / operand.imm);
+			}
+			return full;
+
+		case IR::AND:
+			// Result of and with non-negative value isn't larger than it
+			if (a.low >= 0 || b.low >= 0)
+			{
+				return Make(0, std::min(a.low >= 0 ? a.high : INT_MAX, b.low >= 0 ? b.high : INT_MAX));
+			}
+			return full;
+
+		case IR::SHR:
+			if (operand.op == IR::CONST && a.low >= 0)
+			{
+				return Make(a.low >> (operand.imm & 31), a.high >> (operand.imm & 31));
+			}
+			else if (operand.op == IR::CONST && (operand.imm & 31) != 0)
+			{
+				return Make(0, 0xFFFFFFFFLL >> (operand.imm & 31));
+			}
+			return full;
+
+		case IR::SAR:
+			if (operand.op == IR::CONST)
+			{
+				return Make(a.low >> (operand.imm & 31), a.high >> (operand.imm & 31));
+			}
+			return full;
+
+		case IR::CMPLEQ:
+		case IR::CMPGEQ:
+		case IR::CMPLESS:
+		case IR::CMPGREATER:
+		case IR::CMPEQ:
+		case IR::CMPNEQ:
+			return Make(0, 1);
+
+		default:
+			return full;
+		}
+	};
+
+	// Widened bounds stop at constants of unit (and their neighbours), so loop counters compared against
+	// constants don't go to the limit of int (where their increment would overflow)
+	std::set<long long> thresholds = { INT_MIN, INT_MAX };
+	std::vector<int> order;
+	for (int b : mIR.ReversePostorder())
+	{
+		const IR::Block& blk = mIR.GetBlock(b);
+		order.insert(order.end(), blk.phis.begin(), blk.phis.end());
+		order.insert(order.end(), blk.code.begin(), blk.code.end());
+
+		for (int c : blk.code)
+		{
+			const IR::Value& v = mIR.GetValue(c);
+			if (v.op == IR::CONST)
+			{
+				thresholds.insert({ (long long)v.imm - 1, (long long)v.imm, (long long)v.imm + 1 });
+			}
+		}
+	}
+
+	// Ranges grow until nothing changes, phi nodes changing repeatedly are widened (their bounds which
+	// keep moving go to the next threshold), so loops are done in few iterations
+	std::vector<int> updates(values, 0);
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (int v : order)
+		{
+			Range r = Evaluate(v);
+			Range& old = range[v];
+			if (r.low > r.high || (old.low <= old.high && r.low >= old.low && r.high <= old.high))
+			{
+				continue;
+			}
+
+			if (old.low <= old.high)
+			{
+				bool widen = mIR.GetValue(v).op == IR::PHI && ++updates[v] > 2;
+				r.low = (r.low < old.low) ? (widen ? *std::prev(thresholds.upper_bound(r.low)) : r.low) : old.low;
+				r.high = (r.high > old.high) ? (widen ? *thresholds.lower_bound(r.high) : r.high) : old.high;
+			}
+			old = r;
+			changed = true;
+		}
+	}
+
+	// Widened ranges are narrowed again (each step keeps them covering all values)
+	for (int i = 0; i < 4; i++)
+	{
+		for (int v : order)
+		{
+			Range r = Evaluate(v);
+			range[v].low = std::max(range[v].low, r.low);
+			range[v].high = std::min(range[v].high, r.high);
+		}
+	}
+
+	// Checked accesses (in order of code)
+	std::vector<int> accesses;
+	for (int v : order)
+	{
+		IR::Opcode op = mIR.GetValue(v).op;
+		if (op == IR::LOAD || op == IR::STORE)
+		{
+			accesses.push_back(v);
+		}
+	}
+
+	std::vector<int> unchecked;
+	for (size_t i = 0; i < accesses.size(); i++)
+	{
+		const IR::Value& v = mIR.GetValue(accesses[i]);
+		int count = mIR.GetArray(accesses[i]).count;
+		Range r = RangeIn(range[v.operands[0]], v.operands[0], v.block);
+		bool inside = r.low > r.high || (r.low >= 0 && r.high < count);
+
+		// Access dominated by access which already checked the same index against the same size
+		for (size_t j = 0; j < accesses.size() && !inside; j++)
+		{
+			const IR::Value& w = mIR.GetValue(accesses[j]);
+			if (j == i || w.operands[0] != v.operands[0] || mIR.GetArray(accesses[j]).count != count)
+			{
+				continue;
+			}
+
+			if (w.block == v.block)
+			{
+				const std::vector<int>& code = mIR.GetBlock(v.block).code;
+				inside = std::find(code.begin(), code.end(), accesses[j]) < std::find(code.begin(), code.end(), accesses[i]);
+			}
+			else
+			{
+				inside = mIR.Dominates(w.block, v.block);
+			}
+		}
+
+		if (inside)
+		{
+			unchecked.push_back(accesses[i]);
+		}
+	}
+
+	for (int v : unchecked)
+	{
+		IR::Value& value = mIR.GetValue(v);
+		value.op = (value.op == IR::LOAD) ? IR::LOAD_UNCHECKED : IR::STORE_UNCHECKED;
+	}
+
+	return !unchecked.empty();
+}
+
+// Cost of computing values of branch arm unconditionally, -1 when any of them can't be computed when
+// the arm isn't taken (it has side effect or reads memory, whose access may be guarded by the branch)
+int Optimizer::ArmCost(int block)
+{
+	int cost = 0;
+	for (int c : mIR.GetBlock(block).code)
+	{
+		const IR::Value& v = mIR.GetValue(c);
+		if (mIR.HasSideEffect(c))
+		{
+			return -1;
+		}
+		else if (v.op == IR::DIV)
+		{
+			cost += DIVISION_COST;
+		}
+		else if (IR::IsBinary(v.op) || v.op == IR::NEG || v.op == IR::SELECT)
+		{
+			cost++;
+		}
+		else if (v.op != IR::CONST && v.op != IR::COPY)
+		{
+			return -1;
+		}
+	}
+	return cost;
+}
+
+// If-conversion - small branch whose arms (one of them may be empty) only compute values is replaced
+// by straight code computing both arms, values merged by phi nodes are chosen by selects
+bool Optimizer::IfConversion()
+{
+	bool changed = false;
+	for (int b : mIR.GetLayout())
+	{
+		IR::Block& blk = mIR.GetBlock(b);
+		if (blk.removed || blk.term != IR::BRANCH || blk.succs[0] == blk.succs[1])
+		{
+			continue;
+		}
+
+		// Arm is block with single predecessor continuing to join, missing arm is edge going to join directly
+		int arms[2] = { -1, -1 };
+		int join = -1;
+		for (int i = 0; i < 2; i++)
+		{
+			const IR::Block& s = mIR.GetBlock(blk.succs[i]);
+			if (blk.succs[i] != 0 && s.term == IR::GOTO && s.preds.size() == 1 && s.phis.empty() && s.succs[0] != b)
+			{
+				arms[i] = blk.succs[i];
+			}
+		}
+
+		if (arms[0] != -1 && arms[1] != -1 && mIR.GetBlock(arms[0]).succs[0] == mIR.GetBlock(arms[1]).succs[0])
+		{
+			join = mIR.GetBlock(arms[0]).succs[0];
+		}
+		else if (arms[0] != -1 && mIR.GetBlock(arms[0]).succs[0] == blk.succs[1])
+		{
+			join = blk.succs[1];
+			arms[1] = -1;
+		}
+		else if (arms[1] != -1 && mIR.GetBlock(arms[1]).succs[0] == blk.succs[0])
+		{
+			join = blk.succs[0];
+			arms[0] = -1;
+		}
+
+		if (join == -1 || join == 0 || join == b || mIR.GetBlock(join).preds.size() != 2)
+		{
+			continue;
+		}
+
+		IR::Block& j = mIR.GetBlock(join);
+		int cost = 0;
+		for (int i = 0; i < 2; i++)
+		{
+			int c = (arms[i] == -1) ? 0 : ArmCost(arms[i]);
+			cost = (c == -1 || cost == -1) ? -1 : cost + c;
+		}
+
+		// Only one arm is computed by branch, but it pays for the branch itself (and its misprediction)
+		if (cost == -1 || cost + 2 * (int)j.phis.size() > 2 * BRANCH_COST)
+		{
+			continue;
+		}
+
+		// Predecessor of join reached when condition holds (the other one when it doesn't)
+		int taken = (arms[0] != -1) ? arms[0] : b;
+		int first = (j.preds[0] == taken) ? 0 : 1;
+
+		// Variables hold the same value on both paths, unless join merges them
+		std::vector<int> exit = j.entry;
+		const std::vector<int>& exitTaken = mIR.GetBlock(taken).exit;
+		const std::vector<int>& exitOther = mIR.GetBlock(j.preds[1 - first]).exit;
+		for (size_t x = 0; x < exit.size(); x++)
+		{
+			if (exit[x] < 0 && exitTaken[x] == exitOther[x])
+			{
+				exit[x] = exitTaken[x];
+			}
+		}
+
+		for (int a : arms)
+		{
+			if (a == -1)
+			{
+				continue;
+			}
+
+			IR::Block& arm = mIR.GetBlock(a);
+			for (int c : arm.code)
+			{
+				mIR.GetValue(c).block = b;
+				blk.code.push_back(c);
+			}
+			arm.code.clear();
+			arm.succs.clear();
+			arm.preds.clear();
+			arm.removed = true;
+		}
+
+		std::vector<int> phis = j.phis;
+		for (int p : phis)
+		{
+			std::vector<int> operands = mIR.GetValue(p).operands;
+			int select = mIR.NewValue(IR::SELECT, b, 0, { blk.cond, operands[first], operands[1 - first] });
+			blk.code.push_back(select);
+			mIR.Replace(p, select);
+		}
+
+		blk.exit = exit;
+		blk.term = IR::GOTO;
+		blk.cond = -1;
+		blk.succs.assign(1, join);
+		j.preds.assign(1, b);
+		changed = true;
+	}
+
+	mIR.Canonicalize();
+
+	return changed;
+}
+
+// Constructor, pass in assembly file and path to output file
+Optimizer::Optimizer(const std::string& filename, const std::string& output)
+{
+	mOutputFilename = output;
+	mAssembly = Reader::ReadFile(filename);
+	mValid = false;
+	mInlineBudget = Inliner::DEFAULT_BUDGET;
+	mEvaluateLoops = true;
+	mRelocatable = false;
+}
+
+// Constructor from assembly lines, optimized assembly is kept in memory only
+Optimizer::Optimizer(const std::vector<std::string>& assembly)
+{
+	mAssembly = assembly;
+	mValid = false;
+	mInlineBudget = Inliner::DEFAULT_BUDGET;
+	mEvaluateLoops = true;
+	mRelocatable = false;
+}
+
+// Set maximum number of instructions of inlined procedure (0 disables inlining)
+void Optimizer::SetInlineBudget(size_t budget)
+{
+	mInlineBudget = budget;
+}
+
+// Enable or disable evaluation of loops which depend only on constants at compile time
+void Optimizer::SetLoopEvaluation(bool enable)
+{
+	mEvaluateLoops = enable;
+}
+
+// Set whether assembly is relocatable unit, whose procedures may be called by other units
+void Optimizer::SetRelocatable(bool relocatable)
+{
+	mRelocatable = relocatable;
+}
+
+// Optimize single unit (program or procedure), optimized assembly is appended
+void Optimizer::OptimizeUnit(const std::vector<std::string>& assembly)
+{
+	mIR = IR();
+	if (!mIR.Build(assembly))
+	{
+		// Assembly which can't be represented in IR is left as it is
+		mValid = false;
+		mOptimized.insert(mOptimized.end(), assembly.begin(), assembly.end());
+		return;
+	}
+
+	Cleanup();
+
+	// Loops computing only constants are replaced by their results before anything else is done to them
+	LoopOptimizer loops(mIR);
+	if (mEvaluateLoops && loops.EvaluateLoops())
+	{
+		Cleanup();
+	}
+
+	// Ranges of indices are simplest to find before loops are transformed
+	if (BoundsCheckElimination())
+	{
+		Cleanup();
+	}
+
+	// Loops are rotated first, so there is single block through which they're entered
+	if (loops.RotateLoops())
+	{
+		Cleanup();
+	}
+
+	if (loops.HoistInvariants())
+	{
+		Cleanup();
+	}
+
+	// Vector loops index arrays directly by counter, so they're created before inductions are reduced
+	if (loops.VectorizeLoops())
+	{
+		Cleanup();
+	}
+
+	if (loops.ReduceInductions())
+	{
+		Cleanup();
+	}
+
+	if (loops.UnrollLoops())
+	{
+		Cleanup();
+	}
+
+	// Multiplications and divisions by constants are known only after everything was folded
+	if (StrengthReduction())
+	{
+		Cleanup();
+	}
+
+	// Branches are converted last, loops are transformed (and evaluated) on original control flow (nested
+	// branches become small enough once inner ones are converted)
+	while (IfConversion())
+	{
+		Cleanup();
+	}
+
+	std::vector<std::string> lowered = mIR.Lower();
+	mOptimized.insert(mOptimized.end(), lowered.begin(), lowered.end());
+	mUnits.push_back(std::move(mIR));
+}
+
+// Perform optimization
+void Optimizer::Optimize()
+{
+	// Small procedures are inlined first, so their bodies are optimized along with callers
+	Inliner inliner(mAssembly, mInlineBudget, mRelocatable);
+	inliner.Inline();
+
+	mValid = true;
+	mOptimized.clear();
+	mUnits.clear();
+
+	// Interned strings aren't code, they're passed in front of program as they are
+	std::vector<std::string> program;
+	for (const std::string& line : inliner.GetProgram())
+	{
+		if (StringUtil::starts_with(line, "string "))
+		{
+			mOptimized.push_back(line);
+		}
+		else
+		{
+			program.push_back(line);
+		}
+	}
+
+	OptimizeUnit(program);
+	if (!inliner.GetProcedures().empty())
+	{
+		mOptimized.push_back("halt");
+		for (const Inliner::Procedure& p : inliner.GetProcedures())
+		{
+			OptimizeUnit(p.code);
+		}
+	}
+
+	if (!mOutputFilename.empty())
+	{
+		std::ofstream f(mOutputFilename, std::ios::out);
+		for (const std::string& s : mOptimized)
+		{
+			f << s << std::endl;
+		}
+		f.close();
+	}
+}
+
+// Save IR to given location
+void Optimizer::SaveIR(const std::string& filename)
+{
+	std::ofstream f(filename, std::ios::out);
+	for (IR& unit : mUnits)
+	{
+		unit.Dump(f);
+	}
+	f.close();
+}
\ No newline at end of file
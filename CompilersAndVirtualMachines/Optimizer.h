@@ -0,0 +1,142 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __OPTIMIZER_H__
+#define __OPTIMIZER_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iostream>
+#include "Reader.h"
+#include "IR.h"
+#include "LoopOptimizer.h"
+#include "Inliner.h"
+
+// Optimizer builds SSA form from assembly generated by compiler, runs optimization
+// passes on it and lowers it back into assembly
+class Optimizer
+{
+private:
+	std::vector<std::string> mAssembly;		// Assembly input
+	std::vector<std::string> mOptimized;	// Optimized assembly
+	std::string mOutputFilename;			// Output file
+
+	enum
+	{
+		DIVISION_COST = 2,					// Division (checked for zero) costs as much as this many simple operations
+											// (each instruction of virtual machine pays for its dispatch, so longer
+											// sequences replacing division don't pay off)
+		BRANCH_COST = 4						// Branch (with jump over the other arm) costs as much as this many simple
+											// operations on average, as branch on data is mispredicted every other time
+	};
+
+	IR mIR;									// Unit being optimized in SSA form
+	std::vector<IR> mUnits;					// Optimized units (program and procedures)
+	bool mValid;							// Is assembly representable in IR
+	size_t mInlineBudget;					// Maximum number of instructions of inlined procedure
+	bool mEvaluateLoops;					// Evaluate loops depending only on constants at compile time
+	bool mRelocatable;						// Procedures may be called by other units (unused ones are kept)
+	std::vector<bool> mNonNegative;			// Values which are never negative
+
+	// Copy propagation (removes copies and trivial phi nodes)
+	bool CopyPropagation();
+
+	// Simplify value (constant folding and algebraic identities), returns true if value changed
+	bool Simplify(int value);
+
+	// Global value numbering (over dominator tree, removes redundant computations)
+	bool ValueNumbering();
+
+	// Value numbering of single block and blocks it dominates
+	bool ValueNumberBlock(int block, std::map<std::vector<int>, int>& table, std::map<int, int>& constants);
+
+	// Dead code elimination
+	bool DeadCodeElimination();
+
+	// Control flow simplification (branches on constants, jumps to branches on the same condition, merging of blocks)
+	bool SimplifyControlFlow();
+
+	// Sparse conditional constant propagation - values are assumed constant until proven otherwise and
+	// only edges which can be taken are followed, so constants propagate through phi nodes of loops and
+	// branches which are never taken don't spoil them
+	bool ConstantPropagation();
+
+	// Run scalar passes and control flow simplification while anything changes
+	void Cleanup();
+
+	// Returns true when value is never negative (according to its operands)
+	bool IsNonNegative(int value);
+
+	// Find values which are never negative
+	void ComputeNonNegative();
+
+	// Multiplier and shift for signed division by constant (at least 2) through multiply-high
+	static void DivisionMagic(int divisor, int& multiplier, int& shift);
+
+	// Replace multiplication or division by constant with cheaper operations (new values are
+	// appended to code), returns true if value changed
+	bool ReduceValue(int value, std::vector<int>& code);
+
+	// Strength reduction (multiplication and division by constants)
+	bool StrengthReduction();
+
+	// Bounds check elimination - ranges of values are found over SSA form (refined by branches dominating
+	// their uses), accesses whose index is always within array or which are dominated by access checking
+	// the same index against the same size aren't checked
+	bool BoundsCheckElimination();
+
+	// Cost of computing values of branch arm unconditionally, -1 when any of them can't be computed when
+	// the arm isn't taken (it has side effect or reads memory, whose access may be guarded by the branch)
+	int ArmCost(int block);
+
+	// If-conversion - small branch whose arms (one of them may be empty) only compute values is replaced
+	// by straight code computing both arms, values merged by phi nodes are chosen by selects
+	bool IfConversion();
+
+	// Optimize single unit (program or procedure), optimized assembly is appended
+	void OptimizeUnit(const std::vector<std::string>& assembly);
+
+public:
+	// Constructor, pass in assembly file and path to output file
+	Optimizer(const std::string& filename, const std::string& output);
+
+	// Constructor from assembly lines, optimized assembly is kept in memory only
+	Optimizer(const std::vector<std::string>& assembly);
+
+	// Set maximum number of instructions of inlined procedure (0 disables inlining)
+	void SetInlineBudget(size_t budget);
+
+	// Enable or disable evaluation of loops which depend only on constants at compile time
+	void SetLoopEvaluation(bool enable);
+
+	// Set whether assembly is relocatable unit, whose procedures may be called by other units
+	void SetRelocatable(bool relocatable);
+
+	// Perform optimization
+	void Optimize();
+
+	// Was assembly (all of its units) representable in IR (otherwise it's left unoptimized)
+	bool IsOptimized() const
+	{
+		return mValid;
+	}
+
+	// Get optimized assembly (line by line)
+	const std::vector<std::string>& GetOptimized() const
+	{
+		return mOptimized;
+	}
+
+	// Save IR to given location
+	void SaveIR(const std::string& filename);
+};
+
+#endif
\ No newline at end of file
@@ -154,62 +154,82 @@ std::string Preprocessor::GetInclude(const std::string& line)
 // Copy includes into the file
 void Preprocessor::PreprocessIncludes(const std::vector<std::string>& includeDirs, std::vector<std::pair<LineInfo, std::string> >& data)
 {
-	// Is file in relative folder
-	std::string includeName;
-	std::string filename;
-
 	// Loop through all lines
-	for (auto it = data.begin(); it != data.end(); it++)
+	size_t i = 0;
+	while (i < data.size())
 	{
-		// Get line type
-		LineType lType = GetPreprocessorLineType((*it).second);
+		// Only #include lines with file name of at least 1 character are replaced
+		std::string includeName;
+		if (GetPreprocessorLineType(data[i].second) == LINE_INCLUDE)
+		{
+			includeName = GetInclude(data[i].second);
+		}
 
-		switch (lType)
+		if (includeName.length() == 0)
 		{
-			// If line is #include
-		case LINE_INCLUDE:
-			includeName = GetInclude((*it).second);
+			i++;
+			continue;
+		}
 
-			// If included file name has at least length of 1 character
-			if (includeName.length() > 0)
+		// First include directory which contains file is used
+		std::shared_ptr<const IncludeCache::Lines> lines;
+		std::string path;
+		for (const std::string& dir : includeDirs)
+		{
+			path = dir + includeName;
+			lines = LoadInclude(path);
+			if (lines)
 			{
-				// Check each include directory whether it contains file
-				for (auto itDirs = includeDirs.begin(); itDirs != includeDirs.end(); itDirs++)
-				{
-					// Create full path+filename
-					filename = (*itDirs) + includeName;
-
-					// If file exists
-					std::ifstream infile(filename);
-					if (infile.good())
-					{
-						// Read whole included file and insert its contents into this file
-						std::vector<std::string> lines = Reader::ReadFile(filename);
-						std::vector<std::pair<LineInfo, std::string> > infoLines;
-						size_t lineNo = 0;
-						for (const std::string& s : lines)
-						{
-							infoLines.push_back(std::pair<LineInfo, std::string>(LineInfo(filename, lineNo), s));
-							lineNo++;
-						}
-						RemoveComments(infoLines);
-						for (auto itTmp = infoLines.begin(); itTmp != infoLines.end(); itTmp++)
-						{
-							it = data.insert(it, *itTmp);
-							it++;
-						}
-						it = data.erase(it);
-					}
-				}
+				break;
 			}
-			break;
+		}
 
-		default:
-			break;
+		if (!lines)
+		{
+			i++;
+			continue;
 		}
+
+		// Each file is recorded as dependency only once, even when it's included multiple times
+		if (std::find(mDependencies.begin(), mDependencies.end(), path) == mDependencies.end())
+		{
+			mDependencies.push_back(path);
+		}
+
+		// Insert contents of included file instead of the #include line (they're not searched for includes again)
+		data.erase(data.begin() + i);
+		data.insert(data.begin() + i, lines->begin(), lines->end());
+		i += lines->size();
 	}
 }
 
+// Load included file (with comments removed), through include cache when there is one. Returns
+// nullptr when file doesn't exist
+std::shared_ptr<const IncludeCache::Lines> Preprocessor::LoadInclude(const std::string& filename)
+{
+	if (mIncludes != nullptr)
+	{
+		return mIncludes->Get(filename, [this](IncludeCache::Lines& lines) { RemoveComments(lines); });
+	}
+
+	std::ifstream infile(filename);
+	if (!infile.good())
+	{
+		return nullptr;
+	}
+
+	// Read whole included file
+	std::shared_ptr<IncludeCache::Lines> lines = std::make_shared<IncludeCache::Lines>();
+	size_t lineNo = 0;
+	for (const std::string& s : Reader::ReadFile(filename))
+	{
+		lines->push_back(std::pair<LineInfo, std::string>(LineInfo(filename, lineNo), s));
+		lineNo++;
+	}
+	RemoveComments(*lines);
+	return lines;
+}
+
 // Get define on given line
 std::string Preprocessor::GetDefine(const std::string& line)
 {
@@ -375,6 +395,7 @@ void Preprocessor::ProcessIfdefs(const std::vector<std::string>& defines, std::v
 			else
 			{
 				it = data.erase(it);
+				continue;
 			}
 			break;
 
@@ -394,8 +415,11 @@ void Preprocessor::ProcessIfdefs(const std::vector<std::string>& defines, std::v
 Preprocessor::Preprocessor(const std::vector<std::string>& input, 
 	const std::vector<std::string>& directories, 
 	const std::vector<std::string>& defines, 
-	const std::string& filename)
+	const std::string& filename,
+	IncludeCache* includes)
 {
+	mIncludes = includes;
+
 	// Copy data into preprocessed
 	size_t lineNo = 1;
 	for (std::string s : input)
@@ -414,14 +438,25 @@ Preprocessor::Preprocessor(const std::vector<std::string>& input,
 	ProcessIfdefs(defines, mPreprocessed);
 }
 
+// Get preprocessed lines (each prefixed with its line info), as they're saved into file
+std::vector<std::string> Preprocessor::GetOutput()
+{
+	std::vector<std::string> result;
+	for (const std::pair<LineInfo, std::string>& s : mPreprocessed)
+	{
+		LineInfo info = s.first;
+		result.push_back(info.GetLineInfo() + s.second);
+	}
+	return result;
+}
+
 // Save preprocessed file to given location
 void Preprocessor::Save(const std::string& filename)
 {
 	std::ofstream f(filename, std::ios::out);
-	for (const std::pair<LineInfo, std::string>& s : mPreprocessed)
+	for (const std::string& s : GetOutput())
 	{
-		LineInfo info = s.first;
-		f << info.GetLineInfo() << s.second << std::endl;
+		f << s << std::endl;
 	}
 	f.close();
 }
\ No newline at end of file
@@ -20,6 +20,7 @@
 
 #include "Reader.h"
 #include "LineInfo.h"
+#include "IncludeCache.h"
 
 // Preprocessor performs preprocessing (includes, defines, etc.)
 // after that it merges all lines into single line (so we can tokenize)
@@ -29,6 +30,12 @@ private:
 	// Temporary buffer
 	std::vector<std::pair<LineInfo, std::string> > mPreprocessed;
 
+	// Cache of included files (nullptr when files are always read)
+	IncludeCache* mIncludes;
+
+	// Files included by input (in order of first inclusion)
+	std::vector<std::string> mDependencies;
+
 	// Preprocessor line type
 	enum LineType
 	{
@@ -54,6 +61,10 @@ private:
 	// Copy includes into the file
 	void PreprocessIncludes(const std::vector<std::string>& includeDirs, std::vector<std::pair<LineInfo, std::string> >& data);
 
+	// Load included file (with comments removed), through include cache when there is one. Returns
+	// nullptr when file doesn't exist
+	std::shared_ptr<const IncludeCache::Lines> LoadInclude(const std::string& filename);
+
 	// Get define on given line
 	std::string GetDefine(const std::string& line);
 
@@ -64,11 +75,22 @@ public:
 	// Constructor; input file is passed in as lines (stored in vector); 
 	// need to specify all subdirectories where headers are searched
 	// all defines (which are not written in file)
-	// and filename for generating build info (line number & file)
+	// and filename for generating build info (line number & file),
+	// included files are taken from cache when one is passed in
 	Preprocessor(const std::vector<std::string>& input, 
 		const std::vector<std::string>& directories, 
 		const std::vector<std::string>& defines, 
-		const std::string& filename);
+		const std::string& filename,
+		IncludeCache* includes = nullptr);
+
+	// Get preprocessed lines (each prefixed with its line info), as they're saved into file
+	std::vector<std::string> GetOutput();
+
+	// Get files included by input (in order of first inclusion)
+	const std::vector<std::string>& GetDependencies() const
+	{
+		return mDependencies;
+	}
 
 	// Save preprocessed file to given location
 	void Save(const std::string& filename);
@@ -0,0 +1,135 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ScriptCompiler.h"
+#include "Preprocessor.h"
+#include "Lexer.h"
+#include "Compiler.h"
+#include "Optimizer.h"
+#include "Disassembler.h"
+#include "Linker.h"
+
+// Compile source lines, filename is used for messages and line info
+CompileResult ScriptCompiler::Compile(const std::vector<std::string>& source, const std::string& filename, const CompileOptions& options)
+{
+	return CompilePreprocessed(Preprocess(source, filename, options), filename, options);
+}
+
+// Preprocess source lines (resolve includes and defines), output is input for CompilePreprocessed. Included
+// files are stored into dependencies when they're requested
+std::vector<std::string> ScriptCompiler::Preprocess(const std::vector<std::string>& source, const std::string& filename, const CompileOptions& options,
+	std::vector<std::string>* dependencies)
+{
+	Preprocessor p(source, options.directories, options.defines, filename, options.includes);
+	if (dependencies != nullptr)
+	{
+		*dependencies = p.GetDependencies();
+	}
+	return p.GetOutput();
+}
+
+// Compile already preprocessed lines
+CompileResult ScriptCompiler::CompilePreprocessed(const std::vector<std::string>& preprocessed, const std::string& filename, const CompileOptions& options)
+{
+	CompileResult result;
+
+	// Invalid tokens are skipped by lexer, so compiler still reports errors in the rest of source
+	Lexer l(preprocessed);
+	result.diagnostics = l.GetDiagnostics();
+
+	Compiler c(l);
+	c.AllowExternals(options.relocatable);
+	c.Compile();
+	result.diagnostics.insert(result.diagnostics.end(), c.GetDiagnostics().begin(), c.GetDiagnostics().end());
+
+	result.success = !Diagnostic::HasErrors(result.diagnostics);
+	if (!result.success)
+	{
+		return result;
+	}
+
+	if (options.optimize)
+	{
+		Optimizer o(c.GetAssembly());
+		o.SetInlineBudget(options.inlineBudget);
+		o.SetLoopEvaluation(options.evaluateLoops);
+		o.SetRelocatable(options.relocatable);
+		o.Optimize();
+		if (!o.IsOptimized())
+		{
+			result.diagnostics.push_back(Diagnostic(Diagnostic::SEVERITY_WARNING, "Assembly can't be represented in IR, leaving it unoptimized", filename, 0));
+		}
+		result.assembly = o.GetOptimized();
+	}
+	else
+	{
+		result.assembly = c.GetAssembly();
+	}
+
+	if (options.relocatable)
+	{
+		// Procedures of object are described by compiler, which knows what they access
+		Disassembler d(result.assembly);
+		d.SetRelocatable(true);
+		d.Disassemble();
+		d.GetObject(result.object);
+		c.Export(result.object);
+		result.object.unit = filename;
+		if (options.linkTimeOptimization)
+		{
+			result.object.assembly = c.GetAssembly();
+		}
+	}
+	else if (options.assemble)
+	{
+		Disassembler d(result.assembly);
+		d.Disassemble();
+		result.binary = d.GetCode();
+	}
+
+	return result;
+}
+
+// Compile script file
+CompileResult ScriptCompiler::CompileFile(const std::string& filename, const CompileOptions& options)
+{
+	std::ifstream f(filename);
+	if (!f.good())
+	{
+		CompileResult result;
+		result.success = false;
+		result.diagnostics.push_back(Diagnostic(Diagnostic::SEVERITY_ERROR, "Can't open file " + filename, "", 0));
+		return result;
+	}
+	f.close();
+
+	return Compile(Reader::ReadFile(filename), filename, options);
+}
+
+// Link relocatable objects into binary, options decide whether whole program is optimized (assembly of
+// result is filled only then)
+CompileResult ScriptCompiler::Link(const std::vector<ObjectFile>& objects, const CompileOptions& options)
+{
+	Linker linker;
+	for (const ObjectFile& o : objects)
+	{
+		linker.Add(o);
+	}
+	if (options.linkTimeOptimization)
+	{
+		linker.EnableOptimization(options.inlineBudget, options.evaluateLoops);
+	}
+
+	CompileResult result;
+	result.success = linker.Link();
+	result.diagnostics = linker.GetDiagnostics();
+	result.assembly = linker.GetAssembly();
+	result.binary = linker.GetBinary();
+	return result;
+}
\ No newline at end of file
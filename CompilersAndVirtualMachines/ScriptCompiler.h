@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SCRIPT_COMPILER_H__
+#define __SCRIPT_COMPILER_H__
+
+#include <string>
+#include <vector>
+#include "Diagnostic.h"
+#include "IncludeCache.h"
+#include "Inliner.h"
+#include "ObjectFile.h"
+
+// Options of single compilation
+struct CompileOptions
+{
+	std::vector<std::string> directories;	// Directories where includes are searched
+	std::vector<std::string> defines;		// Defines (which are not written in source)
+	bool optimize;							// Run optimizer on generated assembly
+	bool assemble;							// Assemble result into machine code
+	size_t inlineBudget;					// Maximum number of instructions of inlined procedure (0 disables inlining)
+	bool evaluateLoops;						// Evaluate loops depending only on constants at compile time
+	bool relocatable;						// Compile into relocatable object instead of binary (procedures may be
+											// defined by other units, which are linked with it)
+	bool linkTimeOptimization;				// Object carries its assembly and linker optimizes whole program (when
+											// it links objects, they're all optimized together)
+	IncludeCache* includes;					// Cache of included files (nullptr when they're always read)
+
+	CompileOptions()
+	{
+		directories.push_back("./");
+		optimize = true;
+		assemble = false;
+		inlineBudget = Inliner::DEFAULT_BUDGET;
+		evaluateLoops = true;
+		relocatable = false;
+		linkTimeOptimization = false;
+		includes = nullptr;
+	}
+};
+
+// Result of single compilation
+struct CompileResult
+{
+	bool success;							// No error was reported
+	std::vector<Diagnostic> diagnostics;	// Messages of all stages
+	std::vector<std::string> assembly;		// Generated assembly (empty when compilation failed)
+	std::vector<int> binary;				// Machine code (empty unless assembling was requested)
+	ObjectFile object;						// Relocatable object (empty unless it was requested)
+};
+
+// Library mode compilation of scripts into assembly. Reentrant - it never terminates the process, doesn't
+// wait for input and doesn't write any intermediate files, all messages are returned in result
+class ScriptCompiler
+{
+public:
+	// Compile source lines, filename is used for messages and line info
+	static CompileResult Compile(const std::vector<std::string>& source, const std::string& filename, const CompileOptions& options);
+
+	// Preprocess source lines (resolve includes and defines), output is input for CompilePreprocessed. Included
+	// files are stored into dependencies when they're requested
+	static std::vector<std::string> Preprocess(const std::vector<std::string>& source, const std::string& filename, const CompileOptions& options,
+		std::vector<std::string>* dependencies = nullptr);
+
+	// Compile already preprocessed lines
+	static CompileResult CompilePreprocessed(const std::vector<std::string>& preprocessed, const std::string& filename, const CompileOptions& options);
+
+	// Compile script file
+	static CompileResult CompileFile(const std::string& filename, const CompileOptions& options);
+
+	// Link relocatable objects into binary, options decide whether whole program is optimized (assembly of
+	// result is filled only then)
+	static CompileResult Link(const std::vector<ObjectFile>& objects, const CompileOptions& options = CompileOptions());
+
+	// Get version of compiler - it has to change whenever generated code changes, as it invalidates build cache
+	static const char* GetVersion()
+	{
+		return "1.14";
+	}
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,1410 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#include "VirtualMachine.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <atomic>
+
+// Vector instructions use SSE2 (and AVX2 for 8 lanes) when compiler targets them
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VM_AVX2
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VM_SSE2
+#endif
+
+#if defined(__SSE4_1__) || defined(__AVX__)
+#include <smmintrin.h>
+#define VM_SSE4_1
+#endif
+
+// Constructor (specify how much memory binaries without bounded stack depth get - defaults to 64K)
+VirtualMachine::VirtualMachine(size_t memorySize) : mNull(nullptr)
+{
+	// Memory is allocated once size of binary and its stack is known
+	memory = nullptr;
+	mMemorySize = 0;
+	mUnboundedSize = memorySize;
+	mCodeSize = 0;
+	mInstructionLimit = 0;
+	mExecuted = 0;
+	mThreads = std::max(1u, std::thread::hardware_concurrency());
+	mBinary = 0;
+	mProgramEnd = 0;
+	mPoolLoop = 0;
+	mPoolActive = 0;
+	mPoolBusy = 0;
+	mPoolStop = false;
+	mTrace = &std::cout;
+	mOutput = &std::cout;
+}
+
+// D-tor
+VirtualMachine::~VirtualMachine()
+{
+	StopPool();
+	free(memory);
+}
+
+// Allocate memory of given size (memory which has the same size already is kept as it is)
+void VirtualMachine::Allocate(size_t size)
+{
+	if (memory != nullptr && size == mMemorySize)
+	{
+		return;
+	}
+
+	free(memory);
+	memory = (unsigned char*)calloc(std::max(size, sizeof(int)), 1);
+	mMemorySize = size;
+}
+
+// Set stream receiving trace of executed instructions (nullptr disables trace)
+void VirtualMachine::SetTrace(std::ostream* trace)
+{
+	mTrace = (trace != nullptr) ? trace : &mNull;
+}
+
+// Set stream receiving errors and final state of stack and registers
+void VirtualMachine::SetOutput(std::ostream& output)
+{
+	mOutput = &output;
+}
+
+// Set maximum number of executed instructions (0 for no limit)
+void VirtualMachine::SetInstructionLimit(size_t limit)
+{
+	mInstructionLimit = limit;
+}
+
+// Set number of threads running parallel loops (0 for number of hardware threads)
+void VirtualMachine::SetThreads(size_t threads)
+{
+	mThreads = (threads != 0) ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Get text of string value (handle of interned string) of the last executed binary, returns false
+// when there is no such string
+bool VirtualMachine::GetString(int handle, std::string& text) const
+{
+	return Disassembler::GetString((const int*)memory, mCodeSize, handle, text);
+}
+
+// Print out what is in registers (the ones we work with, not IP and SP)
+void VirtualMachine::DumpRegisters()
+{
+	(*mOutput) << "Registers:" << std::endl;
+	(*mOutput) << "\tr0 = " << registers[0] << std::endl;
+	(*mOutput) << "\tr1 = " << registers[1] << std::endl;
+	(*mOutput) << "\tip = " << registers[2] << std::endl;
+	(*mOutput) << "\tsp = " << registers[3] << std::endl;
+	(*mOutput) << std::endl;
+}
+
+// Print out stack from beginning address
+void VirtualMachine::DumpStack(size_t size)
+{
+	(*mOutput) << "Stack:" << std::endl;
+
+	int* ptr = (int*)memory;
+	ptr += size / sizeof(int);
+	int position = size;
+	int offset = 0;
+	while (position < registers[SP])
+	{
+		(*mOutput) << "\tsp + " << offset << " = " << *ptr << std::endl;
+		ptr++;
+		position += 4;
+		offset += 4;
+	}
+	(*mOutput) << std::endl;
+}
+
+// Copy lanes between vector register and memory
+void VirtualMachine::VectorMove(int* destination, const int* source, int lanes)
+{
+	int i = 0;
+#if defined(VM_AVX2)
+	for (; i + 8 <= lanes; i += 8)
+	{
+		_mm256_storeu_si256((__m256i*)(destination + i), _mm256_loadu_si256((const __m256i*)(source + i)));
+	}
+#endif
+#if defined(VM_SSE2)
+	for (; i + 4 <= lanes; i += 4)
+	{
+		_mm_storeu_si128((__m128i*)(destination + i), _mm_loadu_si128((const __m128i*)(source + i)));
+	}
+#endif
+	for (; i < lanes; i++)
+	{
+		destination[i] = source[i];
+	}
+}
+
+// Fill lanes of vector with value plus lane index multiplied by step
+void VirtualMachine::VectorFill(int* destination, int value, int step, int lanes)
+{
+	int i = 0;
+#if defined(VM_SSE2)
+	__m128i base = _mm_add_epi32(_mm_set1_epi32(value), _mm_setr_epi32(0, step, 2 * step, 3 * step));
+	for (; i + 4 <= lanes; i += 4)
+	{
+		_mm_storeu_si128((__m128i*)(destination + i), base);
+		base = _mm_add_epi32(base, _mm_set1_epi32(4 * step));
+	}
+#endif
+	for (; i < lanes; i++)
+	{
+		destination[i] = (int)((unsigned int)value + (unsigned int)(i * step));
+	}
+}
+
+// Lane-wise operation of vector instruction (opcode of its 4 lane form), result goes into a
+void VirtualMachine::VectorOperation(int opcode, int* a, const int* b, int lanes)
+{
+	int i = 0;
+
+	// Comparison masks (all bits set where comparison holds) are turned into ones
+#if defined(VM_AVX2)
+	__m256i one8 = _mm256_set1_epi32(1);
+	for (; i + 8 <= lanes; i += 8)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+		__m256i r;
+		switch (opcode)
+		{
+		case Disassembler::VADD_I32X4: r = _mm256_add_epi32(x, y); break;
+		case Disassembler::VSUB_I32X4: r = _mm256_sub_epi32(x, y); break;
+		case Disassembler::VMUL_I32X4: r = _mm256_mullo_epi32(x, y); break;
+		case Disassembler::VCMPLEQ_I32X4: r = _mm256_andnot_si256(_mm256_cmpgt_epi32(x, y), one8); break;
+		case Disassembler::VCMPGEQ_I32X4: r = _mm256_andnot_si256(_mm256_cmpgt_epi32(y, x), one8); break;
+		case Disassembler::VCMPLESS_I32X4: r = _mm256_and_si256(_mm256_cmpgt_epi32(y, x), one8); break;
+		case Disassembler::VCMPGREATER_I32X4: r = _mm256_and_si256(_mm256_cmpgt_epi32(x, y), one8); break;
+		case Disassembler::VCMPEQ_I32X4: r = _mm256_and_si256(_mm256_cmpeq_epi32(x, y), one8); break;
+		default: r = _mm256_andnot_si256(_mm256_cmpeq_epi32(x, y), one8); break;
+		}
+		_mm256_storeu_si256((__m256i*)(a + i), r);
+	}
+#endif
+#if defined(VM_SSE2)
+	__m128i one4 = _mm_set1_epi32(1);
+	for (; i + 4 <= lanes; i += 4)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+		__m128i r;
+		switch (opcode)
+		{
+		case Disassembler::VADD_I32X4: r = _mm_add_epi32(x, y); break;
+		case Disassembler::VSUB_I32X4: r = _mm_sub_epi32(x, y); break;
+		case Disassembler::VMUL_I32X4:
+#if defined(VM_SSE4_1)
+			r = _mm_mullo_epi32(x, y);
+#else
+			{
+				// Products of even and odd lanes are computed separately, their low halves are interleaved
+				__m128i even = _mm_mul_epu32(x, y);
+				__m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32));
+				r = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+			}
+#endif
+			break;
+		case Disassembler::VCMPLEQ_I32X4: r = _mm_andnot_si128(_mm_cmpgt_epi32(x, y), one4); break;
+		case Disassembler::VCMPGEQ_I32X4: r = _mm_andnot_si128(_mm_cmplt_epi32(x, y), one4); break;
+		case Disassembler::VCMPLESS_I32X4: r = _mm_and_si128(_mm_cmplt_epi32(x, y), one4); break;
+		case Disassembler::VCMPGREATER_I32X4: r = _mm_and_si128(_mm_cmpgt_epi32(x, y), one4); break;
+		case Disassembler::VCMPEQ_I32X4: r = _mm_and_si128(_mm_cmpeq_epi32(x, y), one4); break;
+		default: r = _mm_andnot_si128(_mm_cmpeq_epi32(x, y), one4); break;
+		}
+		_mm_storeu_si128((__m128i*)(a + i), r);
+	}
+#endif
+	for (; i < lanes; i++)
+	{
+		unsigned int x = (unsigned int)a[i];
+		unsigned int y = (unsigned int)b[i];
+		switch (opcode)
+		{
+		case Disassembler::VADD_I32X4: a[i] = (int)(x + y); break;
+		case Disassembler::VSUB_I32X4: a[i] = (int)(x - y); break;
+		case Disassembler::VMUL_I32X4: a[i] = (int)(x * y); break;
+		case Disassembler::VCMPLEQ_I32X4: a[i] = (a[i] <= b[i]) ? 1 : 0; break;
+		case Disassembler::VCMPGEQ_I32X4: a[i] = (a[i] >= b[i]) ? 1 : 0; break;
+		case Disassembler::VCMPLESS_I32X4: a[i] = (a[i] < b[i]) ? 1 : 0; break;
+		case Disassembler::VCMPGREATER_I32X4: a[i] = (a[i] > b[i]) ? 1 : 0; break;
+		case Disassembler::VCMPEQ_I32X4: a[i] = (a[i] == b[i]) ? 1 : 0; break;
+		default: a[i] = (a[i] != b[i]) ? 1 : 0; break;
+		}
+	}
+}
+
+// Sum of lanes of vector
+int VirtualMachine::VectorSum(const int* a, int lanes)
+{
+	int i = 0;
+	unsigned int sum = 0;
+#if defined(VM_SSE2)
+	// Groups of 4 lanes are added together first, then their lanes are added by shuffles
+	__m128i s = _mm_setzero_si128();
+	for (; i + 4 <= lanes; i += 4)
+	{
+		s = _mm_add_epi32(s, _mm_loadu_si128((const __m128i*)(a + i)));
+	}
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+	sum = (unsigned int)_mm_cvtsi128_si32(s);
+#endif
+	for (; i < lanes; i++)
+	{
+		sum += (unsigned int)a[i];
+	}
+	return (int)sum;
+}
+
+// Execute the binary file, returns false when program was terminated because of an error
+bool VirtualMachine::Execute(const std::string& filename)
+{
+	std::ifstream ifs(filename, std::ios::binary | std::ios::in);
+	std::filebuf* pbuf = ifs.rdbuf();
+	size_t size = (size_t)pbuf->pubseekoff(0, ifs.end, ifs.in);
+	pbuf->pubseekpos(0, ifs.in);
+
+	std::vector<int> binary(size / sizeof(int));
+	pbuf->sgetn((char*)binary.data(), binary.size() * sizeof(int));
+
+	return Execute(binary);
+}
+
+// Execute the binary, returns false when program was terminated because of an error
+bool VirtualMachine::Execute(const std::vector<int>& binary)
+{
+	return Execute(binary.data(), binary.size());
+}
+
+// Execute the binary of given number of words (e.g. embedded in host application), returns false when
+// program was terminated because of an error
+bool VirtualMachine::Execute(const int* binary, size_t words)
+{
+	// Binary with bounded stack depth gets memory for code and stack only (header isn't trusted, stack is
+	// checked anyway and never gets more memory than binaries without bound)
+	size_t size = words * sizeof(int);
+	size_t required = mUnboundedSize;
+	if (words >= Disassembler::HEADER_SIZE && binary[0] == Disassembler::HEADER)
+	{
+		if ((size_t)binary[2] != words)
+		{
+			(*mOutput) << "Error: Binary size doesn't match its header\n" << std::endl;
+			return false;
+		}
+
+		if (binary[3] >= 0)
+		{
+			required = std::min(required, size + (size_t)binary[3]);
+		}
+	}
+
+	if (size > required)
+	{
+		(*mOutput) << "Error: Binary doesn't fit into memory\n" << std::endl;
+		return false;
+	}
+	Allocate(required);
+
+	// Load binary into beginning of memory
+	int* code = (int*)memory;
+	std::copy(binary, binary + words, code);
+
+	size_t instructionsCount = size / sizeof(int);
+	mCodeSize = instructionsCount;
+	registers[R0] = 0;			// Results don't depend on previous execution
+	registers[R1] = 0;
+	registers[IP] = 0;			// Set IP to 0
+	registers[SP] = size;		// Set SP to the end of code
+	registers[GP] = size;		// Program frame begins there too
+	memset(vectors, 0, sizeof(vectors));
+	mCallStack.clear();
+	mExecuted = 0;
+	mBinary++;
+	mProgramEnd = (int)size;
+
+	bool result = Run();
+
+	DumpStack(size);
+	DumpRegisters();
+
+	return result;
+}
+
+// Run instructions from IP until it reaches end of code, returns false when program was terminated
+// because of an error
+bool VirtualMachine::Run()
+{
+	int* code = (int*)memory;
+	size_t instructionsCount = mCodeSize;
+	bool result = true;
+
+	// While IP doesn't reach end of code, process instruction by instruction
+	while ((size_t)(registers[IP]) < instructionsCount)
+	{
+		// Runaway program is stopped once it exceeds the limit
+		if (mInstructionLimit != 0 && mExecuted++ >= mInstructionLimit)
+		{
+			(*mOutput) << "Error: Instruction limit exceeded, terminating application\n" << std::endl;
+			result = false;
+			break;
+		}
+
+		switch (code[registers[IP]])
+		{
+		case Disassembler::ADD_I32:
+			(*mTrace) << registers[IP] << " add.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[code[registers[IP] + 1]] += registers[code[registers[IP] + 2]];
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::SUB_I32:
+			(*mTrace) << registers[IP] << " sub.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[code[registers[IP] + 1]] -= registers[code[registers[IP] + 2]];
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::MUL_I32:
+			(*mTrace) << registers[IP] << " mul.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[code[registers[IP] + 1]] *= registers[code[registers[IP] + 2]];
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::DIV_I32:
+			(*mTrace) << registers[IP] << " div.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			// Avoid division by 0 (print error and finish the program)
+			if (registers[code[registers[IP] + 2]] == 0)
+			{
+				(*mOutput) << "Error: Division by Zero, terminating application\n" << std::endl;
+				registers[IP] = (int)instructionsCount;
+				result = false;
+				break;
+			}
+			registers[code[registers[IP] + 1]] /= registers[code[registers[IP] + 2]];
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::MOV_REG_REG:
+			(*mTrace) << registers[IP] << " mov.reg.reg " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[code[registers[IP] + 1]] = registers[code[registers[IP] + 2]];
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::PUSH_I32:
+			(*mTrace) << registers[IP] << " push.i32 " << registerName[code[registers[IP] + 1]] << std::endl;
+			// Stack can't grow past the end of memory (print error and finish the program)
+			if ((size_t)registers[SP] + sizeof(int) > mMemorySize)
+			{
+				(*mOutput) << "Error: Stack overflow, terminating application\n" << std::endl;
+				registers[IP] = (int)instructionsCount;
+				result = false;
+				break;
+			}
+			((int*)(memory + registers[SP]))[0] = registers[code[registers[IP] + 1]];
+			registers[SP] += 4;
+			registers[IP] += 2;
+			break;
+
+		case Disassembler::POP_I32:
+			(*mTrace) << registers[IP] << " pop.i32 " << registerName[code[registers[IP] + 1]] << std::endl;
+			registers[SP] -= 4;
+			registers[code[registers[IP] + 1]] = ((int*)(memory + registers[SP]))[0];
+			registers[IP] += 2;
+			break;
+
+		case Disassembler::NEG_I32:
+			(*mTrace) << registers[IP] << " neg.i32 " << registerName[code[registers[IP] + 1]] << std::endl;
+			registers[code[registers[IP] + 1]] = -registers[code[registers[IP] + 1]];
+			registers[IP] += 2;
+			break;
+
+		case Disassembler::MOV_REG_I32:
+			(*mTrace) << registers[IP] << " mov.reg.i32 " << registerName[code[registers[IP] + 1]] << " " << code[registers[IP] + 2] << std::endl;
+			registers[code[registers[IP] + 1]] = code[registers[IP] + 2];
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::MOV_MEM_REG_I32:
+			(*mTrace) << registers[IP] << " mov.mem.reg.i32 [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << registerName[code[registers[IP] + 3]] << std::endl;
+			((int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]))[0] = registers[code[registers[IP] + 3]];
+			registers[IP] += 4;
+			break;
+
+		case Disassembler::MOV_REG_MEM_I32:
+		{
+			(*mTrace) << registers[IP] << " mov.reg.mem.i32 " << registerName[code[registers[IP] + 1]] << " [" << registerName[code[registers[IP] + 2]] << " + " << code[registers[IP] + 3] << "]" << std::endl;
+			int reg1 = registers[code[registers[IP] + 2]];
+			int offset = code[registers[IP] + 3];
+			registers[code[registers[IP] + 1]] = ((int*)(memory + registers[code[registers[IP] + 2]] + code[registers[IP] + 3]))[0];
+			registers[IP] += 4;
+		}
+			break;
+
+		case Disassembler::CMPLEQ_I32:
+			(*mTrace) << registers[IP] << " cmpleq.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[R0] = (registers[code[registers[IP] + 1]] <= registers[code[registers[IP] + 2]]) ? 1 : 0;
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::CMPGEQ_I32:
+			(*mTrace) << registers[IP] << " cmpgeq.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[R0] = (registers[code[registers[IP] + 1]] >= registers[code[registers[IP] + 2]]) ? 1 : 0;
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::CMPLESS_I32:
+			(*mTrace) << registers[IP] << " cmpless.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[R0] = (registers[code[registers[IP] + 1]] < registers[code[registers[IP] + 2]]) ? 1 : 0;
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::CMPGREATER_I32:
+			(*mTrace) << registers[IP] << " cmpgreater.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[R0] = (registers[code[registers[IP] + 1]] > registers[code[registers[IP] + 2]]) ? 1 : 0;
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::CMPEQ_I32:
+			(*mTrace) << registers[IP] << " cmpeq.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[R0] = (registers[code[registers[IP] + 1]] == registers[code[registers[IP] + 2]]) ? 1 : 0;
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::CMPNEQ_I32:
+			(*mTrace) << registers[IP] << " cmpneq.i32" << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[R0] = (registers[code[registers[IP] + 1]] != registers[code[registers[IP] + 2]]) ? 1 : 0;
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::SHL_I32:
+			(*mTrace) << registers[IP] << " shl.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			// Shift amount is taken modulo 32 (as on x86)
+			registers[code[registers[IP] + 1]] = (int)((unsigned int)registers[code[registers[IP] + 1]] << (registers[code[registers[IP] + 2]] & 31));
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::SHR_I32:
+			(*mTrace) << registers[IP] << " shr.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[code[registers[IP] + 1]] = (int)((unsigned int)registers[code[registers[IP] + 1]] >> (registers[code[registers[IP] + 2]] & 31));
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::SAR_I32:
+			(*mTrace) << registers[IP] << " sar.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[code[registers[IP] + 1]] >>= (registers[code[registers[IP] + 2]] & 31);
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::AND_I32:
+			(*mTrace) << registers[IP] << " and.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[code[registers[IP] + 1]] &= registers[code[registers[IP] + 2]];
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::OR_I32:
+			(*mTrace) << registers[IP] << " or.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[code[registers[IP] + 1]] |= registers[code[registers[IP] + 2]];
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::XOR_I32:
+			(*mTrace) << registers[IP] << " xor.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[code[registers[IP] + 1]] ^= registers[code[registers[IP] + 2]];
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::MULHI_I32:
+			(*mTrace) << registers[IP] << " mulhi.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			registers[code[registers[IP] + 1]] = (int)(((long long)registers[code[registers[IP] + 1]] * (long long)registers[code[registers[IP] + 2]]) >> 32);
+			registers[IP] += 3;
+			break;
+
+		case Disassembler::JMP:
+			(*mTrace) << registers[IP] << " jmp " << (code[registers[IP] + 1] / 4) << std::endl;
+			registers[IP] = (code[registers[IP] + 1] / 4);
+			break;
+
+		case Disassembler::JZ:
+			(*mTrace) << registers[IP] << " jz " << (code[registers[IP] + 1] / 4) << std::endl;
+			if (registers[R0] == 0)
+			{
+				registers[IP] = (code[registers[IP] + 1] / 4);
+			}
+			else
+			{
+				registers[IP] += 2;
+			}
+			break;
+
+		case Disassembler::JNZ:
+			(*mTrace) << registers[IP] << " jnz " << (code[registers[IP] + 1] / 4) << std::endl;
+			if (registers[R0] != 0)
+			{
+				registers[IP] = (code[registers[IP] + 1] / 4);
+			}
+			else
+			{
+				registers[IP] += 2;
+			}
+			break;
+
+		case Disassembler::JLT_REG_REG:
+			(*mTrace) << registers[IP] << " jlt.reg.reg " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << " " << (code[registers[IP] + 3] / 4) << std::endl;
+			if (registers[code[registers[IP] + 1]] < registers[code[registers[IP] + 2]])
+			{
+				registers[IP] = (code[registers[IP] + 3] / 4);
+			}
+			else
+			{
+				registers[IP] += 4;
+			}
+			break;
+
+		case Disassembler::JLE_REG_REG:
+			(*mTrace) << registers[IP] << " jle.reg.reg " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << " " << (code[registers[IP] + 3] / 4) << std::endl;
+			if (registers[code[registers[IP] + 1]] <= registers[code[registers[IP] + 2]])
+			{
+				registers[IP] = (code[registers[IP] + 3] / 4);
+			}
+			else
+			{
+				registers[IP] += 4;
+			}
+			break;
+
+		case Disassembler::JGT_REG_REG:
+			(*mTrace) << registers[IP] << " jgt.reg.reg " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << " " << (code[registers[IP] + 3] / 4) << std::endl;
+			if (registers[code[registers[IP] + 1]] > registers[code[registers[IP] + 2]])
+			{
+				registers[IP] = (code[registers[IP] + 3] / 4);
+			}
+			else
+			{
+				registers[IP] += 4;
+			}
+			break;
+
+		case Disassembler::JGE_REG_REG:
+			(*mTrace) << registers[IP] << " jge.reg.reg " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << " " << (code[registers[IP] + 3] / 4) << std::endl;
+			if (registers[code[registers[IP] + 1]] >= registers[code[registers[IP] + 2]])
+			{
+				registers[IP] = (code[registers[IP] + 3] / 4);
+			}
+			else
+			{
+				registers[IP] += 4;
+			}
+			break;
+
+		case Disassembler::JEQ_REG_REG:
+			(*mTrace) << registers[IP] << " jeq.reg.reg " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << " " << (code[registers[IP] + 3] / 4) << std::endl;
+			if (registers[code[registers[IP] + 1]] == registers[code[registers[IP] + 2]])
+			{
+				registers[IP] = (code[registers[IP] + 3] / 4);
+			}
+			else
+			{
+				registers[IP] += 4;
+			}
+			break;
+
+		case Disassembler::JNE_REG_REG:
+			(*mTrace) << registers[IP] << " jne.reg.reg " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << " " << (code[registers[IP] + 3] / 4) << std::endl;
+			if (registers[code[registers[IP] + 1]] != registers[code[registers[IP] + 2]])
+			{
+				registers[IP] = (code[registers[IP] + 3] / 4);
+			}
+			else
+			{
+				registers[IP] += 4;
+			}
+			break;
+
+		case Disassembler::JLT_REG_I32:
+			(*mTrace) << registers[IP] << " jlt.reg.i32 " << registerName[code[registers[IP] + 1]] << " " << code[registers[IP] + 2] << " " << (code[registers[IP] + 3] / 4) << std::endl;
+			if (registers[code[registers[IP] + 1]] < code[registers[IP] + 2])
+			{
+				registers[IP] = (code[registers[IP] + 3] / 4);
+			}
+			else
+			{
+				registers[IP] += 4;
+			}
+			break;
+
+		case Disassembler::JLE_REG_I32:
+			(*mTrace) << registers[IP] << " jle.reg.i32 " << registerName[code[registers[IP] + 1]] << " " << code[registers[IP] + 2] << " " << (code[registers[IP] + 3] / 4) << std::endl;
+			if (registers[code[registers[IP] + 1]] <= code[registers[IP] + 2])
+			{
+				registers[IP] = (code[registers[IP] + 3] / 4);
+			}
+			else
+			{
+				registers[IP] += 4;
+			}
+			break;
+
+		case Disassembler::JGT_REG_I32:
+			(*mTrace) << registers[IP] << " jgt.reg.i32 " << registerName[code[registers[IP] + 1]] << " " << code[registers[IP] + 2] << " " << (code[registers[IP] + 3] / 4) << std::endl;
+			if (registers[code[registers[IP] + 1]] > code[registers[IP] + 2])
+			{
+				registers[IP] = (code[registers[IP] + 3] / 4);
+			}
+			else
+			{
+				registers[IP] += 4;
+			}
+			break;
+
+		case Disassembler::JGE_REG_I32:
+			(*mTrace) << registers[IP] << " jge.reg.i32 " << registerName[code[registers[IP] + 1]] << " " << code[registers[IP] + 2] << " " << (code[registers[IP] + 3] / 4) << std::endl;
+			if (registers[code[registers[IP] + 1]] >= code[registers[IP] + 2])
+			{
+				registers[IP] = (code[registers[IP] + 3] / 4);
+			}
+			else
+			{
+				registers[IP] += 4;
+			}
+			break;
+
+		case Disassembler::JEQ_REG_I32:
+			(*mTrace) << registers[IP] << " jeq.reg.i32 " << registerName[code[registers[IP] + 1]] << " " << code[registers[IP] + 2] << " " << (code[registers[IP] + 3] / 4) << std::endl;
+			if (registers[code[registers[IP] + 1]] == code[registers[IP] + 2])
+			{
+				registers[IP] = (code[registers[IP] + 3] / 4);
+			}
+			else
+			{
+				registers[IP] += 4;
+			}
+			break;
+
+		case Disassembler::JNE_REG_I32:
+			(*mTrace) << registers[IP] << " jne.reg.i32 " << registerName[code[registers[IP] + 1]] << " " << code[registers[IP] + 2] << " " << (code[registers[IP] + 3] / 4) << std::endl;
+			if (registers[code[registers[IP] + 1]] != code[registers[IP] + 2])
+			{
+				registers[IP] = (code[registers[IP] + 3] / 4);
+			}
+			else
+			{
+				registers[IP] += 4;
+			}
+			break;
+
+		case Disassembler::LOOP_LT_I32:
+		{
+			(*mTrace) << registers[IP] << " loop.lt.i32 [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << code[registers[IP] + 3] << " " << code[registers[IP] + 4] << " " << (code[registers[IP] + 5] / 4) << std::endl;
+			int* counter = (int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]);
+			counter[0] += code[registers[IP] + 3];
+			if (counter[0] < code[registers[IP] + 4])
+			{
+				registers[IP] = (code[registers[IP] + 5] / 4);
+			}
+			else
+			{
+				registers[IP] += 6;
+			}
+		}
+			break;
+
+		case Disassembler::LOOP_LE_I32:
+		{
+			(*mTrace) << registers[IP] << " loop.le.i32 [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << code[registers[IP] + 3] << " " << code[registers[IP] + 4] << " " << (code[registers[IP] + 5] / 4) << std::endl;
+			int* counter = (int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]);
+			counter[0] += code[registers[IP] + 3];
+			if (counter[0] <= code[registers[IP] + 4])
+			{
+				registers[IP] = (code[registers[IP] + 5] / 4);
+			}
+			else
+			{
+				registers[IP] += 6;
+			}
+		}
+			break;
+
+		case Disassembler::LOOP_GT_I32:
+		{
+			(*mTrace) << registers[IP] << " loop.gt.i32 [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << code[registers[IP] + 3] << " " << code[registers[IP] + 4] << " " << (code[registers[IP] + 5] / 4) << std::endl;
+			int* counter = (int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]);
+			counter[0] += code[registers[IP] + 3];
+			if (counter[0] > code[registers[IP] + 4])
+			{
+				registers[IP] = (code[registers[IP] + 5] / 4);
+			}
+			else
+			{
+				registers[IP] += 6;
+			}
+		}
+			break;
+
+		case Disassembler::LOOP_GE_I32:
+		{
+			(*mTrace) << registers[IP] << " loop.ge.i32 [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << code[registers[IP] + 3] << " " << code[registers[IP] + 4] << " " << (code[registers[IP] + 5] / 4) << std::endl;
+			int* counter = (int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]);
+			counter[0] += code[registers[IP] + 3];
+			if (counter[0] >= code[registers[IP] + 4])
+			{
+				registers[IP] = (code[registers[IP] + 5] / 4);
+			}
+			else
+			{
+				registers[IP] += 6;
+			}
+		}
+			break;
+
+		case Disassembler::LOOP_EQ_I32:
+		{
+			(*mTrace) << registers[IP] << " loop.eq.i32 [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << code[registers[IP] + 3] << " " << code[registers[IP] + 4] << " " << (code[registers[IP] + 5] / 4) << std::endl;
+			int* counter = (int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]);
+			counter[0] += code[registers[IP] + 3];
+			if (counter[0] == code[registers[IP] + 4])
+			{
+				registers[IP] = (code[registers[IP] + 5] / 4);
+			}
+			else
+			{
+				registers[IP] += 6;
+			}
+		}
+			break;
+
+		case Disassembler::LOOP_NE_I32:
+		{
+			(*mTrace) << registers[IP] << " loop.ne.i32 [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << code[registers[IP] + 3] << " " << code[registers[IP] + 4] << " " << (code[registers[IP] + 5] / 4) << std::endl;
+			int* counter = (int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]);
+			counter[0] += code[registers[IP] + 3];
+			if (counter[0] != code[registers[IP] + 4])
+			{
+				registers[IP] = (code[registers[IP] + 5] / 4);
+			}
+			else
+			{
+				registers[IP] += 6;
+			}
+		}
+			break;
+
+		case Disassembler::LOOP_LT_MEM:
+		{
+			(*mTrace) << registers[IP] << " loop.lt.mem [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << code[registers[IP] + 3] << " [" << registerName[code[registers[IP] + 4]] << " + " << code[registers[IP] + 5] << "] " << (code[registers[IP] + 6] / 4) << std::endl;
+			int* counter = (int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]);
+			int* bound = (int*)(memory + registers[code[registers[IP] + 4]] + code[registers[IP] + 5]);
+			counter[0] += code[registers[IP] + 3];
+			if (counter[0] < bound[0])
+			{
+				registers[IP] = (code[registers[IP] + 6] / 4);
+			}
+			else
+			{
+				registers[IP] += 7;
+			}
+		}
+			break;
+
+		case Disassembler::LOOP_LE_MEM:
+		{
+			(*mTrace) << registers[IP] << " loop.le.mem [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << code[registers[IP] + 3] << " [" << registerName[code[registers[IP] + 4]] << " + " << code[registers[IP] + 5] << "] " << (code[registers[IP] + 6] / 4) << std::endl;
+			int* counter = (int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]);
+			int* bound = (int*)(memory + registers[code[registers[IP] + 4]] + code[registers[IP] + 5]);
+			counter[0] += code[registers[IP] + 3];
+			if (counter[0] <= bound[0])
+			{
+				registers[IP] = (code[registers[IP] + 6] / 4);
+			}
+			else
+			{
+				registers[IP] += 7;
+			}
+		}
+			break;
+
+		case Disassembler::LOOP_GT_MEM:
+		{
+			(*mTrace) << registers[IP] << " loop.gt.mem [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << code[registers[IP] + 3] << " [" << registerName[code[registers[IP] + 4]] << " + " << code[registers[IP] + 5] << "] " << (code[registers[IP] + 6] / 4) << std::endl;
+			int* counter = (int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]);
+			int* bound = (int*)(memory + registers[code[registers[IP] + 4]] + code[registers[IP] + 5]);
+			counter[0] += code[registers[IP] + 3];
+			if (counter[0] > bound[0])
+			{
+				registers[IP] = (code[registers[IP] + 6] / 4);
+			}
+			else
+			{
+				registers[IP] += 7;
+			}
+		}
+			break;
+
+		case Disassembler::LOOP_GE_MEM:
+		{
+			(*mTrace) << registers[IP] << " loop.ge.mem [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << code[registers[IP] + 3] << " [" << registerName[code[registers[IP] + 4]] << " + " << code[registers[IP] + 5] << "] " << (code[registers[IP] + 6] / 4) << std::endl;
+			int* counter = (int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]);
+			int* bound = (int*)(memory + registers[code[registers[IP] + 4]] + code[registers[IP] + 5]);
+			counter[0] += code[registers[IP] + 3];
+			if (counter[0] >= bound[0])
+			{
+				registers[IP] = (code[registers[IP] + 6] / 4);
+			}
+			else
+			{
+				registers[IP] += 7;
+			}
+		}
+			break;
+
+		case Disassembler::LOOP_EQ_MEM:
+		{
+			(*mTrace) << registers[IP] << " loop.eq.mem [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << code[registers[IP] + 3] << " [" << registerName[code[registers[IP] + 4]] << " + " << code[registers[IP] + 5] << "] " << (code[registers[IP] + 6] / 4) << std::endl;
+			int* counter = (int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]);
+			int* bound = (int*)(memory + registers[code[registers[IP] + 4]] + code[registers[IP] + 5]);
+			counter[0] += code[registers[IP] + 3];
+			if (counter[0] == bound[0])
+			{
+				registers[IP] = (code[registers[IP] + 6] / 4);
+			}
+			else
+			{
+				registers[IP] += 7;
+			}
+		}
+			break;
+
+		case Disassembler::LOOP_NE_MEM:
+		{
+			(*mTrace) << registers[IP] << " loop.ne.mem [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << code[registers[IP] + 3] << " [" << registerName[code[registers[IP] + 4]] << " + " << code[registers[IP] + 5] << "] " << (code[registers[IP] + 6] / 4) << std::endl;
+			int* counter = (int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]);
+			int* bound = (int*)(memory + registers[code[registers[IP] + 4]] + code[registers[IP] + 5]);
+			counter[0] += code[registers[IP] + 3];
+			if (counter[0] != bound[0])
+			{
+				registers[IP] = (code[registers[IP] + 6] / 4);
+			}
+			else
+			{
+				registers[IP] += 7;
+			}
+		}
+			break;
+
+		case Disassembler::CALL:
+			(*mTrace) << registers[IP] << " call " << (code[registers[IP] + 1] / 4) << std::endl;
+			// Runaway recursion is stopped (print error and finish the program)
+			if (mCallStack.size() >= MAX_CALL_DEPTH)
+			{
+				(*mOutput) << "Error: Call stack overflow, terminating application\n" << std::endl;
+				registers[IP] = (int)instructionsCount;
+				result = false;
+				break;
+			}
+			// Parallel loop in procedure needs to know where program frame ends
+			if (mCallStack.empty())
+			{
+				mProgramEnd = registers[SP];
+			}
+			mCallStack.push_back(registers[IP] + 2);
+			registers[IP] = (code[registers[IP] + 1] / 4);
+			break;
+
+		case Disassembler::RET:
+			(*mTrace) << registers[IP] << " ret " << code[registers[IP] + 1] << std::endl;
+			// Return outside of procedure ends the program
+			if (mCallStack.empty())
+			{
+				registers[IP] = (int)instructionsCount;
+				break;
+			}
+			registers[SP] -= code[registers[IP] + 1];
+			registers[IP] = mCallStack.back();
+			mCallStack.pop_back();
+			break;
+
+		case Disassembler::HALT:
+			(*mTrace) << registers[IP] << " halt" << std::endl;
+			registers[IP] = (int)instructionsCount;
+			break;
+
+		case Disassembler::STRINGS:
+			// Constant pool is data, execution continues after it
+			(*mTrace) << registers[IP] << " strings " << code[registers[IP] + 2] << std::endl;
+			registers[IP] += code[registers[IP] + 1];
+			break;
+
+		case Disassembler::HEADER:
+			// Header was read when binary was loaded
+			(*mTrace) << registers[IP] << " header " << code[registers[IP] + 3] << std::endl;
+			registers[IP] += code[registers[IP] + 1];
+			break;
+
+		case Disassembler::RESERVE:
+			(*mTrace) << registers[IP] << " reserve " << code[registers[IP] + 1] << std::endl;
+			// Reserved space isn't initialized, stack can't grow past the end of memory
+			if ((size_t)registers[SP] + code[registers[IP] + 1] > mMemorySize)
+			{
+				(*mOutput) << "Error: Stack overflow, terminating application\n" << std::endl;
+				registers[IP] = (int)instructionsCount;
+				result = false;
+				break;
+			}
+			registers[SP] += code[registers[IP] + 1];
+			registers[IP] += 2;
+			break;
+
+		case Disassembler::RELEASE:
+			(*mTrace) << registers[IP] << " release " << code[registers[IP] + 1] << std::endl;
+			registers[SP] -= code[registers[IP] + 1];
+			registers[IP] += 2;
+			break;
+
+		case Disassembler::MOV_REG_IDX_I32:
+		case Disassembler::MOV_REG_IDX_NC_I32:
+		{
+			(*mTrace) << registers[IP] << ((code[registers[IP]] == Disassembler::MOV_REG_IDX_I32) ? " mov.reg.idx.i32 " : " mov.reg.idx.nc.i32 ") << registerName[code[registers[IP] + 1]] << " [" << registerName[code[registers[IP] + 2]] << " + " << code[registers[IP] + 3] << "] " << registerName[code[registers[IP] + 4]] << " " << code[registers[IP] + 5] << std::endl;
+			// Single unsigned comparison catches negative indices too
+			int index = registers[code[registers[IP] + 4]];
+			if (code[registers[IP]] == Disassembler::MOV_REG_IDX_I32 && (unsigned int)index >= (unsigned int)code[registers[IP] + 5])
+			{
+				(*mOutput) << "Error: Array index out of bounds, terminating application\n" << std::endl;
+				registers[IP] = (int)instructionsCount;
+				result = false;
+				break;
+			}
+			registers[code[registers[IP] + 1]] = ((int*)(memory + registers[code[registers[IP] + 2]] + code[registers[IP] + 3]))[index];
+			registers[IP] += 6;
+		}
+			break;
+
+		case Disassembler::MOV_IDX_REG_I32:
+		case Disassembler::MOV_IDX_REG_NC_I32:
+		{
+			(*mTrace) << registers[IP] << ((code[registers[IP]] == Disassembler::MOV_IDX_REG_I32) ? " mov.idx.reg.i32 [" : " mov.idx.reg.nc.i32 [") << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << registerName[code[registers[IP] + 3]] << " " << code[registers[IP] + 4] << " " << registerName[code[registers[IP] + 5]] << std::endl;
+			int index = registers[code[registers[IP] + 3]];
+			if (code[registers[IP]] == Disassembler::MOV_IDX_REG_I32 && (unsigned int)index >= (unsigned int)code[registers[IP] + 4])
+			{
+				(*mOutput) << "Error: Array index out of bounds, terminating application\n" << std::endl;
+				registers[IP] = (int)instructionsCount;
+				result = false;
+				break;
+			}
+			((int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]))[index] = registers[code[registers[IP] + 5]];
+			registers[IP] += 6;
+		}
+			break;
+
+		case Disassembler::VLOAD_I32X4:
+		case Disassembler::VLOAD_I32X8:
+		{
+			int lanes = (code[registers[IP]] == Disassembler::VLOAD_I32X8) ? 8 : 4;
+			(*mTrace) << registers[IP] << " vload.i32x" << lanes << " v" << code[registers[IP] + 1] << " [" << registerName[code[registers[IP] + 2]] << " + " << code[registers[IP] + 3] << "] " << registerName[code[registers[IP] + 4]] << std::endl;
+			const int* source = (const int*)(memory + registers[code[registers[IP] + 2]] + code[registers[IP] + 3]) + registers[code[registers[IP] + 4]];
+			VectorMove(vectors[code[registers[IP] + 1]], source, lanes);
+			registers[IP] += 5;
+		}
+			break;
+
+		case Disassembler::VSTORE_I32X4:
+		case Disassembler::VSTORE_I32X8:
+		{
+			int lanes = (code[registers[IP]] == Disassembler::VSTORE_I32X8) ? 8 : 4;
+			(*mTrace) << registers[IP] << " vstore.i32x" << lanes << " [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << registerName[code[registers[IP] + 3]] << " v" << code[registers[IP] + 4] << std::endl;
+			int* destination = (int*)(memory + registers[code[registers[IP] + 1]] + code[registers[IP] + 2]) + registers[code[registers[IP] + 3]];
+			VectorMove(destination, vectors[code[registers[IP] + 4]], lanes);
+			registers[IP] += 5;
+		}
+			break;
+
+		case Disassembler::VSPLAT_I32X4:
+		case Disassembler::VSPLAT_I32X8:
+		case Disassembler::VSEQ_I32X4:
+		case Disassembler::VSEQ_I32X8:
+		{
+			int opcode = code[registers[IP]];
+			int lanes = (opcode >= Disassembler::VLOAD_I32X8) ? 8 : 4;
+			bool splat = (opcode == Disassembler::VSPLAT_I32X4 || opcode == Disassembler::VSPLAT_I32X8);
+			(*mTrace) << registers[IP] << (splat ? " vsplat.i32x" : " vseq.i32x") << lanes << " v" << code[registers[IP] + 1] << " " << registerName[code[registers[IP] + 2]] << std::endl;
+			VectorFill(vectors[code[registers[IP] + 1]], registers[code[registers[IP] + 2]], splat ? 0 : 1, lanes);
+			registers[IP] += 3;
+		}
+			break;
+
+		case Disassembler::VADD_I32X4:
+		case Disassembler::VSUB_I32X4:
+		case Disassembler::VMUL_I32X4:
+		case Disassembler::VCMPLEQ_I32X4:
+		case Disassembler::VCMPGEQ_I32X4:
+		case Disassembler::VCMPLESS_I32X4:
+		case Disassembler::VCMPGREATER_I32X4:
+		case Disassembler::VCMPEQ_I32X4:
+		case Disassembler::VCMPNEQ_I32X4:
+		case Disassembler::VADD_I32X8:
+		case Disassembler::VSUB_I32X8:
+		case Disassembler::VMUL_I32X8:
+		case Disassembler::VCMPLEQ_I32X8:
+		case Disassembler::VCMPGEQ_I32X8:
+		case Disassembler::VCMPLESS_I32X8:
+		case Disassembler::VCMPGREATER_I32X8:
+		case Disassembler::VCMPEQ_I32X8:
+		case Disassembler::VCMPNEQ_I32X8:
+		{
+			static const char* names[] =
+			{
+				"vadd", "vsub", "vmul", "vcmpleq", "vcmpgeq", "vcmpless", "vcmpgreater", "vcmpeq", "vcmpneq"
+			};
+
+			// Both widths share implementation of their 4 lane form
+			int opcode = code[registers[IP]];
+			int lanes = 4;
+			if (opcode >= Disassembler::VLOAD_I32X8)
+			{
+				opcode -= Disassembler::VLOAD_I32X8 - Disassembler::VLOAD_I32X4;
+				lanes = 8;
+			}
+			(*mTrace) << registers[IP] << " " << names[opcode - Disassembler::VADD_I32X4] << ".i32x" << lanes << " v" << code[registers[IP] + 1] << " v" << code[registers[IP] + 2] << std::endl;
+			VectorOperation(opcode, vectors[code[registers[IP] + 1]], vectors[code[registers[IP] + 2]], lanes);
+			registers[IP] += 3;
+		}
+			break;
+
+		case Disassembler::VSUM_I32X4:
+		case Disassembler::VSUM_I32X8:
+		{
+			int lanes = (code[registers[IP]] == Disassembler::VSUM_I32X8) ? 8 : 4;
+			(*mTrace) << registers[IP] << " vsum.i32x" << lanes << " " << registerName[code[registers[IP] + 1]] << " v" << code[registers[IP] + 2] << std::endl;
+			registers[code[registers[IP] + 1]] = VectorSum(vectors[code[registers[IP] + 2]], lanes);
+			registers[IP] += 3;
+		}
+			break;
+
+		case Disassembler::JMP_TABLE:
+		{
+			(*mTrace) << registers[IP] << " jmp.table " << registerName[code[registers[IP] + 1]] << " " << code[registers[IP] + 2] << " " << code[registers[IP] + 3] << std::endl;
+			// Single unsigned comparison catches values both below and above the table
+			unsigned int index = (unsigned int)registers[code[registers[IP] + 1]] - (unsigned int)code[registers[IP] + 2];
+			unsigned int count = (unsigned int)code[registers[IP] + 3];
+			registers[IP] = code[registers[IP] + ((index < count) ? 5 + index : 4)] / 4;
+		}
+			break;
+
+		case Disassembler::PFOR:
+		{
+			(*mTrace) << registers[IP] << " pfor [" << registerName[code[registers[IP] + 1]] << " + " << code[registers[IP] + 2] << "] " << registerName[R0] << std::endl;
+			if (!ParallelFor())
+			{
+				registers[IP] = (int)instructionsCount;
+				result = false;
+				break;
+			}
+			// Label is the last operand
+			int writes = code[registers[IP] + 3];
+			int reductions = code[registers[IP] + 4 + 3 * writes];
+			registers[IP] = code[registers[IP] + 6 + 3 * writes + 2 * reductions] / 4;
+		}
+			break;
+
+		case Disassembler::PEND:
+			(*mTrace) << registers[IP] << " pend" << std::endl;
+			// Iteration of worker is done (body is never reached outside of worker)
+			registers[IP] = (int)instructionsCount;
+			break;
+
+		case Disassembler::SELECT_I32:
+		{
+			(*mTrace) << registers[IP] << " select.i32 " << registerName[code[registers[IP] + 1]] << " " << registerName[code[registers[IP] + 2]] << " [" << registerName[code[registers[IP] + 3]] << " + " << code[registers[IP] + 4] << "]" << std::endl;
+			// Both values are read, so there is no branch depending on data
+			int& reg = registers[code[registers[IP] + 1]];
+			int other = ((int*)(memory + registers[code[registers[IP] + 3]] + code[registers[IP] + 4]))[0];
+			reg = (reg != 0) ? registers[code[registers[IP] + 2]] : other;
+			registers[IP] += 5;
+		}
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return result;
+}
+
+// Run parallel loop at IP on workers, returns false when any of them was terminated because of an error
+bool VirtualMachine::ParallelFor()
+{
+	// 'pfor <counter> <writes> (<array> <count>)* <reductions> <address>* <frame> <label>', body follows
+	const int* pfor = (const int*)memory + registers[IP];
+	int counter = registers[pfor[1]] + pfor[2];
+	int writes = pfor[3];
+	const int* written = pfor + 4;
+	int reductions = written[3 * writes];
+	const int* reduced = written + 3 * writes + 1;
+	int frame = reduced[2 * reductions];
+	int body = registers[IP] + 7 + 3 * writes + 2 * reductions;
+
+	int first = ((int*)(memory + counter))[0];
+	int last = registers[R0];
+	if (first >= last)
+	{
+		return true;
+	}
+
+	// Body accesses its own frame and (through global pointer) program frame, which is the same one when
+	// loop isn't in procedure (frame size of malformed binary can't reach below program frame)
+	int frameBegin = (frame >= 0 && frame <= registers[SP] - registers[GP]) ? registers[SP] - frame : registers[GP];
+	int programEnd = mCallStack.empty() ? registers[SP] : std::min(mProgramEnd, frameBegin);
+
+	// Each worker starts with its own copy of frames, partial sums start at 0. Code is copied only
+	// into memory which doesn't hold it yet
+	size_t threads = std::min(mThreads, (size_t)((long long)last - first));
+	while (mWorkers.size() < threads)
+	{
+		mWorkers.push_back(std::unique_ptr<Worker>(new Worker()));
+		mWorkers.back()->vm.reset(new VirtualMachine(mUnboundedSize));
+	}
+
+	for (size_t i = 0; i < threads; i++)
+	{
+		Worker& w = *mWorkers[i];
+		w.begin = first + (int)(((long long)last - first) * i / threads);
+		w.end = first + (int)(((long long)last - first) * (i + 1) / threads);
+		w.done.clear();
+		w.output.str("");
+		w.result = true;
+
+		VirtualMachine& vm = *w.vm;
+		if (vm.mBinary != mBinary || vm.mMemorySize != mMemorySize)
+		{
+			vm.Allocate(mMemorySize);
+			memcpy(vm.memory, memory, mCodeSize * sizeof(int));
+			vm.mBinary = mBinary;
+		}
+		memcpy(vm.memory + registers[GP], memory + registers[GP], programEnd - registers[GP]);
+		if (frameBegin >= programEnd)
+		{
+			memcpy(vm.memory + frameBegin, memory + frameBegin, registers[SP] - frameBegin);
+		}
+		memcpy(vm.registers, registers, sizeof(registers));
+		vm.mCodeSize = mCodeSize;
+		vm.mInstructionLimit = mInstructionLimit;
+		vm.mExecuted = 0;
+		vm.mThreads = 1;
+		vm.mOutput = &w.output;
+		vm.SetTrace(nullptr);
+		for (int k = 0; k < reductions; k++)
+		{
+			((int*)(vm.memory + registers[reduced[2 * k]] + reduced[2 * k + 1]))[0] = 0;
+		}
+	}
+
+	// Once any worker fails, others stop after their current iteration
+	std::atomic<bool> failed(false);
+	RunPool(threads, [&](size_t id)
+	{
+		Worker& w = *mWorkers[id];
+		VirtualMachine& vm = *w.vm;
+		int begin;
+		int end;
+		while (!failed && Take(threads, id, begin, end))
+		{
+			for (int i = begin; i < end && !failed; i++)
+			{
+				((int*)(vm.memory + counter))[0] = i;
+				vm.registers[IP] = body;
+				vm.registers[SP] = registers[SP];
+				vm.mCallStack.clear();
+				if (!vm.Run())
+				{
+					w.result = false;
+					failed = true;
+					return;
+				}
+			}
+
+			if (!w.done.empty() && w.done.back().second == begin)
+			{
+				w.done.back().second = end;
+			}
+			else
+			{
+				w.done.push_back(std::make_pair(begin, end));
+			}
+		}
+	});
+
+	for (size_t i = 0; i < threads; i++)
+	{
+		if (!mWorkers[i]->result)
+		{
+			(*mOutput) << mWorkers[i]->output.str();
+			return false;
+		}
+	}
+
+	// Elements written in iterations of each worker are copied back, partial sums are added
+	for (size_t i = 0; i < threads; i++)
+	{
+		const Worker& w = *mWorkers[i];
+		for (int k = 0; k < writes; k++)
+		{
+			int address = registers[written[3 * k]] + written[3 * k + 1];
+			int count = written[3 * k + 2];
+			for (const std::pair<int, int>& range : w.done)
+			{
+				int begin = std::max(range.first, 0);
+				int end = std::min(range.second, count);
+				if (begin < end)
+				{
+					memcpy(memory + address + 4 * begin, w.vm->memory + address + 4 * begin, 4 * (end - begin));
+				}
+			}
+		}
+
+		for (int k = 0; k < reductions; k++)
+		{
+			int address = registers[reduced[2 * k]] + reduced[2 * k + 1];
+			((int*)(memory + address))[0] += ((int*)(w.vm->memory + address))[0];
+		}
+	}
+
+	return true;
+}
+
+// Take next iterations for worker (from its own range or stolen from others) among given number of
+// workers, returns false when there is no work left
+bool VirtualMachine::Take(size_t workers, size_t id, int& begin, int& end)
+{
+	// Chunk is part of what remains, so workers finish at about the same time without taking the lock
+	// for every iteration
+	auto Chunk = [workers](int first, int last)
+	{
+		long long remaining = (long long)last - first;
+		return (int)std::min(remaining, std::max(remaining / (2 * (long long)workers), (long long)MIN_CHUNK));
+	};
+
+	Worker& own = *mWorkers[id];
+	{
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (own.begin < own.end)
+		{
+			begin = own.begin;
+			end = begin + Chunk(own.begin, own.end);
+			own.begin = end;
+			return true;
+		}
+	}
+
+	// Iterations are never added, so once all ranges are empty the work is done (stolen ones are run by thief)
+	for (size_t i = 1; i < workers; i++)
+	{
+		Worker& victim = *mWorkers[(id + i) % workers];
+		int stolen;
+		int last;
+		{
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (victim.begin >= victim.end)
+			{
+				continue;
+			}
+			last = victim.end;
+			stolen = victim.end - (int)(((long long)victim.end - victim.begin + 1) / 2);
+			victim.end = stolen;
+		}
+
+		// Thief runs the first chunk of stolen iterations, the rest becomes its own range
+		std::lock_guard<std::mutex> lock(own.mutex);
+		begin = stolen;
+		end = stolen + Chunk(stolen, last);
+		own.begin = end;
+		own.end = last;
+		return true;
+	}
+
+	return false;
+}
+
+// Run work of parallel loop on given number of workers (calling thread is the first one), threads
+// are created once they're needed
+void VirtualMachine::RunPool(size_t workers, const std::function<void(size_t)>& task)
+{
+	while (mPool.size() + 1 < workers)
+	{
+		mPool.push_back(std::thread(&VirtualMachine::PoolThread, this, mPool.size() + 1, mPoolLoop));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mPoolMutex);
+		mPoolTask = task;
+		mPoolActive = workers;
+		mPoolBusy = workers - 1;
+		mPoolLoop++;
+	}
+	mPoolStart.notify_all();
+
+	task(0);
+
+	std::unique_lock<std::mutex> lock(mPoolMutex);
+	mPoolDone.wait(lock, [this]() { return mPoolBusy == 0; });
+	mPoolTask = nullptr;
+}
+
+// Thread of pool running given worker, loops started before it was created are skipped
+void VirtualMachine::PoolThread(size_t id, size_t loop)
+{
+	std::unique_lock<std::mutex> lock(mPoolMutex);
+	while (true)
+	{
+		mPoolStart.wait(lock, [this, loop]() { return mPoolStop || mPoolLoop != loop; });
+		if (mPoolStop)
+		{
+			return;
+		}
+		loop = mPoolLoop;
+
+		// Threads beyond workers of this loop (there are fewer iterations than threads) stay idle
+		if (id < mPoolActive)
+		{
+			lock.unlock();
+			mPoolTask(id);
+			lock.lock();
+			if (--mPoolBusy == 0)
+			{
+				mPoolDone.notify_one();
+			}
+		}
+	}
+}
+
+// Stop and join threads of pool
+void VirtualMachine::StopPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mPoolMutex);
+		mPoolStop = true;
+	}
+	mPoolStart.notify_all();
+
+	for (std::thread& t : mPool)
+	{
+		t.join();
+	}
+	mPool.clear();
+	mPoolStop = false;
+}
\ No newline at end of file
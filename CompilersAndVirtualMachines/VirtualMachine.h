@@ -0,0 +1,192 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// This file is subject to the terms and conditions defined in
+// file 'LICENSE.txt', which is part of this source code package.
+//
+///////////////////////////////////////////////////////////////////////////////
+// (C) Vilem Otte <vilem.otte@post.cz>
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __VIRTUAL_MACHINE_H__
+#define __VIRTUAL_MACHINE_H__
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include "Disassembler.h"
+
+// Virtual machine executing binary produced by disassembler
+//
+// Stack grows from the end of code towards the end of memory. Binary header holds maximum stack depth
+// computed by disassembler, when it's bounded memory holds just code and stack (never more than the size
+// given to constructor, which binaries without bound get). Header isn't trusted, stack pointer is checked
+// against the end of memory either way. Frame of procedure starts with its
+// arguments (pushed by caller in order), followed by its variables and temporaries - everything is
+// addressed relative to stack pointer. Return addresses are kept on separate call stack, so script
+// can't overwrite them, ret removes whole frame (including arguments) and returns result in r0.
+// Global pointer holds the beginning of program frame, procedures address arrays of program with it.
+// Vector registers hold up to 8 lanes, vector instructions work either on the first 4 or on all of them
+// (with SSE2 and AVX2 when compiler targets them, scalar code otherwise).
+//
+// Parallel loop runs its body on worker threads, each of them has its own memory, registers and call
+// stack. Workers and their threads are kept by the machine between loops, so worker gets code once per
+// binary and for each loop only frames its body can access - program frame and frame of the loop (frames
+// of procedures between them aren't reachable). Iterations are split into ranges of workers, worker
+// takes chunks of iterations from its own range (smaller as work runs out) and steals half of range of
+// another one once it's empty.
+// Compiler guarantees iterations are independent - the only memory they write outside of their frame
+// are elements of arrays indexed by counter and sums, so once all workers finish, elements written in
+// iterations of each worker are copied back and partial sums of workers are added.
+class VirtualMachine
+{
+private:
+	// Worker of parallel loop (range is taken by owner from its beginning, stolen from its end)
+	struct Worker
+	{
+		std::unique_ptr<VirtualMachine> vm;			// Machine running iterations (with its own memory)
+		int begin;									// Remaining range of iterations
+		int end;
+		std::mutex mutex;
+		std::vector<std::pair<int, int> > done;		// Ranges of iterations run by worker
+		std::ostringstream output;					// Errors of worker
+		bool result;								// Worker wasn't terminated because of an error
+	};
+
+	unsigned char* memory;		// VM memory
+	int registers[5];			// VM registers (Reg 0, Reg 1, Instruction Pointer, Stack Pointer, Global Pointer)
+	int vectors[Disassembler::VECTOR_REGISTERS][Disassembler::VECTOR_LANES];	// Vector registers (v0 - v7)
+
+	enum
+	{
+		R0 = 0,
+		R1,
+		IP,
+		SP,
+		GP
+	};
+
+	std::string registerName[5] =
+	{
+		"R0",
+		"R1",
+		"IP",
+		"SP",
+		"GP"
+	};
+
+	enum
+	{
+		MAX_CALL_DEPTH = 4096,	// Maximum number of nested procedure calls
+		MIN_CHUNK = 16			// Minimum number of iterations of parallel loop worker takes at once
+	};
+
+	std::vector<int> mCallStack;	// Return addresses of active procedures
+
+	size_t mMemorySize;			// Size of VM memory
+	size_t mUnboundedSize;		// Size of VM memory for binaries whose stack depth isn't bounded
+	size_t mCodeSize;			// Number of words of the last executed binary (header and constant pool are at its beginning)
+	size_t mInstructionLimit;	// Maximum number of executed instructions (0 for no limit)
+	size_t mExecuted;			// Number of executed instructions
+	size_t mThreads;			// Number of threads running parallel loops
+	size_t mBinary;				// Number of executed binaries (identifies code copied into workers)
+	int mProgramEnd;			// End of program frame (stack pointer when program called procedure)
+
+	std::vector<std::unique_ptr<Worker> > mWorkers;	// Workers of parallel loops (the first one runs on calling thread)
+	std::vector<std::thread> mPool;			// Threads of the other workers
+	std::mutex mPoolMutex;					// Guards state of pool
+	std::condition_variable mPoolStart;		// Signalled when loop starts or pool stops
+	std::condition_variable mPoolDone;		// Signalled when the last thread finishes its part of loop
+	std::function<void(size_t)> mPoolTask;	// Work of current loop (for index of worker)
+	size_t mPoolLoop;						// Number of loops started on pool
+	size_t mPoolActive;						// Number of workers running current loop
+	size_t mPoolBusy;						// Number of threads which didn't finish current loop yet
+	bool mPoolStop;							// Threads of pool are being stopped
+	std::ostream mNull;			// Stream discarding everything (trace disabled)
+	std::ostream* mTrace;		// Trace of executed instructions
+	std::ostream* mOutput;		// Errors and dumps of stack and registers
+
+	// Allocate memory of given size (memory which has the same size already is kept as it is)
+	void Allocate(size_t size);
+
+	// Run instructions from IP until it reaches end of code, returns false when program was terminated
+	// because of an error
+	bool Run();
+
+	// Run parallel loop at IP on workers, returns false when any of them was terminated because of an error
+	bool ParallelFor();
+
+	// Take next iterations for worker (from its own range or stolen from others) among given number of
+	// workers, returns false when there is no work left
+	bool Take(size_t workers, size_t id, int& begin, int& end);
+
+	// Run work of parallel loop on given number of workers (calling thread is the first one), threads
+	// are created once they're needed
+	void RunPool(size_t workers, const std::function<void(size_t)>& task);
+
+	// Thread of pool running given worker, loops started before it was created are skipped
+	void PoolThread(size_t id, size_t loop);
+
+	// Stop and join threads of pool
+	void StopPool();
+
+	// Print out what is in registers (the ones we work with, not IP and SP)
+	void DumpRegisters();
+
+	// Print out stack from beginning address
+	void DumpStack(size_t size);
+
+	// Copy lanes between vector register and memory
+	static void VectorMove(int* destination, const int* source, int lanes);
+
+	// Fill lanes of vector with value plus lane index multiplied by step
+	static void VectorFill(int* destination, int value, int step, int lanes);
+
+	// Lane-wise operation of vector instruction (opcode of its 4 lane form), result goes into a
+	static void VectorOperation(int opcode, int* a, const int* b, int lanes);
+
+	// Sum of lanes of vector
+	static int VectorSum(const int* a, int lanes);
+
+public:
+	// Constructor (specify how much memory binaries without bounded stack depth get - defaults to 64K)
+	VirtualMachine(size_t memorySize = 65536);
+
+	// D-tor
+	~VirtualMachine();
+
+	// Set stream receiving trace of executed instructions (nullptr disables trace)
+	void SetTrace(std::ostream* trace);
+
+	// Set stream receiving errors and final state of stack and registers
+	void SetOutput(std::ostream& output);
+
+	// Set maximum number of executed instructions (0 for no limit), workers of parallel loops have
+	// the same limit each
+	void SetInstructionLimit(size_t limit);
+
+	// Set number of threads running parallel loops (0 for number of hardware threads)
+	void SetThreads(size_t threads);
+
+	// Execute the binary file, returns false when program was terminated because of an error
+	bool Execute(const std::string& filename);
+
+	// Execute the binary, returns false when program was terminated because of an error
+	bool Execute(const std::vector<int>& binary);
+
+	// Execute the binary of given number of words (e.g. embedded in host application), returns false when
+	// program was terminated because of an error
+	bool Execute(const int* binary, size_t words);
+
+	// Get text of string value (handle of interned string) of the last executed binary, returns false
+	// when there is no such string
+	bool GetString(int handle, std::string& text) const;
+};
+
+#endif
\ No newline at end of file